@@ -0,0 +1,53 @@
+
+#include <stdlib.h>
+
+#include "../src/universal_utils.h"
+
+#define LOGGER_TEST_FILE "logger_test.log"
+
+/**
+ * This program checks that the logger respects the precision of the strings:
+ * a slice ("%.*s" or "%.Ns") is captured without reading past its end.
+ * The slice is not terminated by a '\0': build with -fsanitize=address to catch an over-read.
+ * 
+ * @author Stoupy51 (COLLIGNON Alexandre)
+ */
+int main() {
+
+	// Redirect the records to a file
+	if (freopen(LOGGER_TEST_FILE, "w", stderr) == NULL)
+		return 1;
+
+	// Log slices which are not terminated by a '\0', like a component in the middle of a path
+	char *slice = malloc(4);
+	if (slice == NULL)
+		return 1;
+	memcpy(slice, "dir1", 4);
+	WARNING_PRINT("main(): star '%.*s'\n", 4, slice);
+	WARNING_PRINT("main(): digits '%.4s'\n", slice);
+	WARNING_PRINT("main(): shorter '%.*s' width '%6.2s'\n", 2, slice, slice);
+	WARNING_PRINT("main(): negative '%.*s'\n", -1, "whole");
+	log_flush();
+	free(slice);
+
+	// Read the records back
+	FILE *file = fopen(LOGGER_TEST_FILE, "r");
+	if (file == NULL)
+		return 1;
+	char content[1024];
+	size_t length = fread(content, 1, sizeof(content) - 1, file);
+	content[length] = '\0';
+	fclose(file);
+	remove(LOGGER_TEST_FILE);
+
+	// Check the records
+	const char *expected[] = { "star 'dir1'", "digits 'dir1'", "shorter 'di' width '    di'", "negative 'whole'" };
+	int failures = 0;
+	size_t i;
+	for (i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+		failures += strstr(content, expected[i]) == NULL;
+	printf("%s", content);
+	printf("%s\n", failures == 0 ? "main(): All the checks passed" : "main(): Some checks failed");
+	return failures == 0 ? 0 : 1;
+}
+
@@ -0,0 +1,67 @@
+
+#include <stdlib.h>
+
+#include "../src/universal_utils.h"
+#include "../src/sync_ignore.h"
+#include "../src/staged_file.h"
+
+int failures = 0;
+
+/**
+ * @brief Function that checks if a path is ignored as expected.
+ * 
+ * @param ignore		The compiled patterns.
+ * @param path			Path relative to the root.
+ * @param is_directory	1 if the path is a directory.
+ * @param expected		1 if the path must be ignored.
+ * 
+ * @return void
+ */
+void check(const sync_ignore_t *ignore, const char *path, int is_directory, int expected) {
+	int ignored = sync_ignore_match(ignore, path, is_directory);
+	if (ignored != expected) {
+		ERROR_PRINT("check(): '%s' is %s, expected %s\n", path, ignored ? "ignored" : "synchronized", expected ? "ignored" : "synchronized");
+		errno = 0;
+		failures++;
+	}
+}
+
+/**
+ * This program checks the default rules of the .syncignore engine:
+ * the trash of the server and the staging files of the transfers are never synchronized.
+ * 
+ * @author Stoupy51 (COLLIGNON Alexandre)
+ */
+int main() {
+
+	// Compile the default rules
+	sync_ignore_t ignore;
+	int code = sync_ignore_init(&ignore);
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Unable to compile the default rules\n");
+
+	// Directories of the tools and trash of the server
+	check(&ignore, ".git", 1, 1);
+	check(&ignore, "sub/__pycache__", 1, 1);
+	check(&ignore, ".rfs-trash", 1, 1);
+
+	// Staging files, at the root and in a subdirectory (named like staged_temp_name() does)
+	check(&ignore, STAGED_TEMP_PREFIX "file.txt.1234-5", 0, 1);
+	check(&ignore, "dir/sub/" STAGED_TEMP_PREFIX "image.png.42-0", 0, 1);
+
+	// Regular files stay synchronized
+	check(&ignore, "file.txt", 0, 0);
+	check(&ignore, "dir/rfs-staging-notes.txt", 0, 0);
+	check(&ignore, "dir/.rfs-stagingfile", 0, 0);
+
+	// The default rules can be re-included
+	code = sync_ignore_add(&ignore, "!" STAGED_TEMP_PREFIX "keep");
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Unable to add a rule\n");
+	check(&ignore, STAGED_TEMP_PREFIX "keep", 0, 0);
+	sync_ignore_free(&ignore);
+
+	// Final print and return
+	if (failures == 0)
+		INFO_PRINT("main(): All the checks passed\n");
+	return failures == 0 ? 0 : 1;
+}
+
@@ -0,0 +1,215 @@
+
+#include <stdlib.h>
+
+#include "../src/st_benchmark.h"
+#include "../src/universal_utils.h"
+#include "../src/hash_engine.h"
+#include "../src/network/net_utils.h"
+#include "../src/file_watcher.h"
+
+#ifndef _WIN32
+	#include <sys/inotify.h>
+#endif
+
+#define ENCRYPT_BUFFER_SIZE (64 * 1024)
+#define LINES_FILE_LINES 2000
+#define WATCHER_EVENTS 1024
+
+char json_path[512] = "";
+char csv_path[512] = "";
+char filter[128] = "";
+int csv_header = 1;
+volatile long events_handled = 0;
+
+/**
+ * @brief Function that reports the results of a benchmark: console, JSON Lines and CSV files.
+ * 
+ * @param result	Results of the benchmark.
+ * 
+ * @return void
+ */
+void report(const st_benchmark_result_t *result) {
+	st_benchmark_print(result);
+	if (json_path[0] != '\0') {
+		FILE *file = fopen(json_path, "a");
+		WARNING_HANDLE_PTR(file, "report(): Unable to open '%s'\n", json_path);
+		if (file != NULL) {
+			st_benchmark_write_json(file, result);
+			fclose(file);
+		}
+	}
+	if (csv_path[0] != '\0') {
+		FILE *file = fopen(csv_path, "a");
+		WARNING_HANDLE_PTR(file, "report(): Unable to open '%s'\n", csv_path);
+		if (file != NULL) {
+			st_benchmark_write_csv(file, result, csv_header);
+			csv_header = 0;
+			fclose(file);
+		}
+	}
+}
+
+/**
+ * @brief Function that tells if a benchmark is selected by the filter.
+ * 
+ * @param name	Name of the benchmark.
+ * 
+ * @return int	1 if it must be run, 0 otherwise.
+ */
+int selected(const char *name) {
+	return filter[0] == '\0' || strstr(name, filter) != NULL;
+}
+
+/**
+ * @brief No-op handler counting the watcher events.
+ * 
+ * @return int	0
+ */
+int count_event(const char *filepath) {
+	(void)filepath;
+	events_handled++;
+	return 0;
+}
+
+/**
+ * @brief No-op handler counting the watcher renames.
+ * 
+ * @return int	0
+ */
+int count_rename(const char *filepath_old, const char *filepath_new) {
+	(void)filepath_old;
+	(void)filepath_new;
+	events_handled++;
+	return 0;
+}
+
+/**
+ * This program measures the hot functions of the project with the st_benchmark.h framework:
+ * bytes_encrypter(), hash_string(), the hash engine, get_line_from_file() and the parsing of the file watcher events.
+ * 
+ * Parameters are key=value arguments: filter=<substring>, samples=<count>, perf=<0|1>,
+ * json=<file> (one JSON object per line, appended) and csv=<file> (appended).
+ * 
+ * @author Stoupy51 (COLLIGNON Alexandre)
+ */
+int main(int argc, char **argv) {
+
+	// Parse the parameters
+	mainInit("main(): Micro benchmark program\n");
+	int i;
+	for (i = 1; i < argc; i++) {
+		char *value = strchr(argv[i], '=');
+		int code = (value == NULL || strlen(value + 1) >= sizeof(json_path)) ? -1 : 0;
+		ERROR_HANDLE_INT_RETURN_INT(code, "main(): Invalid argument '%s' (expected key=value)\n", argv[i]);
+		*value++ = '\0';
+		if (strcmp(argv[i], "json") == 0) strcpy(json_path, value);
+		else if (strcmp(argv[i], "csv") == 0) strcpy(csv_path, value);
+		else if (strcmp(argv[i], "filter") == 0 && strlen(value) < sizeof(filter)) strcpy(filter, value);
+		else if (strcmp(argv[i], "samples") == 0) st_benchmark_default_config.samples = atoi(value);
+		else if (strcmp(argv[i], "perf") == 0) st_benchmark_default_config.use_perf = atoi(value);
+		else {
+			ERROR_PRINT("main(): Unknown parameter '%s'\n", argv[i]);
+			return -1;
+		}
+	}
+	st_benchmark_result_t result;
+
+	// bytes_encrypter() on a network buffer (bytes never encrypt to '\0', so the buffer stays full length)
+	if (selected("bytes_encrypter")) {
+		byte *buffer = malloc(ENCRYPT_BUFFER_SIZE);
+		ERROR_HANDLE_PTR_RETURN_INT(buffer, "main(): Unable to allocate the buffer\n");
+		for (i = 0; i < ENCRYPT_BUFFER_SIZE; i++)
+			buffer[i] = 'a' + i % 26;
+		simple_string_t password = { "benchmark_password", 18 };
+		ST_BENCHMARK_RUN_BYTES(result, { bytes_encrypter(buffer, ENCRYPT_BUFFER_SIZE, password); ST_DO_NOT_OPTIMIZE(buffer[0]); }, "bytes_encrypter_64k", ENCRYPT_BUFFER_SIZE);
+		report(&result);
+		free(buffer);
+	}
+
+	// hash_string() on a password and on a path
+	if (selected("hash_string")) {
+		char password[] = "benchmark_password";
+		char path[] = "projects/remote_folder_sync/src/server/s_tcp_manager.c";
+		ST_BENCHMARK_RUN_BYTES(result, { int hash = hash_string(password); ST_DO_NOT_OPTIMIZE(hash); }, "hash_string_password", sizeof(password) - 1);
+		report(&result);
+		ST_BENCHMARK_RUN_BYTES(result, { int hash = hash_string(path); ST_DO_NOT_OPTIMIZE(hash); }, "hash_string_path", sizeof(path) - 1);
+		report(&result);
+	}
+
+	// Hash engine on a path and on a network buffer, with each implementation of the inner loop
+	if (selected("hash_engine")) {
+		char path[] = "projects/remote_folder_sync/src/server/s_tcp_manager.c";
+		ST_BENCHMARK_RUN_BYTES(result, { unsigned long long hash = hash64(path, sizeof(path) - 1, 0); ST_DO_NOT_OPTIMIZE(hash); }, "hash64_path", sizeof(path) - 1);
+		report(&result);
+		byte *buffer = malloc(ENCRYPT_BUFFER_SIZE);
+		ERROR_HANDLE_PTR_RETURN_INT(buffer, "main(): Unable to allocate the buffer\n");
+		for (i = 0; i < ENCRYPT_BUFFER_SIZE; i++)
+			buffer[i] = (byte)(i * 31);
+		const char *backends[] = { "scalar", "sse2", "avx2" };
+		int b;
+		for (b = 0; b < 3; b++) {
+			if (hash_engine_select(backends[b]) == -1)
+				continue;
+			char name[64];
+			sprintf(name, "hash128_64k_%s", backends[b]);
+			ST_BENCHMARK_RUN_BYTES(result, { hash128_t hash = hash128(buffer, ENCRYPT_BUFFER_SIZE, 0); ST_DO_NOT_OPTIMIZE(hash.low); }, name, ENCRYPT_BUFFER_SIZE);
+			report(&result);
+		}
+		sha256_t sha;
+		byte digest[SHA256_SIZE];
+		ST_BENCHMARK_RUN_BYTES(result, { sha256_init(&sha); sha256_update(&sha, buffer, ENCRYPT_BUFFER_SIZE); sha256_final(&sha, digest); ST_DO_NOT_OPTIMIZE(digest[0]); }, "sha256_64k", ENCRYPT_BUFFER_SIZE);
+		report(&result);
+		free(buffer);
+	}
+
+	// get_line_from_file() on a config-like file (one operation reads the whole file)
+	if (selected("get_line_from_file")) {
+		char lines_path[] = "micro_benchmark_lines.txt";
+		FILE *file = fopen(lines_path, "w");
+		ERROR_HANDLE_PTR_RETURN_INT(file, "main(): Unable to create '%s'\n", lines_path);
+		for (i = 0; i < LINES_FILE_LINES; i++)
+			fprintf(file, "key_%d=value_of_the_key_number_%d\n", i, i);
+		size_t file_size = ftell(file);
+		fclose(file);
+		int fd = open(lines_path, O_RDONLY);
+		ERROR_HANDLE_INT_RETURN_INT(fd, "main(): Unable to open '%s'\n", lines_path);
+		char *line = NULL;
+		ST_BENCHMARK_RUN_BYTES(result, {
+			lseek(fd, 0, SEEK_SET);
+			while (get_line_from_file(&line, fd) != -1)
+				ST_DO_NOT_OPTIMIZE(line[0]);
+		}, "get_line_from_file_2000_lines", file_size);
+		report(&result);
+		free(line);
+		close(fd);
+		remove(lines_path);
+	}
+
+	// Parsing of a buffer of inotify events (typical write pattern: create, modifies, close)
+	#ifndef _WIN32
+	if (selected("watcher_events")) {
+		byte *buffer = malloc(WATCHER_EVENTS * (sizeof(struct inotify_event) + 32));
+		ERROR_HANDLE_PTR_RETURN_INT(buffer, "main(): Unable to allocate the events\n");
+		size_t length = 0;
+		const uint32_t masks[] = { IN_CREATE, IN_MODIFY, IN_MODIFY, IN_MODIFY, IN_CLOSE_WRITE, IN_OPEN, IN_ACCESS, IN_CLOSE_NOWRITE };
+		for (i = 0; i < WATCHER_EVENTS; i++) {
+			struct inotify_event *event = (struct inotify_event *)(buffer + length);
+			memset(event, 0, sizeof(struct inotify_event) + 32);
+			event->wd = 1;
+			event->mask = masks[i % 8];
+			event->len = 32;
+			sprintf(event->name, "file_%04d.txt", i / 8);
+			length += sizeof(struct inotify_event) + event->len;
+		}
+		watcher_events_t watcher = { count_event, count_event, count_event, count_event, count_rename, NULL, "", 0 };
+		ST_BENCHMARK_RUN_BYTES(result, { handle_watcher_events(&watcher, buffer, length); }, "watcher_events_1024", length);
+		report(&result);
+		free(buffer);
+	}
+	#endif
+
+	// Final print and return
+	INFO_PRINT("main(): End of program\n");
+	return 0;
+}
+
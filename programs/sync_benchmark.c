@@ -0,0 +1,725 @@
+
+#ifndef _WIN32
+	#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "../src/server/s_tcp_manager.h"
+#include "../src/client/c_tcp_manager.h"
+#include "../src/wan_proxy.h"
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <signal.h>
+	#include <poll.h>
+	#include <sys/wait.h>
+#endif
+
+#define BENCHMARK_POLL_US 50				// Interval between two checks of the server directory
+#define BENCHMARK_MAX_PATH 1024
+#define BENCHMARK_BUFFER_SIZE (1024 * 1024)		// Buffer used to write the generated files
+
+// Parameters of a benchmark run (key=value arguments)
+typedef struct benchmark_params_t {
+	char label[64];					// Name of the run in the CSV/JSON output
+	int files;						// Files of the initial tree
+	size_t size_min;				// Sizes of the initial tree are log-uniform in [size_min, size_max]
+	size_t size_max;
+	int depth;						// Directory levels of the initial tree
+	int fanout;						// Sub-directories per directory
+	int latency_samples;			// Files written one by one to measure event -> apply latency
+	size_t latency_size;
+	int large_files;				// Files written to measure the throughput
+	size_t large_size;
+	unsigned long long seed;
+	int port;						// 0 for a random port
+	long long timeout_ms;			// Maximum wait for a file to be applied
+	char workdir[512];				// Parent of the temporary directory
+	char config[512];				// Extra config.ini lines for the server and the client (tuning keys)
+	char json[512];					// Output files (empty to disable)
+	char csv[512];
+	int keep;						// 1 to keep the temporary directory
+
+	// Emulated WAN link between the client and the server (see wan_proxy.h)
+	double rtt_ms;
+	double jitter_ms;
+	long long bandwidth_kbps;		// 0 = unlimited
+	double stall_rate;				// Probability that a chunk of 16 KB is stalled
+	double stall_ms;
+} benchmark_params_t;
+
+// Results of a benchmark run
+typedef struct benchmark_results_t {
+	long long tree_bytes;
+	int tree_directories;
+	double initial_sync_ms;
+	int initial_sync_verified;		// Files of the tree found on the client with the right size
+	long long *latencies_us;
+	int latency_count;
+	int latency_failed;
+	long long large_bytes;
+	double large_seconds;
+	int large_failed;
+} benchmark_results_t;
+
+benchmark_params_t params;
+benchmark_results_t results;
+char workdir[600];						// Temporary directory (params.workdir + "/sync_benchmark_XXXXXX")
+unsigned long long rng_state;
+
+#ifndef _WIN32
+
+pid_t server_pid = -1;
+pid_t client_pid = -1;
+
+/**
+ * @brief Function that returns the next pseudo-random number (xorshift64*, seeded: runs are reproducible).
+ * 
+ * @return unsigned long long	The number.
+ */
+unsigned long long rng_next() {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 2685821657736338717ULL;
+}
+
+/**
+ * @brief Function that parses a size with an optional K, M or G suffix.
+ * 
+ * @param value		Text to parse.
+ * 
+ * @return size_t	The size in bytes.
+ */
+size_t parse_size(const char *value) {
+	char *end;
+	double size = strtod(value, &end);
+	switch (*end) {
+		case 'k': case 'K': size *= 1024; break;
+		case 'm': case 'M': size *= 1024 * 1024; break;
+		case 'g': case 'G': size *= 1024 * 1024 * 1024; break;
+		default: break;
+	}
+	return (size_t)size;
+}
+
+/**
+ * @brief Function that parses the key=value arguments of the program.
+ * 
+ * @param argc	Number of arguments.
+ * @param argv	Arguments.
+ * 
+ * @return int	0 if the arguments are valid, -1 otherwise.
+ */
+int parse_params(int argc, char **argv) {
+
+	// Default parameters
+	memset(&params, 0, sizeof(benchmark_params_t));
+	strcpy(params.label, "default");
+	params.files = 1000;
+	params.size_min = 1024;
+	params.size_max = 1024 * 1024;
+	params.depth = 2;
+	params.fanout = 4;
+	params.latency_samples = 200;
+	params.latency_size = 4096;
+	params.large_files = 4;
+	params.large_size = 64 * 1024 * 1024;
+	params.seed = 42;
+	params.timeout_ms = 60000;
+	strcpy(params.workdir, "/tmp");
+
+	// Parse the arguments
+	int i;
+	for (i = 1; i < argc; i++) {
+		char *value = strchr(argv[i], '=');
+		int code = value == NULL ? -1 : 0;
+		ERROR_HANDLE_INT_RETURN_INT(code, "parse_params(): Invalid argument '%s' (expected key=value)\n", argv[i]);
+		*value++ = '\0';
+		char *key = argv[i];
+		#define COPY_PARAM(field) { code = strlen(value) < sizeof(params.field) ? 0 : -1; ERROR_HANDLE_INT_RETURN_INT(code, "parse_params(): Value of '%s' is too long\n", key); strcpy(params.field, value); }
+		if (strcmp(key, "label") == 0) COPY_PARAM(label)
+		else if (strcmp(key, "files") == 0) params.files = atoi(value);
+		else if (strcmp(key, "size_min") == 0) params.size_min = parse_size(value);
+		else if (strcmp(key, "size_max") == 0) params.size_max = parse_size(value);
+		else if (strcmp(key, "depth") == 0) params.depth = atoi(value);
+		else if (strcmp(key, "fanout") == 0) params.fanout = atoi(value);
+		else if (strcmp(key, "latency_samples") == 0) params.latency_samples = atoi(value);
+		else if (strcmp(key, "latency_size") == 0) params.latency_size = parse_size(value);
+		else if (strcmp(key, "large_files") == 0) params.large_files = atoi(value);
+		else if (strcmp(key, "large_size") == 0) params.large_size = parse_size(value);
+		else if (strcmp(key, "seed") == 0) params.seed = strtoull(value, NULL, 10);
+		else if (strcmp(key, "port") == 0) params.port = atoi(value);
+		else if (strcmp(key, "timeout_ms") == 0) params.timeout_ms = atoll(value);
+		else if (strcmp(key, "workdir") == 0) COPY_PARAM(workdir)
+		else if (strcmp(key, "config") == 0) COPY_PARAM(config)
+		else if (strcmp(key, "json") == 0) COPY_PARAM(json)
+		else if (strcmp(key, "csv") == 0) COPY_PARAM(csv)
+		else if (strcmp(key, "keep") == 0) params.keep = atoi(value);
+		else if (strcmp(key, "rtt_ms") == 0) params.rtt_ms = atof(value);
+		else if (strcmp(key, "jitter_ms") == 0) params.jitter_ms = atof(value);
+		else if (strcmp(key, "bandwidth_kbps") == 0) params.bandwidth_kbps = atoll(value);
+		else if (strcmp(key, "stall_rate") == 0) params.stall_rate = atof(value);
+		else if (strcmp(key, "stall_ms") == 0) params.stall_ms = atof(value);
+		else {
+			ERROR_PRINT("parse_params(): Unknown parameter '%s'\n", key);
+			return -1;
+		}
+		#undef COPY_PARAM
+	}
+
+	// Check the parameters
+	int code = (params.files < 0 || params.depth < 0 || params.fanout < 1 || params.size_min < 1 || params.size_max < params.size_min || params.latency_samples < 0 || params.large_files < 0) ? -1 : 0;
+	ERROR_HANDLE_INT_RETURN_INT(code, "parse_params(): Invalid parameters\n");
+	if (params.port == 0)
+		params.port = 20000 + (getpid() % 5000) * 4;		// The server uses port and port + 1, the proxy port + 2 and port + 3
+	return 0;
+}
+
+/**
+ * @brief Function that writes a file of printable pseudo-random content.
+ * (printable bytes only: the transport cipher doesn't keep '\0' bytes)
+ * 
+ * @param path		Path of the file.
+ * @param size		Size of the file.
+ * @param buffer	Buffer to fill the file with.
+ * @param capacity	Size of the buffer.
+ * 
+ * @return int		0 if the file was written, -1 otherwise.
+ */
+int write_random_file(const char *path, size_t size, byte *buffer, size_t capacity) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ERROR_HANDLE_INT_RETURN_INT(fd, "write_random_file(): Unable to create '%s'\n", path);
+	size_t remaining = size;
+	while (remaining > 0) {
+		size_t chunk = remaining < capacity ? remaining : capacity;
+		size_t i;
+		for (i = 0; i < chunk; i += 8) {
+			unsigned long long value = rng_next();
+			size_t j;
+			for (j = 0; j < 8 && i + j < chunk; j++)
+				buffer[i + j] = 'a' + ((value >> (j * 8)) & 0xFF) % 26;
+		}
+		ssize_t written = write(fd, buffer, chunk);
+		int code = written == (ssize_t)chunk ? 0 : -1;
+		if (code == -1) close(fd);
+		ERROR_HANDLE_INT_RETURN_INT(code, "write_random_file(): Unable to write '%s'\n", path);
+		remaining -= chunk;
+	}
+	close(fd);
+	return 0;
+}
+
+/**
+ * @brief Function that builds the relative path of the n-th file of the tree.
+ * Files are spread over the directories of the tree (fanout^level directories per level).
+ * 
+ * @param index		Index of the file.
+ * @param path		Buffer of BENCHMARK_MAX_PATH bytes.
+ * 
+ * @return void
+ */
+void tree_file_path(int index, char *path) {
+	int length = 0;
+	int level;
+	int node = index;
+	for (level = 0; level < params.depth; level++) {
+		length += sprintf(path + length, "d%d/", node % params.fanout);
+		node /= params.fanout;
+	}
+	sprintf(path + length, "f%06d.txt", index);
+}
+
+/**
+ * @brief Function that generates the initial tree in the server directory.
+ * 
+ * @param directory		Server directory.
+ * 
+ * @return int			0 if the tree was generated, -1 otherwise.
+ */
+int generate_tree(const char *directory) {
+	pool_buffer_t *buffer = buffer_pool_acquire(BENCHMARK_BUFFER_SIZE);
+	ERROR_HANDLE_PTR_RETURN_INT(buffer, "generate_tree(): Unable to get a buffer\n");
+	char path[BENCHMARK_MAX_PATH];
+	char relative[BENCHMARK_MAX_PATH];
+	int i;
+	for (i = 0; i < params.files; i++) {
+
+		// Create the parent directories
+		tree_file_path(i, relative);
+		sprintf(path, "%s%s", directory, relative);
+		char *slash;
+		for (slash = strchr(path + strlen(directory), '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+			*slash = '\0';
+			if (mkdir(path, 0755) == 0)
+				results.tree_directories++;
+			*slash = '/';
+		}
+
+		// Write the file (log-uniform size)
+		double u = (double)(rng_next() >> 11) / (double)(1ULL << 53);
+		size_t size = (size_t)(params.size_min * pow((double)params.size_max / params.size_min, u));
+		int code = write_random_file(path, size, buffer->data, buffer->capacity);
+		if (code == -1) buffer_pool_release(buffer);
+		ERROR_HANDLE_INT_RETURN_INT(code, "generate_tree(): Unable to generate the tree\n");
+		results.tree_bytes += size;
+	}
+	errno = 0;
+	buffer_pool_release(buffer);
+	return 0;
+}
+
+/**
+ * @brief Function that waits until a file exists with the expected size.
+ * 
+ * @param path		Path of the file.
+ * @param size		Expected size.
+ * @param timeout_ms	Maximum wait.
+ * 
+ * @return long long	Time when the file was seen (us), -1 on timeout.
+ */
+long long wait_for_file(const char *path, size_t size, long long timeout_ms) {
+	long long deadline = get_time_us() + timeout_ms * 1000;
+	struct stat st;
+	struct timespec interval = {0, BENCHMARK_POLL_US * 1000};
+	while (1) {
+		long long now = get_time_us();
+		if (stat(path, &st) == 0 && (size_t)st.st_size == size)
+			return now;
+		if (now > deadline)
+			return -1;
+		nanosleep(&interval, NULL);
+	}
+}
+
+/**
+ * @brief Function that tells if the client goes through the emulated WAN link.
+ * 
+ * @return int	1 if a link setting is set, 0 otherwise.
+ */
+int wan_enabled() {
+	return params.rtt_ms > 0 || params.jitter_ms > 0 || params.bandwidth_kbps > 0 || params.stall_rate > 0;
+}
+
+/**
+ * @brief Function that writes the config.ini of a role in its working directory.
+ * 
+ * @param role		"srv" or "cli".
+ * 
+ * @return int		0 if the file was written, -1 otherwise.
+ */
+int write_role_config(const char *role) {
+	char path[BENCHMARK_MAX_PATH];
+	sprintf(path, "%s/%s/" CONFIG_FILE, workdir, role);
+	FILE *file = fopen(path, "w");
+	ERROR_HANDLE_PTR_RETURN_INT(file, "write_role_config(): Unable to create '%s'\n", path);
+	int port = (strcmp(role, "cli") == 0 && wan_enabled()) ? params.port + 2 : params.port;
+	fprintf(file, "directory=%s/%s/data/\npassword=benchmark\nip=127.0.0.1\nport=%d\nlog_levels=warning,error\n", workdir, role, port);
+
+	// Append the extra configuration (tuning keys to compare)
+	if (params.config[0] != '\0') {
+		char *extra = readEntireFile(params.config);
+		if (extra == NULL) fclose(file);
+		ERROR_HANDLE_PTR_RETURN_INT(extra, "write_role_config(): Unable to read '%s'\n", params.config);
+		fprintf(file, "%s\n", extra);
+		free(extra);
+	}
+	fclose(file);
+	return 0;
+}
+
+/**
+ * @brief Function that starts this program in a role (server or client) in its working directory.
+ * The child reports on a pipe when its setup is done.
+ * 
+ * @param role		"srv" or "cli".
+ * @param pid		Filled with the process id.
+ * 
+ * @return int		Read end of the pipe, -1 if the process couldn't be started.
+ */
+int spawn_role(const char *role, pid_t *pid) {
+	int fds[2];
+	int code = pipe(fds);
+	ERROR_HANDLE_INT_RETURN_INT(code, "spawn_role(): Unable to create a pipe\n");
+	char self[BENCHMARK_MAX_PATH];
+	ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (length == -1) { close(fds[0]); close(fds[1]); }
+	ERROR_HANDLE_INT_RETURN_INT(length, "spawn_role(): Unable to find the executable\n");
+	self[length] = '\0';
+	char cwd[BENCHMARK_MAX_PATH];
+	char role_arg[32];
+	char notify_arg[32];
+	sprintf(cwd, "%s/%s", workdir, role);
+	sprintf(role_arg, "role=%s", role);
+	sprintf(notify_arg, "notify=%d", fds[1]);
+
+	// Only async-signal-safe calls in the child: the parent has threads
+	*pid = fork();
+	if (*pid == 0) {
+		close(fds[0]);
+		if (chdir(cwd) == 0)
+			execl(self, self, role_arg, notify_arg, (char*)NULL);
+		_exit(127);
+	}
+	close(fds[1]);
+	if (*pid == -1) close(fds[0]);
+	ERROR_HANDLE_INT_RETURN_INT(*pid, "spawn_role(): Unable to fork\n");
+	return fds[0];
+}
+
+/**
+ * @brief Function that waits for the report of a child (a line with a number).
+ * 
+ * @param fd		Read end of the pipe.
+ * 
+ * @return long long	The reported number, -1 if the child failed or timed out.
+ */
+long long wait_report(int fd) {
+	char line[64];
+	size_t length = 0;
+	struct pollfd pfd = {fd, POLLIN, 0};
+	long long deadline = get_time_ms() + params.timeout_ms;
+	while (length < sizeof(line) - 1 && (length == 0 || line[length - 1] != '\n')) {
+		long long remaining = deadline - get_time_ms();
+		if (remaining <= 0 || poll(&pfd, 1, (int)remaining) <= 0)
+			return -1;
+		ssize_t bytes = read(fd, line + length, sizeof(line) - 1 - length);
+		if (bytes <= 0)
+			return -1;
+		length += bytes;
+	}
+	line[length] = '\0';
+	return atoll(line);
+}
+
+/**
+ * @brief Function run in the child processes: starts the server or the client from the config.ini
+ * of the working directory, reports the setup duration (us) on the pipe, then runs forever.
+ * 
+ * @param role		"srv" or "cli".
+ * @param notify	Write end of the pipe.
+ * 
+ * @return int		-1 if the setup failed (doesn't return otherwise).
+ */
+int run_role(const char *role, int notify) {
+	config_t config = read_config_file();
+	int code = config.port == 0 ? -1 : 0;
+	ERROR_HANDLE_INT_RETURN_INT(code, "run_role(): Unable to read the configuration file\n");
+	char report[32];
+	if (strcmp(role, "srv") == 0) {
+		tcp_server_t tcp_server;
+		code = setup_tcp_server(config, &tcp_server);
+		ERROR_HANDLE_INT_RETURN_INT(code, "run_role(): Unable to setup the TCP server\n");
+		sprintf(report, "0\n");
+		code = write(notify, report, strlen(report));
+		close(notify);
+		return tcp_server_run(&tcp_server);
+	}
+
+	// The client setup includes the initial synchronization
+	static tcp_client_t tcp_client;
+	long long start = get_time_us();
+	code = setup_tcp_client(config, &tcp_client);
+	ERROR_HANDLE_INT_RETURN_INT(code, "run_role(): Unable to setup the TCP client\n");
+	sprintf(report, "%lld\n", get_time_us() - start);
+	code = write(notify, report, strlen(report));
+	close(notify);
+	return tcp_client_run(&tcp_client);
+}
+
+/**
+ * @brief Function that stops the child processes and removes the temporary directory.
+ * 
+ * @return void
+ */
+void cleanup() {
+	if (client_pid > 0) { kill(client_pid, SIGTERM); waitpid(client_pid, NULL, 0); }
+	if (server_pid > 0) { kill(server_pid, SIGTERM); waitpid(server_pid, NULL, 0); }
+	client_pid = server_pid = -1;
+	if (workdir[0] != '\0' && !params.keep) {
+		char command[BENCHMARK_MAX_PATH + 16];
+		sprintf(command, "rm -rf '%s'", workdir);
+		if (system(command) != 0)
+			WARNING_PRINT("cleanup(): Unable to remove '%s'\n", workdir);
+	}
+	else if (workdir[0] != '\0')
+		INFO_PRINT("cleanup(): Temporary directory kept: '%s'\n", workdir);
+}
+
+/**
+ * @brief Function that compares two latencies for qsort().
+ * 
+ * @return int	Comparison result.
+ */
+int compare_latencies(const void *a, const void *b) {
+	long long x = *(const long long*)a;
+	long long y = *(const long long*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief Function that returns a percentile of the sorted latencies (nearest rank).
+ * 
+ * @param percentile	Percentile between 0 and 100.
+ * 
+ * @return long long	The latency (us), 0 without samples.
+ */
+long long latency_percentile(double percentile) {
+	if (results.latency_count == 0)
+		return 0;
+	int rank = (int)ceil(percentile / 100.0 * results.latency_count) - 1;
+	if (rank < 0) rank = 0;
+	if (rank >= results.latency_count) rank = results.latency_count - 1;
+	return results.latencies_us[rank];
+}
+
+/**
+ * @brief Function that measures the steady state: event -> apply latency of small files written one by one,
+ * then the throughput of large files. Files are written at the top of the client directory
+ * (the file watcher isn't recursive).
+ * 
+ * @return int	0 if the measures were done, -1 otherwise.
+ */
+int measure_steady_state() {
+	char client_path[BENCHMARK_MAX_PATH];
+	char server_path[BENCHMARK_MAX_PATH];
+	pool_buffer_t *buffer = buffer_pool_acquire(BENCHMARK_BUFFER_SIZE);
+	ERROR_HANDLE_PTR_RETURN_INT(buffer, "measure_steady_state(): Unable to get a buffer\n");
+
+	// Warmup: rewrite a file until the client watches its directory
+	sprintf(client_path, "%s/cli/data/warmup.txt", workdir);
+	sprintf(server_path, "%s/srv/data/warmup.txt", workdir);
+	long long seen = -1;
+	long long deadline = get_time_ms() + params.timeout_ms;
+	while (seen == -1 && get_time_ms() < deadline && write_random_file(client_path, 16, buffer->data, buffer->capacity) == 0)
+		seen = wait_for_file(server_path, 16, 100);
+	int code = seen == -1 ? -1 : 0;
+	if (code == -1) buffer_pool_release(buffer);
+	ERROR_HANDLE_INT_RETURN_INT(code, "measure_steady_state(): The client doesn't synchronize (warmup timed out)\n");
+
+	// Latency of small files
+	results.latencies_us = malloc(sizeof(long long) * (params.latency_samples + 1));
+	if (results.latencies_us == NULL) buffer_pool_release(buffer);
+	ERROR_HANDLE_PTR_RETURN_INT(results.latencies_us, "measure_steady_state(): Unable to allocate the samples\n");
+	int i;
+	for (i = 0; i < params.latency_samples; i++) {
+		sprintf(client_path, "%s/cli/data/latency_%05d.txt", workdir, i);
+		sprintf(server_path, "%s/srv/data/latency_%05d.txt", workdir, i);
+		long long start = get_time_us();
+		if (write_random_file(client_path, params.latency_size, buffer->data, buffer->capacity) == 0
+			&& (seen = wait_for_file(server_path, params.latency_size, params.timeout_ms)) != -1)
+			results.latencies_us[results.latency_count++] = seen - start;
+		else
+			results.latency_failed++;
+	}
+	qsort(results.latencies_us, results.latency_count, sizeof(long long), compare_latencies);
+
+	// Throughput of large files
+	long long start = get_time_us();
+	for (i = 0; i < params.large_files; i++) {
+		sprintf(client_path, "%s/cli/data/large_%03d.txt", workdir, i);
+		sprintf(server_path, "%s/srv/data/large_%03d.txt", workdir, i);
+		if (write_random_file(client_path, params.large_size, buffer->data, buffer->capacity) == 0
+			&& wait_for_file(server_path, params.large_size, params.timeout_ms) != -1)
+			results.large_bytes += params.large_size;
+		else
+			results.large_failed++;
+	}
+	results.large_seconds = (get_time_us() - start) / 1000000.0;
+	errno = 0;
+	buffer_pool_release(buffer);
+	return 0;
+}
+
+/**
+ * @brief Function that checks that the files of the initial tree are on the client with the right size.
+ * 
+ * @return void
+ */
+void verify_initial_sync() {
+	char relative[BENCHMARK_MAX_PATH];
+	char server_path[BENCHMARK_MAX_PATH * 2];
+	char client_path[BENCHMARK_MAX_PATH * 2];
+	struct stat server_st, client_st;
+	int i;
+	for (i = 0; i < params.files; i++) {
+		tree_file_path(i, relative);
+		sprintf(server_path, "%s/srv/data/%s", workdir, relative);
+		sprintf(client_path, "%s/cli/data/%s", workdir, relative);
+		if (stat(server_path, &server_st) == 0 && stat(client_path, &client_st) == 0 && server_st.st_size == client_st.st_size)
+			results.initial_sync_verified++;
+	}
+	errno = 0;
+}
+
+/**
+ * @brief Function that writes the results: summary on the console, JSON document and CSV row.
+ * The CSV file gets a header when it's created, so runs before and after a change can be appended.
+ * 
+ * @return int	0 if the outputs were written, -1 otherwise.
+ */
+int write_results() {
+	double initial_mb_s = results.initial_sync_ms > 0 ? results.tree_bytes / 1048576.0 / (results.initial_sync_ms / 1000.0) : 0;
+	double large_mb_s = results.large_seconds > 0 ? results.large_bytes / 1048576.0 / results.large_seconds : 0;
+	double mean = 0;
+	int i;
+	for (i = 0; i < results.latency_count; i++)
+		mean += results.latencies_us[i];
+	mean = results.latency_count > 0 ? mean / results.latency_count : 0;
+	long long p50 = latency_percentile(50), p90 = latency_percentile(90), p99 = latency_percentile(99), p999 = latency_percentile(99.9);
+	long long min = results.latency_count > 0 ? results.latencies_us[0] : 0;
+	long long max = results.latency_count > 0 ? results.latencies_us[results.latency_count - 1] : 0;
+
+	// Console summary
+	INFO_PRINT("write_results(): Initial sync: %d files (%d verified), %.2f MB in %.1f ms (%.1f MB/s)\n", params.files, results.initial_sync_verified, results.tree_bytes / 1048576.0, results.initial_sync_ms, initial_mb_s);
+	INFO_PRINT("write_results(): Latency (us): p50 %lld, p90 %lld, p99 %lld, p99.9 %lld, max %lld (%d samples, %d failed)\n", p50, p90, p99, p999, max, results.latency_count, results.latency_failed);
+	INFO_PRINT("write_results(): Large files: %.2f MB in %.2f s (%.1f MB/s, %d failed)\n", results.large_bytes / 1048576.0, results.large_seconds, large_mb_s, results.large_failed);
+
+	// JSON document
+	if (params.json[0] != '\0') {
+		FILE *file = fopen(params.json, "w");
+		ERROR_HANDLE_PTR_RETURN_INT(file, "write_results(): Unable to create '%s'\n", params.json);
+		fprintf(file, "{\n\t\"label\": \"%s\",\n\t\"timestamp\": %lld,\n", params.label, (long long)time(NULL));
+		fprintf(file, "\t\"parameters\": {\"files\": %d, \"size_min\": %zu, \"size_max\": %zu, \"depth\": %d, \"fanout\": %d, \"latency_samples\": %d, \"latency_size\": %zu, \"large_files\": %d, \"large_size\": %zu, \"seed\": %llu, \"config\": \"%s\", \"rtt_ms\": %.3f, \"jitter_ms\": %.3f, \"bandwidth_kbps\": %lld, \"stall_rate\": %.6f, \"stall_ms\": %.3f},\n",
+			params.files, params.size_min, params.size_max, params.depth, params.fanout, params.latency_samples, params.latency_size, params.large_files, params.large_size, params.seed, params.config,
+			params.rtt_ms, params.jitter_ms, params.bandwidth_kbps, params.stall_rate, params.stall_ms);
+		fprintf(file, "\t\"initial_sync\": {\"files\": %d, \"directories\": %d, \"bytes\": %lld, \"verified\": %d, \"ms\": %.3f, \"mb_per_s\": %.3f},\n",
+			params.files, results.tree_directories, results.tree_bytes, results.initial_sync_verified, results.initial_sync_ms, initial_mb_s);
+		fprintf(file, "\t\"latency_us\": {\"samples\": %d, \"failed\": %d, \"min\": %lld, \"mean\": %.1f, \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld},\n",
+			results.latency_count, results.latency_failed, min, mean, p50, p90, p99, p999, max);
+		fprintf(file, "\t\"throughput\": {\"files\": %d, \"failed\": %d, \"bytes\": %lld, \"seconds\": %.6f, \"mb_per_s\": %.3f}\n}\n",
+			params.large_files, results.large_failed, results.large_bytes, results.large_seconds, large_mb_s);
+		fclose(file);
+	}
+
+	// CSV row
+	if (params.csv[0] != '\0') {
+		struct stat st;
+		int header = stat(params.csv, &st) != 0 || st.st_size == 0;
+		errno = 0;
+		FILE *file = fopen(params.csv, "a");
+		ERROR_HANDLE_PTR_RETURN_INT(file, "write_results(): Unable to open '%s'\n", params.csv);
+		if (header)
+			fprintf(file, "label,timestamp,rtt_ms,jitter_ms,bandwidth_kbps,stall_rate,files,bytes,initial_sync_ms,initial_sync_mb_s,verified,latency_samples,latency_failed,latency_min_us,latency_mean_us,latency_p50_us,latency_p90_us,latency_p99_us,latency_p999_us,latency_max_us,large_files,large_failed,large_bytes,large_seconds,large_mb_s\n");
+		fprintf(file, "%s,%lld,%.3f,%.3f,%lld,%.6f,%d,%lld,%.3f,%.3f,%d,%d,%d,%lld,%.1f,%lld,%lld,%lld,%lld,%lld,%d,%d,%lld,%.6f,%.3f\n",
+			params.label, (long long)time(NULL), params.rtt_ms, params.jitter_ms, params.bandwidth_kbps, params.stall_rate, params.files, results.tree_bytes, results.initial_sync_ms, initial_mb_s, results.initial_sync_verified,
+			results.latency_count, results.latency_failed, min, mean, p50, p90, p99, p999, max,
+			params.large_files, results.large_failed, results.large_bytes, results.large_seconds, large_mb_s);
+		fclose(file);
+	}
+	return 0;
+}
+
+#endif
+
+/**
+ * This program benchmarks the synchronization end to end on loopback.
+ * It generates a tree in a temporary server directory, starts a server and a client (child processes),
+ * and measures the initial synchronization, the event -> apply latency and the throughput of large files.
+ * 
+ * Parameters are key=value arguments, for example:
+ * sync_benchmark.exe files=5000 size_max=256K depth=3 label=before csv=results.csv json=before.json
+ * The rtt_ms, jitter_ms, bandwidth_kbps, stall_rate and stall_ms parameters put an emulated WAN link
+ * (wan_proxy.h) between the client and the server.
+ * 
+ * @author Stoupy51 (COLLIGNON Alexandre)
+ */
+int main(int argc, char **argv) {
+
+	#ifdef _WIN32
+		(void)argc;
+		(void)argv;
+		ERROR_PRINT("main(): The benchmark needs fork() and is only available on Linux\n");
+		return -1;
+	#else
+
+	// Child process: run the server or the client
+	if (argc == 3 && strncmp(argv[1], "role=", 5) == 0 && strncmp(argv[2], "notify=", 7) == 0)
+		return run_role(argv[1] + 5, atoi(argv[2] + 7));
+
+	// Parse the parameters
+	mainInit("main(): Sync benchmark program\n");
+	int code = parse_params(argc, argv);
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Usage: %s [label=] [files=] [size_min=] [size_max=] [depth=] [fanout=] [latency_samples=] [latency_size=] [large_files=] [large_size=] [seed=] [port=] [timeout_ms=] [workdir=] [config=] [json=] [csv=] [keep=] [rtt_ms=] [jitter_ms=] [bandwidth_kbps=] [stall_rate=] [stall_ms=]\n", argv[0]);
+	rng_state = params.seed * 2654435761ULL + 1;
+	code = buffer_pool_init(NULL, 0, 0);
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Unable to initialize the buffer pool\n");
+
+	// Create the temporary directories
+	sprintf(workdir, "%s/sync_benchmark_XXXXXX", params.workdir);
+	code = mkdtemp(workdir) == NULL ? -1 : 0;
+	if (code == -1) workdir[0] = '\0';
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Unable to create the temporary directory in '%s'\n", params.workdir);
+	atexit(cleanup);
+	const char *subdirectories[] = {"srv", "srv/data", "cli", "cli/data"};
+	char path[BENCHMARK_MAX_PATH * 2];
+	int i;
+	for (i = 0; i < 4; i++) {
+		sprintf(path, "%s/%s", workdir, subdirectories[i]);
+		code = mkdir(path, 0755);
+		ERROR_HANDLE_INT_RETURN_INT(code, "main(): Unable to create '%s'\n", path);
+	}
+	code = write_role_config("srv");
+	if (code == 0) code = write_role_config("cli");
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Unable to write the configuration files\n");
+
+	// Generate the initial tree on the server
+	sprintf(path, "%s/srv/data/", workdir);
+	long long start = get_time_ms();
+	code = generate_tree(path);
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Unable to generate the tree\n");
+	INFO_PRINT("main(): Generated %d files in %d directories (%.2f MB) in %lld ms\n", params.files, results.tree_directories, results.tree_bytes / 1048576.0, get_time_ms() - start);
+
+	// Start the server
+	int report_fd = spawn_role("srv", &server_pid);
+	ERROR_HANDLE_INT_RETURN_INT(report_fd, "main(): Unable to start the server\n");
+	long long report = wait_report(report_fd);
+	close(report_fd);
+	code = report == -1 ? -1 : 0;
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): The server didn't start (port %d)\n", params.port);
+
+	// Start the emulated WAN link in front of the server
+	if (wan_enabled()) {
+		static wan_proxy_t proxy;
+		wan_proxy_config_t link;
+		memset(&link, 0, sizeof(wan_proxy_config_t));
+		link.listen_port = params.port + 2;
+		strcpy(link.target_ip, "127.0.0.1");
+		link.target_port = params.port;
+		link.ports = 2;
+		link.rtt_us = (long long)(params.rtt_ms * 1000);
+		link.jitter_us = (long long)(params.jitter_ms * 1000);
+		link.bandwidth = params.bandwidth_kbps * 1000 / 8;
+		link.stall_rate = params.stall_rate;
+		link.stall_us = (long long)(params.stall_ms * 1000);
+		link.seed = params.seed;
+		code = wan_proxy_start(&proxy, link);
+		ERROR_HANDLE_INT_RETURN_INT(code, "main(): Unable to start the WAN proxy\n");
+	}
+
+	// Start the client: its setup is the initial synchronization
+	report_fd = spawn_role("cli", &client_pid);
+	ERROR_HANDLE_INT_RETURN_INT(report_fd, "main(): Unable to start the client\n");
+	report = wait_report(report_fd);
+	close(report_fd);
+	code = report == -1 ? -1 : 0;
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): The initial synchronization failed or timed out\n");
+	results.initial_sync_ms = report / 1000.0;
+	verify_initial_sync();
+	INFO_PRINT("main(): Initial synchronization done in %.1f ms\n", results.initial_sync_ms);
+
+	// Steady state
+	code = measure_steady_state();
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Unable to measure the steady state\n");
+
+	// Write the results
+	code = write_results();
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Unable to write the results\n");
+	free(results.latencies_us);
+	return 0;
+
+	#endif
+}
+
@@ -0,0 +1,68 @@
+
+#include <stdlib.h>
+
+#include "../src/wan_proxy.h"
+
+wan_proxy_t proxy;
+
+/**
+ * This program emulates a WAN link between a client and a server on the same machine:
+ * it forwards connections with a round trip time, jitter, a bandwidth cap and stalls.
+ * 
+ * Parameters are key=value arguments, for example (server on 8000-8001, client configured on port 9000):
+ * wan_proxy.exe listen=9000 target=127.0.0.1:8000 ports=2 rtt_ms=100 jitter_ms=10 bandwidth_kbps=20000 stall_rate=0.001 stall_ms=300
+ * 
+ * @author Stoupy51 (COLLIGNON Alexandre)
+ */
+int main(int argc, char **argv) {
+
+	// Default settings
+	mainInit("main(): WAN proxy program\n");
+	wan_proxy_config_t config;
+	memset(&config, 0, sizeof(wan_proxy_config_t));
+	strcpy(config.target_ip, "127.0.0.1");
+	config.ports = 2;
+	config.seed = 42;
+
+	// Parse the parameters
+	int i;
+	for (i = 1; i < argc; i++) {
+		char *value = strchr(argv[i], '=');
+		int code = value == NULL ? -1 : 0;
+		ERROR_HANDLE_INT_RETURN_INT(code, "main(): Invalid argument '%s' (expected key=value)\n", argv[i]);
+		*value++ = '\0';
+		if (strcmp(argv[i], "listen") == 0) config.listen_port = atoi(value);
+		else if (strcmp(argv[i], "target") == 0) {
+			char *separator = strrchr(value, ':');
+			code = (separator == NULL || (size_t)(separator - value) >= sizeof(config.target_ip)) ? -1 : 0;
+			ERROR_HANDLE_INT_RETURN_INT(code, "main(): Invalid target '%s' (expected ip:port)\n", value);
+			*separator = '\0';
+			strcpy(config.target_ip, value);
+			config.target_port = atoi(separator + 1);
+		}
+		else if (strcmp(argv[i], "ports") == 0) config.ports = atoi(value);
+		else if (strcmp(argv[i], "rtt_ms") == 0) config.rtt_us = (long long)(atof(value) * 1000);
+		else if (strcmp(argv[i], "jitter_ms") == 0) config.jitter_us = (long long)(atof(value) * 1000);
+		else if (strcmp(argv[i], "bandwidth_kbps") == 0) config.bandwidth = atoll(value) * 1000 / 8;
+		else if (strcmp(argv[i], "stall_rate") == 0) config.stall_rate = atof(value);
+		else if (strcmp(argv[i], "stall_ms") == 0) config.stall_us = (long long)(atof(value) * 1000);
+		else if (strcmp(argv[i], "seed") == 0) config.seed = strtoull(value, NULL, 10);
+		else {
+			ERROR_PRINT("main(): Unknown parameter '%s'\n", argv[i]);
+			return -1;
+		}
+	}
+	int code = (config.listen_port == 0 || config.target_port == 0) ? -1 : 0;
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Usage: %s listen=<port> target=<ip:port> [ports=2] [rtt_ms=] [jitter_ms=] [bandwidth_kbps=] [stall_rate=] [stall_ms=] [seed=]\n", argv[0]);
+
+	// Start the proxy and wait forever
+	code = wan_proxy_start(&proxy, config);
+	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Unable to start the proxy\n");
+	for (i = 0; i < config.ports; i++)
+		pthread_join(proxy.accept_threads[i], NULL);
+
+	// Final print and return
+	INFO_PRINT("main(): End of program\n");
+	return 0;
+}
+
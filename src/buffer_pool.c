@@ -0,0 +1,208 @@
+
+#include "buffer_pool.h"
+#include "universal_pthread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <malloc.h>
+#endif
+
+// Size class of the pool (shared free list protected by a mutex)
+typedef struct buffer_class_t {
+	size_t size;
+	pool_buffer_t *free_list;
+	pthread_mutex_t mutex;
+} buffer_class_t;
+
+// Cache of a thread (no locking needed)
+typedef struct buffer_thread_cache_t {
+	pool_buffer_t *free_list[BUFFER_POOL_MAX_CLASSES];
+	int count[BUFFER_POOL_MAX_CLASSES];
+} buffer_thread_cache_t;
+
+// Global variables
+static buffer_class_t pool_classes[BUFFER_POOL_MAX_CLASSES];
+static int pool_classes_count = 0;
+static int pool_thread_cache_size = BUFFER_POOL_DEFAULT_THREAD_CACHE;
+static volatile int pool_state = 0;		// 0: not initialized, 1: initializing, 2: ready
+static __thread buffer_thread_cache_t pool_thread_cache;
+
+/**
+ * @brief Function that initializes the process-wide buffer pool.
+ * Only the first call configures the pool, the next ones are ignored.
+ * 
+ * @param class_sizes			Sizes of the buffer classes (rounded up to BUFFER_POOL_ALIGNMENT, NULL for the defaults).
+ * @param classes_count			Number of classes.
+ * @param thread_cache_size		Buffers kept by each thread for each class (0 for the default).
+ * 
+ * @return int		0 if the pool is ready, -1 otherwise.
+ */
+int buffer_pool_init(const size_t *class_sizes, int classes_count, int thread_cache_size) {
+
+	// Only the first call configures the pool
+	if (!__sync_bool_compare_and_swap(&pool_state, 0, 1)) {
+		while (pool_state != 2);
+		return 0;
+	}
+
+	// Default classes: small messages and network chunks
+	static const size_t default_sizes[] = { 64 * 1024, 1024 * 1024 };
+	if (class_sizes == NULL || classes_count <= 0) {
+		class_sizes = default_sizes;
+		classes_count = sizeof(default_sizes) / sizeof(size_t);
+	}
+	if (classes_count > BUFFER_POOL_MAX_CLASSES)
+		classes_count = BUFFER_POOL_MAX_CLASSES;
+	if (thread_cache_size > 0)
+		pool_thread_cache_size = thread_cache_size;
+
+	// Create the classes sorted by size (insertion sort, there are only a few)
+	int i, j;
+	for (i = 0; i < classes_count; i++) {
+		size_t size = (class_sizes[i] + BUFFER_POOL_ALIGNMENT - 1) & ~(size_t)(BUFFER_POOL_ALIGNMENT - 1);
+		for (j = pool_classes_count; j > 0 && pool_classes[j - 1].size > size; j--)
+			pool_classes[j].size = pool_classes[j - 1].size;
+		pool_classes[j].size = size;
+		pool_classes_count++;
+	}
+	for (i = 0; i < pool_classes_count; i++) {
+		pool_classes[i].free_list = NULL;
+		pthread_mutex_init(&pool_classes[i].mutex, NULL);
+	}
+
+	// Return
+	pool_state = 2;
+	return 0;
+}
+
+/**
+ * @brief Function that allocates a new page-aligned buffer.
+ * 
+ * @param capacity		Size of the buffer.
+ * @param class_index	Size class of the buffer.
+ * 
+ * @return pool_buffer_t*	The buffer, NULL on failure.
+ */
+static pool_buffer_t* buffer_pool_allocate(size_t capacity, int class_index) {
+	pool_buffer_t *buffer = malloc(sizeof(pool_buffer_t));
+	ERROR_HANDLE_PTR_RETURN_NULL(buffer, "buffer_pool_allocate(): Unable to allocate a buffer descriptor\n");
+	#ifdef _WIN32
+		void *data = _aligned_malloc(capacity, BUFFER_POOL_ALIGNMENT);
+	#else
+		void *data = NULL;
+		if (posix_memalign(&data, BUFFER_POOL_ALIGNMENT, capacity) != 0)
+			data = NULL;
+	#endif
+	if (data == NULL) free(buffer);
+	ERROR_HANDLE_PTR_RETURN_NULL(data, "buffer_pool_allocate(): Unable to allocate a buffer of %zu bytes\n", capacity);
+	buffer->data = data;
+	buffer->capacity = capacity;
+	buffer->class_index = class_index;
+	buffer->next = NULL;
+	return buffer;
+}
+
+/**
+ * @brief Function that gets a page-aligned buffer of at least the given size.
+ * The content of the buffer is not initialized.
+ * 
+ * @param size	Minimum size of the buffer.
+ * 
+ * @return pool_buffer_t*	The buffer (give it back with buffer_pool_release()), NULL on failure.
+ */
+pool_buffer_t* buffer_pool_acquire(size_t size) {
+
+	// Make sure the pool is ready
+	if (pool_state != 2)
+		buffer_pool_init(NULL, 0, 0);
+
+	// Find the smallest class that fits, or allocate a dedicated buffer
+	int i;
+	for (i = 0; i < pool_classes_count && pool_classes[i].size < size; i++);
+	if (i == pool_classes_count)
+		return buffer_pool_allocate((size + BUFFER_POOL_ALIGNMENT - 1) & ~(size_t)(BUFFER_POOL_ALIGNMENT - 1), -1);
+
+	// Try the thread cache first
+	pool_buffer_t *buffer = pool_thread_cache.free_list[i];
+	if (buffer != NULL) {
+		pool_thread_cache.free_list[i] = buffer->next;
+		pool_thread_cache.count[i]--;
+		return buffer;
+	}
+
+	// Then the shared free list
+	buffer_class_t *class = &pool_classes[i];
+	pthread_mutex_lock(&class->mutex);
+	buffer = class->free_list;
+	if (buffer != NULL)
+		class->free_list = buffer->next;
+	pthread_mutex_unlock(&class->mutex);
+	if (buffer != NULL)
+		return buffer;
+
+	// Else, allocate a new one
+	return buffer_pool_allocate(class->size, i);
+}
+
+/**
+ * @brief Function that gives a buffer back to the pool.
+ * 
+ * @param buffer	The buffer (NULL is ignored).
+ * 
+ * @return void
+ */
+void buffer_pool_release(pool_buffer_t *buffer) {
+	if (buffer == NULL)
+		return;
+
+	// Dedicated buffer: free it
+	int i = buffer->class_index;
+	if (i < 0) {
+		#ifdef _WIN32
+			_aligned_free(buffer->data);
+		#else
+			free(buffer->data);
+		#endif
+		free(buffer);
+		return;
+	}
+
+	// Keep it in the thread cache if there is room
+	if (pool_thread_cache.count[i] < pool_thread_cache_size) {
+		buffer->next = pool_thread_cache.free_list[i];
+		pool_thread_cache.free_list[i] = buffer;
+		pool_thread_cache.count[i]++;
+		return;
+	}
+
+	// Else, give it to the shared free list
+	pthread_mutex_lock(&pool_classes[i].mutex);
+	buffer->next = pool_classes[i].free_list;
+	pool_classes[i].free_list = buffer;
+	pthread_mutex_unlock(&pool_classes[i].mutex);
+}
+
+/**
+ * @brief Function that gives the buffers cached by the calling thread back to the shared free lists.
+ * Threads that end should call it so their buffers can be reused.
+ * 
+ * @return void
+ */
+void buffer_pool_thread_flush() {
+	int i;
+	for (i = 0; i < pool_classes_count; i++) {
+		while (pool_thread_cache.free_list[i] != NULL) {
+			pool_buffer_t *buffer = pool_thread_cache.free_list[i];
+			pool_thread_cache.free_list[i] = buffer->next;
+			pthread_mutex_lock(&pool_classes[i].mutex);
+			buffer->next = pool_classes[i].free_list;
+			pool_classes[i].free_list = buffer;
+			pthread_mutex_unlock(&pool_classes[i].mutex);
+		}
+		pool_thread_cache.count[i] = 0;
+	}
+}
+
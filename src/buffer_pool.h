@@ -0,0 +1,26 @@
+
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include "universal_utils.h"
+
+#define BUFFER_POOL_ALIGNMENT 4096			// Page alignment (usable for O_DIRECT)
+#define BUFFER_POOL_MAX_CLASSES 8
+#define BUFFER_POOL_DEFAULT_THREAD_CACHE 4	// Buffers kept by each thread for each size class
+
+// Structure of a buffer from the pool
+typedef struct pool_buffer_t {
+	byte *data;						// Page-aligned memory
+	size_t capacity;				// Size of the memory
+	int class_index;				// Size class of the buffer (-1 if too big for the pool)
+	struct pool_buffer_t *next;		// Next buffer in a free list
+} pool_buffer_t;
+
+// Function prototypes
+int buffer_pool_init(const size_t *class_sizes, int classes_count, int thread_cache_size);
+pool_buffer_t* buffer_pool_acquire(size_t size);
+void buffer_pool_release(pool_buffer_t *buffer);
+void buffer_pool_thread_flush();
+
+#endif
+
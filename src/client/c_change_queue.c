@@ -0,0 +1,684 @@
+
+#include "c_change_queue.h"
+#include "../hash_engine.h"
+#include "../metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CHANGE_INDEX_INITIAL_BUCKETS 64
+
+/**
+ * @brief Function that checks if two paths are related:
+ * they are equal, or one of them is a parent directory of the other.
+ * 
+ * @param a		First path.
+ * @param b		Second path.
+ * 
+ * @return int	1 if the paths are related, 0 otherwise.
+ */
+static int paths_related(const char *a, const char *b) {
+	size_t a_length = strlen(a);
+	size_t b_length = strlen(b);
+	size_t length = a_length < b_length ? a_length : b_length;
+	if (strncmp(a, b, length) != 0)
+		return 0;
+	if (a_length == b_length)
+		return 1;
+	char next = (a_length > b_length) ? a[length] : b[length];
+	return next == '/' || next == '\\';
+}
+
+/**
+ * @brief Function that compares two changes in scheduling order.
+ * 
+ * @return int		1 if the first change must be sent before the second one, 0 otherwise.
+ */
+static int change_before(change_t *a, change_t *b) {
+	return a->key < b->key || (a->key == b->key && a->sequence < b->sequence);
+}
+
+/**
+ * @brief Function that moves a heap entry up until the heap is ordered.
+ * 
+ * @return void
+ */
+static void heap_sift_up(change_queue_t *queue, int index) {
+	change_t *change = queue->heap[index];
+	while (index > 0) {
+		int parent = (index - 1) / 2;
+		if (!change_before(change, queue->heap[parent]))
+			break;
+		queue->heap[index] = queue->heap[parent];
+		queue->heap[index]->heap_index = index;
+		index = parent;
+	}
+	queue->heap[index] = change;
+	change->heap_index = index;
+}
+
+/**
+ * @brief Function that moves a heap entry down until the heap is ordered.
+ * 
+ * @return void
+ */
+static void heap_sift_down(change_queue_t *queue, int index) {
+	change_t *change = queue->heap[index];
+	while (1) {
+		int child = index * 2 + 1;
+		if (child >= queue->count)
+			break;
+		if (child + 1 < queue->count && change_before(queue->heap[child + 1], queue->heap[child]))
+			child++;
+		if (!change_before(queue->heap[child], change))
+			break;
+		queue->heap[index] = queue->heap[child];
+		queue->heap[index]->heap_index = index;
+		index = child;
+	}
+	queue->heap[index] = change;
+	change->heap_index = index;
+}
+
+/**
+ * @brief Function that removes an entry from the heap (the caller owns the change).
+ * 
+ * @return change_t*	The removed change.
+ */
+static change_t* heap_remove(change_queue_t *queue, int index) {
+	change_t *change = queue->heap[index];
+	change->heap_index = -1;
+	queue->count--;
+	if (index < queue->count) {
+		queue->heap[index] = queue->heap[queue->count];
+		heap_sift_down(queue, index);
+		heap_sift_up(queue, index);
+	}
+	return change;
+}
+
+/**
+ * @brief Function that publishes the depths of the queue.
+ * 
+ * @return void
+ */
+static void queue_update_metrics(change_queue_t *queue) {
+	metrics_gauge_set(METRIC_QUEUE_SCHEDULED, queue->count);
+	metrics_gauge_set(METRIC_QUEUE_DEFERRED, queue->deferred_count);
+}
+
+/**
+ * @brief Function that computes the delay of a change before it can be sent.
+ * Metadata operations have no delay, payloads are delayed by their size (up to a maximum,
+ * so large files still make progress) and by the priority class of their path.
+ * 
+ * @param queue		The change queue.
+ * @param action	Action of the change.
+ * @param filepath	Path of the file.
+ * @param size		Size of the payload.
+ * 
+ * @return long long	Delay in milliseconds.
+ */
+static long long change_delay(change_queue_t *queue, message_type_t action, const char *filepath, size_t size) {
+	if (action != FILE_CREATED && action != FILE_MODIFIED)
+		return 0;
+
+	// Size of the payload
+	long long delay = (long long)(size / (size_t)queue->bytes_per_ms);
+	if (delay > queue->max_delay_ms)
+		delay = queue->max_delay_ms;
+
+	// Priority class of the path (first matching pattern)
+	int i;
+	for (i = 0; i < queue->config->priority_classes_count; i++) {
+		if (wildcard_match(queue->config->priority_classes[i].pattern, filepath)) {
+			delay += queue->config->priority_classes[i].level * queue->class_step_ms;
+			break;
+		}
+	}
+
+	// Payloads always go after the metadata operations queued at the same time
+	return delay + 1;
+}
+
+/**
+ * @brief Function that finds a path of the index, creating it if asked.
+ * 
+ * @param queue		The change queue (locked).
+ * @param path		Path to find (not necessarily terminated after length).
+ * @param length	Length of the path.
+ * @param create	1 to create the path if it isn't indexed.
+ * 
+ * @return change_path_t*	The path, NULL if it isn't indexed (or can't be created).
+ */
+static change_path_t* index_path(change_queue_t *queue, const char *path, size_t length, int create) {
+	unsigned long long path_hash = hash64(path, length, 0);
+	change_path_t *entry = queue->paths[path_hash & (queue->paths_buckets_count - 1)];
+	while (entry != NULL && !(entry->path_hash == path_hash && entry->path_length == length && memcmp(entry->path, path, length) == 0))
+		entry = entry->next;
+	if (entry != NULL || !create)
+		return entry;
+
+	// Grow the buckets to keep the chains short (the index works with longer chains if the allocation fails)
+	if (queue->paths_count >= queue->paths_buckets_count) {
+		size_t buckets_count = queue->paths_buckets_count * 2;
+		change_path_t **buckets = calloc(buckets_count, sizeof(change_path_t*));
+		if (buckets != NULL) {
+			size_t i;
+			for (i = 0; i < queue->paths_buckets_count; i++) {
+				while (queue->paths[i] != NULL) {
+					change_path_t *moved = queue->paths[i];
+					queue->paths[i] = moved->next;
+					moved->next = buckets[moved->path_hash & (buckets_count - 1)];
+					buckets[moved->path_hash & (buckets_count - 1)] = moved;
+				}
+			}
+			free(queue->paths);
+			queue->paths = buckets;
+			queue->paths_buckets_count = buckets_count;
+		}
+	}
+
+	// Create the path
+	entry = calloc(1, sizeof(change_path_t) + length + 1);
+	if (entry == NULL)
+		return NULL;
+	entry->path_hash = path_hash;
+	entry->path_length = length;
+	memcpy(entry->path, path, length);
+	change_path_t **bucket = &queue->paths[path_hash & (queue->paths_buckets_count - 1)];
+	entry->next = *bucket;
+	*bucket = entry;
+	queue->paths_count++;
+	return entry;
+}
+
+/**
+ * @brief Function that removes a change from the index (its paths without changes are freed).
+ * 
+ * @param queue		The change queue (locked).
+ * @param change	The indexed change (nothing is done if it isn't indexed).
+ * 
+ * @return void
+ */
+static void index_remove(change_queue_t *queue, change_t *change) {
+	while (change->links != NULL) {
+		change_link_t *link = change->links;
+		change->links = link->sibling;
+
+		// Unlink the change from the list of the path
+		change_path_t *entry = link->path;
+		if (link->prev != NULL)
+			link->prev->next = link->next;
+		else if (link->under)
+			entry->under = link->next;
+		else
+			entry->on = link->next;
+		if (link->next != NULL)
+			link->next->prev = link->prev;
+		free(link);
+
+		// Free the path when no change uses it anymore
+		if (entry->on == NULL && entry->under == NULL) {
+			change_path_t **bucket = &queue->paths[entry->path_hash & (queue->paths_buckets_count - 1)];
+			while (*bucket != entry)
+				bucket = &(*bucket)->next;
+			*bucket = entry->next;
+			free(entry);
+			queue->paths_count--;
+		}
+	}
+}
+
+/**
+ * @brief Function that adds a change to the index: it is listed on its path and under each of its parent directories
+ * (and the same for its new path), so the changes related to a path are found without scanning the queue.
+ * 
+ * @param queue		The change queue (locked).
+ * @param change	The change to index (not indexed yet).
+ * 
+ * @return int		0 if the change was indexed, -1 otherwise (the change stays unindexed).
+ */
+static int index_add(change_queue_t *queue, change_t *change) {
+	const char *paths[2] = { change->filepath, change->new_filepath };
+	int i;
+	for (i = 0; i < 2 && paths[i] != NULL; i++) {
+		size_t length = strlen(paths[i]);
+		size_t end;
+		for (end = 1; end <= length; end++) {
+			if (end < length && paths[i][end] != '/' && paths[i][end] != '\\')
+				continue;
+
+			// Link the change on the path or under the parent directory ending here
+			change_link_t *link = malloc(sizeof(change_link_t));
+			change_path_t *entry = (link == NULL) ? NULL : index_path(queue, paths[i], end, 1);
+			if (entry == NULL) {
+				free(link);
+				index_remove(queue, change);
+				return -1;
+			}
+			link->under = (end < length);
+			link->path = entry;
+			link->change = change;
+			link->prev = NULL;
+			link->next = link->under ? entry->under : entry->on;
+			if (link->next != NULL)
+				link->next->prev = link;
+			if (link->under)
+				entry->under = link;
+			else
+				entry->on = link;
+			link->sibling = change->links;
+			change->links = link;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that finds the queued and deferred changes touching a path (with their path or their new path):
+ * the changes on the path or under it, and the changes on one of its parent directories.
+ * 
+ * @param queue		The change queue (locked).
+ * @param path		Path to check.
+ * 
+ * @return int		Number of changes found (stored once each in queue->matches), -1 if they can't be stored.
+ */
+static int index_find(change_queue_t *queue, const char *path) {
+	int count = 0;
+	size_t length = strlen(path);
+	size_t end;
+	queue->lookup_stamp++;
+	for (end = 1; end <= length; end++) {
+		if (end < length && path[end] != '/' && path[end] != '\\')
+			continue;
+
+		// Without changes on or under a parent directory, there are none deeper
+		change_path_t *entry = index_path(queue, path, end, 0);
+		if (entry == NULL)
+			break;
+
+		// Changes on the parent directory (or on the path), and under the path itself
+		int list;
+		for (list = 0; list < 2; list++) {
+			change_link_t *link = (list == 0) ? entry->on : ((end == length) ? entry->under : NULL);
+			for (; link != NULL; link = link->next) {
+				if (link->change->lookup_stamp == queue->lookup_stamp)
+					continue;
+				if ((size_t)count == queue->matches_capacity) {
+					size_t capacity = (queue->matches_capacity == 0) ? 16 : queue->matches_capacity * 2;
+					change_t **matches = realloc(queue->matches, capacity * sizeof(change_t*));
+					if (matches == NULL)
+						return -1;
+					queue->matches = matches;
+					queue->matches_capacity = capacity;
+				}
+				link->change->lookup_stamp = queue->lookup_stamp;
+				queue->matches[count++] = link->change;
+			}
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief Function that initializes the outbound change queue.
+ * 
+ * @param queue		The change queue to initialize.
+ * @param config	Configuration with the scheduler settings and the priority classes (must outlive the queue).
+ * 
+ * @return int		0 if the queue is ready, -1 otherwise.
+ */
+int change_queue_init(change_queue_t *queue, config_t *config) {
+	memset(queue, 0, sizeof(change_queue_t));
+	queue->config = config;
+	queue->bytes_per_ms = config->scheduler_bytes_per_ms > 0 ? config->scheduler_bytes_per_ms : CHANGE_QUEUE_DEFAULT_BYTES_PER_MS;
+	queue->max_delay_ms = config->scheduler_max_delay_ms > 0 ? config->scheduler_max_delay_ms : CHANGE_QUEUE_DEFAULT_MAX_DELAY_MS;
+	queue->class_step_ms = config->scheduler_class_step_ms > 0 ? config->scheduler_class_step_ms : CHANGE_QUEUE_DEFAULT_CLASS_STEP_MS;
+	queue->capacity = 64;
+	queue->heap = malloc(queue->capacity * sizeof(change_t*));
+	ERROR_HANDLE_PTR_RETURN_INT(queue->heap, "change_queue_init(): Unable to allocate the queue\n");
+	queue->paths_buckets_count = CHANGE_INDEX_INITIAL_BUCKETS;
+	queue->paths = calloc(queue->paths_buckets_count, sizeof(change_path_t*));
+	if (queue->paths == NULL) {
+		free(queue->heap);
+		queue->heap = NULL;
+	}
+	ERROR_HANDLE_PTR_RETURN_INT(queue->paths, "change_queue_init(): Unable to allocate the path index\n");
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	return 0;
+}
+
+/**
+ * @brief Function that inserts a change in the heap, growing it if needed.
+ * 
+ * @return int		0 if the change was inserted, -1 otherwise.
+ */
+static int heap_insert(change_queue_t *queue, change_t *change) {
+	if (queue->count == queue->capacity) {
+		change_t **heap = realloc(queue->heap, queue->capacity * 2 * sizeof(change_t*));
+		if (heap == NULL)
+			return -1;
+		queue->heap = heap;
+		queue->capacity *= 2;
+	}
+	queue->heap[queue->count++] = change;
+	heap_sift_up(queue, queue->count - 1);
+	return 0;
+}
+
+/**
+ * @brief Function that removes a change from the deferred list (the caller owns the change).
+ * 
+ * @return void
+ */
+static void deferred_remove(change_queue_t *queue, change_t *change) {
+	if (change->prev != NULL)
+		change->prev->next = change->next;
+	else
+		queue->deferred = change->next;
+	if (change->next != NULL)
+		change->next->prev = change->prev;
+	change->next = NULL;
+	change->prev = NULL;
+	queue->deferred_count--;
+}
+
+/**
+ * @brief Function that inserts a change in the deferred list, sorted by retry time.
+ * 
+ * @return void
+ */
+static void deferred_insert(change_queue_t *queue, change_t *change) {
+	change_t *prev = NULL;
+	change_t *next = queue->deferred;
+	while (next != NULL && next->retry_time <= change->retry_time) {
+		prev = next;
+		next = next->next;
+	}
+	change->prev = prev;
+	change->next = next;
+	if (prev != NULL)
+		prev->next = change;
+	else
+		queue->deferred = change;
+	if (next != NULL)
+		next->prev = change;
+	queue->deferred_count++;
+}
+
+/**
+ * @brief Function that replaces the leading directory (or file) of a path after a rename.
+ * Example: ("dir/sub/file.txt", "dir", "new") -> "new/sub/file.txt"
+ * 
+ * @param path		Path to update (reallocated).
+ * @param old_path	Old path of the renamed entry.
+ * @param new_path	New path of the renamed entry.
+ * 
+ * @return int		0 if the path was updated, -1 otherwise.
+ */
+static int path_rename(char **path, const char *old_path, const char *new_path) {
+	const char *rest = *path + strlen(old_path);
+	char *renamed = malloc(strlen(new_path) + strlen(rest) + 1);
+	if (renamed == NULL)
+		return -1;
+	sprintf(renamed, "%s%s", new_path, rest);
+	free(*path);
+	*path = renamed;
+	return 0;
+}
+
+/**
+ * @brief Function that applies a rename or a deletion that is being sent to the deferred changes.
+ * Deferred changes are always older than it, so they follow the file to its new path
+ * or are dropped with it.
+ * 
+ * @param queue		The change queue (locked).
+ * @param change	The rename or deletion.
+ * 
+ * @return void
+ */
+static void deferred_follow(change_queue_t *queue, change_t *change) {
+	if (queue->deferred == NULL)
+		return;
+	int count = index_find(queue, change->filepath);
+	if (count == -1) {
+		WARNING_PRINT("change_queue_pop(): Unable to find the deferred changes under '%s'\n", change->filepath);
+		return;
+	}
+	int i;
+	for (i = 0; i < count; i++) {
+		change_t *deferred = queue->matches[i];
+		if (deferred->heap_index != -1 || !paths_related(deferred->filepath, change->filepath) || strlen(deferred->filepath) < strlen(change->filepath))
+			continue;
+		index_remove(queue, deferred);
+		if (change->action == FILE_DELETED) {
+			DEBUG_PRINT("change_queue_pop(): Deferred content of '%s' dropped\n", deferred->filepath);
+			deferred_remove(queue, deferred);
+			change_free(deferred);
+			continue;
+		}
+		if (change->action == FILE_RENAMED && path_rename(&deferred->filepath, change->filepath, change->new_filepath) == -1)
+			WARNING_PRINT("change_queue_pop(): Unable to follow the rename of '%s'\n", deferred->filepath);
+		if (index_add(queue, deferred) == -1)
+			WARNING_PRINT("change_queue_pop(): Unable to index the deferred change of '%s'\n", deferred->filepath);
+	}
+}
+
+/**
+ * @brief Function that queues a change to send to the server.
+ * Changes on the same path (or a parent directory) keep their relative order,
+ * a content change already queued for the path absorbs a new one,
+ * and a deletion drops the content change queued for the path.
+ * 
+ * @param queue			The change queue.
+ * @param action		Action that was done on the file.
+ * @param filepath		Path of the file (relative to the directory).
+ * @param new_filepath	New path of the file (NULL if the action isn't FILE_RENAMED).
+ * @param size			Size of the payload (0 for metadata operations).
+ * @param writer_closed	1 if the event says the writer closed the file (the content is complete).
+ * 
+ * @return int			0 if the change was queued, -1 otherwise.
+ */
+int change_queue_push(change_queue_t *queue, message_type_t action, const char *filepath, const char *new_filepath, size_t size, int writer_closed) {
+	long long now = get_time_ms();
+	long long key = now + change_delay(queue, action, filepath, size);
+	int is_content = (action == FILE_CREATED || action == FILE_MODIFIED);
+	int i;
+	int r;
+
+	pthread_mutex_lock(&queue->mutex);
+
+	// Find the last queued or deferred change touching the path (with the path index)
+	change_t *previous = NULL;
+	int count = index_find(queue, filepath);
+	if (count == -1) {
+		pthread_mutex_unlock(&queue->mutex);
+		ERROR_HANDLE_INT_RETURN_INT(count, "change_queue_push(): Unable to find the changes queued for '%s'\n", filepath);
+	}
+	for (i = 0; i < count; i++) {
+		if (previous == NULL || queue->matches[i]->sequence > previous->sequence)
+			previous = queue->matches[i];
+	}
+
+	// If it's a content change of the same file, it will send the latest content anyway
+	if (previous != NULL && (previous->action == FILE_CREATED || previous->action == FILE_MODIFIED) && strcmp(previous->filepath, filepath) == 0) {
+		if (is_content) {
+			previous->size = size;
+			previous->writer_closed = writer_closed;
+
+			// A closed file doesn't need to wait anymore
+			int code = 0;
+			if (previous->heap_index == -1 && writer_closed) {
+				deferred_remove(queue, previous);
+				previous->backoff_ms = 0;
+				code = heap_insert(queue, previous);
+				if (code == -1) deferred_insert(queue, previous);
+				pthread_cond_signal(&queue->cond);
+			}
+			queue_update_metrics(queue);
+			pthread_mutex_unlock(&queue->mutex);
+			WARNING_HANDLE_INT(code, "change_queue_push(): Unable to wake up the deferred change of '%s'\n", filepath);
+			DEBUG_PRINT("change_queue_push(): Change of '%s' merged with the queued one\n", filepath);
+			return 0;
+		}
+		if (action == FILE_DELETED) {
+			if (previous->heap_index != -1)
+				heap_remove(queue, previous->heap_index);
+			else
+				deferred_remove(queue, previous);
+			index_remove(queue, previous);
+			change_free(previous);
+			DEBUG_PRINT("change_queue_push(): Queued content of '%s' dropped\n", filepath);
+		}
+	}
+
+	// Keep the order of the changes on related paths (the deferred ones get a new key when they come back)
+	const char *related[2] = { filepath, new_filepath };
+	for (r = 0; r < 2 && related[r] != NULL && count != -1; r++) {
+		count = index_find(queue, related[r]);
+		for (i = 0; i < count; i++) {
+			change_t *queued = queue->matches[i];
+			if (queued->heap_index != -1 && queued->key > key)
+				key = queued->key;
+		}
+	}
+
+	// Create the change
+	change_t *change = (count == -1) ? NULL : calloc(1, sizeof(change_t));
+	int code = (change == NULL) ? -1 : 0;
+	if (code == 0) {
+		change->action = action;
+		change->filepath = strdup(filepath);
+		change->new_filepath = (new_filepath != NULL) ? strdup(new_filepath) : NULL;
+		change->size = size;
+		change->enqueue_time = now;
+		change->key = key;
+		change->sequence = queue->next_sequence++;
+		change->writer_closed = writer_closed;
+		change->heap_index = -1;
+		if (change->filepath == NULL || (new_filepath != NULL && change->new_filepath == NULL))
+			code = -1;
+	}
+
+	// Index the change, insert it and wake up the sender
+	if (code == 0)
+		code = index_add(queue, change);
+	if (code == 0) {
+		code = heap_insert(queue, change);
+		if (code == -1)
+			index_remove(queue, change);
+	}
+	if (code == 0)
+		pthread_cond_signal(&queue->cond);
+	queue_update_metrics(queue);
+	pthread_mutex_unlock(&queue->mutex);
+	if (code == -1) change_free(change);
+	ERROR_HANDLE_INT_RETURN_INT(code, "change_queue_push(): Unable to queue the change of '%s'\n", filepath);
+	return 0;
+}
+
+/**
+ * @brief Function that waits for a change to be queued, at most the given time.
+ * 
+ * @param queue		The change queue (locked).
+ * @param delay_ms	Maximum time to wait (ms).
+ * 
+ * @return void
+ */
+static void queue_wait_ms(change_queue_t *queue, long long delay_ms) {
+	#ifdef _WIN32
+		pthread_cond_timedwait(&queue->cond, &queue->mutex, (DWORD)delay_ms);
+	#else
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += delay_ms / 1000;
+		deadline.tv_nsec += (delay_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&queue->cond, &queue->mutex, &deadline);
+	#endif
+}
+
+/**
+ * @brief Function that takes the next change to send, waiting until there is one.
+ * Deferred changes come back in the queue (with their original priority) when their retry time is reached.
+ * 
+ * @param queue		The change queue.
+ * 
+ * @return change_t*	The change (free it with change_free(), or give it back with change_queue_defer()).
+ */
+change_t* change_queue_pop(change_queue_t *queue) {
+	pthread_mutex_lock(&queue->mutex);
+	while (1) {
+
+		// Move the deferred changes that are due back to the heap
+		long long now = get_time_ms();
+		while (queue->deferred != NULL && queue->deferred->retry_time <= now) {
+			change_t *due = queue->deferred;
+			deferred_remove(queue, due);
+			if (heap_insert(queue, due) == -1) {
+				due->retry_time = now + due->backoff_ms;
+				deferred_insert(queue, due);
+				break;
+			}
+		}
+
+		// Take the best change
+		if (queue->count > 0)
+			break;
+
+		// Else, wait for a new change or the next deferred one
+		if (queue->deferred != NULL)
+			queue_wait_ms(queue, queue->deferred->retry_time - now);
+		else
+			pthread_cond_wait(&queue->cond, &queue->mutex);
+	}
+	change_t *change = heap_remove(queue, 0);
+	index_remove(queue, change);
+	if (change->action == FILE_DELETED || change->action == FILE_RENAMED)
+		deferred_follow(queue, change);
+	queue_update_metrics(queue);
+	pthread_mutex_unlock(&queue->mutex);
+	return change;
+}
+
+/**
+ * @brief Function that parks a change whose file isn't ready yet, without blocking the other changes.
+ * 
+ * @param queue		The change queue.
+ * @param change	The change (taken from change_queue_pop()).
+ * @param delay_ms	Time before the change comes back in the queue (ms).
+ * 
+ * @return void
+ */
+void change_queue_defer(change_queue_t *queue, change_t *change, long long delay_ms) {
+	pthread_mutex_lock(&queue->mutex);
+	change->retry_time = get_time_ms() + delay_ms;
+	deferred_insert(queue, change);
+	int code = index_add(queue, change);
+	WARNING_HANDLE_INT(code, "change_queue_defer(): Unable to index the deferred change of '%s'\n", change->filepath);
+	queue_update_metrics(queue);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * @brief Function that frees a change.
+ * 
+ * @param change	The change (NULL is ignored).
+ * 
+ * @return void
+ */
+void change_free(change_t *change) {
+	if (change == NULL)
+		return;
+	free(change->filepath);
+	free(change->new_filepath);
+	free(change);
+}
+
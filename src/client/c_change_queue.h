@@ -0,0 +1,88 @@
+
+#ifndef __CLIENT_CHANGE_QUEUE_H__
+#define __CLIENT_CHANGE_QUEUE_H__
+
+#include "../universal_pthread.h"
+#include "../network/net_utils.h"
+#include "../config_manager.h"
+
+#define CHANGE_QUEUE_DEFAULT_BYTES_PER_MS 10000		// 1 ms of delay per 10 KB (1 GB waits at most the max delay)
+#define CHANGE_QUEUE_DEFAULT_MAX_DELAY_MS 10000		// Ageing: a large file never waits more than 10 s behind new small ones
+#define CHANGE_QUEUE_DEFAULT_CLASS_STEP_MS 1000
+
+// Structure of a change waiting to be sent to the server
+typedef struct change_t {
+	message_type_t action;
+	char *filepath;					// Path of the file (relative to the directory)
+	char *new_filepath;				// New path of the file (NULL if the action isn't FILE_RENAMED)
+	size_t size;					// Size of the payload (0 for metadata operations)
+	long long enqueue_time;			// Time when the change was queued (ms)
+	long long key;					// Scheduling key, lowest first (enqueue time + delay of the change)
+	unsigned long sequence;			// Arrival order (breaks ties between equal keys)
+
+	// Readiness of the file (content changes only)
+	int writer_closed;				// 1 if the last writer closed the file (nothing more to wait for)
+	size_t observed_size;			// Size seen at the last readiness check
+	long long observed_mtime;		// Modification time seen at the last readiness check (ns)
+	long long backoff_ms;			// Delay before the next readiness check
+	long long retry_time;			// Time of the next readiness check (ms)
+	struct change_t *next;			// Neighbours in the deferred list
+	struct change_t *prev;
+
+	// Position in the queue
+	int heap_index;					// Index in the heap, -1 if the change isn't in it
+	struct change_link_t *links;	// Links in the path index (NULL if the change isn't indexed)
+	unsigned long lookup_stamp;		// Last lookup of the index that found the change
+} change_t;
+
+// Path of the index of the queued changes
+typedef struct change_path_t {
+	struct change_path_t *next;		// Next path of the bucket
+	unsigned long long path_hash;
+	struct change_link_t *on;		// Changes on this path (path or new path)
+	struct change_link_t *under;	// Changes on a path under this directory
+	size_t path_length;
+	char path[];
+} change_path_t;
+
+// Link of a change in a list of a path of the index
+typedef struct change_link_t {
+	struct change_link_t *next;		// Neighbours in the list of the path
+	struct change_link_t *prev;
+	struct change_link_t *sibling;	// Next link of the same change
+	change_path_t *path;
+	change_t *change;
+	int under;						// 1 if the link is in the 'under' list of the path
+} change_link_t;
+
+// Structure of the outbound change queue (min-heap on the scheduling key)
+typedef struct change_queue_t {
+	change_t **heap;
+	int count;
+	int capacity;
+	change_t *deferred;				// Changes whose file isn't ready yet, sorted by retry time
+	int deferred_count;
+	change_path_t **paths;			// Index of the queued and deferred changes by path (buckets)
+	size_t paths_buckets_count;		// Power of two
+	size_t paths_count;
+	change_t **matches;				// Changes found by the last lookup of the index
+	size_t matches_capacity;
+	unsigned long lookup_stamp;
+	unsigned long next_sequence;
+	long long bytes_per_ms;
+	long long max_delay_ms;
+	long long class_step_ms;
+	config_t *config;				// Priority classes
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} change_queue_t;
+
+// Function prototypes
+int change_queue_init(change_queue_t *queue, config_t *config);
+int change_queue_push(change_queue_t *queue, message_type_t action, const char *filepath, const char *new_filepath, size_t size, int writer_closed);
+change_t* change_queue_pop(change_queue_t *queue);
+void change_queue_defer(change_queue_t *queue, change_t *change, long long delay_ms);
+void change_free(change_t *change);
+
+#endif
+
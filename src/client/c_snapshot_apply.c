@@ -0,0 +1,406 @@
+
+#ifndef _WIN32
+	#define _GNU_SOURCE
+#endif
+
+#include "c_snapshot_apply.h"
+#include "../staged_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Function that creates a directory, and its parents if they are missing.
+ * 
+ * @param path	Full path of the directory.
+ * @param mode	Permissions of the directory (0 for the default).
+ * 
+ * @return int	0 if the directory exists, -1 otherwise.
+ */
+static int snapshot_apply_mkdir(char *path, unsigned int mode) {
+	char *separator;
+	mode = (mode == 0 ? 0755 : mode) | 0700;		// The content is written right after
+	#ifdef _WIN32
+		int code = mkdir(path);
+	#else
+		int code = mkdir(path, (mode_t)mode);
+	#endif
+	if (code == -1 && errno == ENOENT) {
+
+		// Create the missing parents one by one
+		for (separator = strchr(path + 1, '/'); separator != NULL; separator = strchr(separator + 1, '/')) {
+			*separator = '\0';
+			#ifdef _WIN32
+				mkdir(path);
+			#else
+				mkdir(path, 0755);
+			#endif
+			*separator = '/';
+		}
+		#ifdef _WIN32
+			code = mkdir(path);
+		#else
+			code = mkdir(path, (mode_t)mode);
+		#endif
+	}
+	if (code == -1 && errno == EEXIST)
+		code = 0;
+	if (code == 0)
+		errno = 0;
+	return code;
+}
+
+/**
+ * @brief Function that creates the directories waiting in the batch.
+ * 
+ * @param apply	The application of the snapshot.
+ * 
+ * @return int	0 if success, -1 if a directory couldn't be created.
+ */
+static int snapshot_apply_flush_directories(snapshot_apply_t *apply) {
+	int i;
+	int code = 0;
+	for (i = 0; i < apply->directories_count; i++) {
+		if (code == 0) {
+			code = snapshot_apply_mkdir(apply->directories[i], apply->directories_mode[i]);
+			WARNING_HANDLE_INT(code, "snapshot_apply_flush_directories(): Unable to create the directory '%s'\n", apply->directories[i]);
+			if (code == 0)
+				apply->directories_created++;
+		}
+		free(apply->directories[i]);
+	}
+	apply->directories_count = 0;
+	return code;
+}
+
+/**
+ * @brief Function that frees a job and its remaining segments.
+ * 
+ * @param job	The job.
+ * 
+ * @return void
+ */
+static void apply_job_free(apply_job_t *job) {
+	while (job->head != NULL) {
+		apply_segment_t *segment = job->head;
+		job->head = segment->next;
+		free(segment);
+	}
+	free(job);
+}
+
+/**
+ * @brief Function that takes the next segment of a job, waiting for the decoder if needed.
+ * 
+ * @param apply	The application of the snapshot.
+ * @param job	The job being written.
+ * 
+ * @return apply_segment_t*	The segment (to free), NULL once the file is complete.
+ */
+static apply_segment_t* snapshot_apply_next_segment(snapshot_apply_t *apply, apply_job_t *job) {
+	pthread_mutex_lock(&apply->mutex);
+	while (job->head == NULL && !job->complete && !apply->stop)
+		pthread_cond_wait(&apply->cond, &apply->mutex);
+	apply_segment_t *segment = job->head;
+	if (segment != NULL) {
+		job->head = segment->next;
+		if (job->head == NULL)
+			job->tail = NULL;
+		apply->queued -= segment->size;
+		pthread_cond_broadcast(&apply->cond);
+	}
+	pthread_mutex_unlock(&apply->mutex);
+	return segment;
+}
+
+/**
+ * @brief Function that writes a file of the snapshot and publishes it with its permissions and modification time.
+ * The segments are consumed even if the file can't be written, so the decoder never waits for them.
+ * 
+ * @param apply	The application of the snapshot.
+ * @param job	The job to write.
+ * 
+ * @return int	0 if the file is published, -1 otherwise.
+ */
+static int snapshot_apply_write(snapshot_apply_t *apply, apply_job_t *job) {
+	staged_file_t staged;
+	int opened = staged_file_open(&staged, job->path, (size_t)job->record.size, NULL) == 0;
+	int code = opened ? 0 : -1;
+	WARNING_HANDLE_INT(code, "snapshot_apply_write(): Unable to create '%s'\n", job->path);
+	apply_segment_t *segment;
+	while ((segment = snapshot_apply_next_segment(apply, job)) != NULL) {
+		if (code == 0) {
+			code = staged_file_write(&staged, segment->data, segment->size);
+			WARNING_HANDLE_INT(code, "snapshot_apply_write(): Unable to write '%s'\n", job->path);
+		}
+		free(segment);
+	}
+	if (code == -1 || !job->complete) {
+		if (opened) staged_file_abort(&staged);
+		return -1;
+	}
+
+	// Keep the metadata of the server (applied before the publication, so the file never appears with the wrong ones)
+	staged_file_set_metadata(&staged, job->record.mode, job->record.mtime_ns);
+	code = staged_file_commit(&staged);
+	WARNING_HANDLE_INT(code, "snapshot_apply_write(): Unable to publish '%s'\n", job->path);
+	if (code == 0) {
+		__sync_fetch_and_add(&apply->files, 1);
+		__sync_fetch_and_add(&apply->bytes, (long long)job->record.size);
+	}
+	return code;
+}
+
+/**
+ * @brief Function run by the writers: takes the files in the order of the snapshot and writes them.
+ * 
+ * @param arg	The application of the snapshot.
+ * 
+ * @return thread_return_type	0
+ */
+static thread_return_type snapshot_apply_worker(thread_param_type arg) {
+	snapshot_apply_t *apply = (snapshot_apply_t*)arg;
+	while (1) {
+
+		// Wait for the next file
+		pthread_mutex_lock(&apply->mutex);
+		while (apply->head == NULL && !apply->stop)
+			pthread_cond_wait(&apply->cond, &apply->mutex);
+		apply_job_t *job = apply->head;
+		if (job == NULL) {
+			pthread_mutex_unlock(&apply->mutex);
+			break;
+		}
+		apply->head = job->next;
+		if (apply->head == NULL)
+			apply->tail = NULL;
+		pthread_mutex_unlock(&apply->mutex);
+
+		// Write it
+		if (snapshot_apply_write(apply, job) == -1)
+			__sync_fetch_and_add(&apply->errors, 1);
+		apply_job_free(job);
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that hands the segment being filled to the writer of the current file.
+ * The decoder waits while too much content is queued, so a slow disk slows the reception down instead of filling the memory.
+ * 
+ * @param apply	The application of the snapshot.
+ * 
+ * @return void
+ */
+static void snapshot_apply_push_segment(snapshot_apply_t *apply) {
+	apply_segment_t *segment = apply->segment;
+	apply->segment = NULL;
+	apply_job_t *job = apply->current;
+	pthread_mutex_lock(&apply->mutex);
+	while (apply->queued >= SNAPSHOT_APPLY_MAX_QUEUED)
+		pthread_cond_wait(&apply->cond, &apply->mutex);
+	if (job->tail == NULL)
+		job->head = segment;
+	else
+		job->tail->next = segment;
+	job->tail = segment;
+	apply->queued += segment->size;
+	pthread_cond_broadcast(&apply->cond);
+	pthread_mutex_unlock(&apply->mutex);
+}
+
+/**
+ * @brief Decoder handler: queues a directory to create.
+ * 
+ * @param record	The record of the directory.
+ * @param path		Path relative to the synchronized directory.
+ * @param arg		The application of the snapshot.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+static int snapshot_apply_on_directory(const snapshot_record_t *record, const char *path, void *arg) {
+	snapshot_apply_t *apply = (snapshot_apply_t*)arg;
+	if (apply->directories_count == SNAPSHOT_APPLY_DIRECTORY_BATCH && snapshot_apply_flush_directories(apply) == -1)
+		return -1;
+	char *full_path = malloc(strlen(apply->root) + strlen(path) + 1);
+	ERROR_HANDLE_PTR_RETURN_INT(full_path, "snapshot_apply_on_directory(): Unable to allocate the path of '%s'\n", path);
+	sprintf(full_path, "%s%s", apply->root, path);
+	apply->directories[apply->directories_count] = full_path;
+	apply->directories_mode[apply->directories_count] = record->mode;
+	apply->directories_count++;
+	return 0;
+}
+
+/**
+ * @brief Decoder handler: queues a new file for the writers (its directory is created first).
+ * 
+ * @param record	The record of the file.
+ * @param path		Path relative to the synchronized directory.
+ * @param arg		The application of the snapshot.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+static int snapshot_apply_on_file_begin(const snapshot_record_t *record, const char *path, void *arg) {
+	snapshot_apply_t *apply = (snapshot_apply_t*)arg;
+	if (apply->errors > 0 || snapshot_apply_flush_directories(apply) == -1)
+		return -1;
+	apply_job_t *job = calloc(1, sizeof(apply_job_t) + strlen(apply->root) + strlen(path) + 1);
+	ERROR_HANDLE_PTR_RETURN_INT(job, "snapshot_apply_on_file_begin(): Unable to allocate the job of '%s'\n", path);
+	job->record = *record;
+	sprintf(job->path, "%s%s", apply->root, path);
+	apply->current = job;
+
+	// Queue it now, so the staging file is created and preallocated while the content arrives
+	pthread_mutex_lock(&apply->mutex);
+	if (apply->tail == NULL)
+		apply->head = job;
+	else
+		apply->tail->next = job;
+	apply->tail = job;
+	pthread_cond_broadcast(&apply->cond);
+	pthread_mutex_unlock(&apply->mutex);
+	return 0;
+}
+
+/**
+ * @brief Decoder handler: copies content of the current file into segments for its writer.
+ * 
+ * @param data	Part of the content.
+ * @param size	Number of bytes.
+ * @param arg	The application of the snapshot.
+ * 
+ * @return int	0 if success, -1 otherwise.
+ */
+static int snapshot_apply_on_file_data(const byte *data, size_t size, void *arg) {
+	snapshot_apply_t *apply = (snapshot_apply_t*)arg;
+	while (size > 0) {
+		if (apply->segment == NULL) {
+			apply->segment = malloc(sizeof(apply_segment_t) + SNAPSHOT_APPLY_SEGMENT_SIZE);
+			ERROR_HANDLE_PTR_RETURN_INT(apply->segment, "snapshot_apply_on_file_data(): Unable to allocate a segment\n");
+			apply->segment->next = NULL;
+			apply->segment->size = 0;
+		}
+		size_t chunk = SNAPSHOT_APPLY_SEGMENT_SIZE - apply->segment->size;
+		if (chunk > size) chunk = size;
+		memcpy(apply->segment->data + apply->segment->size, data, chunk);
+		apply->segment->size += chunk;
+		data += chunk;
+		size -= chunk;
+		if (apply->segment->size == SNAPSHOT_APPLY_SEGMENT_SIZE)
+			snapshot_apply_push_segment(apply);
+	}
+	return 0;
+}
+
+/**
+ * @brief Decoder handler: marks the current file as complete.
+ * 
+ * @param arg	The application of the snapshot.
+ * 
+ * @return int	0
+ */
+static int snapshot_apply_on_file_end(void *arg) {
+	snapshot_apply_t *apply = (snapshot_apply_t*)arg;
+	if (apply->segment != NULL)
+		snapshot_apply_push_segment(apply);
+	pthread_mutex_lock(&apply->mutex);
+	apply->current->complete = 1;
+	apply->current = NULL;
+	pthread_cond_broadcast(&apply->cond);
+	pthread_mutex_unlock(&apply->mutex);
+	return 0;
+}
+
+/**
+ * @brief Function that starts the writers applying a snapshot to a directory.
+ * The snapshot is then given to snapshot_apply_feed() as it's received, and snapshot_apply_finish() waits for the writers.
+ * 
+ * @param apply		The application of the snapshot.
+ * @param root		The synchronized directory (ending with a '/').
+ * @param threads	Number of writers (0 for one per CPU).
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+int snapshot_apply_start(snapshot_apply_t *apply, const char *root, int threads) {
+	int i;
+	memset(apply, 0, sizeof(snapshot_apply_t));
+	int code = strlen(root) < SNAPSHOT_MAX_PATH ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "snapshot_apply_start(): Path of the directory too long\n");
+	strcpy(apply->root, root);
+	snapshot_decoder_init(&apply->decoder, snapshot_apply_on_directory, snapshot_apply_on_file_begin, snapshot_apply_on_file_data, snapshot_apply_on_file_end, apply);
+	pthread_mutex_init(&apply->mutex, NULL);
+	pthread_cond_init(&apply->cond, NULL);
+
+	// Start the writers
+	if (threads <= 0) {
+		#ifdef _WIN32
+			threads = 4;
+		#else
+			threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		#endif
+	}
+	threads = threads < 1 ? 1 : (threads > SNAPSHOT_APPLY_MAX_THREADS ? SNAPSHOT_APPLY_MAX_THREADS : threads);
+	for (i = 0; i < threads; i++) {
+		code = pthread_create(&apply->workers[i], NULL, snapshot_apply_worker, apply) == 0 ? 0 : -1;
+		if (code == -1) snapshot_apply_finish(apply);
+		ERROR_HANDLE_INT_RETURN_INT(code, "snapshot_apply_start(): Unable to start the writers\n");
+		apply->threads++;
+	}
+	DEBUG_PRINT("snapshot_apply_start(): %d writers started\n", apply->threads);
+	return 0;
+}
+
+/**
+ * @brief Function that gives the next decrypted bytes of the snapshot to the writers.
+ * 
+ * @param apply	The application of the snapshot.
+ * @param data	Next bytes of the snapshot.
+ * @param size	Number of bytes.
+ * 
+ * @return int	0 if success, -1 if the snapshot is invalid or a file couldn't be written.
+ */
+int snapshot_apply_feed(snapshot_apply_t *apply, const byte *data, size_t size) {
+	return snapshot_decoder_feed(&apply->decoder, data, size);
+}
+
+/**
+ * @brief Function that waits for the writers and releases the application of the snapshot.
+ * 
+ * @param apply	The application of the snapshot.
+ * 
+ * @return int	0 if the whole snapshot is applied, -1 otherwise.
+ */
+int snapshot_apply_finish(snapshot_apply_t *apply) {
+	int i;
+	int code = snapshot_apply_flush_directories(apply);
+	int truncated = !snapshot_decoder_finished(&apply->decoder);
+
+	// A file interrupted in the middle is dropped by its writer
+	if (apply->segment != NULL)
+		snapshot_apply_push_segment(apply);
+
+	// Wait for the writers
+	pthread_mutex_lock(&apply->mutex);
+	apply->stop = 1;
+	pthread_cond_broadcast(&apply->cond);
+	pthread_mutex_unlock(&apply->mutex);
+	for (i = 0; i < apply->threads; i++)
+		pthread_join(apply->workers[i], NULL);
+
+	// Release the files never taken
+	while (apply->head != NULL) {
+		apply_job_t *job = apply->head;
+		apply->head = job->next;
+		apply_job_free(job);
+	}
+	pthread_cond_destroy(&apply->cond);
+	pthread_mutex_destroy(&apply->mutex);
+	code = (code == 0 && !truncated && apply->errors == 0) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "snapshot_apply_finish(): Snapshot not fully applied (%d errors%s)\n", apply->errors, truncated ? ", truncated" : "");
+	DEBUG_PRINT("snapshot_apply_finish(): %lld files (%lld bytes) and %lld directories written\n", apply->files, apply->bytes, apply->directories_created);
+	return 0;
+}
+
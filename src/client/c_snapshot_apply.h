@@ -0,0 +1,61 @@
+
+#ifndef __CLIENT_SNAPSHOT_APPLY_H__
+#define __CLIENT_SNAPSHOT_APPLY_H__
+
+#include "../universal_utils.h"
+#include "../universal_pthread.h"
+#include "../snapshot_stream.h"
+
+#define SNAPSHOT_APPLY_MAX_THREADS 32
+#define SNAPSHOT_APPLY_SEGMENT_SIZE (1024 * 1024)				// Content handed to a writer at once
+#define SNAPSHOT_APPLY_MAX_QUEUED (64 * 1024 * 1024)			// Content waiting for the writers (the reception waits above it)
+#define SNAPSHOT_APPLY_DIRECTORY_BATCH 256						// Directories created at once
+
+// Part of the content of a file, waiting for its writer
+typedef struct apply_segment_t {
+	struct apply_segment_t *next;
+	size_t size;
+	byte data[];
+} apply_segment_t;
+
+// File to write, taken by one writer and fed with segments while it's received
+typedef struct apply_job_t {
+	struct apply_job_t *next;					// Next job in the queue
+	snapshot_record_t record;
+	apply_segment_t *head;
+	apply_segment_t *tail;
+	int complete;								// 1 once every segment is queued
+	char path[];								// Full path of the file
+} apply_job_t;
+
+// Streaming application of a snapshot: the decoder (reception thread) queues the files,
+// a pool of writers publishes them while the rest of the snapshot is still being received
+typedef struct snapshot_apply_t {
+	char root[SNAPSHOT_MAX_PATH];				// The synchronized directory (ending with a '/')
+	snapshot_decoder_t decoder;					// Decoder of the received snapshot (run by the reception thread)
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;						// Signaled when a job or a segment is queued, or when the content queued decreases
+	apply_job_t *head;							// Jobs not taken by a writer yet
+	apply_job_t *tail;
+	apply_job_t *current;						// Job receiving the content being decoded
+	apply_segment_t *segment;					// Segment being filled by the decoder
+	size_t queued;								// Bytes of content queued for the writers
+	int stop;
+	int threads;
+	pthread_t workers[SNAPSHOT_APPLY_MAX_THREADS];
+	char *directories[SNAPSHOT_APPLY_DIRECTORY_BATCH];	// Directories waiting to be created
+	unsigned int directories_mode[SNAPSHOT_APPLY_DIRECTORY_BATCH];
+	int directories_count;
+	volatile long long files;
+	volatile long long directories_created;
+	volatile long long bytes;
+	volatile int errors;
+} snapshot_apply_t;
+
+// Function prototypes
+int snapshot_apply_start(snapshot_apply_t *apply, const char *root, int threads);
+int snapshot_apply_feed(snapshot_apply_t *apply, const byte *data, size_t size);
+int snapshot_apply_finish(snapshot_apply_t *apply);
+
+#endif
+
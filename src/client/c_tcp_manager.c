@@ -1,21 +1,93 @@
 
+#ifndef _WIN32
+	#define _GNU_SOURCE
+#endif
+
 #include "c_tcp_manager.h"
 #include "../file_watcher.h"
+#include "../metrics.h"
+#include "../hash_engine.h"
+#include "c_snapshot_apply.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 
 #ifdef _WIN32
+	#include <io.h>
 	int c_winsock_init = 0;
 #endif
 
-#define C_BUFFER_SIZE CS_BUFFER_SIZE
+#define C_BUFFER_SIZE ((ssize_t)g_client->config.transfer_buffer_size)
+#define C_READY_DEFAULT_SETTLE_MS 20		// Time without writes after which a file is considered complete
+#define C_READY_DEFAULT_TIMEOUT_MS 60000	// Time after which a file that is still not ready is sent (or dropped if unreadable)
+#define C_READY_MIN_BACKOFF_MS 5
+#define C_READY_MAX_BACKOFF_MS 1000
 
 // Global variables
 tcp_client_t *g_client;
 
+// Root watched by the current thread (the handlers of the watcher only get the paths)
+static __thread client_root_t *c_watched_root = NULL;
+
+/**
+ * @brief Function that sends the names of the roots of the client, the server answers with a snapshot for each one.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+static int send_sync_roots() {
+
+	// List the names, each one NUL terminated
+	char names[MAX_SYNC_ROOTS * sizeof(((sync_root_t*)0)->name)];
+	size_t size = 0;
+	int i;
+	for (i = 0; i < g_client->roots_count; i++) {
+		size_t length = strlen(g_client->roots[i].config->name) + 1;
+		memcpy(names + size, g_client->roots[i].config->name, length);
+		size += length;
+	}
+
+	// Send the request and the names
+	message_t message;
+	memset(&message, 0, sizeof(message_t));
+	message.type = SYNC_ROOTS;
+	message.size = size;
+	ENCRYPT_BYTES(&message, sizeof(message_t), g_client->config.password);
+	int code = socket_write(g_client->socket, &message, sizeof(message_t), 0) > 0 ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "send_sync_roots(): Unable to send the request\n");
+	ENCRYPT_BYTES(names, size, g_client->config.password);
+	code = socket_write_all(g_client->socket, names, size);
+	ERROR_HANDLE_INT_RETURN_INT(code, "send_sync_roots(): Unable to send the names of the roots\n");
+
+	// Send the transfer buffer size (the encryption restarts on each buffer, the server must use the same one)
+	size_t transfer_buffer_size = g_client->config.transfer_buffer_size;
+	ENCRYPT_BYTES(&transfer_buffer_size, sizeof(size_t), g_client->config.password);
+	code = socket_write_all(g_client->socket, &transfer_buffer_size, sizeof(size_t));
+	ERROR_HANDLE_INT_RETURN_INT(code, "send_sync_roots(): Unable to send the transfer buffer size\n");
+	metrics_add(METRIC_BYTES_SENT_WIRE, sizeof(message_t) + size + sizeof(size_t));
+	return 0;
+}
+
+/**
+ * @brief Function that gives the local path of a file from its path prefixed with its root (config_root_path()).
+ * 
+ * @param root_path		Path of the file prefixed with its root.
+ * @param real_filepath	Filled with the path of the file on the disk.
+ * @param size			Size of real_filepath.
+ * 
+ * @return int			0 if success, -1 if the root is unknown or the path too long.
+ */
+static int client_real_path(const char *root_path, char *real_filepath, size_t size) {
+	const char *path;
+	const sync_root_t *root = config_find_root(&g_client->config, root_path, &path);
+	if (root == NULL)
+		return -1;
+	int length = snprintf(real_filepath, size, "%s%s", root->directory, path);
+	return (length < 0 || (size_t)length >= size) ? -1 : 0;
+}
+
 /**
  * @brief Function that sets up the TCP client.
  * 
@@ -34,6 +106,15 @@ int setup_tcp_client(config_t config, tcp_client_t *tcp_client) {
 	// Fill the TCP client structure
 	memset(tcp_client, 0, sizeof(tcp_client_t));
 	tcp_client->config = config;
+	if (config.transfer_buffer_size == 0)
+		config.transfer_buffer_size = tcp_client->config.transfer_buffer_size = CONFIG_DEFAULT_TRANSFER_BUFFER_SIZE;
+
+	// Apply the logger settings
+	log_configure(config.log_levels, config.log_rate_limit);
+
+	// Initialize the I/O buffer pool
+	code = buffer_pool_init(config.buffer_classes, config.buffer_classes_count, config.buffer_thread_cache);
+	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_client(): Unable to initialize the buffer pool\n");
 
 	// Init Winsock if needed
 	#ifdef _WIN32
@@ -49,6 +130,10 @@ int setup_tcp_client(config_t config, tcp_client_t *tcp_client) {
 
 	// Init mutex
 	pthread_mutex_init(&tcp_client->mutex, NULL);
+
+	// Init the outbound change queue
+	code = change_queue_init(&tcp_client->queue, &tcp_client->config);
+	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_client(): Unable to init the change queue\n");
 	
 	// Create the TCP socket
 	tcp_client->socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -56,6 +141,9 @@ int setup_tcp_client(config_t config, tcp_client_t *tcp_client) {
 	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_client(): Unable to create the socket\n");
 	DEBUG_PRINT("setup_tcp_client(): Socket created\n");
 
+	code = set_socket_options(tcp_client->socket, config.socket_send_buffer, config.socket_recv_buffer, config.tcp_nodelay);
+	WARNING_HANDLE_INT(code, "setup_tcp_client(): Unable to apply the socket options\n");
+
 	// Connect to the server
 	client_addr.sin_family = AF_INET;
 	client_addr.sin_addr.s_addr = inet_addr(config.ip);
@@ -64,10 +152,29 @@ int setup_tcp_client(config_t config, tcp_client_t *tcp_client) {
 	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_client(): Unable to connect to the server\n");
 	DEBUG_PRINT("setup_tcp_client(): Connected to the server\n");
 
-	// Receive the zip file
+	// Ask for the roots, in the order of the config
 	g_client = tcp_client;
-	code = getAllDirectoryFiles();
-	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_client(): Failed to receive the zip file\n");
+	code = config.roots_count > 0 ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_client(): No directory to synchronize\n");
+	tcp_client->roots = calloc(config.roots_count, sizeof(client_root_t));
+	ERROR_HANDLE_PTR_RETURN_INT(tcp_client->roots, "setup_tcp_client(): Unable to allocate the roots\n");
+	int i;
+	for (i = 0; i < config.roots_count; i++)
+		tcp_client->roots[i].config = &tcp_client->config.roots[i];
+	tcp_client->roots_count = config.roots_count;
+	code = send_sync_roots();
+	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_client(): Unable to ask for the roots\n");
+
+	// Receive the files of each root on the same connection
+	for (i = 0; i < tcp_client->roots_count; i++) {
+		client_root_t *root = &tcp_client->roots[i];
+		code = getAllDirectoryFiles(root);
+		ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_client(): Failed to receive the files of '%s'\n", root->config->directory);
+
+		// Compile the patterns of the paths that are never synchronized (after the initial sync, which can bring the .syncignore file)
+		code = sync_ignore_load(&root->ignore, root->config->directory);
+		ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_client(): Unable to load the ignore patterns of '%s'\n", root->config->directory);
+	}
 
 	// Info print
 	INFO_PRINT("setup_tcp_client(): Client setup successfully\n");
@@ -85,20 +192,24 @@ int setup_tcp_client(config_t config, tcp_client_t *tcp_client) {
  */
 int tcp_client_run(tcp_client_t *tcp_client) {
 
+	// Expose the metrics if configured
+	int code = metrics_start_exporter(tcp_client->config.metrics_port, tcp_client->config.metrics_socket);
+	WARNING_HANDLE_INT(code, "tcp_client_run(): Metrics are not exposed\n");
+
 	// Create the thread that will handle the connection with the server
 	pthread_create(&tcp_client->thread, NULL, tcp_client_thread, NULL);
 
-	// Monitor the directory
-	int code = monitor_directory(
-		tcp_client->config.directory,
-		on_client_file_created,
-		on_client_file_modified,
-		on_client_file_deleted,
-		on_client_file_renamed
-	);
-	ERROR_HANDLE_INT_RETURN_INT(code, "main(): Failed to monitor the directory\n");
+	// Create the thread that will send the queued changes (of every root)
+	pthread_create(&tcp_client->sender_thread, NULL, tcp_client_sender_thread, NULL);
 
-	// Wait for the thread to end
+	// Monitor the directories, a watcher per root
+	int i;
+	for (i = 0; i < tcp_client->roots_count; i++)
+		pthread_create(&tcp_client->roots[i].watcher_thread, NULL, tcp_client_watcher_thread, &tcp_client->roots[i]);
+
+	// Wait for the threads to end
+	for (i = 0; i < tcp_client->roots_count; i++)
+		pthread_join(tcp_client->roots[i].watcher_thread, NULL);
 	pthread_join(tcp_client->thread, NULL);
 
 	// Return
@@ -127,93 +238,325 @@ thread_return_type tcp_client_thread(thread_param_type arg) {
 	memset(&message, 0, sizeof(message_t));
 
 	// TODO : Receive directory changes from the server
-	while (1);
+	// Until then, the thread sleeps in the read, which only returns when the server closes the connection
+	while (socket_read(g_client->socket, &message, sizeof(message_t), MSG_WAITALL) == (ssize_t)sizeof(message_t)) {
+		DECRYPT_BYTES(&message, sizeof(message_t), g_client->config.password);
+		WARNING_PRINT("tcp_client_thread(): Ignoring message %d from the server\n", message.type);
+	}
+	errno = 0;
+	WARNING_PRINT("tcp_client_thread(): Disconnected from the server\n");
 
-	// Disconnect from the server
-	memset(&message, 0, sizeof(message_t));
-	message.type = DISCONNECT;
-	ENCRYPT_BYTES(&message, sizeof(message_t), g_client->config.password);
-	code = socket_write(g_client->socket, &message, sizeof(message_t), 0) > 0 ? 0 : -1;
+	// Close the socket and return
+	socket_close(g_client->socket);
+	return 0;
+}
+
+/**
+ * @brief Function that watches the directory of a root and queues its changes.
+ * 
+ * @param arg The client_root_t to watch.
+ * 
+ * @return thread_return_type		0 when the watcher stops.
+ */
+thread_return_type tcp_client_watcher_thread(thread_param_type arg) {
+	c_watched_root = (client_root_t*)arg;
+	int code = monitor_directory(
+		c_watched_root->config->directory,
+		on_client_file_created,
+		on_client_file_modified,
+		on_client_file_closed,
+		on_client_file_deleted,
+		on_client_file_renamed,
+		&c_watched_root->ignore
+	);
+	WARNING_HANDLE_INT(code, "tcp_client_watcher_thread(): The changes of '%s' are not synchronized anymore\n", c_watched_root->config->directory);
+	return 0;
+}
+
+/**
+ * @brief Function that checks if a file is ready to be sent:
+ * it can be opened, and either its writer closed it or it wasn't written for the settle time.
+ * Files still being written are retried right after the settle time, unreadable ones with an exponential backoff.
+ * 
+ * @param change	The content change (its size and readiness state are updated).
+ * 
+ * @return long long	0 if the file is ready, the delay before the next check (ms), or -1 if the change must be dropped.
+ */
+static long long client_file_ready_delay(change_t *change) {
+	long long settle_ms = g_client->config.readiness_settle_ms > 0 ? g_client->config.readiness_settle_ms : C_READY_DEFAULT_SETTLE_MS;
+	long long timeout_ms = g_client->config.readiness_timeout_ms > 0 ? g_client->config.readiness_timeout_ms : C_READY_DEFAULT_TIMEOUT_MS;
+	long long waited_ms = get_time_ms() - change->enqueue_time;
+
+	// Get the real filepath
+	char real_filepath[2048];
+	if (client_real_path(change->filepath, real_filepath, sizeof(real_filepath)) == -1) {
+		WARNING_PRINT("client_file_ready_delay(): No root for '%s', change dropped\n", change->filepath);
+		return -1;
+	}
+
+	// The file is gone: its deletion or rename follows
+	struct stat st;
+	if (stat(real_filepath, &st) != 0 && errno == ENOENT) {
+		DEBUG_PRINT("client_file_ready_delay(): File '%s' is gone, change dropped\n", change->filepath);
+		errno = 0;
+		return -1;
+	}
+
+	// The file can't be opened yet (locked by another program): exponential backoff
+	int fd = open(real_filepath, O_RDONLY);
+	if (fd == -1) {
+		errno = 0;
+		if (waited_ms >= timeout_ms) {
+			WARNING_PRINT("client_file_ready_delay(): File '%s' not accessible for %lld ms, change dropped\n", change->filepath, waited_ms);
+			return -1;
+		}
+		change->backoff_ms = change->backoff_ms < C_READY_MIN_BACKOFF_MS ? C_READY_MIN_BACKOFF_MS : change->backoff_ms * 2;
+		if (change->backoff_ms > C_READY_MAX_BACKOFF_MS)
+			change->backoff_ms = C_READY_MAX_BACKOFF_MS;
+		return change->backoff_ms;
+	}
+	close(fd);
+	change->backoff_ms = 0;
+	change->size = (size_t)st.st_size;
+
+	// The writer closed the file, or it's written for too long to wait more
+	if (change->writer_closed || waited_ms >= timeout_ms)
+		return 0;
+
+	// Else, the size and modification time must be stable for the settle time
 	#ifdef _WIN32
-		ERROR_HANDLE_INT_RETURN_INT(code, "tcp_client_thread(): Unable to send the disconnect message\n");
+		long long mtime = (long long)st.st_mtime * 1000000000LL;
+		long long now = (long long)time(NULL) * 1000000000LL;
 	#else
-		ERROR_HANDLE_INT_RETURN_NULL(code, "tcp_client_thread(): Unable to send the disconnect message\n");
+		long long mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		long long now = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 	#endif
-	INFO_PRINT("tcp_client_thread(): Disconnected from the server\n");
+	int stable = (change->observed_size == (size_t)st.st_size && change->observed_mtime == mtime);
+	change->observed_size = (size_t)st.st_size;
+	change->observed_mtime = mtime;
+	long long quiet_ms = (now - mtime) / 1000000;
+	if (quiet_ms >= settle_ms || (stable && quiet_ms < 0))
+		return 0;
+	return (quiet_ms < 0) ? settle_ms : settle_ms - quiet_ms;
+}
 
-	// Close the socket and return
-	socket_close(g_client->socket);
+/**
+ * @brief Function that handles the thread sending the queued changes to the server,
+ * in the order chosen by the change queue (metadata first, then the smallest payloads).
+ * 
+ * @param arg NULL
+ * 
+ * @return thread_return_type		Never returns.
+*/
+thread_return_type tcp_client_sender_thread(thread_param_type arg) {
+	(void)arg;
+	while (1) {
+
+		// Wait for the next change
+		change_t *change = change_queue_pop(&g_client->queue);
+
+		// Park the files that are still being written, without blocking the other changes
+		if (change->action == FILE_CREATED || change->action == FILE_MODIFIED) {
+			long long delay_ms = client_file_ready_delay(change);
+			if (delay_ms > 0) {
+				change_queue_defer(&g_client->queue, change, delay_ms);
+				continue;
+			}
+			if (delay_ms < 0) {
+				metrics_add(METRIC_CHANGES_DROPPED, 1);
+				change_free(change);
+				continue;
+			}
+		}
+		DEBUG_PRINT("tcp_client_sender_thread(): Sending change of '%s' (queued for %lld ms)\n", change->filepath, get_time_ms() - change->enqueue_time);
+
+		// Send it
+		int code = on_client_file_change_handler(change->filepath, change->new_filepath, change->action);
+		WARNING_HANDLE_INT(code, "tcp_client_sender_thread(): Unable to send the change of '%s'\n", change->filepath);
+		if (code == 0) {
+			metrics_add(METRIC_CHANGES_SENT, 1);
+			metrics_record(METRIC_CHANGE_LATENCY, (get_time_ms() - change->enqueue_time) * 1000);
+		}
+		else
+			metrics_add(METRIC_CHANGES_FAILED, 1);
+		change_free(change);
+	}
 	return 0;
 }
 
 /**
- * @brief Function that gets all the files in the directory from the server.
- * It receives a zip file containing all, and extracts it.
+ * @brief Function that gets all the files of a root from the server.
+ * It receives the snapshot of the root and writes its files while the rest is still being received.
+ * 
+ * @param root		The root (the snapshots come in the order of the roots sent by send_sync_roots()).
  * 
  * @return int		0 if the function ended successfully, -1 otherwise.
  */
-int getAllDirectoryFiles() {
+int getAllDirectoryFiles(client_root_t *root) {
 
 	// Create the message
 	message_t message;
 	memset(&message, 0, sizeof(message_t));
 
-	// Receive the file size through the socket
+	// Receive the snapshot size through the socket
 	size_t bytes = socket_read(g_client->socket, &message, sizeof(message_t), 0);
 	DECRYPT_BYTES(&message, sizeof(message_t), g_client->config.password);
 	int code = bytes > 0 ? 0 : -1;
 	ERROR_HANDLE_INT_RETURN_INT(code, "getAllDirectoryFiles(): Unable to receive the message\n");
-
-	///// Receive the zip file
-	// Open the zip file
-	FILE *fd = fopen(ZIP_TEMPORARY_FILE, "wb");
-	ERROR_HANDLE_PTR_RETURN_INT(fd, "getAllDirectoryFiles(): Unable to open the zip file\n");
-
-	// Receive the zip file
-	byte zip_buffer[C_BUFFER_SIZE];
+	code = message.type == (message_type_t)-1 ? -1 : 0;
+	ERROR_HANDLE_INT_RETURN_INT(code, "getAllDirectoryFiles(): The server refused the synchronization (unknown root, or another transfer_buffer_size)\n");
+
+	///// Receive the snapshot
+	// Start the writers (the application is big because of the decoder, so it's not on the stack)
+	snapshot_apply_t *apply = malloc(sizeof(snapshot_apply_t));
+	ERROR_HANDLE_PTR_RETURN_INT(apply, "getAllDirectoryFiles(): Unable to allocate the application of the snapshot\n");
+	code = snapshot_apply_start(apply, root->config->directory, g_client->config.apply_threads);
+	if (code == -1) free(apply);
+	ERROR_HANDLE_INT_RETURN_INT(code, "getAllDirectoryFiles(): Unable to start the writers\n");
+	pool_buffer_t *snapshot_buffer = buffer_pool_acquire(C_BUFFER_SIZE);
+	if (snapshot_buffer == NULL) { snapshot_apply_finish(apply); free(apply); }
+	ERROR_HANDLE_PTR_RETURN_INT(snapshot_buffer, "getAllDirectoryFiles(): Unable to get a buffer\n");
+
+	// Decode each chunk as soon as it's received
 	ssize_t bytes_remaining = message.size;
-	while (bytes_remaining > 0) {
+	while (code == 0 && bytes_remaining > 0) {
 
 		// Get the size of the buffer
 		size_t buffer_size = C_BUFFER_SIZE < bytes_remaining ? C_BUFFER_SIZE : bytes_remaining;
 
-		// Read the file into the buffer
-		socket_read(g_client->socket, zip_buffer, buffer_size, 0);
-		DECRYPT_BYTES(zip_buffer, buffer_size, g_client->config.password);
-		fwrite(zip_buffer, sizeof(byte), buffer_size, fd);
+		// Read the chunk into the buffer and give it to the writers
+		code = socket_read(g_client->socket, snapshot_buffer->data, buffer_size, MSG_WAITALL) == (ssize_t)buffer_size ? 0 : -1;
+		WARNING_HANDLE_INT(code, "getAllDirectoryFiles(): Unable to receive the snapshot\n");
+		if (code == 0) {
+			DECRYPT_BYTES(snapshot_buffer->data, buffer_size, g_client->config.password);
+			code = snapshot_apply_feed(apply, snapshot_buffer->data, buffer_size);
+		}
 
 		// Update the bytes remaining
 		bytes_remaining -= buffer_size;
 	}
 
-	// Close the zip file
-	fclose(fd);
+	// Wait for the writers and release the buffer
+	buffer_pool_release(snapshot_buffer);
+	if (snapshot_apply_finish(apply) == -1)
+		code = -1;
+	free(apply);
+	ERROR_HANDLE_INT_RETURN_INT(code, "getAllDirectoryFiles(): Unable to apply the snapshot\n");
 
-	// Unzip the zip file into the directory using system()
-	char command[1024];
-	#ifdef _WIN32
-		sprintf(command, "powershell -Command \"Expand-Archive -Path '%s' -DestinationPath '%s' -Force\"", ZIP_TEMPORARY_FILE, g_client->config.directory);
+	// Print the message
+	INFO_PRINT("getAllDirectoryFiles(): Files of '%s' received\n", root->config->directory);
+
+	// Return
+	return 0;
+}
+
+/**
+ * @brief Function that lists the extents of data of a file with SEEK_DATA and SEEK_HOLE (sparse files).
+ * When the filesystem can't tell, the whole file is one extent.
+ * 
+ * @param fd			File descriptor of the file (its offset is changed).
+ * @param file_size		Size of the file.
+ * @param extents		Filled with the extents (to free).
+ * @param count			Filled with the number of extents.
+ * @param data_size		Filled with the bytes of data (the size minus the holes).
+ * 
+ * @return int			0 if success, -1 otherwise.
+ */
+static int client_file_extents(int fd, size_t file_size, data_extent_t **extents, size_t *count, size_t *data_size) {
+	*count = 0;
+	*data_size = 0;
+	*extents = malloc(sizeof(data_extent_t));
+	ERROR_HANDLE_PTR_RETURN_INT(*extents, "client_file_extents(): Unable to allocate the extents\n");
+	int whole_file = 1;
+	#ifdef SEEK_DATA
+		whole_file = 0;
+		size_t offset = 0, capacity = 1;
+		while (offset < file_size) {
+
+			// Start of the next data (ENXIO: only a hole is left)
+			off_t data = lseek(fd, (off_t)offset, SEEK_DATA);
+			if (data == -1) {
+				whole_file = (errno != ENXIO);
+				break;
+			}
+			if ((size_t)data >= file_size)
+				break;
+			off_t hole = lseek(fd, data, SEEK_HOLE);
+			size_t end = (hole == -1 || (size_t)hole > file_size) ? file_size : (size_t)hole;
+
+			// Add the extent
+			if (*count == capacity) {
+				capacity *= 2;
+				data_extent_t *grown = realloc(*extents, capacity * sizeof(data_extent_t));
+				if (grown == NULL) free(*extents);
+				ERROR_HANDLE_PTR_RETURN_INT(grown, "client_file_extents(): Unable to grow the extents\n");
+				*extents = grown;
+			}
+			(*extents)[*count].offset = (size_t)data;
+			(*extents)[*count].length = end - (size_t)data;
+			(*count)++;
+			*data_size += end - (size_t)data;
+			offset = end;
+		}
+		errno = 0;
 	#else
-		sprintf(command, "unzip -o '%s' -d '%s'", ZIP_TEMPORARY_FILE, g_client->config.directory);
+		(void)fd;
 	#endif
-	code = system(command);
-	ERROR_HANDLE_INT_RETURN_INT(code, "getAllDirectoryFiles(): Unable to unzip the zip file\n");
-
-	// Remove the zip file
-	code = remove(ZIP_TEMPORARY_FILE);
-	ERROR_HANDLE_INT_RETURN_INT(code, "getAllDirectoryFiles(): Unable to remove the zip file\n");
 
-	// Print the message
-	INFO_PRINT("getAllDirectoryFiles(): Directory files received\n");
+	// Not supported by the filesystem: send everything
+	if (whole_file) {
+		*count = file_size > 0 ? 1 : 0;
+		(*extents)[0].offset = 0;
+		(*extents)[0].length = file_size;
+		*data_size = file_size;
+	}
+	return 0;
+}
 
-	// Return
+/**
+ * @brief Function that reads a whole range of a file at a 64-bit offset.
+ * 
+ * @param fd		File descriptor.
+ * @param buffer	Filled with the bytes of the range.
+ * @param size		Size of the range.
+ * @param offset	Offset of the range in the file.
+ * 
+ * @return int		0 if success, -1 if the range can't be read (the file shrank).
+ */
+static int client_read_at(int fd, byte *buffer, size_t size, size_t offset) {
+	while (size > 0) {
+		#ifdef _WIN32
+			ssize_t bytes = (_lseeki64(fd, (__int64)offset, SEEK_SET) == -1) ? -1 : read(fd, buffer, (unsigned int)size);
+		#else
+			ssize_t bytes = pread(fd, buffer, size, (off_t)offset);
+		#endif
+		if (bytes <= 0)
+			return -1;
+		buffer += bytes;
+		size -= (size_t)bytes;
+		offset += (size_t)bytes;
+	}
 	return 0;
 }
 
+/**
+ * @brief Function that releases the change handler resources when sending fails.
+ * 
+ * @param send_socket	Socket connected to the server.
+ * 
+ * @return void
+ */
+static void on_client_file_change_cleanup(SOCKET send_socket) {
+	socket_close(send_socket);
+	pthread_mutex_unlock(&g_client->mutex);
+}
+
 /**
  * @brief Function called when a file is created, modified, deleted or renamed.
  * 
- * @param filepath		Path of the file that changed (relative to the directory)
+ * @param filepath		Path of the file that changed (prefixed with its root, see config_root_path())
  * @param new_filepath	New path of the file that changed (NULL if the action isn't FILE_RENAMED)
  * @param action		Action that was done on the file
  * 
@@ -234,38 +577,50 @@ int on_client_file_change_handler(const char *filepath, const char *new_filepath
 	send_addr.sin_port = htons(g_client->config.port + 1);
 	send_addr.sin_addr.s_addr = inet_addr(g_client->config.ip);
 
+	// Apply the socket options
+	code = set_socket_options(send_socket, g_client->config.socket_send_buffer, g_client->config.socket_recv_buffer, g_client->config.tcp_nodelay);
+	WARNING_HANDLE_INT(code, "on_client_file_change_handler(): Unable to apply the socket options\n");
+
 	// Connect to the server
 	code = connect(send_socket, (struct sockaddr *)&send_addr, sizeof(struct sockaddr_in));
+	if (code == -1) socket_close(send_socket);
 	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to connect to the server\n");
 	INFO_PRINT("on_client_file_change_handler(): Connected to the server\n");
+	metrics_add(METRIC_CONNECTIONS_OPENED, 1);
 
 	///// Send the message
 	// Variables
-	byte action_buffer[C_BUFFER_SIZE];
 	size_t filepath_size = strlen(filepath) + 1;
 	size_t new_filepath_size = new_filepath != NULL ? strlen(new_filepath) + 1 : 0;
 	message_t message;
 	memset(&message, 0, sizeof(message_t));
 	message.type = action;
 	message.size = filepath_size;
-	size_t bytes;
+	ssize_t bytes;
+	long long wire_bytes = 0;
 
 	// Lock the mutex
+	long long lock_start = get_time_us();
 	pthread_mutex_lock(&g_client->mutex);
+	metrics_record(METRIC_MUTEX_WAIT, get_time_us() - lock_start);
 	DEBUG_PRINT("on_client_file_change_handler(): Mutex locked for file '%s'\n", filepath);
 
 	// Send the message through the socket
 	ENCRYPT_BYTES(&message, sizeof(message_t), g_client->config.password);
 	bytes = socket_write(send_socket, &message, sizeof(message_t), 0);
 	code = bytes > 0 ? 0 : -1;
+	if (code == -1) on_client_file_change_cleanup(send_socket);
 	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to send the message\n");
+	wire_bytes += bytes;
 
 	// Send the filepath through the socket
 	char *filepath_to_send = strdup((char*)filepath);
 	ENCRYPT_BYTES(filepath_to_send, filepath_size, g_client->config.password);
 	bytes = socket_write(send_socket, filepath_to_send, filepath_size, 0);
 	code = bytes > 0 ? 0 : -1;
+	if (code == -1) { free(filepath_to_send); on_client_file_change_cleanup(send_socket); }
 	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to send the message.message\n");
+	wire_bytes += bytes;
 	DEBUG_PRINT("on_client_file_change_handler(): Message sent\n");
 	free(filepath_to_send);
 
@@ -281,54 +636,136 @@ int on_client_file_change_handler(const char *filepath, const char *new_filepath
 	///// Read the file
 	// Get the real filepath
 	char real_filepath[2048];
-	sprintf(real_filepath, "%s%s", g_client->config.directory, filepath);
+	code = client_real_path(filepath, real_filepath, sizeof(real_filepath));
+	if (code == -1) on_client_file_change_cleanup(send_socket);
+	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): No root for '%s'\n", filepath);
 	DEBUG_PRINT("on_client_file_change_handler(): Real filepath : '%s'\n", real_filepath);
 
-	// Wait for the file to be fully accessible (60 tries, 1 second each)
-	int tries = 60;
-	while (tries > 0) {
-
-		// Check if the file is accessible
-		if ((code = file_accessible(real_filepath)) == 0)
-			break;
-
-		// Else, print a warning and wait
-		WARNING_PRINT("on_client_file_created(): File not accessible yet, waiting... (%d tries left)\n", tries);
-		tries--;
-		sleep(1);
-	}
-	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_created(): File '%s' not accessible\n", real_filepath);
-
 	// Open the file
 	FILE *file = fopen(real_filepath, "rb");
+	if (file == NULL) on_client_file_change_cleanup(send_socket);
 	ERROR_HANDLE_PTR_RETURN_INT(file, "on_client_file_change_handler(): Unable to open the file\n");
 
-	// Get the file size
+	// Get the file size and metadata
 	size_t file_size = get_file_size(fileno(file));
 	DEBUG_PRINT("on_client_file_change_handler(): File size : %zu\n", file_size);
+	file_metadata_t metadata;
+	memset(&metadata, 0, sizeof(file_metadata_t));
+	struct stat st;
+	if (fstat(fileno(file), &st) == 0) {
+		metadata.mode = (unsigned int)st.st_mode & 07777;
+		#ifdef __linux__
+			metadata.mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+		#else
+			metadata.mtime_ns = (long long)st.st_mtime * 1000000000LL;
+		#endif
+	}
+	errno = 0;
 
 	// Send the crypted file size
 	size_t file_size_crypted = file_size;
 	ENCRYPT_BYTES(&file_size_crypted, sizeof(size_t), g_client->config.password);
 	bytes = socket_write(send_socket, &file_size_crypted, sizeof(size_t), 0);
 	code = bytes > 0 ? 0 : -1;
+	if (code == -1) { fclose(file); on_client_file_change_cleanup(send_socket); }
 	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to send the file size\n");
+	wire_bytes += bytes;
 
-	// Send the file
-	ssize_t bytes_remaining = file_size;
-	while (bytes_remaining > 0) {
-
-		// Get the size of the buffer
-		size_t buffer_size = C_BUFFER_SIZE < bytes_remaining ? C_BUFFER_SIZE : bytes_remaining;
-
-		// Read the file into the buffer
-		fread(action_buffer, sizeof(byte), buffer_size, file);
-		ENCRYPT_BYTES(action_buffer, buffer_size, g_client->config.password);
-		socket_write(send_socket, action_buffer, buffer_size, 0);
+	// Send the crypted metadata
+	ENCRYPT_BYTES(&metadata, sizeof(file_metadata_t), g_client->config.password);
+	bytes = socket_write(send_socket, &metadata, sizeof(file_metadata_t), 0);
+	code = bytes > 0 ? 0 : -1;
+	if (code == -1) { fclose(file); on_client_file_change_cleanup(send_socket); }
+	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to send the metadata of the file\n");
+	wire_bytes += bytes;
+
+	// Send the hash of the content (saving a file without changes, or rewriting it identically, doesn't resend it)
+	hash128_t content_hash;
+	code = hash_file(fileno(file), file_size, 0, &content_hash);
+	if (code == -1) { fclose(file); on_client_file_change_cleanup(send_socket); }
+	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to hash the file\n");
+	ENCRYPT_BYTES(&content_hash, sizeof(hash128_t), g_client->config.password);
+	bytes = socket_write(send_socket, &content_hash, sizeof(hash128_t), 0);
+	code = bytes > 0 ? 0 : -1;
+	if (code == -1) { fclose(file); on_client_file_change_cleanup(send_socket); }
+	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to send the hash of the file\n");
+	wire_bytes += bytes;
 
-		// Update the bytes remaining
-		bytes_remaining -= buffer_size;
+	// Wait for the answer of the server
+	memset(&message, 0, sizeof(message_t));
+	bytes = socket_read(send_socket, &message, sizeof(message_t), MSG_WAITALL);
+	DECRYPT_BYTES(&message, sizeof(message_t), g_client->config.password);
+	code = (bytes == (ssize_t)sizeof(message_t) && (message.type == CONTENT_PRESENT || message.type == CONTENT_NEEDED)) ? 0 : -1;
+	if (bytes > 0)
+		metrics_add(METRIC_BYTES_RECEIVED_WIRE, bytes);
+	if (code == -1) { fclose(file); on_client_file_change_cleanup(send_socket); }
+	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): No answer of the server to the hash of '%s'\n", filepath);
+	if (message.type == CONTENT_PRESENT) {
+		INFO_PRINT("on_client_file_change_handler(): File '%s' already on the server\n", filepath);
+		metrics_add(METRIC_PRECHECK_PRESENT, 1);
+		metrics_add(METRIC_BYTES_SKIPPED, file_size);
+		fclose(file);
+		break;
 	}
+	metrics_add(METRIC_PRECHECK_NEEDED, 1);
+
+	// Find the data of the file and send its size (the holes of a sparse file are not sent)
+	data_extent_t *extents = NULL;
+	size_t extents_count = 0, data_size = 0;
+	code = client_file_extents(fileno(file), file_size, &extents, &extents_count, &data_size);
+	if (code == -1) { fclose(file); on_client_file_change_cleanup(send_socket); }
+	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to list the data of the file\n");
+	size_t data_size_crypted = data_size;
+	ENCRYPT_BYTES(&data_size_crypted, sizeof(size_t), g_client->config.password);
+	bytes = socket_write(send_socket, &data_size_crypted, sizeof(size_t), 0);
+	code = bytes > 0 ? 0 : -1;
+	if (code == -1) { free(extents); fclose(file); on_client_file_change_cleanup(send_socket); }
+	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to send the data size\n");
+	wire_bytes += bytes;
+
+	// Send each extent followed by its content, then the end of the list
+	pool_buffer_t *action_buffer = buffer_pool_acquire(C_BUFFER_SIZE);
+	if (action_buffer == NULL) { free(extents); fclose(file); on_client_file_change_cleanup(send_socket); }
+	ERROR_HANDLE_PTR_RETURN_INT(action_buffer, "on_client_file_change_handler(): Unable to get a buffer\n");
+	size_t e;
+	for (e = 0; e <= extents_count; e++) {
+		data_extent_t extent;
+		memset(&extent, 0, sizeof(data_extent_t));
+		extent.offset = e < extents_count ? extents[e].offset : file_size;
+		extent.length = e < extents_count ? extents[e].length : 0;
+		ENCRYPT_BYTES(&extent, sizeof(data_extent_t), g_client->config.password);
+		code = socket_write_all(send_socket, &extent, sizeof(data_extent_t));
+		if (code == -1) { buffer_pool_release(action_buffer); free(extents); fclose(file); on_client_file_change_cleanup(send_socket); }
+		ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to send an extent of the file\n");
+		wire_bytes += sizeof(data_extent_t);
+		if (e == extents_count)
+			break;
+		size_t offset = extents[e].offset;
+		size_t bytes_remaining = extents[e].length;
+		while (bytes_remaining > 0) {
+
+			// Get the size of the buffer
+			size_t buffer_size = (size_t)C_BUFFER_SIZE < bytes_remaining ? (size_t)C_BUFFER_SIZE : bytes_remaining;
+
+			// Read the file into the buffer and send it (a file that shrank meanwhile aborts the transfer)
+			code = client_read_at(fileno(file), action_buffer->data, buffer_size, offset);
+			if (code == -1) { buffer_pool_release(action_buffer); free(extents); fclose(file); on_client_file_change_cleanup(send_socket); }
+			ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to read '%s'\n", filepath);
+			ENCRYPT_BYTES(action_buffer->data, buffer_size, g_client->config.password);
+			code = socket_write_all(send_socket, action_buffer->data, buffer_size);
+			if (code == -1) { buffer_pool_release(action_buffer); free(extents); fclose(file); on_client_file_change_cleanup(send_socket); }
+			ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to send the content of '%s'\n", filepath);
+			wire_bytes += buffer_size;
+
+			// Update the bytes remaining
+			offset += buffer_size;
+			bytes_remaining -= buffer_size;
+		}
+	}
+	buffer_pool_release(action_buffer);
+	free(extents);
+	metrics_add(METRIC_BYTES_SENT_RAW, data_size);
+	metrics_add(METRIC_BYTES_SPARSE, file_size - data_size);
 
 	// Info print
 	INFO_PRINT("on_client_file_change_handler(): File '%s' sent\n", filepath);
@@ -359,7 +796,9 @@ int on_client_file_change_handler(const char *filepath, const char *new_filepath
 	ENCRYPT_BYTES(&new_filepath_size_crypted, sizeof(size_t), g_client->config.password);
 	bytes = socket_write(send_socket, &new_filepath_size_crypted, sizeof(size_t), 0);
 	code = bytes > 0 ? 0 : -1;
+	if (code == -1) on_client_file_change_cleanup(send_socket);
 	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to send the new filepath size\n");
+	wire_bytes += bytes;
 	DEBUG_PRINT("on_client_file_change_handler(): New filepath size crypted : %zu\n", new_filepath_size);
 
 	// Send the new filepath through the socket
@@ -367,7 +806,9 @@ int on_client_file_change_handler(const char *filepath, const char *new_filepath
 	ENCRYPT_BYTES(new_filepath_crypted, new_filepath_size, g_client->config.password);
 	bytes = socket_write(send_socket, new_filepath_crypted, new_filepath_size, 0);
 	code = bytes > 0 ? 0 : -1;
+	if (code == -1) { free(new_filepath_crypted); on_client_file_change_cleanup(send_socket); }
 	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): Unable to send the new filepath\n");
+	wire_bytes += bytes;
 
 	// Info print
 	INFO_PRINT("on_client_file_change_handler(): New filepath sent ('%s' -> '%s')\n", filepath, new_filepath);
@@ -380,6 +821,17 @@ int on_client_file_change_handler(const char *filepath, const char *new_filepath
 		default:
 			break;
 	}
+	metrics_add(METRIC_BYTES_SENT_WIRE, wire_bytes);
+
+	// Wait for the acknowledgement of the server
+	memset(&message, 0, sizeof(message_t));
+	bytes = socket_read(send_socket, &message, sizeof(message_t), MSG_WAITALL);
+	DECRYPT_BYTES(&message, sizeof(message_t), g_client->config.password);
+	code = (bytes == (ssize_t)sizeof(message_t) && message.type == VALID_RESPONSE) ? 0 : -1;
+	if (bytes > 0)
+		metrics_add(METRIC_BYTES_RECEIVED_WIRE, bytes);
+	if (code == -1) on_client_file_change_cleanup(send_socket);
+	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_change_handler(): The server didn't acknowledge the change of '%s'\n", filepath);
 
 	// Close the socket
 	socket_close(send_socket);
@@ -397,6 +849,36 @@ int on_client_file_change_handler(const char *filepath, const char *new_filepath
 }
 
 
+/**
+ * @brief Function that queues a change of the root watched by the current thread for the sender thread.
+ * The paths are prefixed with the root, and the size of the payload is taken now so the scheduler can send small files first.
+ * 
+ * @param filepath		Path of the file that changed (relative to the root directory)
+ * @param new_filepath	New path of the file that changed (NULL if the action isn't FILE_RENAMED)
+ * @param action		Action that was done on the file
+ * @param writer_closed	1 if the writer closed the file (the content is complete)
+ * 
+ * @return int	0 if success, -1 otherwise
+ */
+int on_client_file_queue(const char *filepath, const char *new_filepath, message_type_t action, int writer_closed) {
+	const sync_root_t *root = c_watched_root->config;
+	size_t size = 0;
+	if (action == FILE_CREATED || action == FILE_MODIFIED) {
+		char real_filepath[2048];
+		struct stat st;
+		snprintf(real_filepath, sizeof(real_filepath), "%s%s", root->directory, filepath);
+		if (stat(real_filepath, &st) == 0)
+			size = (size_t)st.st_size;
+		errno = 0;
+	}
+	char root_filepath[SYNC_IGNORE_MAX_PATH], root_new_filepath[SYNC_IGNORE_MAX_PATH];
+	int code = config_root_path(root, filepath, root_filepath, sizeof(root_filepath));
+	if (code == 0 && new_filepath != NULL)
+		code = config_root_path(root, new_filepath, root_new_filepath, sizeof(root_new_filepath));
+	ERROR_HANDLE_INT_RETURN_INT(code, "on_client_file_queue(): Path too long '%s'\n", filepath);
+	return change_queue_push(&g_client->queue, action, root_filepath, new_filepath != NULL ? root_new_filepath : NULL, size, writer_closed);
+}
+
 /**
  * @brief Function called when a file is created.
  * 
@@ -405,8 +887,9 @@ int on_client_file_change_handler(const char *filepath, const char *new_filepath
  * @return int	0 if success, -1 otherwise
  */
 int on_client_file_created(const char *filepath) {
+	metrics_add(METRIC_EVENTS_CREATED, 1);
 	INFO_PRINT("on_client_file_created(): File created : '%s'\n", filepath);
-	return on_client_file_change_handler(filepath, NULL, FILE_CREATED);
+	return on_client_file_queue(filepath, NULL, FILE_CREATED, 0);
 }
 
 /**
@@ -417,8 +900,22 @@ int on_client_file_created(const char *filepath) {
  * @return int	0 if success, -1 otherwise
  */
 int on_client_file_modified(const char *filepath) {
+	metrics_add(METRIC_EVENTS_MODIFIED, 1);
 	INFO_PRINT("on_client_file_modified(): File modified : '%s'\n", filepath);
-	return on_client_file_change_handler(filepath, NULL, FILE_MODIFIED);
+	return on_client_file_queue(filepath, NULL, FILE_MODIFIED, 0);
+}
+
+/**
+ * @brief Function called when a file opened for writing is closed.
+ * 
+ * @param filepath	Path of the file closed
+ * 
+ * @return int	0 if success, -1 otherwise
+ */
+int on_client_file_closed(const char *filepath) {
+	metrics_add(METRIC_EVENTS_CLOSED, 1);
+	DEBUG_PRINT("on_client_file_closed(): File closed after writing : '%s'\n", filepath);
+	return on_client_file_queue(filepath, NULL, FILE_MODIFIED, 1);
 }
 
 /**
@@ -429,8 +926,9 @@ int on_client_file_modified(const char *filepath) {
  * @return int	0 if success, -1 otherwise
  */
 int on_client_file_deleted(const char *filepath) {
+	metrics_add(METRIC_EVENTS_DELETED, 1);
 	INFO_PRINT("on_client_file_deleted(): File deleted : '%s'\n", filepath);
-	return on_client_file_change_handler(filepath, NULL, FILE_DELETED);
+	return on_client_file_queue(filepath, NULL, FILE_DELETED, 0);
 }
 
 /**
@@ -442,7 +940,8 @@ int on_client_file_deleted(const char *filepath) {
  * @return int	0 if success, -1 otherwise
  */
 int on_client_file_renamed(const char *filepath_old, const char *filepath_new) {
+	metrics_add(METRIC_EVENTS_RENAMED, 1);
 	INFO_PRINT("file_renamed_handler(): File '%s' renamed to '%s'\n", filepath_old, filepath_new);
-	return on_client_file_change_handler(filepath_old, filepath_new, FILE_RENAMED);
+	return on_client_file_queue(filepath_old, filepath_new, FILE_RENAMED, 0);
 }
 
@@ -6,6 +6,15 @@
 #include "../universal_pthread.h"
 #include "../network/net_utils.h"
 #include "../config_manager.h"
+#include "../sync_ignore.h"
+#include "c_change_queue.h"
+
+// Synchronized root of the client (a directory of the config, with its own watcher)
+typedef struct client_root_t {
+	const sync_root_t *config;		// Name and directory (in the config of the client)
+	sync_ignore_t ignore;			// Paths never synchronized (.syncignore of the directory)
+	pthread_t watcher_thread;
+} client_root_t;
 
 // Structure of the TCP client
 typedef struct {
@@ -17,18 +26,28 @@ typedef struct {
 
 	struct sockaddr_in address;
 
+	change_queue_t queue;			// Changes waiting to be sent (shortest job first, shared by the roots)
+	pthread_t sender_thread;
+
+	client_root_t *roots;			// Synchronized roots (the paths sent start with the name of their root)
+	int roots_count;
+
 } tcp_client_t;
 
 // Function Prototypes
 int setup_tcp_client(config_t config, tcp_client_t *tcp_client);
 int tcp_client_run(tcp_client_t *tcp_client);
 thread_return_type tcp_client_thread(thread_param_type arg);
+thread_return_type tcp_client_sender_thread(thread_param_type arg);
+thread_return_type tcp_client_watcher_thread(thread_param_type arg);
 
 // Internal functions prototypes
-int getAllDirectoryFiles();
+int getAllDirectoryFiles(client_root_t *root);
+int on_client_file_queue(const char *filepath, const char *new_filepath, message_type_t action, int writer_closed);
 int on_client_file_change_handler(const char *filepath, const char *new_filepath, message_type_t action);
 int on_client_file_created(const char *filepath);
 int on_client_file_modified(const char *filepath);
+int on_client_file_closed(const char *filepath);
 int on_client_file_deleted(const char *filepath);
 int on_client_file_renamed(const char *filepath_old, const char *filepath_new);
 
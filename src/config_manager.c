@@ -4,91 +4,520 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <ctype.h>
 #include <fcntl.h>
+#include <errno.h>
+
+// Types of the config values
+typedef enum config_value_type_t {
+	CONFIG_INT,			// int
+	CONFIG_LONG,		// long long
+	CONFIG_SIZE,		// size_t, with an optional K, M or G suffix
+	CONFIG_BOOL,		// int: 1/0, true/false, yes/no or on/off
+	CONFIG_STRING,		// char array of 'max' bytes
+	CONFIG_CUSTOM,		// parsed by a function
+} config_value_type_t;
+
+// Description of a key of the config file
+typedef struct config_key_t {
+	const char *section;
+	const char *name;
+	config_value_type_t type;
+	size_t offset;									// Offset of the field in config_t
+	long long min;									// Valid range of the numbers
+	long long max;									// (size of the field for the strings)
+	int (*parse)(config_t *config, char *value);	// Parser of the custom values (returns -1 if the value is invalid)
+} config_key_t;
+
+// Custom parsers
+int config_parse_directory(config_t *config, char *value);
+int config_parse_root(config_t *config, char *value);
+int config_parse_password(config_t *config, char *value);
+int config_parse_buffer_classes(config_t *config, char *value);
+int config_parse_priority_class(config_t *config, char *value);
+int config_parse_log_levels(config_t *config, char *value);
+
+#define CONFIG_KEY(section, name, type, min, max) { section, #name, type, offsetof(config_t, name), min, max, NULL }
+#define CONFIG_CUSTOM_KEY(section, name, parse) { section, #name, CONFIG_CUSTOM, 0, 0, 0, parse }
+
+// Known keys
+static const config_key_t config_keys[] = {
+
+	// General settings
+	CONFIG_CUSTOM_KEY("general", directory, config_parse_directory),
+	CONFIG_CUSTOM_KEY("general", root, config_parse_root),
+	CONFIG_CUSTOM_KEY("general", password, config_parse_password),
+	CONFIG_KEY("general", ip, CONFIG_STRING, 0, sizeof(((config_t*)0)->ip)),
+	CONFIG_KEY("general", port, CONFIG_INT, 1, 65534),						// The port + 1 is used too
+
+	// Performance tuning
+	CONFIG_KEY("performance", transfer_buffer_size, CONFIG_SIZE, 4096, 256LL * 1024 * 1024),
+	CONFIG_KEY("performance", socket_send_buffer, CONFIG_SIZE, 0, INT_MAX),
+	CONFIG_KEY("performance", socket_recv_buffer, CONFIG_SIZE, 0, INT_MAX),
+	CONFIG_KEY("performance", tcp_nodelay, CONFIG_BOOL, 0, 1),
+	CONFIG_CUSTOM_KEY("performance", buffer_classes, config_parse_buffer_classes),
+	CONFIG_KEY("performance", buffer_thread_cache, CONFIG_INT, 0, 4096),
+	CONFIG_KEY("performance", io_uring, CONFIG_BOOL, 0, 1),
+	CONFIG_KEY("performance", io_queue_depth, CONFIG_INT, 0, 4096),
+	CONFIG_KEY("performance", io_direct_threshold, CONFIG_SIZE, 0, LLONG_MAX),
+	CONFIG_KEY("performance", io_fsync, CONFIG_BOOL, 0, 1),
+	CONFIG_KEY("performance", scan_threads, CONFIG_INT, 0, 64),
+	CONFIG_KEY("performance", dir_cache_size, CONFIG_INT, 0, 65536),
+	CONFIG_KEY("performance", snapshot_window_ms, CONFIG_LONG, -1, LLONG_MAX),
+	CONFIG_KEY("performance", snapshot_max_streams, CONFIG_INT, 0, 4096),
+	CONFIG_KEY("performance", delete_trash, CONFIG_BOOL, 0, 1),
+	CONFIG_KEY("performance", apply_threads, CONFIG_INT, 0, 32),
+	CONFIG_KEY("performance", scheduler_bytes_per_ms, CONFIG_LONG, 0, LLONG_MAX),
+	CONFIG_KEY("performance", scheduler_max_delay_ms, CONFIG_LONG, 0, LLONG_MAX),
+	CONFIG_KEY("performance", scheduler_class_step_ms, CONFIG_LONG, 0, LLONG_MAX),
+	CONFIG_KEY("performance", readiness_settle_ms, CONFIG_LONG, 0, LLONG_MAX),
+	CONFIG_KEY("performance", readiness_timeout_ms, CONFIG_LONG, 0, LLONG_MAX),
+	CONFIG_CUSTOM_KEY("performance", priority_class, config_parse_priority_class),
+
+	// Metrics exporter
+	CONFIG_KEY("metrics", metrics_port, CONFIG_INT, 0, 65535),
+	CONFIG_KEY("metrics", metrics_socket, CONFIG_STRING, 0, sizeof(((config_t*)0)->metrics_socket)),
+
+	// Logger
+	CONFIG_CUSTOM_KEY("logging", log_levels, config_parse_log_levels),
+	CONFIG_KEY("logging", log_rate_limit, CONFIG_INT, -1, INT_MAX),
+};
+#define CONFIG_KEYS_COUNT (sizeof(config_keys) / sizeof(config_key_t))
+
+/**
+ * @brief Function that copies a directory, with '/' as separator.
+ * 
+ * @param directory	Directory to fill.
+ * @param size		Size of the directory.
+ * @param value		Value of the key.
+ * 
+ * @return int		0 if the value is valid, -1 otherwise.
+ */
+static int config_copy_directory(char *directory, size_t size, const char *value) {
+	if (value[0] == '\0' || strlen(value) >= size)
+		return -1;
+	strcpy(directory, value);
+	int len = strlen(directory) - 1;
+	for (; len >= 0; len--)
+		if (directory[len] == '\\')
+			directory[len] = '/';
+	return 0;
+}
+
+/**
+ * @brief Function that parses the directory, with '/' as separator.
+ * 
+ * @param config	Configuration to fill.
+ * @param value		Value of the key.
+ * 
+ * @return int		0 if the value is valid, -1 otherwise.
+ */
+int config_parse_directory(config_t *config, char *value) {
+	return config_copy_directory(config->directory, sizeof(config->directory), value);
+}
+
+/**
+ * @brief Function that parses a named root (name:directory, the key can be repeated).
+ * The name is the first component of the paths exchanged for this root, so it can't contain a '/'.
+ * 
+ * @param config	Configuration to fill.
+ * @param value		Value of the key.
+ * 
+ * @return int		0 if the value is valid, -1 otherwise.
+ */
+int config_parse_root(config_t *config, char *value) {
+	char *separator = strchr(value, ':');
+	if (separator == NULL || separator == value || config->roots_count >= MAX_SYNC_ROOTS || (size_t)(separator - value) >= sizeof(config->roots[0].name))
+		return -1;
+	*separator = '\0';
+	if (strchr(value, '/') != NULL || strcmp(value, ".") == 0 || strcmp(value, "..") == 0 || config_find_root(config, value, NULL) != NULL)
+		return -1;
+	sync_root_t *root = &config->roots[config->roots_count];
+	if (config_copy_directory(root->directory, sizeof(root->directory), separator + 1) == -1)
+		return -1;
+	strcpy(root->name, value);
+	config->roots_count++;
+	return 0;
+}
+
+/**
+ * @brief Function that parses the password and scrambles it with its hash.
+ * 
+ * @param config	Configuration to fill.
+ * @param value		Value of the key.
+ * 
+ * @return int		0 if the value is valid, -1 otherwise.
+ */
+int config_parse_password(config_t *config, char *value) {
+	if (value[0] == '\0')
+		return -1;
+	free(config->password.str);
+	config->password.size = strlen(value);
+	config->password.str = strdup(value);
+	if (config->password.str == NULL)
+		return -1;
+	long hash = hash_string(value);
+	size_t i;
+	for (i = 0; i < config->password.size; i++) {
+		char c = config->password.str[i];
+		config->password.str[i] = (char) (config->password.str[i] ^ hash);
+		if (config->password.str[i] == '\0')
+			config->password.str[i] = c;
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that parses a size with an optional K, M or G suffix (powers of 1024).
+ * 
+ * @param value		Value to parse.
+ * @param size		Pointer to the parsed size.
+ * 
+ * @return int		0 if the value is valid, -1 otherwise.
+ */
+int config_parse_size(const char *value, unsigned long long *size) {
+	char *end;
+	errno = 0;
+	if (value[0] == '-')
+		return -1;
+	*size = strtoull(value, &end, 10);
+	int shift = 0;
+	switch (toupper((unsigned char)*end)) {
+		case 'K': shift = 10; end++; break;
+		case 'M': shift = 20; end++; break;
+		case 'G': shift = 30; end++; break;
+	}
+	if (toupper((unsigned char)*end) == 'B')
+		end++;
+	int code = (end == value || *end != '\0' || errno == ERANGE || (*size << shift) >> shift != *size) ? -1 : 0;
+	errno = 0;
+	*size <<= shift;
+	return code;
+}
+
+/**
+ * @brief Function that parses the buffer classes (sizes separated by commas).
+ * 
+ * @param config	Configuration to fill.
+ * @param value		Value of the key.
+ * 
+ * @return int		0 if the value is valid, -1 otherwise.
+ */
+int config_parse_buffer_classes(config_t *config, char *value) {
+	size_t classes[BUFFER_POOL_MAX_CLASSES];
+	int count = 0;
+	char *size = strtok(value, ", ");
+	while (size != NULL) {
+		unsigned long long parsed;
+		if (count >= BUFFER_POOL_MAX_CLASSES || config_parse_size(size, &parsed) == -1 || parsed == 0)
+			return -1;
+		classes[count++] = parsed;
+		size = strtok(NULL, ", ");
+	}
+	memcpy(config->buffer_classes, classes, count * sizeof(size_t));
+	config->buffer_classes_count = count;
+	return 0;
+}
+
+/**
+ * @brief Function that parses a priority class (pattern:level, the key can be repeated).
+ * 
+ * @param config	Configuration to fill.
+ * @param value		Value of the key.
+ * 
+ * @return int		0 if the value is valid, -1 otherwise.
+ */
+int config_parse_priority_class(config_t *config, char *value) {
+	char *separator = strrchr(value, ':');
+	if (separator == NULL || separator == value || config->priority_classes_count >= MAX_PRIORITY_CLASSES || (size_t)(separator - value) >= sizeof(config->priority_classes[0].pattern))
+		return -1;
+	char *end;
+	long level = strtol(separator + 1, &end, 10);
+	if (end == separator + 1 || *end != '\0' || level < 0 || level > 1000)
+		return -1;
+	priority_class_t *class = &config->priority_classes[config->priority_classes_count++];
+	*separator = '\0';
+	strcpy(class->pattern, value);
+	class->level = (int)level;
+	return 0;
+}
+
+/**
+ * @brief Function that parses the enabled log levels (e.g. 'info,warning,error').
+ * 
+ * @param config	Configuration to fill.
+ * @param value		Value of the key.
+ * 
+ * @return int		0 if the value is valid, -1 otherwise.
+ */
+int config_parse_log_levels(config_t *config, char *value) {
+	int levels = log_parse_levels(value);
+	if (levels == -1)
+		return -1;
+	config->log_levels = levels;
+	return 0;
+}
+
+/**
+ * @brief Function that parses a value according to the type of its key.
+ * 
+ * @param config	Configuration to fill.
+ * @param key		Description of the key.
+ * @param value		Value to parse (modified in place by some parsers).
+ * 
+ * @return int		0 if the value is valid, -1 otherwise (the field keeps its previous value).
+ */
+int config_parse_value(config_t *config, const config_key_t *key, char *value) {
+	char *field = (char*)config + key->offset;
+	char *end;
+	switch (key->type) {
+		case CONFIG_INT:
+		case CONFIG_LONG: {
+			errno = 0;
+			long long number = strtoll(value, &end, 10);
+			int code = (end == value || *end != '\0' || errno == ERANGE || number < key->min || number > key->max) ? -1 : 0;
+			errno = 0;
+			if (code == -1)
+				return -1;
+			if (key->type == CONFIG_INT)
+				*(int*)field = (int)number;
+			else
+				*(long long*)field = number;
+			return 0;
+		}
+		case CONFIG_SIZE: {
+			unsigned long long size;
+			if (config_parse_size(value, &size) == -1 || size < (unsigned long long)key->min || size > (unsigned long long)key->max)
+				return -1;
+			*(size_t*)field = (size_t)size;
+			return 0;
+		}
+		case CONFIG_BOOL: {
+			const char *true_values[] = { "1", "true", "yes", "on" };
+			const char *false_values[] = { "0", "false", "no", "off" };
+			int i;
+			for (end = value; *end != '\0'; end++)
+				*end = tolower((unsigned char)*end);
+			for (i = 0; i < 4; i++) {
+				if (strcmp(value, true_values[i]) == 0) { *(int*)field = 1; return 0; }
+				if (strcmp(value, false_values[i]) == 0) { *(int*)field = 0; return 0; }
+			}
+			return -1;
+		}
+		case CONFIG_STRING:
+			if (strlen(value) >= (size_t)key->max)
+				return -1;
+			strcpy(field, value);
+			return 0;
+		case CONFIG_CUSTOM:
+			return key->parse(config, value);
+	}
+	return -1;
+}
+
+/**
+ * @brief Function that removes the spaces at the beginning and at the end of a string, in place.
+ * 
+ * @param str	String to trim.
+ * 
+ * @return char*	Pointer to the first non space character.
+ */
+char* config_trim(char *str) {
+	while (*str == ' ' || *str == '\t')
+		str++;
+	size_t len = strlen(str);
+	while (len > 0 && (str[len - 1] == ' ' || str[len - 1] == '\t' || str[len - 1] == '\r'))
+		str[--len] = '\0';
+	return str;
+}
+
+/**
+ * @brief Function that parses the content of a config file, in place.
+ * Comments start with '#' or ';', sections are written [name] and values key=value.
+ * Invalid lines are reported with their number and ignored.
+ * 
+ * @param config	Configuration to fill (defaults already set).
+ * @param content	Content of the file (NUL terminated, modified).
+ * @param path		Path of the file (for the warnings).
+ * 
+ * @return void
+ */
+void config_parse_content(config_t *config, char *content, const char *path) {
+	const char *section = NULL;		// NULL before the first section header
+	int skip_section = 0;
+	int line_number = 0;
+	char *next = content;
+	while (next != NULL) {
+
+		// Cut the next line
+		char *line = next;
+		next = strchr(line, '\n');
+		if (next != NULL)
+			*next++ = '\0';
+		line_number++;
+
+		// Skip the empty lines and the comments
+		line = config_trim(line);
+		if (line[0] == '\0' || line[0] == '#' || line[0] == ';')
+			continue;
+
+		// Section header
+		if (line[0] == '[') {
+			char *close = strchr(line, ']');
+			if (close == NULL) {
+				WARNING_PRINT("read_config_file(): %s:%d: Invalid section header '%s'\n", path, line_number, line);
+				continue;
+			}
+			*close = '\0';
+			section = config_trim(line + 1);
+			size_t i;
+			for (i = 0; i < CONFIG_KEYS_COUNT && strcmp(config_keys[i].section, section) != 0; i++);
+			skip_section = i == CONFIG_KEYS_COUNT;
+			if (skip_section)
+				WARNING_PRINT("read_config_file(): %s:%d: Ignoring unknown section [%s]\n", path, line_number, section);
+			continue;
+		}
+		if (skip_section)
+			continue;
+
+		// Split the key and the value
+		char *equal = strchr(line, '=');
+		if (equal == NULL) {
+			WARNING_PRINT("read_config_file(): %s:%d: Ignoring line without '=': '%s'\n", path, line_number, line);
+			continue;
+		}
+		*equal = '\0';
+		char *name = config_trim(line);
+		char *value = config_trim(equal + 1);
+
+		// Find the key (in the current section, or anywhere for the keys before the first section)
+		const config_key_t *key = NULL;
+		size_t i;
+		for (i = 0; i < CONFIG_KEYS_COUNT && key == NULL; i++)
+			if (strcmp(config_keys[i].name, name) == 0 && (section == NULL || strcmp(config_keys[i].section, section) == 0))
+				key = &config_keys[i];
+		if (key == NULL) {
+			WARNING_PRINT("read_config_file(): %s:%d: Ignoring unknown key '%s' in section [%s]\n", path, line_number, name, section == NULL ? "" : section);
+			continue;
+		}
+
+		// Parse the value
+		if (config_parse_value(config, key, value) == -1)
+			WARNING_PRINT("read_config_file(): %s:%d: Ignoring invalid value '%s' for the key '%s'\n", path, line_number, value, name);
+	}
+}
 
 /**
  * @brief Function that reads the config file and returns the config_t structure.
+ * The file is read at once and parsed in place.
  * 
  * @return config_t The configuration read from the file.
  */
 config_t read_config_file() {
 
-	// Variables
+	// Default values
 	config_t config;
 	memset(&config, 0, sizeof(config_t));
+	config.log_levels = -1;
+	config.transfer_buffer_size = CONFIG_DEFAULT_TRANSFER_BUFFER_SIZE;
 
-	// Try to open the file
-	int fd = open(CONFIG_FILE, O_RDONLY);
+	// Try to open the file, then the file in the bin folder
+	const char *path = CONFIG_FILE;
+	int fd = open(path, O_RDONLY);
 	if (fd == -1) {
-		
-		// Try to open the file in the bin folder
-		fd = open(CONFIG_FILE_IN_BIN, O_RDONLY);
+		path = CONFIG_FILE_IN_BIN;
+		fd = open(path, O_RDONLY);
 		if (fd < 0) {
 			ERROR_PRINT("read_config_file(): Unable to open the config file\n");
 			return config;
 		}
 	}
+	errno = 0;
 
-	// Read the file line by line
-	char *line = NULL;
-	while (get_line_from_file(&line, fd) != -1) {
-
-		// Check if the line is empty
-		if (line[0] == '\n' || line[0] == '\0')
-			continue;
-
-		// Get the key and the value
-		char *key = strtok(line, "=");
-		char *value = line + strlen(key) + 1;
-		value = strdup(value);
-
-		// Remove the \n at the end of the value if there is one
-		int len = strlen(value) - 1;
-		if (value[len] == '\n')
-			value[len] = '\0';
-
-		///// Check the key
-		// Check if the key is directory
-		if (strcmp(key, "directory") == 0) {
-			strcpy(config.directory, value);
-			int len = strlen(config.directory) - 1;
-			for (; len >= 0; len--)
-				if (config.directory[len] == '\\')
-					config.directory[len] = '/';
-		}
-
-		// Check if the key is password
-		else if (strcmp(key, "password") == 0) {
-			config.password.size = strlen(value);
-			config.password.str = strdup(value);
-			long hash = hash_string(value);
-			size_t i;
-			for (i = 0; i < config.password.size; i++) {
-				char c = config.password.str[i]; 
-				config.password.str[i] = (char) (config.password.str[i] ^ hash);
-				if (config.password.str[i] == '\0')
-					config.password.str[i] = c;
-			}
-		}
+	// Read the whole file
+	size_t size = get_file_size(fd);
+	char *content = malloc(size + 1);
+	if (content == NULL) {
+		close(fd);
+		ERROR_PRINT("read_config_file(): Unable to allocate %zu bytes for the config file\n", size);
+		return config;
+	}
+	size_t total = 0;
+	while (total < size) {
+		ssize_t bytes = read(fd, content + total, size - total);
+		if (bytes <= 0)
+			break;
+		total += bytes;
+	}
+	content[total] = '\0';
+	close(fd);
 
-		// Check if the key is ip
-		else if (strcmp(key, "ip") == 0) {
-			strcpy(config.ip, value);
-		}
+	// Parse the content
+	config_parse_content(&config, content, path);
+	free(content);
 
-		// Check if the key is port
-		else if (strcmp(key, "port") == 0) {
-			config.port = atoi(value);
-		}
+	// Without named roots, the directory is the only root
+	if (config.roots_count == 0 && config.directory[0] != '\0') {
+		strcpy(config.roots[0].directory, config.directory);
+		config.roots_count = 1;
 	}
+	else if (config.directory[0] != '\0')
+		WARNING_PRINT("read_config_file(): %s: Ignoring the key 'directory', the named roots are synchronized\n", path);
 
-	// Free the line
-	free(line);
+	// Check the required keys
+	if (config.roots_count == 0 || config.password.size == 0 || config.ip[0] == '\0' || config.port == 0)
+		WARNING_PRINT("read_config_file(): %s: Missing required keys in section [general] (directory or root, password, ip and port)\n", path);
 
-	// Close the file
-	close(fd);
-	
 	// Return the config
 	return config;
 }
 
+/**
+ * @brief Function that gives the path of a file as exchanged with the other side: prefixed with the name of its root
+ * ("docs" and "a/b.txt" give "docs/a/b.txt"), unchanged for the unnamed root.
+ * 
+ * @param root		The root of the file.
+ * @param path		Path of the file relative to the root directory.
+ * @param root_path	Filled with the path prefixed with the root.
+ * @param size		Size of root_path.
+ * 
+ * @return int		0 if success, -1 if the path is too long.
+ */
+int config_root_path(const sync_root_t *root, const char *path, char *root_path, size_t size) {
+	int length = root->name[0] == '\0' ? snprintf(root_path, size, "%s", path) : snprintf(root_path, size, "%s/%s", root->name, path);
+	return (length < 0 || (size_t)length >= size) ? -1 : 0;
+}
+
+/**
+ * @brief Function that finds the root of a path exchanged with the other side (see config_root_path()).
+ * A root alone (without '/') is matched too, for the list of roots of a session.
+ * 
+ * @param config	The configuration.
+ * @param root_path	Path prefixed with the name of its root.
+ * @param path		Filled with the path relative to the root directory (NULL if not needed).
+ * 
+ * @return const sync_root_t*	The root, NULL if no root has this name.
+ */
+const sync_root_t* config_find_root(const config_t *config, const char *root_path, const char **path) {
+	const char *slash = strchr(root_path, '/');
+	size_t name_length = slash == NULL ? strlen(root_path) : (size_t)(slash - root_path);
+	int i;
+	for (i = 0; i < config->roots_count; i++) {
+		const sync_root_t *root = &config->roots[i];
+
+		// The unnamed root takes the paths as they are
+		if (root->name[0] == '\0') {
+			if (path != NULL)
+				*path = root_path;
+			return root;
+		}
+		if (strlen(root->name) == name_length && strncmp(root->name, root_path, name_length) == 0) {
+			if (path != NULL)
+				*path = slash == NULL ? root_path + name_length : slash + 1;
+			return root;
+		}
+	}
+	return NULL;
+}
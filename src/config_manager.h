@@ -3,20 +3,89 @@
 #define __CONFIG_MANAGER_H__
 
 #include "universal_utils.h"
+#include "buffer_pool.h"
 
 #define CONFIG_FILE "config.ini"
 #define CONFIG_FILE_IN_BIN "bin/config.ini"
+#define MAX_PRIORITY_CLASSES 32
+#define CONFIG_DEFAULT_TRANSFER_BUFFER_SIZE (1024 * 1024)
+#define MAX_SYNC_ROOTS 32
+
+// Priority class of the paths matching a pattern (0 = highest priority)
+typedef struct priority_class_t {
+	char pattern[128];
+	int level;
+} priority_class_t;
+
+// Synchronized directory, matched by name between the client and the server
+typedef struct sync_root_t {
+	char name[64];					// Empty for the single directory of the 'directory' key
+	char directory[512];			// Path written with a final '/' (like the 'directory' key)
+} sync_root_t;
 
 // Structure of the configuration file
+// Keys are grouped in sections: [general], [performance], [metrics] and [logging].
+// Keys written before any section header are matched in every section (old flat config files).
 typedef struct {
 	char directory[512];
 	simple_string_t password;
+	sync_root_t roots[MAX_SYNC_ROOTS];	// Named roots ('root' keys), or the directory alone
+	int roots_count;
 	char ip[16];
 	int port;
+
+	// Network transfers (the transfer buffer size must be the same on the client and the server: the encryption restarts on each buffer,
+	// so the server refuses the clients announcing another size in their SYNC_ROOTS request)
+	size_t transfer_buffer_size;	// Bytes read, encrypted and sent at once
+	size_t socket_send_buffer;		// SO_SNDBUF of the sockets (0 to keep the system default)
+	size_t socket_recv_buffer;		// SO_RCVBUF of the sockets (0 to keep the system default)
+	int tcp_nodelay;				// 1 to send the small messages without waiting (TCP_NODELAY)
+
+	// I/O buffer pool
+	size_t buffer_classes[BUFFER_POOL_MAX_CLASSES];	// Sizes of the buffer classes
+	int buffer_classes_count;						// Number of classes (0 for the defaults)
+	int buffer_thread_cache;						// Buffers cached per thread and class (0 for the default)
+
+	// Disk I/O engine
+	int io_uring;					// 1 to use io_uring when available
+	int io_queue_depth;				// Number of disk operations in flight (0 for the default)
+	size_t io_direct_threshold;		// Files bigger than this are written with O_DIRECT (0 = never)
+	int io_fsync;					// 1 to fsync received files before publishing them
+	int scan_threads;				// Threads walking the directory tree (0 for the default)
+	int dir_cache_size;				// Directories of the tree kept open by the server (0 for the default)
+
+	// Initial synchronization (server)
+	long long snapshot_window_ms;	// Clients connecting within this time share one snapshot (0 for the default, -1 to never share)
+	int snapshot_max_streams;		// Snapshots sent at the same time (0 for the default)
+
+	// Deletions (server)
+	int delete_trash;				// 1 to move the deleted directories to a trash and delete them in the background
+
+	// Initial synchronization (client)
+	int apply_threads;				// Threads writing the files of the received snapshot (0 for one per CPU)
+
+	// Outbound change scheduler
+	long long scheduler_bytes_per_ms;		// Payload bytes that add 1 ms of delay (0 for the default)
+	long long scheduler_max_delay_ms;		// Maximum delay added for the size, so large files still make progress
+	long long scheduler_class_step_ms;		// Delay added per priority class level
+	long long readiness_settle_ms;			// Time without writes after which a file is sent (0 for the default)
+	long long readiness_timeout_ms;			// Maximum time to wait for a file to be ready (0 for the default)
+	int priority_classes_count;
+	priority_class_t priority_classes[MAX_PRIORITY_CLASSES];	// Matched on the paths prefixed with their root name (named roots)
+
+	// Metrics exporter (Prometheus text format, local only)
+	int metrics_port;				// TCP port on 127.0.0.1 (0 to disable)
+	char metrics_socket[108];		// Path of a Unix socket (empty to disable)
+
+	// Logger
+	int log_levels;					// Mask of the enabled levels (-1 to keep all the compiled ones)
+	int log_rate_limit;				// Records per second and per call site (0 for the default, -1 for no limit)
 } config_t;
 
 // Function Prototypes
 config_t read_config_file();
+int config_root_path(const sync_root_t *root, const char *path, char *root_path, size_t size);
+const sync_root_t* config_find_root(const config_t *config, const char *root_path, const char **path);
 
 #endif
 
@@ -0,0 +1,469 @@
+
+#ifndef _WIN32
+	#define _GNU_SOURCE
+#endif
+
+#include "dir_scanner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#ifdef __linux__
+	#include <sys/syscall.h>
+	#include <time.h>
+	#define DIR_SCAN_GETDENTS 1
+#endif
+
+#define DIR_SCAN_DEQUE_INITIAL 64
+#define DIR_SCAN_IDLE_US 50							// Wait of an idle thread before looking for work again
+
+// Directory entry returned by getdents64
+#ifdef DIR_SCAN_GETDENTS
+typedef struct linux_dirent64_t {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} linux_dirent64_t;
+#endif
+
+// State shared by the scanner threads
+typedef struct dir_scanner_t {
+	const dir_scan_options_t *options;
+	char root[SYNC_IGNORE_MAX_PATH];		// Root path ending with a '/'
+	int root_fd;							// Directory fd of the root (the directories are opened relative to it)
+	int threads;
+	scan_deque_t deques[DIR_SCAN_MAX_THREADS];
+	volatile long pending;					// Directories queued or being read
+	volatile int stop;						// Set when a handler asks to stop
+} dir_scanner_t;
+
+// State of a scanner thread
+typedef struct scan_worker_t {
+	dir_scanner_t *scanner;
+	int index;
+	pthread_t thread;
+	char path[SYNC_IGNORE_MAX_PATH];		// Path of the current entry
+	byte *buffer;							// Directory entries read at once
+	dir_scan_stats_t stats;					// Merged at the end of the scan
+} scan_worker_t;
+
+/**
+ * @brief Function that gets the default number of scanner threads:
+ * one per CPU, at least 4 because the threads mostly wait for the metadata I/O.
+ * 
+ * @return int	Number of threads.
+ */
+int dir_scan_default_threads() {
+	#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		int cpus = (int)info.dwNumberOfProcessors;
+	#else
+		int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	#endif
+	if (cpus < 4)
+		cpus = 4;
+	return cpus > DIR_SCAN_MAX_THREADS ? DIR_SCAN_MAX_THREADS : cpus;
+}
+
+/**
+ * @brief Function that pushes a directory at the bottom of a deque (the owner's end).
+ * 
+ * @param deque		The deque.
+ * @param task		The directory.
+ * 
+ * @return int		0 if success, -1 if the deque can't grow.
+ */
+static int scan_deque_push(scan_deque_t *deque, scan_task_t task) {
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->bottom - deque->top == deque->capacity) {
+
+		// Grow the ring buffer (the tasks are copied in order)
+		size_t capacity = deque->capacity == 0 ? DIR_SCAN_DEQUE_INITIAL : deque->capacity * 2;
+		scan_task_t *tasks = malloc(capacity * sizeof(scan_task_t));
+		if (tasks == NULL) {
+			pthread_mutex_unlock(&deque->mutex);
+			ERROR_PRINT("scan_deque_push(): Unable to grow the deque to %zu directories\n", capacity);
+			return -1;
+		}
+		size_t i;
+		for (i = deque->top; i < deque->bottom; i++)
+			tasks[i - deque->top] = deque->tasks[i % deque->capacity];
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->bottom -= deque->top;
+		deque->top = 0;
+		deque->capacity = capacity;
+	}
+	deque->tasks[deque->bottom++ % deque->capacity] = task;
+	pthread_mutex_unlock(&deque->mutex);
+	return 0;
+}
+
+/**
+ * @brief Function that takes a directory from a deque: the last pushed one for the owner (depth first, warm caches),
+ * the oldest one for a thief (closest to the root, so the biggest amount of work).
+ * 
+ * @param deque		The deque.
+ * @param task		The directory taken.
+ * @param steal		1 to take from the top (thief), 0 from the bottom (owner).
+ * 
+ * @return int		0 if a directory was taken, -1 if the deque is empty.
+ */
+static int scan_deque_take(scan_deque_t *deque, scan_task_t *task, int steal) {
+	pthread_mutex_lock(&deque->mutex);
+	int code = -1;
+	if (deque->bottom != deque->top) {
+		if (steal)
+			*task = deque->tasks[deque->top++ % deque->capacity];
+		else
+			*task = deque->tasks[--deque->bottom % deque->capacity];
+		code = 0;
+	}
+	pthread_mutex_unlock(&deque->mutex);
+	return code;
+}
+
+/**
+ * @brief Function that handles one entry of a directory: filter, handler, and queue of the subdirectories.
+ * 
+ * @param worker		The scanner thread (its path buffer holds the path of the entry).
+ * @param length		Length of the path.
+ * @param is_directory	1 if the entry is a directory.
+ * @param st_mode		Mode of the entry (0 if unknown).
+ * @param size			Size of the entry.
+ * @param mtime_ns		Modification time of the entry.
+ * @param name_offset	Offset of the name of the entry in its path.
+ * @param directory_fd	Directory fd of the parent (-1 if not opened).
+ * 
+ * @return int			0 if success, -1 if the scan must stop.
+ */
+static int scan_handle_entry(scan_worker_t *worker, size_t length, int is_directory, unsigned int st_mode, unsigned long long size, long long mtime_ns, size_t name_offset, int directory_fd) {
+	dir_scanner_t *scanner = worker->scanner;
+
+	// Skip the ignored paths and subtrees
+	if (sync_ignore_match(scanner->options->ignore, worker->path, is_directory))
+		return 0;
+
+	// Give the entry to the consumer
+	if (is_directory) worker->stats.directories++;
+	else { worker->stats.files++; worker->stats.bytes += size; }
+	if (scanner->options->handler != NULL) {
+		scan_entry_t entry = { worker->path, length, is_directory, st_mode, size, mtime_ns, worker->path + name_offset, directory_fd };
+		if (scanner->options->handler(&entry, scanner->options->arg) == -1) {
+			scanner->stop = 1;
+			return -1;
+		}
+	}
+
+	// Queue the subdirectory on the deque of this thread
+	if (is_directory) {
+		scan_task_t task;
+		task.length = length + 1;
+		task.path = malloc(task.length + 1);
+		ERROR_HANDLE_PTR_RETURN_INT(task.path, "scan_handle_entry(): Unable to queue the directory '%s'\n", worker->path);
+		memcpy(task.path, worker->path, length);
+		task.path[length] = '/';
+		task.path[length + 1] = '\0';
+		__sync_fetch_and_add(&scanner->pending, 1);
+		if (scan_deque_push(&scanner->deques[worker->index], task) == -1) {
+			__sync_fetch_and_sub(&scanner->pending, 1);
+			free(task.path);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that reads a directory and handles its entries.
+ * On Linux, the directory is opened relative to the root fd, read with getdents64
+ * and its entries are stat-ed with statx relative to its fd (no path resolution from '/').
+ * 
+ * @param worker	The scanner thread.
+ * @param task		The directory.
+ * 
+ * @return int		0 if success, -1 if the scan must stop (unreadable directories are counted and skipped).
+ */
+static int scan_directory(scan_worker_t *worker, scan_task_t *task) {
+	dir_scanner_t *scanner = worker->scanner;
+	int want_stat = scanner->options->want_stat;
+	memcpy(worker->path, task->path, task->length + 1);
+
+	#ifdef DIR_SCAN_GETDENTS
+
+	// Open the directory
+	int fd = openat(scanner->root_fd, task->length == 0 ? "." : task->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1) {
+		WARNING_PRINT("scan_directory(): Unable to open the directory '%s'\n", task->path);
+		errno = 0;
+		worker->stats.errors++;
+		return 0;
+	}
+
+	// Read the entries by batches
+	long bytes = 0;
+	while (!scanner->stop && (bytes = syscall(SYS_getdents64, fd, worker->buffer, DIR_SCAN_BUFFER_SIZE)) > 0) {
+		long offset = 0;
+		while (offset < bytes) {
+			linux_dirent64_t *entry = (linux_dirent64_t *)(worker->buffer + offset);
+			offset += entry->d_reclen;
+			const char *name = entry->d_name;
+			if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+				continue;
+
+			// Path of the entry
+			size_t name_length = strlen(name);
+			if (task->length + name_length + 2 >= SYNC_IGNORE_MAX_PATH) {
+				WARNING_PRINT("scan_directory(): Skipping '%s%s' (path too long)\n", task->path, name);
+				worker->stats.errors++;
+				continue;
+			}
+			memcpy(worker->path + task->length, name, name_length + 1);
+
+			// Type, and the metadata if requested (the symbolic links are not followed)
+			int is_directory = entry->d_type == DT_DIR;
+			unsigned int mode = 0;
+			unsigned long long size = 0;
+			long long mtime_ns = 0;
+			if (want_stat || entry->d_type == DT_UNKNOWN) {
+				struct statx stx;
+				if (statx(fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME, &stx) == -1) {
+					errno = 0;
+					worker->stats.errors++;
+					continue;
+				}
+				is_directory = S_ISDIR(stx.stx_mode);
+				mode = stx.stx_mode;
+				size = stx.stx_size;
+				mtime_ns = (long long)stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec;
+			}
+			if (scan_handle_entry(worker, task->length + name_length, is_directory, mode, is_directory ? 0 : size, mtime_ns, task->length, fd) == -1) {
+				close(fd);
+				return -1;
+			}
+		}
+	}
+	if (bytes == -1) {
+		WARNING_PRINT("scan_directory(): Error while reading the directory '%s'\n", task->path);
+		errno = 0;
+		worker->stats.errors++;
+	}
+	close(fd);
+
+	#else
+
+	// Portable version: opendir() and stat() on the full paths
+	char full_path[SYNC_IGNORE_MAX_PATH * 2];
+	snprintf(full_path, sizeof(full_path), "%s%s", scanner->root, task->path);
+	DIR *directory = opendir(full_path);
+	if (directory == NULL) {
+		WARNING_PRINT("scan_directory(): Unable to open the directory '%s'\n", full_path);
+		errno = 0;
+		worker->stats.errors++;
+		return 0;
+	}
+	struct dirent *entry;
+	int code;
+	while (!scanner->stop && (entry = readdir(directory)) != NULL) {
+		const char *name = entry->d_name;
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+			continue;
+		size_t name_length = strlen(name);
+		if (task->length + name_length + 2 >= SYNC_IGNORE_MAX_PATH) {
+			worker->stats.errors++;
+			continue;
+		}
+		memcpy(worker->path + task->length, name, name_length + 1);
+		snprintf(full_path, sizeof(full_path), "%s%s", scanner->root, worker->path);
+		struct stat st;
+		#ifdef _WIN32
+			code = stat(full_path, &st);
+		#else
+			code = lstat(full_path, &st);		// The symbolic links are not followed (as with getdents64)
+		#endif
+		if (code == -1) {
+			errno = 0;
+			worker->stats.errors++;
+			continue;
+		}
+		int is_directory = S_ISDIR(st.st_mode);
+		if (scan_handle_entry(worker, task->length + name_length, is_directory, want_stat ? (unsigned int)st.st_mode : 0, (want_stat && !is_directory) ? (unsigned long long)st.st_size : 0, want_stat ? (long long)st.st_mtime * 1000000000LL : 0, task->length, -1) == -1) {
+			closedir(directory);
+			return -1;
+		}
+	}
+	closedir(directory);
+
+	#endif
+	return 0;
+}
+
+/**
+ * @brief Function run by the scanner threads: read the directories of the own deque,
+ * steal from the other threads when it's empty, and stop when no directory is left anywhere.
+ * 
+ * @param arg	The scan_worker_t of the thread.
+ * 
+ * @return thread_return_type	0
+ */
+static thread_return_type scan_worker_thread(thread_param_type arg) {
+	scan_worker_t *worker = (scan_worker_t*)arg;
+	dir_scanner_t *scanner = worker->scanner;
+	unsigned int victim = (unsigned int)worker->index;
+	while (!scanner->stop) {
+
+		// Own work first, then steal the oldest directory of another thread
+		scan_task_t task;
+		int code = scan_deque_take(&scanner->deques[worker->index], &task, 0);
+		int i;
+		for (i = 1; code == -1 && i < scanner->threads; i++) {
+			victim = (victim + 1) % scanner->threads;
+			if (victim != (unsigned int)worker->index && (code = scan_deque_take(&scanner->deques[victim], &task, 1)) == 0)
+				worker->stats.steals++;
+		}
+
+		// Read the directory
+		if (code == 0) {
+			if (scan_directory(worker, &task) == -1)
+				scanner->stop = 1;
+			free(task.path);
+			__sync_fetch_and_sub(&scanner->pending, 1);
+			continue;
+		}
+
+		// Nothing to take: the scan is over when no directory is queued or being read
+		if (__atomic_load_n(&scanner->pending, __ATOMIC_ACQUIRE) == 0)
+			break;
+		#ifdef _WIN32
+			Sleep(0);
+		#else
+			struct timespec idle = { 0, DIR_SCAN_IDLE_US * 1000 };
+			nanosleep(&idle, NULL);
+		#endif
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that walks a directory tree with several threads and streams its entries to a handler.
+ * Each thread owns a deque of directories to read, the idle threads steal from the others.
+ * The entries are given in no particular order, concurrently from the scanner threads.
+ * 
+ * @param root		Root of the tree (not given to the handler).
+ * @param options	Settings of the scan (threads, metadata, ignore patterns and handler).
+ * @param stats		Statistics of the scan (can be NULL).
+ * 
+ * @return int		0 if the tree was walked, -1 if the root can't be opened or the scan was stopped.
+ */
+int dir_scan(const char *root, const dir_scan_options_t *options, dir_scan_stats_t *stats) {
+	return dir_scan_at(AT_FDCWD, root, options, stats);
+}
+
+/**
+ * @brief Function that walks a directory tree like dir_scan(), its root being opened relative to a directory fd
+ * without following a symbolic link (only with the Linux scanner, the portable one needs AT_FDCWD).
+ * 
+ * @param directory_fd	Directory fd of the parent of the root (AT_FDCWD for a path).
+ * @param root			Root of the tree, relative to the directory fd.
+ * @param options		Settings of the scan (threads, metadata, ignore patterns and handler).
+ * @param stats			Statistics of the scan (can be NULL).
+ * 
+ * @return int			0 if the tree was walked, -1 if the root can't be opened or the scan was stopped.
+ */
+int dir_scan_at(int directory_fd, const char *root, const dir_scan_options_t *options, dir_scan_stats_t *stats) {
+	long long start_time = get_time_us();
+
+	// Prepare the scanner
+	dir_scanner_t *scanner = calloc(1, sizeof(dir_scanner_t));
+	ERROR_HANDLE_PTR_RETURN_INT(scanner, "dir_scan(): Unable to allocate the scanner\n");
+	scanner->options = options;
+	size_t root_length = strlen(root);
+	int code = (root_length + 2 < sizeof(scanner->root)) ? 0 : -1;
+	if (code == -1) free(scanner);
+	ERROR_HANDLE_INT_RETURN_INT(code, "dir_scan(): Root path too long '%s'\n", root);
+	strcpy(scanner->root, root);
+	if (root_length > 0 && root[root_length - 1] != '/')
+		strcat(scanner->root, "/");
+	#ifdef DIR_SCAN_GETDENTS
+		scanner->root_fd = openat(directory_fd, root, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (directory_fd != AT_FDCWD ? O_NOFOLLOW : 0));
+		code = scanner->root_fd;
+		if (code == -1) free(scanner);
+		ERROR_HANDLE_INT_RETURN_INT(code, "dir_scan(): Unable to open the root '%s'\n", root);
+	#else
+		code = directory_fd == AT_FDCWD ? 0 : -1;
+		if (code == -1) { free(scanner); errno = EINVAL; }
+		ERROR_HANDLE_INT_RETURN_INT(code, "dir_scan(): The portable scanner can't open '%s' relative to a directory fd\n", root);
+	#endif
+	scanner->threads = options->threads > 0 ? options->threads : dir_scan_default_threads();
+	if (scanner->threads > DIR_SCAN_MAX_THREADS)
+		scanner->threads = DIR_SCAN_MAX_THREADS;
+	int i;
+	for (i = 0; i < scanner->threads; i++)
+		pthread_mutex_init(&scanner->deques[i].mutex, NULL);
+
+	// Queue the root
+	scan_task_t task = { strdup(""), 0 };
+	scanner->pending = 1;
+	code = task.path == NULL ? -1 : scan_deque_push(&scanner->deques[0], task);
+
+	// Start the threads, and wait for them
+	scan_worker_t *workers = calloc(scanner->threads, sizeof(scan_worker_t));
+	if (workers == NULL) code = -1;
+	int started = 0;
+	for (i = 0; code == 0 && i < scanner->threads; i++) {
+		workers[i].scanner = scanner;
+		workers[i].index = i;
+		workers[i].buffer = malloc(DIR_SCAN_BUFFER_SIZE);
+		if (workers[i].buffer == NULL) {
+			scanner->stop = 1;
+			code = -1;
+			break;
+		}
+		pthread_create(&workers[i].thread, NULL, scan_worker_thread, &workers[i]);
+		started++;
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+	if (scanner->stop)
+		code = -1;
+
+	// Merge the statistics
+	dir_scan_stats_t total;
+	memset(&total, 0, sizeof(dir_scan_stats_t));
+	for (i = 0; workers != NULL && i < scanner->threads; i++) {
+		total.directories += workers[i].stats.directories;
+		total.files += workers[i].stats.files;
+		total.bytes += workers[i].stats.bytes;
+		total.errors += workers[i].stats.errors;
+		total.steals += workers[i].stats.steals;
+		free(workers[i].buffer);
+	}
+	total.duration_us = get_time_us() - start_time;
+	if (stats != NULL)
+		*stats = total;
+
+	// Free the scanner (the directories left after a stop are dropped)
+	for (i = 0; i < scanner->threads; i++) {
+		while (scan_deque_take(&scanner->deques[i], &task, 0) == 0)
+			free(task.path);
+		free(scanner->deques[i].tasks);
+		pthread_mutex_destroy(&scanner->deques[i].mutex);
+	}
+	#ifdef DIR_SCAN_GETDENTS
+		close(scanner->root_fd);
+	#endif
+	int threads = scanner->threads;
+	free(workers);
+	free(scanner);
+	ERROR_HANDLE_INT_RETURN_INT(code, "dir_scan(): The scan of '%s' failed\n", root);
+	DEBUG_PRINT("dir_scan(): %lld directories and %lld files scanned in %lld us (%d threads, %lld steals, %lld errors)\n", total.directories, total.files, total.duration_us, threads, total.steals, total.errors);
+	return 0;
+}
+
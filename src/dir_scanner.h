@@ -0,0 +1,67 @@
+
+#ifndef __DIR_SCANNER_H__
+#define __DIR_SCANNER_H__
+
+#include "universal_utils.h"
+#include "universal_pthread.h"
+#include "sync_ignore.h"
+
+#define DIR_SCAN_MAX_THREADS 64
+#define DIR_SCAN_BUFFER_SIZE (64 * 1024)			// Bytes of directory entries read at once (getdents64)
+
+// Entry found by the scanner
+typedef struct scan_entry_t {
+	const char *path;				// Path relative to the root (only valid during the call of the handler)
+	size_t path_length;
+	int is_directory;
+	unsigned int mode;				// Type and permissions (0 if not requested)
+	unsigned long long size;		// Size in bytes (0 if not requested)
+	long long mtime_ns;				// Modification time in nanoseconds (0 if not requested)
+	const char *name;				// Last component of the path
+	int directory_fd;				// Directory fd of the parent, for the *at calls (-1 without them)
+} scan_entry_t;
+
+// Function receiving the entries, called concurrently by the scanner threads (returns -1 to stop the scan)
+typedef int (*scan_entry_handler)(const scan_entry_t *entry, void *arg);
+
+// Settings of a scan
+typedef struct dir_scan_options_t {
+	int threads;					// Scanner threads (0 for one per CPU)
+	int want_stat;					// 1 to fill the mode, size and mtime of the entries (one statx per entry)
+	const sync_ignore_t *ignore;	// Skipped paths, their subtrees are not walked (NULL for none)
+	scan_entry_handler handler;
+	void *arg;						// Argument of the handler
+} dir_scan_options_t;
+
+// Statistics of a scan
+typedef struct dir_scan_stats_t {
+	long long directories;
+	long long files;				// Every entry that is not a directory
+	long long bytes;				// Total size of the files (when want_stat is set)
+	long long errors;				// Directories or entries that couldn't be read
+	long long steals;				// Directories taken from the queue of another thread
+	long long duration_us;
+} dir_scan_stats_t;
+
+// Directory waiting to be read, owned by one thread's deque
+typedef struct scan_task_t {
+	char *path;						// Relative path ending with a '/' ("" for the root)
+	size_t length;
+} scan_task_t;
+
+// Deque of a scanner thread: the owner pushes and pops at the bottom, the other threads steal at the top
+typedef struct scan_deque_t {
+	pthread_mutex_t mutex;
+	scan_task_t *tasks;				// Ring buffer
+	size_t capacity;
+	size_t top;
+	size_t bottom;
+} scan_deque_t;
+
+// Function prototypes
+int dir_scan(const char *root, const dir_scan_options_t *options, dir_scan_stats_t *stats);
+int dir_scan_at(int directory_fd, const char *root, const dir_scan_options_t *options, dir_scan_stats_t *stats);
+int dir_scan_default_threads();
+
+#endif
+
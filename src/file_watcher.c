@@ -16,15 +16,18 @@
  * @param directory_path	Path to the directory to monitor
  * @param file_created		Function to call when a file is created
  * @param file_modified		Function to call when a file is modified
+ * @param file_closed		Function to call when a file opened for writing is closed (NULL to ignore, never called on Windows)
  * @param file_deleted		Function to call when a file is deleted
  * @param file_renamed		Function to call when a file is renamed
+ * @param ignore			Compiled ignore patterns, the matching paths are never reported (NULL to report everything)
  * 
  * @return int				0 if success, -1 otherwise
  */
-int monitor_directory(const char *directory_path, file_created_handler file_created, file_modified_handler file_modified, file_deleted_handler file_deleted, file_renamed_handler file_renamed) {
+int monitor_directory(const char *directory_path, file_created_handler file_created, file_modified_handler file_modified, file_closed_handler file_closed, file_deleted_handler file_deleted, file_renamed_handler file_renamed, const sync_ignore_t *ignore) {
 
 	// Error code handler
 	int code;
+	(void)file_closed;
 
 	// Create the directory handle
 	HANDLE directory_handle = CreateFile(
@@ -97,6 +100,11 @@ int monitor_directory(const char *directory_path, file_created_handler file_crea
 				WARNING_PRINT("monitor_directory(): Skipping event about folder: '%s'\n", filepath_new_full);
 			}
 
+			// Skip the ignored paths (the old name of a rename is checked with the new one)
+			else if (notifyInfo->Action != FILE_ACTION_RENAMED_OLD_NAME && notifyInfo->Action != FILE_ACTION_RENAMED_NEW_NAME && sync_ignore_match(ignore, filepath_new, 0)) {
+				DEBUG_PRINT("monitor_directory(): Ignoring event about '%s'\n", filepath_new);
+			}
+
 			// Call the appropriate function
 			else switch (notifyInfo->Action) {
 
@@ -119,10 +127,20 @@ int monitor_directory(const char *directory_path, file_created_handler file_crea
 					strcpy(filepath_old, filepath_new);
 					break;
 				
-				case FILE_ACTION_RENAMED_NEW_NAME:
-					code = file_renamed(filepath_old, filepath_new);
+				case FILE_ACTION_RENAMED_NEW_NAME: {
+					int old_ignored = sync_ignore_match(ignore, filepath_old, 0);
+					int new_ignored = sync_ignore_match(ignore, filepath_new, 0);
+					if (old_ignored && new_ignored)
+						code = 0;
+					else if (old_ignored)
+						code = file_created(filepath_new);
+					else if (new_ignored)
+						code = file_deleted(filepath_old);
+					else
+						code = file_renamed(filepath_old, filepath_new);
 					ERROR_HANDLE_INT_RETURN_INT(code, "monitor_directory(): Error when calling file_renamed() function\n");
 					break;
+				}
 				
 				default:
 					WARNING_PRINT("monitor_directory(): Unknown action: %ld\n", notifyInfo->Action);
@@ -147,9 +165,125 @@ int monitor_directory(const char *directory_path, file_created_handler file_crea
 #else
 
 #include <sys/inotify.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <poll.h>
 
 #define WATCH_EVENT_SIZE (sizeof(struct inotify_event))
 #define WATCH_BUFFER_SIZE (1024 * (WATCH_EVENT_SIZE + 16))
+#define WATCH_MOVE_TIMEOUT_MS 50		// Time to wait for the IN_MOVED_TO of a pending IN_MOVED_FROM ending a batch
+
+/**
+ * @brief Reports the pending IN_MOVED_FROM as a deletion (the file was moved outside the directory)
+ * 
+ * @param watcher	Handlers and rename pairing state
+ * 
+ * @return int		0 if success (or nothing pending), -1 if the handler failed
+ */
+int flush_watcher_moved(watcher_events_t *watcher) {
+	if (watcher->moved_from[0] == '\0')
+		return 0;
+	int code = watcher->file_deleted(watcher->moved_from);
+	watcher->moved_from[0] = '\0';
+	ERROR_HANDLE_INT_RETURN_INT(code, "flush_watcher_moved(): Error in file_deleted_handler\n");
+	return 0;
+}
+
+/**
+ * @brief Calls the handlers of the events read from an inotify instance
+ * (separated from monitor_directory() so the parsing can be benchmarked)
+ * 
+ * @param watcher	Handlers and rename pairing state (moved_from must start empty)
+ * @param buffer	Events read from the inotify instance
+ * @param length	Number of bytes read
+ * 
+ * @return int		0 if success, -1 if a handler failed
+ */
+int handle_watcher_events(watcher_events_t *watcher, const void *buffer, size_t length) {
+
+	// Error code handler
+	int code;
+
+	// For each event in the buffer (there can be multiple events in the buffer)
+	const byte *ptr = buffer;
+	while (ptr < ((const byte*)buffer + length)) {
+
+		// Get the event from the buffer
+		const struct inotify_event *event = (const struct inotify_event *)ptr;
+
+		// A file moved outside the directory is a deletion
+		if (watcher->moved_from[0] != '\0' && !((event->mask & IN_MOVED_TO) && event->cookie == watcher->moved_cookie)) {
+			code = flush_watcher_moved(watcher);
+			ERROR_HANDLE_INT_RETURN_INT(code, "handle_watcher_events(): Error while flushing the moved file\n");
+		}
+
+		// If the event is valid and its path is not ignored
+		int ignored = event->len > 0 && sync_ignore_match(watcher->ignore, event->name, (event->mask & IN_ISDIR) != 0);
+		if (ignored) {
+
+			// A file renamed to an ignored name is gone for the synchronization
+			if ((event->mask & IN_MOVED_TO) && watcher->moved_from[0] != '\0' && event->cookie == watcher->moved_cookie) {
+				code = watcher->file_deleted(watcher->moved_from);
+				watcher->moved_from[0] = '\0';
+				ERROR_HANDLE_INT_RETURN_INT(code, "handle_watcher_events(): Error in file_deleted_handler\n");
+			}
+		}
+		else if (event->len > 0) {
+
+			///// Call the appropriate handler depending on the event type
+			// If the file was created
+			if (event->mask & IN_CREATE) {
+				code = watcher->file_created(event->name);
+				ERROR_HANDLE_INT_RETURN_INT(code, "handle_watcher_events(): Error in file_created_handler\n");
+			}
+
+			// If the file was modified
+			if (event->mask & IN_MODIFY) {
+				code = watcher->file_modified(event->name);
+				ERROR_HANDLE_INT_RETURN_INT(code, "handle_watcher_events(): Error in file_modified_handler\n");
+			}
+
+			// If the file opened for writing was closed (its content is complete)
+			if ((event->mask & IN_CLOSE_WRITE) && watcher->file_closed != NULL) {
+				code = watcher->file_closed(event->name);
+				ERROR_HANDLE_INT_RETURN_INT(code, "handle_watcher_events(): Error in file_closed_handler\n");
+			}
+
+			// If the file was deleted
+			if (event->mask & IN_DELETE) {
+				code = watcher->file_deleted(event->name);
+				ERROR_HANDLE_INT_RETURN_INT(code, "handle_watcher_events(): Error in file_deleted_handler\n");
+			}
+
+			// If the file was renamed, wait for the new name (same cookie, a file renamed from an ignored name is a creation)
+			if (event->mask & IN_MOVED_FROM) {
+				strcpy(watcher->moved_from, event->name);
+				watcher->moved_cookie = event->cookie;
+			}
+
+			// New name of a renamed file (a file moved from outside the directory is a creation)
+			if (event->mask & IN_MOVED_TO) {
+				if (watcher->moved_from[0] != '\0' && event->cookie == watcher->moved_cookie) {
+					code = watcher->file_renamed(watcher->moved_from, event->name);
+					watcher->moved_from[0] = '\0';
+					ERROR_HANDLE_INT_RETURN_INT(code, "handle_watcher_events(): Error in file_renamed_handler\n");
+				}
+				else {
+					code = watcher->file_created(event->name);
+					ERROR_HANDLE_INT_RETURN_INT(code, "handle_watcher_events(): Error in file_created_handler\n");
+				}
+			}
+		}
+
+		// Move to the next event
+		ptr += WATCH_EVENT_SIZE + event->len;
+	}
+
+	// Return success
+	return 0;
+}
 
 /**
  * @brief Monitor a directory for file creation, modification and deletion
@@ -157,12 +291,14 @@ int monitor_directory(const char *directory_path, file_created_handler file_crea
  * @param directory_path	Path to the directory to monitor
  * @param file_created		Function to call when a file is created
  * @param file_modified		Function to call when a file is modified
+ * @param file_closed		Function to call when a file opened for writing is closed (NULL to ignore, never called on Windows)
  * @param file_deleted		Function to call when a file is deleted
  * @param file_renamed		Function to call when a file is renamed
+ * @param ignore			Compiled ignore patterns, the matching paths are never reported (NULL to report everything)
  * 
  * @return int				0 if success, -1 otherwise
  */
-int monitor_directory(const char *directory_path, file_created_handler file_created, file_modified_handler file_modified, file_deleted_handler file_deleted, file_renamed_handler file_renamed) {
+int monitor_directory(const char *directory_path, file_created_handler file_created, file_modified_handler file_modified, file_closed_handler file_closed, file_deleted_handler file_deleted, file_renamed_handler file_renamed, const sync_ignore_t *ignore) {
 
 	// Error code handler
 	int code;
@@ -178,51 +314,26 @@ int monitor_directory(const char *directory_path, file_created_handler file_crea
 	// Print the directory path
 	INFO_PRINT("Monitoring directory: %s\n", directory_path);
 
-	// Prepare the buffer
+	// Prepare the buffer and the handlers
 	byte buffer[WATCH_BUFFER_SIZE];
-	size_t bytesRead;
+	ssize_t bytesRead;
+	watcher_events_t watcher = { file_created, file_modified, file_closed, file_deleted, file_renamed, ignore, "", 0 };
 
 	// Read the events
 	while ((bytesRead = read(fd, buffer, WATCH_BUFFER_SIZE)) > 0) {
-
-		// For each event in the buffer (there can be multiple events in the buffer)
-		byte *ptr = buffer;
-		while (ptr < (buffer + bytesRead)) {
-
-			// Get the event from the buffer
-			struct inotify_event *event = (struct inotify_event *)ptr;
-
-			// If the event is valid
-			if (event->len > 0) {
-
-				///// Call the appropriate handler depending on the event type
-				// If the file was created
-				if (event->mask & IN_CREATE) {
-					code = file_created(event->name);
-					ERROR_HANDLE_INT_RETURN_INT(code, "monitor_directory(): Error in file_created_handler\n");
-				}
-
-				// If the file was modified
-				if (event->mask & IN_MODIFY) {
-					code = file_modified(event->name);
-					ERROR_HANDLE_INT_RETURN_INT(code, "monitor_directory(): Error in file_modified_handler\n");
-				}
-
-				// If the file was deleted
-				if (event->mask & IN_DELETE) {
-					code = file_deleted(event->name);
-					ERROR_HANDLE_INT_RETURN_INT(code, "monitor_directory(): Error in file_deleted_handler\n");
-				}
-
-				// If the file was renamed
-				if (event->mask & IN_MOVED_FROM) {
-					code = file_renamed(event->name, NULL);
-					ERROR_HANDLE_INT_RETURN_INT(code, "monitor_directory(): Error in file_renamed_handler\n");
-				}
+		code = handle_watcher_events(&watcher, buffer, bytesRead);
+		ERROR_HANDLE_INT_RETURN_INT(code, "monitor_directory(): Error while handling the events\n");
+
+		// A batch ending with an IN_MOVED_FROM: without its IN_MOVED_TO shortly after, the file left the directory
+		if (watcher.moved_from[0] != '\0') {
+			struct pollfd pfd = { fd, POLLIN, 0 };
+			code = poll(&pfd, 1, WATCH_MOVE_TIMEOUT_MS);
+			if (code == -1 && errno == EINTR)
+				errno = 0;
+			if (code == 0) {
+				code = flush_watcher_moved(&watcher);
+				ERROR_HANDLE_INT_RETURN_INT(code, "monitor_directory(): Error while flushing the moved file\n");
 			}
-
-			// Move to the next event
-			ptr += WATCH_EVENT_SIZE + event->len;
 		}
 	}
 
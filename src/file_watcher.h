@@ -2,13 +2,36 @@
 #ifndef __FILE_WATCHER_H__
 #define __FILE_WATCHER_H__
 
+#include <stddef.h>
+#include "sync_ignore.h"
+
 typedef int (*file_action_handler)(const char *filepath);
 typedef int (*file_renamed_handler)(const char *filepath_old, const char *filepath_new);
 typedef file_action_handler file_created_handler;
 typedef file_action_handler file_modified_handler;
+typedef file_action_handler file_closed_handler;
 typedef file_action_handler file_deleted_handler;
 
-int monitor_directory(const char *directory_path, file_created_handler file_created, file_modified_handler file_modified, file_deleted_handler file_deleted, file_renamed_handler file_renamed);
+#ifndef _WIN32
+
+// Handlers and rename pairing state of a watched directory
+typedef struct watcher_events_t {
+	file_created_handler file_created;
+	file_modified_handler file_modified;
+	file_closed_handler file_closed;
+	file_deleted_handler file_deleted;
+	file_renamed_handler file_renamed;
+	const sync_ignore_t *ignore;	// Paths never reported (NULL to report everything)
+	char moved_from[256];			// Name of the last IN_MOVED_FROM event waiting for its IN_MOVED_TO (NAME_MAX + 1)
+	unsigned int moved_cookie;
+} watcher_events_t;
+
+int handle_watcher_events(watcher_events_t *watcher, const void *buffer, size_t length);
+int flush_watcher_moved(watcher_events_t *watcher);
+
+#endif
+
+int monitor_directory(const char *directory_path, file_created_handler file_created, file_modified_handler file_modified, file_closed_handler file_closed, file_deleted_handler file_deleted, file_renamed_handler file_renamed, const sync_ignore_t *ignore);
 
 #endif
 
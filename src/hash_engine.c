@@ -0,0 +1,720 @@
+
+#ifndef _WIN32
+	#define _GNU_SOURCE
+#endif
+
+#include "hash_engine.h"
+#include "universal_pthread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#include <immintrin.h>
+	#define HASH_ENGINE_HAS_AVX2 1
+	#ifdef __SSE2__
+		#define HASH_ENGINE_HAS_SSE2 1
+	#endif
+#endif
+
+#ifdef _WIN32
+	#include <io.h>
+#endif
+
+// Constants of the mixing functions (the primes of xxHash)
+#define PRIME32_1 0x9E3779B1U
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+// Layout of the long inputs: stripes of 64 bytes, each one mixed with the key shifted by one word,
+// and the accumulators scrambled after each block of 16 stripes
+#define HASH_STRIPE_SIZE 64
+#define HASH_STRIPES_PER_BLOCK 16
+#define HASH_BLOCK_SIZE (HASH_STRIPE_SIZE * HASH_STRIPES_PER_BLOCK)
+#define HASH_KEY_WORDS 24
+#define HASH_SCRAMBLE_KEY 16						// Words of the key used to scramble the accumulators
+#define HASH_LAST_STRIPE_KEY 7						// Words of the key used for the last (overlapping) stripe
+#define HASH_SHORT_MAX 128							// Inputs up to this size don't use the accumulators
+
+// Key of the hash (splitmix64 output, any random words work)
+static const unsigned long long hash_secret[HASH_KEY_WORDS] = {
+	0xBBD2EA4D8F45DC1EULL, 0x25524016E7B1806AULL, 0xD7100A74993D1BA2ULL, 0x9EFC6F4ACEE9068AULL,
+	0xA1B4B0FA8604FD80ULL, 0x22CE52F6B41A2883ULL, 0x172846117ABF94CBULL, 0x62185E26F42622C3ULL,
+	0x201723829A3E3B89ULL, 0x20E73202DADE5994ULL, 0x82F4D9D06F052BA8ULL, 0xBD51B31C7B29658AULL,
+	0x0DA2DC9648B3D068ULL, 0x758D728C8B2E4595ULL, 0x13819D3BDECEAB23ULL, 0x99F7BD711F8C86E4ULL,
+	0xC71FE0E903956D50ULL, 0x6D226CB07C091733ULL, 0x9EBBC1FCC0FE1EB2ULL, 0xEEF2D68F53D37532ULL,
+	0x1D3CAB153B5F6C71ULL, 0xA45AFAD466D98DFCULL, 0x31EB46471272BCE2ULL, 0x4D8A4F6B7E2F0C3CULL,
+};
+
+// Implementation of the inner loop (the result is the same for all of them)
+typedef struct hash_backend_t {
+	const char *name;
+	void (*accumulate)(unsigned long long *acc, const byte *data, size_t stripes, const unsigned long long *key);
+	void (*scramble)(unsigned long long *acc, const unsigned long long *key);
+	int (*supported)();
+} hash_backend_t;
+
+
+///// Mixing functions
+
+/**
+ * @brief Functions that read little endian words (the hashes are exchanged between hosts).
+ */
+static inline unsigned int hash_read32(const byte *p) {
+	unsigned int value;
+	memcpy(&value, p, sizeof(value));
+	#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		value = __builtin_bswap32(value);
+	#endif
+	return value;
+}
+static inline unsigned long long hash_read64(const byte *p) {
+	unsigned long long value;
+	memcpy(&value, p, sizeof(value));
+	#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		value = __builtin_bswap64(value);
+	#endif
+	return value;
+}
+static inline void hash_write64(byte *p, unsigned long long value) {
+	#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		value = __builtin_bswap64(value);
+	#endif
+	memcpy(p, &value, sizeof(value));
+}
+
+static inline unsigned long long hash_rotl64(unsigned long long x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * @brief Function that multiplies two words into 128 bits and folds the result into 64 bits.
+ */
+static inline unsigned long long hash_mul128_fold64(unsigned long long a, unsigned long long b) {
+	#ifdef __SIZEOF_INT128__
+		__extension__ typedef unsigned __int128 hash_uint128_t;
+		hash_uint128_t product = (hash_uint128_t)a * b;
+		return (unsigned long long)product ^ (unsigned long long)(product >> 64);
+	#else
+		unsigned long long lo_lo = (a & 0xFFFFFFFFULL) * (b & 0xFFFFFFFFULL);
+		unsigned long long hi_lo = (a >> 32) * (b & 0xFFFFFFFFULL);
+		unsigned long long lo_hi = (a & 0xFFFFFFFFULL) * (b >> 32);
+		unsigned long long hi_hi = (a >> 32) * (b >> 32);
+		unsigned long long cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFFULL) + lo_hi;
+		unsigned long long upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+		unsigned long long lower = (cross << 32) | (lo_lo & 0xFFFFFFFFULL);
+		return lower ^ upper;
+	#endif
+}
+
+/**
+ * @brief Functions that spread the entropy of a word over all its bits.
+ */
+static inline unsigned long long hash_avalanche(unsigned long long h) {
+	h ^= h >> 37;
+	h *= 0x165667919E3779F9ULL;
+	return h ^ (h >> 32);
+}
+static inline unsigned long long hash_avalanche_xxh64(unsigned long long h) {
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	return h ^ (h >> 32);
+}
+static inline unsigned long long hash_rrmxmx(unsigned long long h, size_t size) {
+	h ^= hash_rotl64(h, 49) ^ hash_rotl64(h, 24);
+	h *= 0x9FB21C651E98DF25ULL;
+	h ^= (h >> 35) + size;
+	h *= 0x9FB21C651E98DF25ULL;
+	return h ^ (h >> 28);
+}
+
+/**
+ * @brief Function that mixes 16 bytes of input with 2 words of the key.
+ */
+static inline unsigned long long hash_mix16(const byte *p, const unsigned long long *key, unsigned long long seed) {
+	return hash_mul128_fold64(hash_read64(p) ^ (key[0] + seed), hash_read64(p + 8) ^ (key[1] - seed));
+}
+
+
+///// Inner loop of the long inputs
+
+/**
+ * @brief Function that accumulates stripes of 64 bytes into the 8 accumulators (portable version).
+ * 
+ * @param acc		The accumulators.
+ * @param data		First stripe.
+ * @param stripes	Number of stripes.
+ * @param key		Key of the first stripe (shifted by one word for each stripe).
+ * 
+ * @return void
+ */
+static void hash_accumulate_scalar(unsigned long long *acc, const byte *data, size_t stripes, const unsigned long long *key) {
+	size_t s;
+	int i;
+	for (s = 0; s < stripes; s++) {
+		const byte *p = data + s * HASH_STRIPE_SIZE;
+		for (i = 0; i < 8; i++) {
+			unsigned long long value = hash_read64(p + 8 * i);
+			unsigned long long keyed = value ^ key[s + i];
+			acc[i ^ 1] += value;
+			acc[i] += (keyed & 0xFFFFFFFFULL) * (keyed >> 32);
+		}
+	}
+}
+
+/**
+ * @brief Function that scrambles the accumulators at the end of a block (portable version).
+ * 
+ * @param acc	The accumulators.
+ * @param key	Key of the scrambling.
+ * 
+ * @return void
+ */
+static void hash_scramble_scalar(unsigned long long *acc, const unsigned long long *key) {
+	int i;
+	for (i = 0; i < 8; i++) {
+		unsigned long long a = acc[i];
+		a ^= a >> 47;
+		a ^= key[i];
+		acc[i] = a * PRIME32_1;
+	}
+}
+
+static int hash_supported_always() {
+	return 1;
+}
+
+#ifdef HASH_ENGINE_HAS_SSE2
+/**
+ * @brief SSE2 version of hash_accumulate_scalar() (2 accumulators per register).
+ */
+static void hash_accumulate_sse2(unsigned long long *acc, const byte *data, size_t stripes, const unsigned long long *key) {
+	__m128i a[4];
+	int i;
+	for (i = 0; i < 4; i++)
+		a[i] = _mm_loadu_si128((const __m128i*)(acc + 2 * i));
+	size_t s;
+	for (s = 0; s < stripes; s++) {
+		const byte *p = data + s * HASH_STRIPE_SIZE;
+		for (i = 0; i < 4; i++) {
+			__m128i value = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+			__m128i keyed = _mm_xor_si128(value, _mm_loadu_si128((const __m128i*)(key + s + 2 * i)));
+			__m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+			__m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+			a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+		}
+	}
+	for (i = 0; i < 4; i++)
+		_mm_storeu_si128((__m128i*)(acc + 2 * i), a[i]);
+}
+
+/**
+ * @brief SSE2 version of hash_scramble_scalar().
+ */
+static void hash_scramble_sse2(unsigned long long *acc, const unsigned long long *key) {
+	const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+	int i;
+	for (i = 0; i < 4; i++) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(acc + 2 * i));
+		a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+		a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)(key + 2 * i)));
+		__m128i product_low = _mm_mul_epu32(a, prime);
+		__m128i product_high = _mm_mul_epu32(_mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+		_mm_storeu_si128((__m128i*)(acc + 2 * i), _mm_add_epi64(product_low, _mm_slli_epi64(product_high, 32)));
+	}
+}
+#endif
+
+#ifdef HASH_ENGINE_HAS_AVX2
+/**
+ * @brief AVX2 version of hash_accumulate_scalar() (4 accumulators per register, selected at runtime).
+ */
+__attribute__((target("avx2")))
+static void hash_accumulate_avx2(unsigned long long *acc, const byte *data, size_t stripes, const unsigned long long *key) {
+	__m256i a0 = _mm256_loadu_si256((const __m256i*)acc);
+	__m256i a1 = _mm256_loadu_si256((const __m256i*)(acc + 4));
+	size_t s;
+	for (s = 0; s < stripes; s++) {
+		const byte *p = data + s * HASH_STRIPE_SIZE;
+		__m256i v0 = _mm256_loadu_si256((const __m256i*)p);
+		__m256i v1 = _mm256_loadu_si256((const __m256i*)(p + 32));
+		__m256i k0 = _mm256_xor_si256(v0, _mm256_loadu_si256((const __m256i*)(key + s)));
+		__m256i k1 = _mm256_xor_si256(v1, _mm256_loadu_si256((const __m256i*)(key + s + 4)));
+		a0 = _mm256_add_epi64(a0, _mm256_add_epi64(_mm256_mul_epu32(k0, _mm256_shuffle_epi32(k0, _MM_SHUFFLE(0, 3, 0, 1))), _mm256_shuffle_epi32(v0, _MM_SHUFFLE(1, 0, 3, 2))));
+		a1 = _mm256_add_epi64(a1, _mm256_add_epi64(_mm256_mul_epu32(k1, _mm256_shuffle_epi32(k1, _MM_SHUFFLE(0, 3, 0, 1))), _mm256_shuffle_epi32(v1, _MM_SHUFFLE(1, 0, 3, 2))));
+	}
+	_mm256_storeu_si256((__m256i*)acc, a0);
+	_mm256_storeu_si256((__m256i*)(acc + 4), a1);
+}
+
+/**
+ * @brief AVX2 version of hash_scramble_scalar().
+ */
+__attribute__((target("avx2")))
+static void hash_scramble_avx2(unsigned long long *acc, const unsigned long long *key) {
+	const __m256i prime = _mm256_set1_epi32((int)PRIME32_1);
+	int i;
+	for (i = 0; i < 2; i++) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(acc + 4 * i));
+		a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+		a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i*)(key + 4 * i)));
+		__m256i product_low = _mm256_mul_epu32(a, prime);
+		__m256i product_high = _mm256_mul_epu32(_mm256_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+		_mm256_storeu_si256((__m256i*)(acc + 4 * i), _mm256_add_epi64(product_low, _mm256_slli_epi64(product_high, 32)));
+	}
+}
+
+static int hash_supported_avx2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+// Backends from the slowest to the fastest
+static const hash_backend_t hash_backends[] = {
+	{ "scalar", hash_accumulate_scalar, hash_scramble_scalar, hash_supported_always },
+	#ifdef HASH_ENGINE_HAS_SSE2
+	{ "sse2", hash_accumulate_sse2, hash_scramble_sse2, hash_supported_always },
+	#endif
+	#ifdef HASH_ENGINE_HAS_AVX2
+	{ "avx2", hash_accumulate_avx2, hash_scramble_avx2, hash_supported_avx2 },
+	#endif
+};
+#define HASH_BACKENDS_COUNT ((int)(sizeof(hash_backends) / sizeof(hash_backend_t)))
+static const hash_backend_t *hash_backend = NULL;
+
+/**
+ * @brief Function that gets the backend used, selecting the fastest one supported by the CPU on the first call.
+ * 
+ * @return const hash_backend_t*	The backend.
+ */
+static const hash_backend_t* hash_engine_current() {
+	const hash_backend_t *backend = __atomic_load_n(&hash_backend, __ATOMIC_ACQUIRE);
+	if (backend == NULL) {
+		int i;
+		for (i = HASH_BACKENDS_COUNT - 1; i > 0 && !hash_backends[i].supported(); i--);
+		backend = &hash_backends[i];
+		__atomic_store_n(&hash_backend, backend, __ATOMIC_RELEASE);
+	}
+	return backend;
+}
+
+/**
+ * @brief Function that gets the name of the implementation used by the hash functions.
+ * 
+ * @return const char*	"avx2", "sse2" or "scalar".
+ */
+const char* hash_engine_backend() {
+	return hash_engine_current()->name;
+}
+
+/**
+ * @brief Function that forces the implementation used by the hash functions (benchmarks, the hashes stay the same).
+ * 
+ * @param backend	"avx2", "sse2" or "scalar".
+ * 
+ * @return int		0 if the implementation is selected, -1 if it's unknown or not supported by the CPU.
+ */
+int hash_engine_select(const char *backend) {
+	int i;
+	for (i = 0; i < HASH_BACKENDS_COUNT; i++) {
+		if (strcmp(hash_backends[i].name, backend) == 0 && hash_backends[i].supported()) {
+			__atomic_store_n(&hash_backend, &hash_backends[i], __ATOMIC_RELEASE);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+
+///// Hash functions
+
+/**
+ * @brief Function that hashes an input of at most HASH_SHORT_MAX bytes (no accumulators).
+ * 
+ * @param p		The input.
+ * @param size	Size of the input.
+ * @param seed	Seed of the hash.
+ * 
+ * @return unsigned long long	The hash.
+ */
+static unsigned long long hash_short(const byte *p, size_t size, unsigned long long seed) {
+	const unsigned long long *key = hash_secret;
+	if (size == 0)
+		return hash_avalanche_xxh64(seed ^ key[7] ^ key[8]);
+	if (size <= 3) {
+		unsigned int combined = ((unsigned int)p[0] << 16) | ((unsigned int)p[size >> 1] << 24) | (unsigned int)p[size - 1] | ((unsigned int)size << 8);
+		return hash_avalanche_xxh64((unsigned long long)combined ^ (((key[0] ^ key[0] >> 32) & 0xFFFFFFFFULL) + seed));
+	}
+	if (size <= 8) {
+		unsigned long long input = (unsigned long long)hash_read32(p + size - 4) + ((unsigned long long)hash_read32(p) << 32);
+		return hash_rrmxmx(input ^ ((key[1] ^ key[2]) - seed), size);
+	}
+	if (size <= 16) {
+		unsigned long long low = hash_read64(p) ^ ((key[3] ^ key[4]) + seed);
+		unsigned long long high = hash_read64(p + size - 8) ^ ((key[5] ^ key[6]) - seed);
+		unsigned long long acc = size + __builtin_bswap64(low) + high + hash_mul128_fold64(low, high);
+		return hash_avalanche(acc);
+	}
+
+	// 17 to 128 bytes: pairs of 16 bytes taken from both ends
+	const byte *end = p + size;
+	unsigned long long acc = size * PRIME64_1;
+	if (size > 32) {
+		if (size > 64) {
+			if (size > 96) {
+				acc += hash_mix16(p + 48, key + 12, seed);
+				acc += hash_mix16(end - 64, key + 14, seed);
+			}
+			acc += hash_mix16(p + 32, key + 8, seed);
+			acc += hash_mix16(end - 48, key + 10, seed);
+		}
+		acc += hash_mix16(p + 16, key + 4, seed);
+		acc += hash_mix16(end - 32, key + 6, seed);
+	}
+	acc += hash_mix16(p, key, seed);
+	acc += hash_mix16(end - 16, key + 2, seed);
+	return hash_avalanche(acc);
+}
+
+/**
+ * @brief Function that runs the accumulators over an input longer than HASH_SHORT_MAX bytes.
+ * 
+ * @param p		The input.
+ * @param size	Size of the input.
+ * @param seed	Seed of the hash (derives the key).
+ * @param acc	Filled with the accumulators.
+ * @param key	Filled with the key derived from the seed.
+ * 
+ * @return void
+ */
+static void hash_long(const byte *p, size_t size, unsigned long long seed, unsigned long long acc[8], unsigned long long key[HASH_KEY_WORDS]) {
+	const hash_backend_t *backend = hash_engine_current();
+	int i;
+	for (i = 0; i < HASH_KEY_WORDS; i++)
+		key[i] = (i & 1) ? hash_secret[i] - seed : hash_secret[i] + seed;
+	acc[0] = PRIME32_1 ^ 0xC2B2AE3DULL; acc[1] = PRIME64_1; acc[2] = PRIME64_2; acc[3] = PRIME64_3;
+	acc[4] = PRIME64_4; acc[5] = 0x85EBCA77ULL; acc[6] = PRIME64_5; acc[7] = PRIME32_1;
+
+	// Full blocks, then the remaining stripes and the last 64 bytes (overlapping the previous stripe)
+	size_t blocks = (size - 1) / HASH_BLOCK_SIZE;
+	size_t b;
+	for (b = 0; b < blocks; b++) {
+		backend->accumulate(acc, p + b * HASH_BLOCK_SIZE, HASH_STRIPES_PER_BLOCK, key);
+		backend->scramble(acc, key + HASH_SCRAMBLE_KEY);
+	}
+	size_t stripes = ((size - 1) - blocks * HASH_BLOCK_SIZE) / HASH_STRIPE_SIZE;
+	backend->accumulate(acc, p + blocks * HASH_BLOCK_SIZE, stripes, key);
+	backend->accumulate(acc, p + size - HASH_STRIPE_SIZE, 1, key + HASH_LAST_STRIPE_KEY);
+}
+
+/**
+ * @brief Function that merges the accumulators into a 64 bits hash.
+ * 
+ * @param acc	The accumulators.
+ * @param key	Words of the key used for the merge.
+ * @param start	Initial value of the hash.
+ * 
+ * @return unsigned long long	The hash.
+ */
+static unsigned long long hash_merge(const unsigned long long acc[8], const unsigned long long *key, unsigned long long start) {
+	unsigned long long result = start;
+	int i;
+	for (i = 0; i < 4; i++)
+		result += hash_mul128_fold64(acc[2 * i] ^ key[2 * i], acc[2 * i + 1] ^ key[2 * i + 1]);
+	return hash_avalanche(result);
+}
+
+/**
+ * @brief Function that computes the 64 bits hash of a buffer (paths, lookups).
+ * The hash is the same on every CPU and implementation.
+ * 
+ * @param data	The buffer.
+ * @param size	Size of the buffer.
+ * @param seed	Seed of the hash (0 by default).
+ * 
+ * @return unsigned long long	The hash.
+ */
+unsigned long long hash64(const void *data, size_t size, unsigned long long seed) {
+	if (size <= HASH_SHORT_MAX)
+		return hash_short((const byte*)data, size, seed);
+	unsigned long long acc[8], key[HASH_KEY_WORDS];
+	hash_long((const byte*)data, size, seed, acc, key);
+	return hash_merge(acc, key + 1, size * PRIME64_1);
+}
+
+/**
+ * @brief Function that computes the 128 bits hash of a buffer (content identity).
+ * 
+ * @param data	The buffer.
+ * @param size	Size of the buffer.
+ * @param seed	Seed of the hash (0 by default).
+ * 
+ * @return hash128_t	The hash.
+ */
+hash128_t hash128(const void *data, size_t size, unsigned long long seed) {
+	hash128_t hash;
+	if (size <= HASH_SHORT_MAX) {
+		hash.low = hash_short((const byte*)data, size, seed);
+		hash.high = hash_short((const byte*)data, size, hash_rotl64(seed, 32) ^ PRIME64_4);
+		return hash;
+	}
+	unsigned long long acc[8], key[HASH_KEY_WORDS];
+	hash_long((const byte*)data, size, seed, acc, key);
+	hash.low = hash_merge(acc, key + 1, size * PRIME64_1);
+	hash.high = hash_merge(acc, key + 11, ~(size * PRIME64_2));
+	return hash;
+}
+
+/**
+ * @brief Function that compares two 128 bits hashes.
+ * 
+ * @return int	1 if they are equal, 0 otherwise.
+ */
+int hash128_equals(hash128_t a, hash128_t b) {
+	return a.low == b.low && a.high == b.high;
+}
+
+
+///// Parallel hash of the files
+
+// Chunks of a file shared by the hashing threads
+typedef struct hash_file_job_t {
+	int fd;
+	size_t size;
+	size_t chunks;
+	volatile size_t next;				// Next chunk to hash
+	volatile int failed;
+	byte *digests;						// 16 bytes per chunk (little endian)
+} hash_file_job_t;
+
+/**
+ * @brief Function that reads a whole range of a file.
+ * 
+ * @return int	0 if success, -1 if the range can't be read (the file shrank).
+ */
+static int hash_read_at(int fd, byte *buffer, size_t size, size_t offset) {
+	while (size > 0) {
+		#ifdef _WIN32
+			ssize_t bytes = (lseek(fd, (off_t)offset, SEEK_SET) == -1) ? -1 : read(fd, buffer, size);
+		#else
+			ssize_t bytes = pread(fd, buffer, size, (off_t)offset);
+		#endif
+		if (bytes <= 0)
+			return -1;
+		buffer += bytes;
+		size -= (size_t)bytes;
+		offset += (size_t)bytes;
+	}
+	return 0;
+}
+
+/**
+ * @brief Function run by the hashing threads: hashes the next chunk until none is left.
+ * 
+ * @param arg	The job.
+ * 
+ * @return thread_return_type	0
+ */
+static thread_return_type hash_file_worker(thread_param_type arg) {
+	hash_file_job_t *job = (hash_file_job_t*)arg;
+	byte *buffer = malloc(job->size < HASH_FILE_CHUNK_SIZE ? job->size : HASH_FILE_CHUNK_SIZE);
+	if (buffer == NULL)
+		job->failed = 1;
+	while (!job->failed) {
+		size_t chunk = __sync_fetch_and_add(&job->next, 1);
+		if (chunk >= job->chunks)
+			break;
+		size_t offset = chunk * HASH_FILE_CHUNK_SIZE;
+		size_t length = job->size - offset < HASH_FILE_CHUNK_SIZE ? job->size - offset : HASH_FILE_CHUNK_SIZE;
+
+		// A chunk entirely in a hole of a sparse file reads as zeros without touching the disk
+		int hole = 0;
+		#ifdef SEEK_DATA
+			off_t data = lseek(job->fd, (off_t)offset, SEEK_DATA);
+			hole = (data == -1 && errno == ENXIO) || (data != -1 && (size_t)data >= offset + length);
+			errno = 0;
+		#endif
+		if (hole)
+			memset(buffer, 0, length);
+		else if (hash_read_at(job->fd, buffer, length, offset) == -1) {
+			job->failed = 1;
+			break;
+		}
+		hash128_t hash = hash128(buffer, length, chunk);
+		hash_write64(job->digests + chunk * 16, hash.low);
+		hash_write64(job->digests + chunk * 16 + 8, hash.high);
+	}
+	free(buffer);
+	return 0;
+}
+
+/**
+ * @brief Function that computes the 128 bits hash of the content of a file.
+ * The chunks of HASH_FILE_CHUNK_SIZE bytes are hashed in parallel, then the list of their hashes is hashed:
+ * the result doesn't depend on the number of threads.
+ * 
+ * @param fd		File descriptor (read with pread, the holes are found with SEEK_DATA which moves its offset).
+ * @param size		Size of the file.
+ * @param threads	Threads hashing the chunks (0 for one per CPU).
+ * @param hash		Filled with the hash.
+ * 
+ * @return int		0 if success, -1 if the file can't be read.
+ */
+int hash_file(int fd, size_t size, int threads, hash128_t *hash) {
+	hash_file_job_t job;
+	memset(&job, 0, sizeof(hash_file_job_t));
+	job.fd = fd;
+	job.size = size;
+	job.chunks = (size + HASH_FILE_CHUNK_SIZE - 1) / HASH_FILE_CHUNK_SIZE;
+	if (job.chunks > 0) {
+		job.digests = malloc(job.chunks * 16);
+		ERROR_HANDLE_PTR_RETURN_INT(job.digests, "hash_file(): Unable to allocate the hashes of %zu chunks\n", job.chunks);
+	}
+
+	// Number of threads (the offset of the file is shared on Windows)
+	#ifdef _WIN32
+		threads = 1;
+	#else
+		if (threads <= 0)
+			threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	#endif
+	if (threads > HASH_FILE_MAX_THREADS) threads = HASH_FILE_MAX_THREADS;
+	if ((size_t)threads > job.chunks) threads = (int)job.chunks;
+
+	// Hash the chunks, the calling thread being one of the workers
+	pthread_t workers[HASH_FILE_MAX_THREADS];
+	int started = 0;
+	for (; started < threads - 1; started++)
+		if (pthread_create(&workers[started], NULL, hash_file_worker, &job) != 0)
+			break;
+	if (job.chunks > 0)
+		hash_file_worker(&job);
+	int i;
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+	int code = job.failed ? -1 : 0;
+	if (code == -1) free(job.digests);
+	ERROR_HANDLE_INT_RETURN_INT(code, "hash_file(): Unable to read the content (%zu bytes)\n", size);
+
+	// Hash of the list of hashes
+	*hash = hash128(job.digests, job.chunks * 16, size);
+	free(job.digests);
+	return 0;
+}
+
+
+///// SHA-256
+
+static const unsigned int sha256_constants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * @brief Function that compresses a block of 64 bytes into the state.
+ */
+static void sha256_block(unsigned int state[8], const byte *block) {
+	unsigned int w[64];
+	int i;
+	for (i = 0; i < 16; i++)
+		w[i] = ((unsigned int)block[4 * i] << 24) | ((unsigned int)block[4 * i + 1] << 16) | ((unsigned int)block[4 * i + 2] << 8) | block[4 * i + 3];
+	for (i = 16; i < 64; i++) {
+		unsigned int s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		unsigned int s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	unsigned int a = state[0], b = state[1], c = state[2], d = state[3];
+	unsigned int e = state[4], f = state[5], g = state[6], h = state[7];
+	for (i = 0; i < 64; i++) {
+		unsigned int t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_constants[i] + w[i];
+		unsigned int t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+/**
+ * @brief Function that starts a SHA-256 computation.
+ * 
+ * @param context	The context.
+ * 
+ * @return void
+ */
+void sha256_init(sha256_t *context) {
+	static const unsigned int initial_state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	memset(context, 0, sizeof(sha256_t));
+	memcpy(context->state, initial_state, sizeof(initial_state));
+}
+
+/**
+ * @brief Function that adds bytes to a SHA-256 computation.
+ * 
+ * @param context	The context.
+ * @param data		The bytes.
+ * @param size		Number of bytes.
+ * 
+ * @return void
+ */
+void sha256_update(sha256_t *context, const void *data, size_t size) {
+	const byte *p = (const byte*)data;
+	context->length += size;
+	if (context->filled > 0) {
+		size_t chunk = 64 - context->filled < size ? 64 - context->filled : size;
+		memcpy(context->block + context->filled, p, chunk);
+		context->filled += chunk;
+		p += chunk;
+		size -= chunk;
+		if (context->filled < 64)
+			return;
+		sha256_block(context->state, context->block);
+		context->filled = 0;
+	}
+	for (; size >= 64; p += 64, size -= 64)
+		sha256_block(context->state, p);
+	memcpy(context->block, p, size);
+	context->filled = size;
+}
+
+/**
+ * @brief Function that ends a SHA-256 computation.
+ * 
+ * @param context	The context.
+ * @param digest	Filled with the digest.
+ * 
+ * @return void
+ */
+void sha256_final(sha256_t *context, byte digest[SHA256_SIZE]) {
+	unsigned long long bits = context->length * 8;
+	byte padding[72];
+	size_t padding_size = (context->filled < 56 ? 56 : 120) - context->filled;
+	memset(padding, 0, sizeof(padding));
+	padding[0] = 0x80;
+	int i;
+	for (i = 0; i < 8; i++)
+		padding[padding_size + i] = (byte)(bits >> (56 - 8 * i));
+	sha256_update(context, padding, padding_size + 8);
+	for (i = 0; i < 8; i++) {
+		digest[4 * i] = (byte)(context->state[i] >> 24);
+		digest[4 * i + 1] = (byte)(context->state[i] >> 16);
+		digest[4 * i + 2] = (byte)(context->state[i] >> 8);
+		digest[4 * i + 3] = (byte)context->state[i];
+	}
+}
+
@@ -0,0 +1,37 @@
+
+#ifndef __HASH_ENGINE_H__
+#define __HASH_ENGINE_H__
+
+#include "universal_utils.h"
+
+#define HASH_FILE_CHUNK_SIZE (4 * 1024 * 1024)		// Files are hashed by independent chunks of this size (in parallel)
+#define HASH_FILE_MAX_THREADS 16
+#define SHA256_SIZE 32
+
+// 128 bits hash (content identity: the collisions of 64 bits are too likely across a large tree)
+typedef struct hash128_t {
+	unsigned long long low;
+	unsigned long long high;
+} hash128_t;
+
+// Incremental SHA-256 (strong hash, when the identity must resist crafted collisions)
+typedef struct sha256_t {
+	unsigned int state[8];
+	unsigned long long length;			// Bytes hashed so far
+	byte block[64];						// Bytes waiting for a full block
+	size_t filled;
+} sha256_t;
+
+// Function prototypes
+const char* hash_engine_backend();
+int hash_engine_select(const char *backend);
+unsigned long long hash64(const void *data, size_t size, unsigned long long seed);
+hash128_t hash128(const void *data, size_t size, unsigned long long seed);
+int hash128_equals(hash128_t a, hash128_t b);
+int hash_file(int fd, size_t size, int threads, hash128_t *hash);
+void sha256_init(sha256_t *context);
+void sha256_update(sha256_t *context, const void *data, size_t size);
+void sha256_final(sha256_t *context, byte digest[SHA256_SIZE]);
+
+#endif
+
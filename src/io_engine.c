@@ -0,0 +1,730 @@
+
+#ifndef _WIN32
+	#define _GNU_SOURCE
+#endif
+
+#include "io_engine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+	#include <io.h>
+#endif
+
+#ifdef __linux__
+	#include <sys/mman.h>
+	#include <sys/uio.h>
+	#include <sys/syscall.h>
+	#include <linux/io_uring.h>
+	#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_NATIVE_WORKERS)
+		#define IO_ENGINE_HAS_IO_URING 1
+	#endif
+#endif
+
+#define IO_ENGINE_SUBMIT_ATTEMPTS 16		// Submissions of an entry refused by the kernel before giving up
+
+
+///// Blocking syscalls (used when io_uring is disabled, unavailable, or doesn't support an operation)
+
+/**
+ * @brief Function that writes all the data at the given offset with blocking syscalls.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+static int io_engine_sync_write(int fd, const void *data, size_t size, size_t offset) {
+	const byte *ptr = (const byte*)data;
+	while (size > 0) {
+		#ifdef _WIN32
+			ssize_t written = (lseek(fd, (off_t)offset, SEEK_SET) == -1) ? -1 : write(fd, ptr, size);
+		#else
+			ssize_t written = pwrite(fd, ptr, size, (off_t)offset);
+		#endif
+		if (written == -1)
+			return -1;
+		ptr += written;
+		size -= written;
+		offset += written;
+	}
+	return 0;
+}
+
+
+#ifdef IO_ENGINE_HAS_IO_URING
+
+///// io_uring backend (raw syscalls, no external library)
+
+/**
+ * @brief Function that sets up the ring and maps its queues.
+ * 
+ * @param engine	The engine to fill.
+ * 
+ * @return int		0 if the ring is ready, -1 otherwise.
+ */
+static int io_engine_ring_setup(io_engine_t *engine) {
+
+	// Create the ring
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(struct io_uring_params));
+	engine->ring_fd = (int)syscall(__NR_io_uring_setup, engine->depth, &params);
+	if (engine->ring_fd < 0)
+		return -1;
+
+	// Map the submission and completion rings
+	engine->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	engine->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (engine->cq_ring_size > engine->sq_ring_size)
+			engine->sq_ring_size = engine->cq_ring_size;
+		engine->cq_ring_size = engine->sq_ring_size;
+	}
+	engine->sq_ring = mmap(NULL, engine->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_SQ_RING);
+	if (engine->sq_ring == MAP_FAILED)
+		return -1;
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		engine->cq_ring = engine->sq_ring;
+	else {
+		engine->cq_ring = mmap(NULL, engine->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_CQ_RING);
+		if (engine->cq_ring == MAP_FAILED)
+			return -1;
+	}
+
+	// Map the submission entries
+	engine->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	engine->sqes = mmap(NULL, engine->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_SQES);
+	if (engine->sqes == MAP_FAILED)
+		return -1;
+
+	// Get the pointers to the ring fields
+	byte *sq = (byte*)engine->sq_ring;
+	byte *cq = (byte*)engine->cq_ring;
+	engine->sq_head = (unsigned*)(sq + params.sq_off.head);
+	engine->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	engine->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	engine->sq_array = (unsigned*)(sq + params.sq_off.array);
+	engine->cq_head = (unsigned*)(cq + params.cq_off.head);
+	engine->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	engine->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	engine->cqes = cq + params.cq_off.cqes;
+
+	// Probe the supported operations
+	size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, probe_size);
+	if (probe == NULL)
+		return -1;
+	if (syscall(__NR_io_uring_register, engine->ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+		int i;
+		for (i = 0; i < probe->ops_len && i < 256; i++)
+			engine->supported[i] = (probe->ops[i].flags & IO_URING_OP_SUPPORTED) ? 1 : 0;
+	}
+	free(probe);
+
+	// Writes are the minimum required to be worth it
+	return engine->supported[IORING_OP_WRITE] ? 0 : -1;
+}
+
+/**
+ * @brief Function that processes the available completions.
+ * 
+ * @param engine	The engine.
+ * @param wait		1 to wait for at least one completion.
+ * 
+ * @return void
+ */
+static void io_engine_reap(io_engine_t *engine, int wait) {
+
+	// Wait for a completion if needed
+	if (wait && syscall(__NR_io_uring_enter, engine->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1 && errno != EINTR)
+		WARNING_PRINT("io_engine_reap(): io_uring_enter() failed\n");
+	errno = 0;
+
+	// Process the completions
+	unsigned head = *engine->cq_head;
+	unsigned tail = __atomic_load_n(engine->cq_tail, __ATOMIC_ACQUIRE);
+	struct io_uring_cqe *cqes = (struct io_uring_cqe*)engine->cqes;
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &cqes[head & *engine->cq_mask];
+		io_engine_request_t *request = &engine->requests[cqe->user_data];
+		request->result = cqe->res;
+		request->done = 1;
+		engine->in_flight--;
+
+		// Asynchronous write: release the buffer and the slot, remember the first error
+		if (request->buffer_index != -1) {
+			if (cqe->res >= 0 && (size_t)cqe->res != request->expected)
+				request->result = -EIO;
+			if (request->result < 0 && engine->write_error == 0)
+				engine->write_error = request->result;
+			engine->buffers_busy[request->buffer_index] = 0;
+			request->in_use = 0;
+		}
+		head++;
+	}
+	__atomic_store_n(engine->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Function that gets a free submission entry (waiting for completions if the ring is full).
+ * 
+ * @param engine			The engine.
+ * @param request_index		Filled with the index of the request slot.
+ * 
+ * @return struct io_uring_sqe*	The entry to fill before calling io_engine_ring_submit().
+ */
+static struct io_uring_sqe* io_engine_ring_prepare(io_engine_t *engine, int *request_index) {
+
+	// Wait for a free slot
+	while (engine->in_flight >= engine->depth)
+		io_engine_reap(engine, 1);
+	unsigned i;
+	for (i = 0; engine->requests[i].in_use; i++);
+	memset(&engine->requests[i], 0, sizeof(io_engine_request_t));
+	engine->requests[i].in_use = 1;
+	engine->requests[i].buffer_index = -1;
+	*request_index = (int)i;
+
+	// Get the entry at the tail of the submission queue
+	unsigned index = *engine->sq_tail & *engine->sq_mask;
+	struct io_uring_sqe *sqe = &((struct io_uring_sqe*)engine->sqes)[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->user_data = i;
+	engine->sq_array[index] = index;
+	return sqe;
+}
+
+/**
+ * @brief Function that submits the prepared entry to the kernel.
+ * The entry is either consumed by the kernel (and counted in flight), or taken back from the ring:
+ * after a failure, nothing of it can be submitted later (its buffer can be reused).
+ * 
+ * @param engine	The engine.
+ * 
+ * @return int		0 if submitted, -1 otherwise (errno set).
+ */
+static int io_engine_ring_submit(io_engine_t *engine) {
+	unsigned tail = *engine->sq_tail;
+	__atomic_store_n(engine->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	int code = 0, error = EAGAIN, attempt;
+	for (attempt = 0; attempt < IO_ENGINE_SUBMIT_ATTEMPTS; attempt++) {
+		code = (int)syscall(__NR_io_uring_enter, engine->ring_fd, 1, 0, 0, NULL, 0);
+		error = code == -1 ? errno : EAGAIN;
+		if (code == 1) {
+			engine->in_flight++;
+			return 0;
+		}
+
+		// Consumed but not submitted: the kernel dropped the invalid entry (no completion will come)
+		if (__atomic_load_n(engine->sq_head, __ATOMIC_ACQUIRE) != tail) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		// Nothing consumed: retry after an interruption, or once the completions are processed (EBUSY, EAGAIN, 0)
+		if (code == -1 && error != EINTR && error != EBUSY && error != EAGAIN)
+			break;
+		io_engine_reap(engine, 0);
+	}
+
+	// Take the entry back, the kernel never saw it
+	__atomic_store_n(engine->sq_tail, tail, __ATOMIC_RELEASE);
+	errno = error;
+	return -1;
+}
+
+/**
+ * @brief Function that submits the prepared entry and waits for its completion.
+ * 
+ * @param engine			The engine.
+ * @param request_index		Index of the request slot.
+ * 
+ * @return int		Result of the operation (>= 0), or -1 with errno set.
+ */
+static int io_engine_ring_wait(io_engine_t *engine, int request_index) {
+	io_engine_request_t *request = &engine->requests[request_index];
+	if (io_engine_ring_submit(engine) == -1) {
+		request->in_use = 0;
+		return -1;
+	}
+	while (!request->done)
+		io_engine_reap(engine, 1);
+	request->in_use = 0;
+	if (request->result < 0) {
+		errno = -request->result;
+		return -1;
+	}
+	return request->result;
+}
+
+#define IO_ENGINE_USES_RING(engine, opcode) ((engine) != NULL && (engine)->enabled && (engine)->supported[opcode])
+
+#else
+
+#define IO_ENGINE_USES_RING(engine, opcode) 0
+
+#endif
+
+
+/**
+ * @brief Function that initializes the disk I/O engine.
+ * When io_uring is requested but unavailable, the engine falls back to blocking syscalls.
+ * 
+ * @param engine				The engine to initialize.
+ * @param use_io_uring			1 to use io_uring if available.
+ * @param depth					Maximum number of operations in flight (0 for the default).
+ * @param buffer_size			Size of each I/O buffer (multiple of IO_ENGINE_ALIGNMENT).
+ * @param direct_threshold		Files bigger than this are written with O_DIRECT (0 = never).
+ * @param fsync_before_publish	1 to fsync files before publishing them.
+ * 
+ * @return int					0 if the engine is ready, -1 otherwise.
+ */
+int io_engine_init(io_engine_t *engine, int use_io_uring, unsigned depth, size_t buffer_size, size_t direct_threshold, int fsync_before_publish) {
+
+	// Fill the structure
+	memset(engine, 0, sizeof(io_engine_t));
+	engine->ring_fd = -1;
+	engine->depth = (depth == 0) ? IO_ENGINE_DEFAULT_DEPTH : depth;
+	engine->buffer_size = buffer_size;
+	engine->direct_threshold = direct_threshold;
+	engine->fsync_before_publish = fsync_before_publish;
+
+	// Setup the ring if requested
+	#ifdef IO_ENGINE_HAS_IO_URING
+		if (use_io_uring) {
+			engine->enabled = (io_engine_ring_setup(engine) == 0);
+			if (!engine->enabled) {
+				WARNING_PRINT("io_engine_init(): io_uring unavailable, falling back to blocking I/O\n");
+				io_engine_destroy(engine);
+				engine->depth = (depth == 0) ? IO_ENGINE_DEFAULT_DEPTH : depth;
+				engine->buffer_size = buffer_size;
+				engine->direct_threshold = direct_threshold;
+				engine->fsync_before_publish = fsync_before_publish;
+			}
+		}
+	#else
+		if (use_io_uring)
+			WARNING_PRINT("io_engine_init(): io_uring not supported on this platform, using blocking I/O\n");
+	#endif
+
+	// Allocate the request slots and the buffers (one buffer is enough for blocking I/O)
+	engine->buffers_count = engine->enabled ? engine->depth : 1;
+	engine->requests = calloc(engine->depth, sizeof(io_engine_request_t));
+	engine->buffers = calloc(engine->buffers_count, sizeof(pool_buffer_t*));
+	engine->buffers_busy = calloc(engine->buffers_count, sizeof(int));
+	int code = (engine->requests == NULL || engine->buffers == NULL || engine->buffers_busy == NULL) ? -1 : 0;
+	ERROR_HANDLE_INT_RETURN_INT(code, "io_engine_init(): Unable to allocate the engine\n");
+	unsigned i;
+	for (i = 0; i < engine->buffers_count; i++) {
+		engine->buffers[i] = buffer_pool_acquire(buffer_size);
+		ERROR_HANDLE_PTR_RETURN_INT(engine->buffers[i], "io_engine_init(): Unable to get the I/O buffers\n");
+	}
+
+	// Register the buffers with the ring so writes skip the per-operation page mapping
+	#ifdef IO_ENGINE_HAS_IO_URING
+		if (engine->enabled && engine->supported[IORING_OP_WRITE_FIXED]) {
+			struct iovec *iovecs = calloc(engine->buffers_count, sizeof(struct iovec));
+			if (iovecs != NULL) {
+				for (i = 0; i < engine->buffers_count; i++) {
+					iovecs[i].iov_base = engine->buffers[i]->data;
+					iovecs[i].iov_len = buffer_size;
+				}
+				engine->buffers_registered = (syscall(__NR_io_uring_register, engine->ring_fd, IORING_REGISTER_BUFFERS, iovecs, engine->buffers_count) == 0);
+				free(iovecs);
+			}
+			errno = 0;
+		}
+	#endif
+
+	// Return
+	INFO_PRINT("io_engine_init(): Disk I/O engine ready (%s, depth %u%s)\n", engine->enabled ? "io_uring" : "blocking", engine->enabled ? engine->depth : 1, engine->buffers_registered ? ", registered buffers" : "");
+	return 0;
+}
+
+/**
+ * @brief Function that waits for the operations in flight and frees the engine.
+ * 
+ * @param engine	The engine.
+ * 
+ * @return void
+ */
+void io_engine_destroy(io_engine_t *engine) {
+	io_engine_drain(engine);
+	#ifdef IO_ENGINE_HAS_IO_URING
+		if (engine->sqes != NULL && engine->sqes != MAP_FAILED)
+			munmap(engine->sqes, engine->sqes_size);
+		if (engine->cq_ring != NULL && engine->cq_ring != MAP_FAILED && engine->cq_ring != engine->sq_ring)
+			munmap(engine->cq_ring, engine->cq_ring_size);
+		if (engine->sq_ring != NULL && engine->sq_ring != MAP_FAILED)
+			munmap(engine->sq_ring, engine->sq_ring_size);
+		if (engine->ring_fd >= 0)
+			close(engine->ring_fd);
+	#endif
+	unsigned i;
+	for (i = 0; engine->buffers != NULL && i < engine->buffers_count; i++)
+		buffer_pool_release(engine->buffers[i]);
+	free(engine->buffers);
+	free(engine->buffers_busy);
+	free(engine->requests);
+	memset(engine, 0, sizeof(io_engine_t));
+	engine->ring_fd = -1;
+}
+
+/**
+ * @brief Function that gets a free I/O buffer of engine->buffer_size bytes,
+ * waiting for a write to complete if they are all in flight.
+ * The buffer is given back to the engine by passing it to io_engine_write().
+ * 
+ * @param engine	The engine.
+ * 
+ * @return byte*	An aligned buffer.
+ */
+byte* io_engine_buffer(io_engine_t *engine) {
+	while (1) {
+		unsigned i;
+		for (i = 0; i < engine->buffers_count; i++)
+			if (!engine->buffers_busy[i])
+				return engine->buffers[i]->data;
+		#ifdef IO_ENGINE_HAS_IO_URING
+			io_engine_reap(engine, 1);
+		#endif
+	}
+}
+
+/**
+ * @brief Function that gets the index of the engine buffer containing the data.
+ * 
+ * @return int		The index of the buffer, -1 if the data is not inside an engine buffer.
+ */
+static int io_engine_buffer_index(io_engine_t *engine, const void *data) {
+	unsigned i;
+	for (i = 0; engine != NULL && i < engine->buffers_count; i++)
+		if ((const byte*)data >= engine->buffers[i]->data && (const byte*)data < engine->buffers[i]->data + engine->buffer_size)
+			return (int)i;
+	return -1;
+}
+
+/**
+ * @brief Function that gets the number of bytes available from data to the end of its engine buffer.
+ * 
+ * @param engine	The engine.
+ * @param data		The data to check.
+ * 
+ * @return size_t	The remaining capacity, 0 if the data is not inside an engine buffer.
+ */
+size_t io_engine_capacity(io_engine_t *engine, const void *data) {
+	int i = io_engine_buffer_index(engine, data);
+	return (i == -1) ? 0 : (size_t)(engine->buffers[i]->data + engine->buffer_size - (const byte*)data);
+}
+
+/**
+ * @brief Function that opens a file.
+ * 
+ * @param engine	The engine (NULL for a blocking call).
+ * @param path		Path of the file.
+ * @param flags		Flags of open().
+ * @param mode		Mode of the file if created.
+ * 
+ * @return int		The file descriptor, -1 otherwise.
+ */
+int io_engine_open(io_engine_t *engine, const char *path, int flags, int mode) {
+	return io_engine_openat(engine, AT_FDCWD, path, flags, mode);
+}
+
+/**
+ * @brief Function that opens a file relative to a directory fd (no resolution of the parent directories).
+ * 
+ * @param engine		The engine (NULL for a blocking call).
+ * @param directory_fd	Directory fd the path is relative to (AT_FDCWD for the working directory).
+ * @param path			Path of the file.
+ * @param flags			Flags of open().
+ * @param mode			Mode of the file if created.
+ * 
+ * @return int			The file descriptor, -1 otherwise.
+ */
+int io_engine_openat(io_engine_t *engine, int directory_fd, const char *path, int flags, int mode) {
+	(void)engine;
+	#ifdef IO_ENGINE_HAS_IO_URING
+		if (IO_ENGINE_USES_RING(engine, IORING_OP_OPENAT)) {
+			int request_index;
+			struct io_uring_sqe *sqe = io_engine_ring_prepare(engine, &request_index);
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = directory_fd;
+			sqe->addr = (unsigned long)path;
+			sqe->len = (unsigned)mode;
+			sqe->open_flags = (unsigned)flags;
+			return io_engine_ring_wait(engine, request_index);
+		}
+	#endif
+	#ifdef _WIN32
+		(void)directory_fd;
+		return open(path, flags, mode);
+	#else
+		return openat(directory_fd, path, flags, mode);
+	#endif
+}
+
+/**
+ * @brief Function that writes data to a file at the given offset.
+ * If the data is an engine buffer and io_uring is enabled, the write is asynchronous:
+ * the buffer is released when it completes, and errors are reported by io_engine_drain().
+ * 
+ * @param engine	The engine (NULL for a blocking call).
+ * @param fd		File descriptor.
+ * @param data		Data to write.
+ * @param size		Size of the data.
+ * @param offset	Offset in the file.
+ * 
+ * @return int		0 if the write was queued or done, -1 otherwise.
+ */
+int io_engine_write(io_engine_t *engine, int fd, const void *data, size_t size, size_t offset) {
+	(void)engine;
+	#ifdef IO_ENGINE_HAS_IO_URING
+		int buffer_index = io_engine_buffer_index(engine, data);
+		if (IO_ENGINE_USES_RING(engine, IORING_OP_WRITE) && buffer_index != -1 && size > 0) {
+			int request_index;
+			struct io_uring_sqe *sqe = io_engine_ring_prepare(engine, &request_index);
+			sqe->opcode = engine->buffers_registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+			sqe->buf_index = (unsigned short)buffer_index;
+			sqe->fd = fd;
+			sqe->addr = (unsigned long)data;
+			sqe->len = (unsigned)size;
+			sqe->off = offset;
+			engine->requests[request_index].buffer_index = buffer_index;
+			engine->requests[request_index].expected = size;
+			engine->buffers_busy[buffer_index] = 1;
+			if (io_engine_ring_submit(engine) == -1) {
+				errno = 0;
+				engine->buffers_busy[buffer_index] = 0;
+				engine->requests[request_index].in_use = 0;
+				return io_engine_sync_write(fd, data, size, offset);
+			}
+			return 0;
+		}
+	#endif
+	return io_engine_sync_write(fd, data, size, offset);
+}
+
+/**
+ * @brief Function that reserves disk space for a file (Linux only, no-op elsewhere).
+ * 
+ * @param engine	The engine (NULL for a blocking call).
+ * @param fd		File descriptor.
+ * @param size		Number of bytes to reserve.
+ * 
+ * @return int		0 if the space is reserved, -1 otherwise.
+ */
+int io_engine_fallocate(io_engine_t *engine, int fd, size_t size) {
+	(void)engine;
+	#ifdef IO_ENGINE_HAS_IO_URING
+		if (IO_ENGINE_USES_RING(engine, IORING_OP_FALLOCATE)) {
+			int request_index;
+			struct io_uring_sqe *sqe = io_engine_ring_prepare(engine, &request_index);
+			sqe->opcode = IORING_OP_FALLOCATE;
+			sqe->fd = fd;
+			sqe->off = 0;
+			sqe->addr = size;
+			sqe->len = 0;
+			return io_engine_ring_wait(engine, request_index) < 0 ? -1 : 0;
+		}
+	#endif
+	#ifdef __linux__
+		return fallocate(fd, 0, 0, (off_t)size);
+	#else
+		(void)fd; (void)size;
+		errno = EOPNOTSUPP;
+		return -1;
+	#endif
+}
+
+/**
+ * @brief Function that flushes a file to the disk.
+ * 
+ * @param engine	The engine (NULL for a blocking call).
+ * @param fd		File descriptor.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+int io_engine_fsync(io_engine_t *engine, int fd) {
+	(void)engine;
+	#ifdef IO_ENGINE_HAS_IO_URING
+		if (IO_ENGINE_USES_RING(engine, IORING_OP_FSYNC)) {
+			int request_index;
+			struct io_uring_sqe *sqe = io_engine_ring_prepare(engine, &request_index);
+			sqe->opcode = IORING_OP_FSYNC;
+			sqe->fd = fd;
+			return io_engine_ring_wait(engine, request_index) < 0 ? -1 : 0;
+		}
+	#endif
+	#ifdef _WIN32
+		return _commit(fd);
+	#else
+		return fsync(fd);
+	#endif
+}
+
+/**
+ * @brief Function that renames a file, replacing the destination if it exists.
+ * 
+ * @param engine	The engine (NULL for a blocking call).
+ * @param old_path	Current path.
+ * @param new_path	New path.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+int io_engine_rename(io_engine_t *engine, const char *old_path, const char *new_path) {
+	return io_engine_renameat(engine, AT_FDCWD, old_path, AT_FDCWD, new_path);
+}
+
+/**
+ * @brief Function that renames a file relative to directory fds, replacing the destination if it exists.
+ * 
+ * @param engine		The engine (NULL for a blocking call).
+ * @param old_directory	Directory fd of the current path (AT_FDCWD for the working directory).
+ * @param old_path		Current path.
+ * @param new_directory	Directory fd of the new path.
+ * @param new_path		New path.
+ * 
+ * @return int			0 if success, -1 otherwise.
+ */
+int io_engine_renameat(io_engine_t *engine, int old_directory, const char *old_path, int new_directory, const char *new_path) {
+	(void)engine;
+	#ifdef IO_ENGINE_HAS_IO_URING
+		if (IO_ENGINE_USES_RING(engine, IORING_OP_RENAMEAT)) {
+			int request_index;
+			struct io_uring_sqe *sqe = io_engine_ring_prepare(engine, &request_index);
+			sqe->opcode = IORING_OP_RENAMEAT;
+			sqe->fd = old_directory;
+			sqe->addr = (unsigned long)old_path;
+			sqe->len = (unsigned)new_directory;
+			sqe->addr2 = (unsigned long)new_path;
+			return io_engine_ring_wait(engine, request_index) < 0 ? -1 : 0;
+		}
+	#endif
+	#ifdef _WIN32
+		(void)old_directory; (void)new_directory;
+		return MoveFileExA(old_path, new_path, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+	#else
+		return renameat(old_directory, old_path, new_directory, new_path);
+	#endif
+}
+
+/**
+ * @brief Function that creates a hard link, following symbolic links
+ * (used to publish O_TMPFILE files through /proc/self/fd).
+ * 
+ * @param engine	The engine (NULL for a blocking call).
+ * @param old_path	Existing path.
+ * @param new_path	Path of the new link (must not exist).
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+int io_engine_link(io_engine_t *engine, const char *old_path, const char *new_path) {
+	return io_engine_linkat(engine, AT_FDCWD, old_path, AT_FDCWD, new_path);
+}
+
+/**
+ * @brief Function that creates a hard link relative to directory fds, following symbolic links.
+ * 
+ * @param engine		The engine (NULL for a blocking call).
+ * @param old_directory	Directory fd of the existing path (AT_FDCWD for the working directory).
+ * @param old_path		Existing path.
+ * @param new_directory	Directory fd of the new link.
+ * @param new_path		Path of the new link (must not exist).
+ * 
+ * @return int			0 if success, -1 otherwise.
+ */
+int io_engine_linkat(io_engine_t *engine, int old_directory, const char *old_path, int new_directory, const char *new_path) {
+	(void)engine;
+	#ifdef IO_ENGINE_HAS_IO_URING
+		if (IO_ENGINE_USES_RING(engine, IORING_OP_LINKAT)) {
+			int request_index;
+			struct io_uring_sqe *sqe = io_engine_ring_prepare(engine, &request_index);
+			sqe->opcode = IORING_OP_LINKAT;
+			sqe->fd = old_directory;
+			sqe->addr = (unsigned long)old_path;
+			sqe->len = (unsigned)new_directory;
+			sqe->addr2 = (unsigned long)new_path;
+			sqe->hardlink_flags = AT_SYMLINK_FOLLOW;
+			return io_engine_ring_wait(engine, request_index) < 0 ? -1 : 0;
+		}
+	#endif
+	#ifdef _WIN32
+		(void)old_directory; (void)new_directory;
+		return CreateHardLinkA(new_path, old_path, NULL) ? 0 : -1;
+	#else
+		return linkat(old_directory, old_path, new_directory, new_path, AT_SYMLINK_FOLLOW);
+	#endif
+}
+
+/**
+ * @brief Function that removes a file.
+ * 
+ * @param engine	The engine (NULL for a blocking call).
+ * @param path		Path of the file.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+int io_engine_unlink(io_engine_t *engine, const char *path) {
+	#ifdef _WIN32
+		(void)engine;
+		return remove(path);
+	#else
+		return io_engine_unlinkat(engine, AT_FDCWD, path, 0);
+	#endif
+}
+
+/**
+ * @brief Function that removes a file (or an empty directory with AT_REMOVEDIR) relative to a directory fd.
+ * 
+ * @param engine		The engine (NULL for a blocking call).
+ * @param directory_fd	Directory fd the path is relative to (AT_FDCWD for the working directory).
+ * @param path			Path of the file.
+ * @param flags			0, or AT_REMOVEDIR.
+ * 
+ * @return int			0 if success, -1 otherwise.
+ */
+int io_engine_unlinkat(io_engine_t *engine, int directory_fd, const char *path, int flags) {
+	(void)engine;
+	#ifdef IO_ENGINE_HAS_IO_URING
+		if (IO_ENGINE_USES_RING(engine, IORING_OP_UNLINKAT)) {
+			int request_index;
+			struct io_uring_sqe *sqe = io_engine_ring_prepare(engine, &request_index);
+			sqe->opcode = IORING_OP_UNLINKAT;
+			sqe->fd = directory_fd;
+			sqe->addr = (unsigned long)path;
+			sqe->unlink_flags = (unsigned)flags;
+			return io_engine_ring_wait(engine, request_index) < 0 ? -1 : 0;
+		}
+	#endif
+	#ifdef _WIN32
+		(void)directory_fd;
+		return (flags != 0) ? rmdir(path) : remove(path);
+	#else
+		return unlinkat(directory_fd, path, flags);
+	#endif
+}
+
+/**
+ * @brief Function that waits for all the asynchronous writes to complete.
+ * 
+ * @param engine	The engine (NULL does nothing).
+ * 
+ * @return int		0 if all the writes succeeded since the last drain, -1 otherwise (errno set).
+ */
+int io_engine_drain(io_engine_t *engine) {
+	if (engine == NULL)
+		return 0;
+	#ifdef IO_ENGINE_HAS_IO_URING
+		while (engine->enabled && engine->in_flight > 0)
+			io_engine_reap(engine, 1);
+	#endif
+	int error = engine->write_error;
+	engine->write_error = 0;
+	if (error < 0) {
+		errno = -error;
+		return -1;
+	}
+	return 0;
+}
+
@@ -0,0 +1,70 @@
+
+#ifndef __IO_ENGINE_H__
+#define __IO_ENGINE_H__
+
+#include "universal_utils.h"
+#include "buffer_pool.h"
+
+#include <fcntl.h>
+
+#define IO_ENGINE_ALIGNMENT BUFFER_POOL_ALIGNMENT
+#define IO_ENGINE_DEFAULT_DEPTH 8
+
+// Structure of an operation submitted to the ring
+typedef struct io_engine_request_t {
+	int in_use;				// 1 if the slot is used by an operation
+	int done;				// 1 when the completion was received
+	int result;				// Result of the operation (negative errno on failure)
+	int buffer_index;		// Buffer released on completion (-1 if none)
+	size_t expected;		// Expected result for asynchronous writes
+} io_engine_request_t;
+
+// Structure of the disk I/O engine (one per thread, io_uring or blocking syscalls)
+typedef struct io_engine_t {
+
+	// Configuration
+	int enabled;					// 1 if io_uring is used, 0 for blocking syscalls
+	unsigned depth;					// Maximum number of operations in flight
+	size_t buffer_size;				// Size of each I/O buffer
+	size_t direct_threshold;		// Files bigger than this are written with O_DIRECT (0 = never)
+	int fsync_before_publish;		// 1 to fsync files before publishing them
+
+	// Ring (only used when enabled)
+	int ring_fd;
+	void *sq_ring, *cq_ring, *sqes, *cqes;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	byte supported[256];			// Opcodes supported by the running kernel
+
+	// Operations and buffers
+	io_engine_request_t *requests;
+	unsigned in_flight;
+	int write_error;				// First error of the asynchronous writes (negative errno)
+	pool_buffer_t **buffers;		// Buffers taken from the buffer pool
+	int *buffers_busy;
+	unsigned buffers_count;
+	int buffers_registered;			// 1 if the buffers are registered with the ring (fixed writes)
+
+} io_engine_t;
+
+// Function prototypes
+int io_engine_init(io_engine_t *engine, int use_io_uring, unsigned depth, size_t buffer_size, size_t direct_threshold, int fsync_before_publish);
+void io_engine_destroy(io_engine_t *engine);
+byte* io_engine_buffer(io_engine_t *engine);
+size_t io_engine_capacity(io_engine_t *engine, const void *data);
+int io_engine_open(io_engine_t *engine, const char *path, int flags, int mode);
+int io_engine_openat(io_engine_t *engine, int directory_fd, const char *path, int flags, int mode);
+int io_engine_write(io_engine_t *engine, int fd, const void *data, size_t size, size_t offset);
+int io_engine_fallocate(io_engine_t *engine, int fd, size_t size);
+int io_engine_fsync(io_engine_t *engine, int fd);
+int io_engine_rename(io_engine_t *engine, const char *old_path, const char *new_path);
+int io_engine_renameat(io_engine_t *engine, int old_directory, const char *old_path, int new_directory, const char *new_path);
+int io_engine_link(io_engine_t *engine, const char *old_path, const char *new_path);
+int io_engine_linkat(io_engine_t *engine, int old_directory, const char *old_path, int new_directory, const char *new_path);
+int io_engine_unlink(io_engine_t *engine, const char *path);
+int io_engine_unlinkat(io_engine_t *engine, int directory_fd, const char *path, int flags);
+int io_engine_drain(io_engine_t *engine);
+
+#endif
+
@@ -0,0 +1,723 @@
+
+#include "logger.h"
+#include "universal_utils.h"
+#include "universal_pthread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#define LOG_OUTPUT_SIZE (64 * 1024)
+#define LOG_RATE_SLOTS 256					// Call sites tracked for the rate limiting
+
+// Header of a record in a ring (followed by the captured arguments)
+typedef struct log_header_t {
+	unsigned int size;				// Size of the record, header included (0 level = padding until the end of the ring)
+	int level;
+	int saved_errno;				// errno when the record was made (appended with strerror() if not 0)
+	unsigned int suppressed;		// Records of the same call site suppressed before this one
+	long long time_us;
+	const char *format;				// Format string (always a literal)
+} log_header_t;
+
+// Ring of a thread (single producer: the thread, single consumer: the writer)
+typedef struct log_ring_t {
+	byte data[LOG_RING_SIZE];
+	size_t head;					// Written by the producer
+	size_t tail;					// Written by the consumer
+	long long dropped;				// Records dropped because the ring was full
+	long long dropped_reported;
+	volatile int in_use;			// Owned by a running thread (a released ring is reused by the next thread)
+	struct log_ring_t *next;
+} log_ring_t;
+
+// Rate limiting state of a call site
+typedef struct log_rate_t {
+	volatile int lock;
+	const char *format;
+	long long window_start;
+	unsigned int count;
+	unsigned int suppressed;
+} log_rate_t;
+
+// Parsed conversion specification of a format
+typedef struct log_spec_t {
+	const char *start;				// '%' character
+	const char *end;				// Conversion character
+	int width_star;
+	int precision_star;
+	int precision;					// Precision given in the format, -1 without one (or with '*')
+	char length;					// 'H' (hh), 'h', 'l', 'q' (ll), 'L', 'j', 'z', 't' or 0
+	char conversion;
+} log_spec_t;
+
+// Global variables
+volatile int log_levels = DEBUG_STATES;
+static int log_rate_limit = LOG_DEFAULT_RATE_LIMIT;
+static log_ring_t *log_rings = NULL;
+static __thread log_ring_t *log_local_ring = NULL;
+static log_rate_t log_rates[LOG_RATE_SLOTS];
+static __thread byte log_staging[LOG_MAX_RECORD];
+static volatile int log_state = 0;			// 0: not started, 1: starting, 2: running
+static pthread_t log_thread;
+static pthread_mutex_t log_mutex;			// Held while draining the rings
+static pthread_cond_t log_cond;
+static char *log_output = NULL;
+static char *log_line = NULL;
+
+/**
+ * @brief Function that parses a conversion specification of a printf format.
+ * 
+ * @param p		Pointer to the '%' character.
+ * @param spec	Structure to fill.
+ * 
+ * @return const char*	Pointer to the conversion character.
+ */
+static const char* log_parse_spec(const char *p, log_spec_t *spec) {
+	memset(spec, 0, sizeof(log_spec_t));
+	spec->precision = -1;
+	spec->start = p++;
+	while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+		p++;
+	if (*p == '*') {
+		spec->width_star = 1;
+		p++;
+	}
+	while (*p >= '0' && *p <= '9')
+		p++;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->precision_star = 1;
+			p++;
+		}
+		else
+			spec->precision = 0;
+		while (*p >= '0' && *p <= '9')
+			spec->precision = spec->precision * 10 + (*p++ - '0');
+	}
+	if (*p == 'h' || *p == 'l') {
+		spec->length = *p++;
+		if (*p == spec->length) {
+			spec->length = (spec->length == 'h') ? 'H' : 'q';
+			p++;
+		}
+	}
+	else if (*p == 'L' || *p == 'j' || *p == 'z' || *p == 't' || *p == 'q')
+		spec->length = *p++;
+	spec->conversion = *p;
+	spec->end = p;
+	return p;
+}
+
+/**
+ * @brief Function that captures the arguments of a format into a buffer,
+ * so they can be formatted later by the writer thread.
+ * 
+ * @param buffer	Buffer to fill.
+ * @param size		Size of the buffer.
+ * @param format	Format string.
+ * @param args		Arguments.
+ * 
+ * @return size_t	Number of bytes used.
+ */
+static size_t log_capture(byte *buffer, size_t size, const char *format, va_list args) {
+	size_t used = 0;
+	const char *p;
+	log_spec_t spec;
+	#define LOG_PUT(value) { if (used + sizeof(value) <= size) { memcpy(buffer + used, &(value), sizeof(value)); used += sizeof(value); } }
+
+	for (p = format; *p != '\0'; p++) {
+		if (*p != '%')
+			continue;
+		if (p[1] == '%') {
+			p++;
+			continue;
+		}
+		p = log_parse_spec(p, &spec);
+		if (spec.width_star) {
+			int width = va_arg(args, int);
+			LOG_PUT(width);
+		}
+		if (spec.precision_star) {
+			int precision = va_arg(args, int);
+			LOG_PUT(precision);
+			spec.precision = (precision < 0) ? -1 : precision;
+		}
+		switch (spec.conversion) {
+			case 'd': case 'i': {
+				long long value;
+				switch (spec.length) {
+					case 'H': value = (signed char)va_arg(args, int); break;
+					case 'h': value = (short)va_arg(args, int); break;
+					case 'l': value = va_arg(args, long); break;
+					case 'q': value = va_arg(args, long long); break;
+					case 'j': value = va_arg(args, intmax_t); break;
+					case 'z': value = va_arg(args, ssize_t); break;
+					case 't': value = va_arg(args, ptrdiff_t); break;
+					default: value = va_arg(args, int); break;
+				}
+				LOG_PUT(value);
+				break;
+			}
+			case 'u': case 'o': case 'x': case 'X': case 'c': {
+				unsigned long long value;
+				switch (spec.length) {
+					case 'H': value = (unsigned char)va_arg(args, unsigned int); break;
+					case 'h': value = (unsigned short)va_arg(args, unsigned int); break;
+					case 'l': value = va_arg(args, unsigned long); break;
+					case 'q': value = va_arg(args, unsigned long long); break;
+					case 'j': value = va_arg(args, uintmax_t); break;
+					case 'z': value = va_arg(args, size_t); break;
+					case 't': value = va_arg(args, ptrdiff_t); break;
+					default: value = va_arg(args, unsigned int); break;
+				}
+				LOG_PUT(value);
+				break;
+			}
+			case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+				if (spec.length == 'L') {
+					long double value = va_arg(args, long double);
+					LOG_PUT(value);
+				}
+				else {
+					double value = va_arg(args, double);
+					LOG_PUT(value);
+				}
+				break;
+			}
+			case 's': {
+				const char *str = va_arg(args, const char*);
+				if (str == NULL)
+					str = "(null)";
+
+				// With a precision ("%.*s" of a slice), the string may not be terminated: never read past it
+				size_t length = (spec.precision >= 0) ? strnlen(str, (size_t)spec.precision) : strlen(str);
+				if (used + sizeof(unsigned short) + 1 > size)
+					break;
+				if (length > size - used - sizeof(unsigned short) - 1)
+					length = size - used - sizeof(unsigned short) - 1;
+				unsigned short stored = (unsigned short)length;
+				LOG_PUT(stored);
+				memcpy(buffer + used, str, length);
+				buffer[used + length] = '\0';
+				used += length + 1;
+				break;
+			}
+			case 'p': {
+				void *value = va_arg(args, void*);
+				LOG_PUT(value);
+				break;
+			}
+			case 'n':
+				(void)va_arg(args, void*);
+				break;
+			default:
+				break;
+		}
+		if (*p == '\0')
+			break;
+	}
+	#undef LOG_PUT
+	return used;
+}
+
+/**
+ * @brief Function that formats a record from its format and captured arguments.
+ * 
+ * @param output	Buffer to fill.
+ * @param size		Size of the buffer.
+ * @param format	Format string.
+ * @param payload	Captured arguments.
+ * @param end		End of the captured arguments.
+ * 
+ * @return size_t	Length of the text.
+ */
+static size_t log_render(char *output, size_t size, const char *format, const byte *payload, const byte *end) {
+	size_t length = 0;
+	const char *p = format;
+	log_spec_t spec;
+	#define LOG_GET(value) { if (payload + sizeof(value) <= end) { memcpy(&(value), payload, sizeof(value)); payload += sizeof(value); } }
+	#define LOG_OUT(...) { int written = snprintf(output + length, size - length, __VA_ARGS__); if (written > 0) length = (length + written < size) ? length + written : size - 1; }
+
+	while (*p != '\0' && length + 1 < size) {
+
+		// Copy the literal text
+		if (*p != '%' || p[1] == '%') {
+			output[length++] = *p;
+			p += (*p == '%') ? 2 : 1;
+			continue;
+		}
+
+		// Rebuild the specification: '*' replaced by the captured values, length adapted to the stored type
+		log_parse_spec(p, &spec);
+		char rebuilt[64];
+		size_t r = 0;
+		const char *c;
+		for (c = spec.start; c < spec.end && r < sizeof(rebuilt) - 24; c++) {
+			if (*c == '*') {
+				int value = 0;
+				LOG_GET(value);
+				if (value < 0 && r > 0 && rebuilt[r - 1] == '.')
+					r--;					// A negative precision is taken as if it was omitted
+				else
+					r += sprintf(rebuilt + r, "%d", value);
+			}
+			else if (strchr("hlLjztq", *c) == NULL)
+				rebuilt[r++] = *c;
+		}
+		switch (spec.conversion) {
+			case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+				rebuilt[r++] = 'l';
+				rebuilt[r++] = 'l';
+				break;
+			case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+				if (spec.length == 'L')
+					rebuilt[r++] = 'L';
+				break;
+			default:
+				break;
+		}
+		rebuilt[r++] = spec.conversion;
+		rebuilt[r] = '\0';
+
+		// Format the value
+		switch (spec.conversion) {
+			case 'd': case 'i': {
+				long long value = 0;
+				LOG_GET(value);
+				LOG_OUT(rebuilt, value);
+				break;
+			}
+			case 'u': case 'o': case 'x': case 'X': {
+				unsigned long long value = 0;
+				LOG_GET(value);
+				LOG_OUT(rebuilt, value);
+				break;
+			}
+			case 'c': {
+				unsigned long long value = 0;
+				LOG_GET(value);
+				LOG_OUT(rebuilt, (int)value);
+				break;
+			}
+			case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+				if (spec.length == 'L') {
+					long double value = 0;
+					LOG_GET(value);
+					LOG_OUT(rebuilt, value);
+				}
+				else {
+					double value = 0;
+					LOG_GET(value);
+					LOG_OUT(rebuilt, value);
+				}
+				break;
+			}
+			case 's': {
+				unsigned short stored = 0;
+				LOG_GET(stored);
+				const char *str = (payload + stored < end) ? (const char*)payload : "";
+				payload += (payload + stored < end) ? stored + 1 : 0;
+				LOG_OUT(rebuilt, str);
+				break;
+			}
+			case 'p': {
+				void *value = NULL;
+				LOG_GET(value);
+				LOG_OUT(rebuilt, value);
+				break;
+			}
+			default:
+				break;
+		}
+		if (*spec.end == '\0')
+			break;
+		p = spec.end + 1;
+	}
+	output[length] = '\0';
+	#undef LOG_GET
+	#undef LOG_OUT
+	return length;
+}
+
+/**
+ * @brief Function that applies the rate limit of a call site (shared by all the threads).
+ * 
+ * @param format		Format string of the call site.
+ * @param now			Current time (us).
+ * @param suppressed	Filled with the records suppressed in the previous window.
+ * 
+ * @return int			1 if the record can be written, 0 if it's suppressed.
+ */
+static int log_rate_check(const char *format, long long now, unsigned int *suppressed) {
+	log_rate_t *rate = &log_rates[((uintptr_t)format >> 3) % LOG_RATE_SLOTS];
+	int accepted = 1;
+	*suppressed = 0;
+	while (__sync_lock_test_and_set(&rate->lock, 1));
+	if (rate->format != format || now - rate->window_start >= 1000000) {
+		if (rate->format == format)
+			*suppressed = rate->suppressed;
+		rate->format = format;
+		rate->window_start = now;
+		rate->count = 0;
+		rate->suppressed = 0;
+	}
+	if (log_rate_limit > 0 && rate->count >= (unsigned int)log_rate_limit) {
+		rate->suppressed++;
+		accepted = 0;
+	}
+	else
+		rate->count++;
+	__sync_lock_release(&rate->lock);
+	return accepted;
+}
+
+/**
+ * @brief Function that reports the suppressed records of the call sites that stopped logging.
+ * The caller must hold log_mutex.
+ * 
+ * @param length	Length of the output buffer, updated.
+ * 
+ * @return void
+ */
+static void log_rate_report(size_t *length) {
+	long long now = get_time_us();
+	int i;
+	for (i = 0; i < LOG_RATE_SLOTS; i++) {
+		log_rate_t *rate = &log_rates[i];
+		if (rate->suppressed == 0 || now - rate->window_start < 1000000)
+			continue;
+		while (__sync_lock_test_and_set(&rate->lock, 1));
+		unsigned int suppressed = rate->suppressed;
+		rate->suppressed = 0;
+		__sync_lock_release(&rate->lock);
+		if (suppressed > 0 && *length + 128 <= LOG_OUTPUT_SIZE)
+			*length += sprintf(log_output + *length, YELLOW "[WARNING] " RESET "(%u similar messages suppressed)\n", suppressed);
+	}
+}
+
+/**
+ * @brief Function that writes the output buffer to its stream.
+ * 
+ * @return void
+ */
+static void log_output_write(FILE *stream, size_t *length) {
+	if (*length == 0)
+		return;
+	fwrite(log_output, 1, *length, stream);
+	fflush(stream);
+	*length = 0;
+}
+
+/**
+ * @brief Function that formats and writes all the pending records, oldest first across the threads.
+ * The caller must hold log_mutex.
+ * 
+ * @return void
+ */
+static void log_drain() {
+	FILE *current = NULL;
+	size_t length = 0;
+	log_ring_t *ring;
+
+	while (1) {
+
+		// Find the oldest record of all the rings (skipping the paddings)
+		log_ring_t *best = NULL;
+		log_header_t *best_header = NULL;
+		for (ring = log_rings; ring != NULL; ring = ring->next) {
+			size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+			while (ring->tail != head) {
+				log_header_t *header = (log_header_t*)(ring->data + (ring->tail & (LOG_RING_SIZE - 1)));
+				if (header->level != 0) {
+					if (best == NULL || header->time_us < best_header->time_us) {
+						best = ring;
+						best_header = header;
+					}
+					break;
+				}
+				__atomic_store_n(&ring->tail, ring->tail + header->size, __ATOMIC_RELEASE);
+			}
+		}
+		if (best == NULL)
+			break;
+
+		// Format the record, with the errno message like the synchronous printer did
+		log_header_t *header = best_header;
+		size_t line_length = log_render(log_line, LOG_MAX_RECORD, header->format, (byte*)(header + 1), (byte*)header + header->size);
+		if (header->saved_errno != 0) {
+			while (line_length > 0 && log_line[line_length] != '\n')
+				line_length--;
+			log_line[line_length] = '\0';
+			line_length += snprintf(log_line + line_length, LOG_MAX_RECORD - line_length, ": %s\n", strerror(header->saved_errno));
+			if (line_length >= LOG_MAX_RECORD)
+				line_length = LOG_MAX_RECORD - 1;
+		}
+
+		// Info and debug go to stdout outside development mode
+		#if DEVELOPMENT_MODE
+			FILE *stream = stderr;
+		#else
+			FILE *stream = (header->level & (INFO_LEVEL | DEBUG_LEVEL)) ? stdout : stderr;
+		#endif
+		if (stream != current || length + line_length + 128 > LOG_OUTPUT_SIZE) {
+			log_output_write(current, &length);
+			current = stream;
+		}
+		memcpy(log_output + length, log_line, line_length);
+		length += line_length;
+		if (header->suppressed > 0)
+			length += sprintf(log_output + length, YELLOW "[WARNING] " RESET "(%u similar messages suppressed)\n", header->suppressed);
+		__atomic_store_n(&best->tail, best->tail + header->size, __ATOMIC_RELEASE);
+	}
+
+	// Report the dropped records
+	for (ring = log_rings; ring != NULL; ring = ring->next) {
+		long long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if (dropped != ring->dropped_reported) {
+			if (current != stderr || length + 128 > LOG_OUTPUT_SIZE) {
+				log_output_write(current, &length);
+				current = stderr;
+			}
+			length += sprintf(log_output + length, YELLOW "[WARNING] " RESET "%lld log records dropped (log ring full)\n", dropped - ring->dropped_reported);
+			ring->dropped_reported = dropped;
+		}
+	}
+
+	// Report the call sites that stopped being suppressed
+	if (current != stderr || length + 128 * 4 > LOG_OUTPUT_SIZE) {
+		log_output_write(current, &length);
+		current = stderr;
+	}
+	log_rate_report(&length);
+	if (current != NULL)
+		log_output_write(current, &length);
+}
+
+/**
+ * @brief Function that handles the writer thread: it drains the rings every LOG_FLUSH_INTERVAL_MS,
+ * or sooner when a warning or an error is recorded.
+ * 
+ * @param arg NULL
+ * 
+ * @return thread_return_type	Never returns.
+ */
+static thread_return_type log_writer_thread(thread_param_type arg) {
+	(void)arg;
+	pthread_mutex_lock(&log_mutex);
+	while (1) {
+		log_drain();
+		#ifdef _WIN32
+			pthread_cond_timedwait(&log_cond, &log_mutex, LOG_FLUSH_INTERVAL_MS);
+		#else
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&log_cond, &log_mutex, &deadline);
+		#endif
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that starts the writer thread (only once).
+ * 
+ * @return int		0 if the writer is running, -1 otherwise (records are then written synchronously).
+ */
+static int log_start() {
+	if (!__sync_bool_compare_and_swap(&log_state, 0, 1)) {
+		while (log_state == 1);
+		return log_state == 2 ? 0 : -1;
+	}
+	log_output = malloc(LOG_OUTPUT_SIZE);
+	log_line = malloc(LOG_MAX_RECORD);
+	if (log_output == NULL || log_line == NULL) {
+		log_state = 3;
+		return -1;
+	}
+	pthread_mutex_init(&log_mutex, NULL);
+	pthread_cond_init(&log_cond, NULL);
+	pthread_create(&log_thread, NULL, log_writer_thread, NULL);
+	atexit(log_flush);
+	log_state = 2;
+	return 0;
+}
+
+/**
+ * @brief Function that gets the ring of the calling thread on first use: a ring released by an ended thread, or a new one.
+ * Rings are never freed so the records of ended threads are still written.
+ * 
+ * @return log_ring_t*	The ring, NULL if it can't be allocated.
+ */
+static log_ring_t* log_ring() {
+	if (log_local_ring != NULL)
+		return log_local_ring;
+	log_ring_t *ring;
+	for (ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+		if (ring->in_use == 0 && __sync_bool_compare_and_swap(&ring->in_use, 0, 1)) {
+			log_local_ring = ring;
+			return ring;
+		}
+	}
+	ring = calloc(1, sizeof(log_ring_t));
+	if (ring == NULL)
+		return NULL;
+	ring->in_use = 1;
+	do {
+		ring->next = log_rings;
+	} while (!__sync_bool_compare_and_swap(&log_rings, ring->next, ring));
+	log_local_ring = ring;
+	return ring;
+}
+
+/**
+ * @brief Function that gives the ring of the calling thread to the next threads (its pending records are still written).
+ * Threads that end should call it, so a thread per connection doesn't allocate a ring each time.
+ * 
+ * @return void
+ */
+void log_thread_release() {
+	if (log_local_ring == NULL)
+		return;
+	__atomic_store_n(&log_local_ring->in_use, 0, __ATOMIC_RELEASE);
+	log_local_ring = NULL;
+}
+
+/**
+ * @brief Function that records a log message: the arguments are captured in the ring of the thread,
+ * and the background thread formats and writes them. errno is reset to 0 like the synchronous printer did.
+ * 
+ * @param level		Level of the message (INFO_LEVEL, DEBUG_LEVEL, WARNING_LEVEL or ERROR_LEVEL).
+ * @param format	Format string (must be a literal: it's formatted later).
+ * @param ...		Arguments of the format.
+ * 
+ * @return void
+ */
+void log_record(int level, const char *format, ...) {
+	int saved_errno = errno;
+	errno = 0;
+	long long now = get_time_us();
+
+	// Rate limiting of the call site
+	unsigned int suppressed;
+	if (!log_rate_check(format, now, &suppressed))
+		return;
+
+	// Capture the arguments
+	va_list args;
+	va_start(args, format);
+	size_t payload = log_capture(log_staging, LOG_MAX_RECORD - sizeof(log_header_t), format, args);
+	va_end(args);
+	size_t size = (sizeof(log_header_t) + payload + 7) & ~(size_t)7;
+
+	// Without the writer thread, write synchronously
+	log_ring_t *ring = (log_state == 2 || log_start() == 0) ? log_ring() : NULL;
+	if (ring == NULL) {
+		char line[512];
+		log_render(line, sizeof(line), format, log_staging, log_staging + payload);
+		if (saved_errno != 0)
+			fprintf(stderr, "%s (%s)\n", line, strerror(saved_errno));
+		else
+			fputs(line, stderr);
+		return;
+	}
+
+	// Reserve the space in the ring (a padding fills the end of the ring if the record doesn't fit)
+	size_t head = ring->head;
+	size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	size_t offset = head & (LOG_RING_SIZE - 1);
+	size_t padding = (offset + size > LOG_RING_SIZE) ? LOG_RING_SIZE - offset : 0;
+	if (head + padding + size - tail > LOG_RING_SIZE) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (padding > 0) {
+		log_header_t *pad = (log_header_t*)(ring->data + offset);
+		pad->size = (unsigned int)padding;
+		pad->level = 0;
+		head += padding;
+		offset = 0;
+	}
+
+	// Write the record and publish it
+	log_header_t *header = (log_header_t*)(ring->data + offset);
+	header->size = (unsigned int)size;
+	header->level = level;
+	header->saved_errno = saved_errno;
+	header->suppressed = suppressed;
+	header->time_us = now;
+	header->format = format;
+	memcpy(header + 1, log_staging, payload);
+	__atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);
+
+	// Wake up the writer for warnings and errors
+	if (level & (WARNING_LEVEL | ERROR_LEVEL))
+		pthread_cond_signal(&log_cond);
+}
+
+/**
+ * @brief Function that changes the logger settings at runtime.
+ * 
+ * @param levels		Mask of the enabled levels (-1 to keep the current ones).
+ * @param rate_limit	Records per second and per call site (0 to keep the current one, -1 for no limit).
+ * 
+ * @return void
+ */
+void log_configure(int levels, int rate_limit) {
+	if (levels >= 0)
+		log_levels = levels & DEBUG_STATES;
+	if (rate_limit != 0)
+		log_rate_limit = rate_limit;
+}
+
+/**
+ * @brief Function that parses a list of level names ("info,debug,warning,error", "all" or "none")
+ * or a mask of the *_LEVEL defines.
+ * 
+ * @param value		Text to parse.
+ * 
+ * @return int		Mask of the levels, -1 if the text is invalid.
+ */
+int log_parse_levels(const char *value) {
+	if (value[0] >= '0' && value[0] <= '9')
+		return atoi(value);
+	int levels = 0;
+	const char *p = value;
+	while (*p != '\0') {
+		size_t length = strcspn(p, ", ");
+		if (length == 4 && strncmp(p, "info", 4) == 0) levels |= INFO_LEVEL;
+		else if (length == 5 && strncmp(p, "debug", 5) == 0) levels |= DEBUG_LEVEL;
+		else if (length == 7 && strncmp(p, "warning", 7) == 0) levels |= WARNING_LEVEL;
+		else if (length == 5 && strncmp(p, "error", 5) == 0) levels |= ERROR_LEVEL;
+		else if (length == 3 && strncmp(p, "all", 3) == 0) levels |= INFO_LEVEL | DEBUG_LEVEL | WARNING_LEVEL | ERROR_LEVEL;
+		else if (length == 4 && strncmp(p, "none", 4) == 0) levels |= 0;
+		else if (length > 0) return -1;
+		p += length;
+		p += strspn(p, ", ");
+	}
+	return levels;
+}
+
+/**
+ * @brief Function that writes all the pending records (registered with atexit()).
+ * 
+ * @return void
+ */
+void log_flush() {
+	if (log_state != 2)
+		return;
+	pthread_mutex_lock(&log_mutex);
+	log_drain();
+	pthread_mutex_unlock(&log_mutex);
+}
+
@@ -0,0 +1,24 @@
+
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#define LOG_RING_SIZE (64 * 1024)			// Ring of each thread (power of two)
+#define LOG_MAX_RECORD 4096					// Maximum size of a record (longer strings are truncated)
+#define LOG_DEFAULT_RATE_LIMIT 50			// Records per second and per call site before suppression
+#define LOG_FLUSH_INTERVAL_MS 10			// Maximum delay before a record is written
+
+// Levels enabled at runtime (mask of the *_LEVEL defines)
+extern volatile int log_levels;
+
+// Function prototypes
+#ifdef __GNUC__
+	__attribute__((format(printf, 2, 3)))
+#endif
+void log_record(int level, const char *format, ...);
+void log_configure(int levels, int rate_limit);
+int log_parse_levels(const char *value);
+void log_flush();
+void log_thread_release();
+
+#endif
+
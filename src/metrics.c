@@ -0,0 +1,478 @@
+
+#include "metrics.h"
+#include "universal_socket.h"
+#include "universal_pthread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#ifndef _WIN32
+	#include <sys/un.h>
+#endif
+
+#define METRICS_SUB_BITS 3						// log2(METRICS_HISTOGRAM_SUB_BUCKETS)
+#define METRICS_OUTPUT_SIZE (256 * 1024)
+
+// Counters and histograms of a thread (only written by their thread, read by the exporter)
+typedef struct metrics_shard_t {
+	long long counters[METRIC_COUNTERS_COUNT];
+	long long buckets[METRIC_HISTOGRAMS_COUNT][METRICS_HISTOGRAM_BUCKETS];
+	long long sums[METRIC_HISTOGRAMS_COUNT];
+	volatile int in_use;						// Owned by a running thread (a released shard is reused by the next thread)
+	struct metrics_shard_t *next;
+} metrics_shard_t;
+
+// Throughput of a client seen by the server
+typedef struct metrics_client_t {
+	char name[64];
+	long long bytes;
+	long long actions;
+} metrics_client_t;
+
+// Description of a metric in the Prometheus output
+typedef struct metrics_descriptor_t {
+	const char *name;
+	const char *labels;
+	const char *help;
+} metrics_descriptor_t;
+
+static const metrics_descriptor_t counter_descriptors[METRIC_COUNTERS_COUNT] = {
+	{ "rfs_events_total", "type=\"created\"", "File events received from the watcher" },
+	{ "rfs_events_total", "type=\"modified\"", NULL },
+	{ "rfs_events_total", "type=\"closed\"", NULL },
+	{ "rfs_events_total", "type=\"deleted\"", NULL },
+	{ "rfs_events_total", "type=\"renamed\"", NULL },
+	{ "rfs_changes_total", "result=\"sent\"", "Changes handled by the client sender" },
+	{ "rfs_changes_total", "result=\"failed\"", NULL },
+	{ "rfs_changes_total", "result=\"dropped\"", NULL },
+	{ "rfs_actions_total", "type=\"created\"", "Client actions handled by the server" },
+	{ "rfs_actions_total", "type=\"modified\"", NULL },
+	{ "rfs_actions_total", "type=\"deleted\"", NULL },
+	{ "rfs_actions_total", "type=\"renamed\"", NULL },
+	{ "rfs_actions_total", "type=\"failed\"", NULL },
+	{ "rfs_bytes_total", "direction=\"sent\",layer=\"raw\"", "Bytes exchanged (raw: file content, wire: everything written to the sockets)" },
+	{ "rfs_bytes_total", "direction=\"sent\",layer=\"wire\"", NULL },
+	{ "rfs_bytes_total", "direction=\"received\",layer=\"raw\"", NULL },
+	{ "rfs_bytes_total", "direction=\"received\",layer=\"wire\"", NULL },
+	{ "rfs_connections_total", "", "Connections opened or accepted" },
+	{ "rfs_snapshots_total", "result=\"built\"", "Snapshots of the directory built, or joined by a session arriving during the sharing window" },
+	{ "rfs_snapshots_total", "result=\"shared\"", NULL },
+	{ "rfs_precheck_total", "result=\"present\"", "Contents announced by their hash, already present on the server or needed" },
+	{ "rfs_precheck_total", "result=\"needed\"", NULL },
+	{ "rfs_bytes_skipped_total", "", "Bytes of content not transferred because the server already had them" },
+	{ "rfs_bytes_sparse_total", "", "Bytes of holes of sparse files, not transferred and not allocated by the receiver" },
+	{ "rfs_dir_cache_total", "result=\"hit\"", "Parent directories of the applied actions found open in the cache, or opened" },
+	{ "rfs_dir_cache_total", "result=\"miss\"", NULL },
+};
+static const metrics_descriptor_t gauge_descriptors[METRIC_GAUGES_COUNT] = {
+	{ "rfs_queue_depth", "queue=\"scheduled\"", "Changes waiting in the client queues" },
+	{ "rfs_queue_depth", "queue=\"deferred\"", NULL },
+	{ "rfs_connections_active", "", "Connections currently handled" },
+	{ "rfs_clients_registered", "", "Clients connected to the server" },
+	{ "rfs_index_entries", "", "Files and directories in the index of the server" },
+	{ "rfs_sync_sessions_active", "", "Initial synchronizations in progress" },
+	{ "rfs_snapshot_streams", "", "Snapshots being sent to the clients (limited by snapshot_max_streams)" },
+};
+static const metrics_descriptor_t histogram_descriptors[METRIC_HISTOGRAMS_COUNT] = {
+	{ "rfs_change_latency_seconds", "", "Time from a file event to the acknowledgement of the server" },
+	{ "rfs_mutex_wait_seconds", "", "Time spent waiting for the client mutex" },
+	{ "rfs_apply_latency_seconds", "", "Time to receive and apply a client action on the server" },
+};
+
+// Global variables
+static metrics_shard_t *metrics_shards = NULL;
+static __thread metrics_shard_t *metrics_local = NULL;
+static long long metrics_gauges[METRIC_GAUGES_COUNT];
+static metrics_client_t metrics_clients[METRICS_MAX_CLIENTS];
+static int metrics_clients_count = 0;
+static pthread_mutex_t metrics_clients_mutex;
+static volatile int metrics_clients_mutex_state = 0;	// 0: not initialized, 1: initializing, 2: ready
+static SOCKET metrics_socket = INVALID_SOCKET;
+static pthread_t metrics_thread;
+
+/**
+ * @brief Function that gets the shard of the calling thread on first use: a shard released by an ended thread, or a new one.
+ * Shards are never freed so the counters of ended threads are kept.
+ * 
+ * @return metrics_shard_t*		The shard, NULL if it can't be allocated.
+ */
+static metrics_shard_t* metrics_shard() {
+	if (metrics_local != NULL)
+		return metrics_local;
+	metrics_shard_t *shard;
+	for (shard = __atomic_load_n(&metrics_shards, __ATOMIC_ACQUIRE); shard != NULL; shard = shard->next) {
+		if (shard->in_use == 0 && __sync_bool_compare_and_swap(&shard->in_use, 0, 1)) {
+			metrics_local = shard;
+			return shard;
+		}
+	}
+	shard = calloc(1, sizeof(metrics_shard_t));
+	if (shard == NULL)
+		return NULL;
+	shard->in_use = 1;
+
+	// Push it on the list of shards (lock-free)
+	do {
+		shard->next = metrics_shards;
+	} while (!__sync_bool_compare_and_swap(&metrics_shards, shard->next, shard));
+	metrics_local = shard;
+	return shard;
+}
+
+/**
+ * @brief Function that gives the shard of the calling thread to the next threads (its counters are kept).
+ * Threads that end should call it, so a thread per connection doesn't allocate a shard each time.
+ * 
+ * @return void
+ */
+void metrics_thread_release() {
+	if (metrics_local == NULL)
+		return;
+	__atomic_store_n(&metrics_local->in_use, 0, __ATOMIC_RELEASE);
+	metrics_local = NULL;
+}
+
+/**
+ * @brief Function that adds a value to a counter.
+ * 
+ * @param counter	The counter.
+ * @param value		Value to add.
+ * 
+ * @return void
+ */
+void metrics_add(metrics_counter_t counter, long long value) {
+	metrics_shard_t *shard = metrics_shard();
+	if (shard != NULL)
+		__atomic_store_n(&shard->counters[counter], shard->counters[counter] + value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Function that sets the value of a gauge.
+ * 
+ * @param gauge		The gauge.
+ * @param value		New value.
+ * 
+ * @return void
+ */
+void metrics_gauge_set(metrics_gauge_t gauge, long long value) {
+	__atomic_store_n(&metrics_gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Function that adds a value (possibly negative) to a gauge.
+ * 
+ * @param gauge		The gauge.
+ * @param value		Value to add.
+ * 
+ * @return void
+ */
+void metrics_gauge_add(metrics_gauge_t gauge, long long value) {
+	__atomic_fetch_add(&metrics_gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Function that gets the histogram bucket of a value.
+ * Values below METRICS_HISTOGRAM_SUB_BUCKETS are exact, then each power of two
+ * is split in METRICS_HISTOGRAM_SUB_BUCKETS linear buckets.
+ * 
+ * @param value		The value.
+ * 
+ * @return int		Index of the bucket.
+ */
+static int metrics_bucket_index(unsigned long long value) {
+	if (value < METRICS_HISTOGRAM_SUB_BUCKETS)
+		return (int)value;
+	int exponent = 63 - __builtin_clzll(value);
+	int index = METRICS_HISTOGRAM_SUB_BUCKETS * (exponent - METRICS_SUB_BITS + 1) + (int)((value >> (exponent - METRICS_SUB_BITS)) & (METRICS_HISTOGRAM_SUB_BUCKETS - 1));
+	return index < METRICS_HISTOGRAM_BUCKETS ? index : METRICS_HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * @brief Function that gets the highest value of a histogram bucket.
+ * 
+ * @param index		Index of the bucket.
+ * 
+ * @return unsigned long long	Highest value counted in the bucket.
+ */
+static unsigned long long metrics_bucket_upper(int index) {
+	if (index < METRICS_HISTOGRAM_SUB_BUCKETS)
+		return (unsigned long long)index;
+	int shift = index / METRICS_HISTOGRAM_SUB_BUCKETS - 1;
+	int sub = index % METRICS_HISTOGRAM_SUB_BUCKETS;
+	return ((unsigned long long)(METRICS_HISTOGRAM_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+/**
+ * @brief Function that records a value in a histogram.
+ * 
+ * @param histogram		The histogram.
+ * @param value_us		Value in microseconds (negative values are counted as 0).
+ * 
+ * @return void
+ */
+void metrics_record(metrics_histogram_t histogram, long long value_us) {
+	metrics_shard_t *shard = metrics_shard();
+	if (shard == NULL)
+		return;
+	if (value_us < 0)
+		value_us = 0;
+	long long *bucket = &shard->buckets[histogram][metrics_bucket_index((unsigned long long)value_us)];
+	__atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&shard->sums[histogram], shard->sums[histogram] + value_us, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Function that adds the throughput of a client (server side).
+ * Clients beyond METRICS_MAX_CLIENTS are not tracked individually.
+ * 
+ * @param client	Name of the client (IP address).
+ * @param bytes		Bytes received from the client.
+ * @param actions	Actions received from the client.
+ * 
+ * @return void
+ */
+void metrics_client_add(const char *client, long long bytes, long long actions) {
+
+	// Find the client (entries are never removed, so the lookup doesn't need the lock)
+	int count = __atomic_load_n(&metrics_clients_count, __ATOMIC_ACQUIRE);
+	int i;
+	for (i = 0; i < count && strcmp(metrics_clients[i].name, client) != 0; i++);
+
+	// Else, register it
+	if (i == count) {
+		if (__sync_bool_compare_and_swap(&metrics_clients_mutex_state, 0, 1)) {
+			pthread_mutex_init(&metrics_clients_mutex, NULL);
+			metrics_clients_mutex_state = 2;
+		}
+		while (metrics_clients_mutex_state != 2);
+		pthread_mutex_lock(&metrics_clients_mutex);
+		count = metrics_clients_count;
+		for (i = 0; i < count && strcmp(metrics_clients[i].name, client) != 0; i++);
+		if (i == count && count < METRICS_MAX_CLIENTS) {
+			snprintf(metrics_clients[i].name, sizeof(metrics_clients[i].name), "%s", client);
+			__atomic_store_n(&metrics_clients_count, count + 1, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&metrics_clients_mutex);
+		if (i == METRICS_MAX_CLIENTS)
+			return;
+	}
+
+	// Update the counters
+	__atomic_fetch_add(&metrics_clients[i].bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&metrics_clients[i].actions, actions, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Function that appends formatted text to the output buffer (truncated when full).
+ * 
+ * @return void
+ */
+static void metrics_append(char *buffer, size_t size, size_t *length, const char *format, ...) {
+	if (*length >= size)
+		return;
+	va_list args;
+	va_start(args, format);
+	int written = vsnprintf(buffer + *length, size - *length, format, args);
+	va_end(args);
+	if (written > 0)
+		*length = (*length + written < size) ? *length + written : size - 1;
+}
+
+/**
+ * @brief Function that appends the HELP and TYPE lines of a metric family when it starts.
+ * 
+ * @return void
+ */
+static void metrics_append_family(char *buffer, size_t size, size_t *length, const metrics_descriptor_t *descriptor, const char *type) {
+	if (descriptor->help != NULL)
+		metrics_append(buffer, size, length, "# HELP %s %s\n# TYPE %s %s\n", descriptor->name, descriptor->help, descriptor->name, type);
+}
+
+/**
+ * @brief Function that writes all the metrics in the Prometheus text format.
+ * 
+ * @param buffer	Buffer to fill.
+ * @param size		Size of the buffer.
+ * 
+ * @return size_t	Length of the text (without the final '\0').
+ */
+size_t metrics_format(char *buffer, size_t size) {
+	size_t length = 0;
+	metrics_shard_t *shard;
+	int i, j;
+	buffer[0] = '\0';
+
+	// Counters (sum of the shards)
+	for (i = 0; i < METRIC_COUNTERS_COUNT; i++) {
+		long long total = 0;
+		for (shard = metrics_shards; shard != NULL; shard = shard->next)
+			total += __atomic_load_n(&shard->counters[i], __ATOMIC_RELAXED);
+		const metrics_descriptor_t *descriptor = &counter_descriptors[i];
+		metrics_append_family(buffer, size, &length, descriptor, "counter");
+		metrics_append(buffer, size, &length, descriptor->labels[0] ? "%s{%s} %lld\n" : "%s%s %lld\n", descriptor->name, descriptor->labels, total);
+	}
+
+	// Gauges
+	for (i = 0; i < METRIC_GAUGES_COUNT; i++) {
+		const metrics_descriptor_t *descriptor = &gauge_descriptors[i];
+		metrics_append_family(buffer, size, &length, descriptor, "gauge");
+		metrics_append(buffer, size, &length, descriptor->labels[0] ? "%s{%s} %lld\n" : "%s%s %lld\n", descriptor->name, descriptor->labels, __atomic_load_n(&metrics_gauges[i], __ATOMIC_RELAXED));
+	}
+
+	// Histograms, as summaries with the usual quantiles
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	for (i = 0; i < METRIC_HISTOGRAMS_COUNT; i++) {
+		long long buckets[METRICS_HISTOGRAM_BUCKETS];
+		long long count = 0, sum = 0;
+		memset(buckets, 0, sizeof(buckets));
+		for (shard = metrics_shards; shard != NULL; shard = shard->next) {
+			for (j = 0; j < METRICS_HISTOGRAM_BUCKETS; j++)
+				buckets[j] += __atomic_load_n(&shard->buckets[i][j], __ATOMIC_RELAXED);
+			sum += __atomic_load_n(&shard->sums[i], __ATOMIC_RELAXED);
+		}
+		for (j = 0; j < METRICS_HISTOGRAM_BUCKETS; j++)
+			count += buckets[j];
+
+		const metrics_descriptor_t *descriptor = &histogram_descriptors[i];
+		metrics_append_family(buffer, size, &length, descriptor, "summary");
+		size_t q;
+		for (q = 0; q < sizeof(quantiles) / sizeof(double); q++) {
+			long long rank = (long long)(quantiles[q] * count + 0.5), seen = 0;
+			for (j = 0; j < METRICS_HISTOGRAM_BUCKETS - 1 && (seen += buckets[j]) < rank; j++);
+			double value = count > 0 ? metrics_bucket_upper(j) / 1e6 : 0;
+			metrics_append(buffer, size, &length, "%s{quantile=\"%g\"} %.6f\n", descriptor->name, quantiles[q], value);
+		}
+		metrics_append(buffer, size, &length, "%s_sum %.6f\n%s_count %lld\n", descriptor->name, sum / 1e6, descriptor->name, count);
+	}
+
+	// Per-client throughput (server side)
+	int clients_count = __atomic_load_n(&metrics_clients_count, __ATOMIC_ACQUIRE);
+	if (clients_count > 0) {
+		metrics_append(buffer, size, &length, "# HELP rfs_client_bytes_total Bytes received from each client\n# TYPE rfs_client_bytes_total counter\n");
+		for (i = 0; i < clients_count; i++)
+			metrics_append(buffer, size, &length, "rfs_client_bytes_total{client=\"%s\"} %lld\n", metrics_clients[i].name, __atomic_load_n(&metrics_clients[i].bytes, __ATOMIC_RELAXED));
+		metrics_append(buffer, size, &length, "# HELP rfs_client_actions_total Actions received from each client\n# TYPE rfs_client_actions_total counter\n");
+		for (i = 0; i < clients_count; i++)
+			metrics_append(buffer, size, &length, "rfs_client_actions_total{client=\"%s\"} %lld\n", metrics_clients[i].name, __atomic_load_n(&metrics_clients[i].actions, __ATOMIC_RELAXED));
+	}
+
+	// Return
+	return length;
+}
+
+/**
+ * @brief Function that handles the metrics exporter thread:
+ * it answers each connection with the metrics (HTTP, Prometheus text format).
+ * 
+ * @param arg NULL
+ * 
+ * @return thread_return_type		0 when the socket is closed.
+ */
+static thread_return_type metrics_exporter_thread(thread_param_type arg) {
+	(void)arg;
+
+	// Allocate the output buffer
+	char *output = malloc(METRICS_OUTPUT_SIZE);
+	int code = output == NULL ? -1 : 0;
+	#ifdef _WIN32
+		ERROR_HANDLE_INT_RETURN_INT(code, "metrics_exporter_thread(): Unable to allocate the output buffer\n");
+	#else
+		ERROR_HANDLE_INT_RETURN_NULL(code, "metrics_exporter_thread(): Unable to allocate the output buffer\n");
+	#endif
+
+	// Answer the connections
+	while (1) {
+		SOCKET client = accept(metrics_socket, NULL, NULL);
+		if (client == INVALID_SOCKET)
+			break;
+
+		// Read the request (its content doesn't matter)
+		char request[1024];
+		tcp_read(client, request, sizeof(request), 0);
+
+		// Send the metrics
+		size_t length = metrics_format(output, METRICS_OUTPUT_SIZE);
+		char header[128];
+		int header_length = sprintf(header, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", length);
+		tcp_write(client, header, header_length, 0);
+		size_t sent = 0;
+		while (sent < length) {
+			int bytes = tcp_write(client, output + sent, length - sent, 0);
+			if (bytes <= 0)
+				break;
+			sent += bytes;
+		}
+		socket_close(client);
+	}
+
+	// Return
+	free(output);
+	return 0;
+}
+
+/**
+ * @brief Function that starts the metrics exporter thread.
+ * Only local connections are accepted: loopback TCP port or Unix socket.
+ * 
+ * @param port		TCP port on 127.0.0.1 (0 to disable).
+ * @param unix_path	Path of a Unix socket (NULL or empty to disable, not supported on Windows).
+ * 
+ * @return int		0 if the exporter is running or disabled, -1 otherwise.
+ */
+int metrics_start_exporter(int port, const char *unix_path) {
+	int code;
+
+	// Unix socket
+	#ifndef _WIN32
+	if (unix_path != NULL && unix_path[0] != '\0') {
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(struct sockaddr_un));
+		address.sun_family = AF_UNIX;
+		code = strlen(unix_path) < sizeof(address.sun_path) ? 0 : -1;
+		ERROR_HANDLE_INT_RETURN_INT(code, "metrics_start_exporter(): Unix socket path too long '%s'\n", unix_path);
+		strcpy(address.sun_path, unix_path);
+		unlink(unix_path);
+		errno = 0;
+		metrics_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+		code = metrics_socket == INVALID_SOCKET ? -1 : bind(metrics_socket, (struct sockaddr *)&address, sizeof(struct sockaddr_un));
+	}
+	else
+	#else
+		(void)unix_path;
+	#endif
+
+	// Loopback TCP port
+	if (port > 0) {
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof(struct sockaddr_in));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(port);
+		metrics_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		int reuse = 1;
+		if (metrics_socket != INVALID_SOCKET)
+			setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, (char*)&reuse, sizeof(int));
+		code = metrics_socket == INVALID_SOCKET ? -1 : bind(metrics_socket, (struct sockaddr *)&address, sizeof(struct sockaddr_in));
+	}
+
+	// Disabled
+	else
+		return 0;
+
+	// Listen and start the thread
+	if (code == 0)
+		code = listen(metrics_socket, 16);
+	if (code == -1 && metrics_socket != INVALID_SOCKET) socket_close(metrics_socket);
+	ERROR_HANDLE_INT_RETURN_INT(code, "metrics_start_exporter(): Unable to open the metrics socket\n");
+	pthread_create(&metrics_thread, NULL, metrics_exporter_thread, NULL);
+	if (port > 0 && (unix_path == NULL || unix_path[0] == '\0')) {
+		INFO_PRINT("metrics_start_exporter(): Metrics available on http://127.0.0.1:%d/metrics\n", port);
+	}
+	else {
+		INFO_PRINT("metrics_start_exporter(): Metrics available on the Unix socket '%s'\n", unix_path);
+	}
+	return 0;
+}
+
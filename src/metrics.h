@@ -0,0 +1,73 @@
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "universal_utils.h"
+
+#define METRICS_HISTOGRAM_SUB_BUCKETS 8			// Buckets per power of two (~12% relative precision)
+#define METRICS_HISTOGRAM_BUCKETS (METRICS_HISTOGRAM_SUB_BUCKETS * 41)
+#define METRICS_MAX_CLIENTS 256					// Clients tracked individually by the server
+
+// Counters (sharded per thread, only increase)
+typedef enum metrics_counter_t {
+	METRIC_EVENTS_CREATED,
+	METRIC_EVENTS_MODIFIED,
+	METRIC_EVENTS_CLOSED,
+	METRIC_EVENTS_DELETED,
+	METRIC_EVENTS_RENAMED,
+	METRIC_CHANGES_SENT,
+	METRIC_CHANGES_FAILED,
+	METRIC_CHANGES_DROPPED,
+	METRIC_ACTIONS_CREATED,
+	METRIC_ACTIONS_MODIFIED,
+	METRIC_ACTIONS_DELETED,
+	METRIC_ACTIONS_RENAMED,
+	METRIC_ACTIONS_FAILED,
+	METRIC_BYTES_SENT_RAW,
+	METRIC_BYTES_SENT_WIRE,
+	METRIC_BYTES_RECEIVED_RAW,
+	METRIC_BYTES_RECEIVED_WIRE,
+	METRIC_CONNECTIONS_OPENED,
+	METRIC_SNAPSHOTS_BUILT,
+	METRIC_SNAPSHOTS_SHARED,
+	METRIC_PRECHECK_PRESENT,
+	METRIC_PRECHECK_NEEDED,
+	METRIC_BYTES_SKIPPED,
+	METRIC_BYTES_SPARSE,
+	METRIC_DIR_CACHE_HITS,
+	METRIC_DIR_CACHE_MISSES,
+	METRIC_COUNTERS_COUNT
+} metrics_counter_t;
+
+// Gauges (current values)
+typedef enum metrics_gauge_t {
+	METRIC_QUEUE_SCHEDULED,
+	METRIC_QUEUE_DEFERRED,
+	METRIC_CONNECTIONS_ACTIVE,
+	METRIC_CLIENTS_REGISTERED,
+	METRIC_INDEX_ENTRIES,
+	METRIC_SYNC_SESSIONS_ACTIVE,
+	METRIC_SNAPSHOT_STREAMS,
+	METRIC_GAUGES_COUNT
+} metrics_gauge_t;
+
+// Histograms (sharded per thread, values in microseconds)
+typedef enum metrics_histogram_t {
+	METRIC_CHANGE_LATENCY,			// Client: event -> acknowledgement of the server
+	METRIC_MUTEX_WAIT,				// Client: wait time of g_client->mutex
+	METRIC_APPLY_LATENCY,			// Server: reception and application of an action
+	METRIC_HISTOGRAMS_COUNT
+} metrics_histogram_t;
+
+// Function prototypes
+void metrics_thread_release();
+void metrics_add(metrics_counter_t counter, long long value);
+void metrics_gauge_set(metrics_gauge_t gauge, long long value);
+void metrics_gauge_add(metrics_gauge_t gauge, long long value);
+void metrics_record(metrics_histogram_t histogram, long long value_us);
+void metrics_client_add(const char *client, long long bytes, long long actions);
+size_t metrics_format(char *buffer, size_t size);
+int metrics_start_exporter(int port, const char *unix_path);
+
+#endif
+
@@ -2,6 +2,12 @@
 #include "net_utils.h"
 #include "../config_manager.h"
 
+#ifdef _WIN32
+	#include <ws2tcpip.h>
+#else
+	#include <netinet/tcp.h>
+#endif
+
 /**
  * @brief Encode the message using the password.
  * 
@@ -52,3 +58,51 @@ void bytes_decrypter(byte* bytes, size_t size, simple_string_t password) {
 	}
 }
 
+
+/**
+ * @brief Apply the configured options to a socket (before connect() or listen(), the accepted sockets inherit them).
+ * 
+ * @param socket The socket to configure.
+ * @param send_buffer Size of the send buffer (0 to keep the system default).
+ * @param recv_buffer Size of the receive buffer (0 to keep the system default).
+ * @param no_delay 1 to disable Nagle's algorithm.
+ * 
+ * @return int 0 if every option was applied, -1 otherwise (the socket stays usable).
+ */
+int set_socket_options(SOCKET socket, size_t send_buffer, size_t recv_buffer, int no_delay) {
+	int code = 0;
+	int value;
+	if (send_buffer > 0) {
+		value = (int)send_buffer;
+		code |= setsockopt(socket, SOL_SOCKET, SO_SNDBUF, (const char*)&value, sizeof(int));
+	}
+	if (recv_buffer > 0) {
+		value = (int)recv_buffer;
+		code |= setsockopt(socket, SOL_SOCKET, SO_RCVBUF, (const char*)&value, sizeof(int));
+	}
+	if (no_delay) {
+		value = 1;
+		code |= setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&value, sizeof(int));
+	}
+	return code == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Write every byte of a buffer to a socket (a write can send only a part of them).
+ * 
+ * @param socket The socket to write to.
+ * @param data The bytes to send.
+ * @param size Number of bytes to send.
+ * 
+ * @return int 0 if every byte was sent, -1 otherwise.
+ */
+int socket_write_all(SOCKET socket, void *data, size_t size) {
+	size_t sent = 0;
+	while (sent < size) {
+		ssize_t bytes = socket_write(socket, (byte*)data + sent, size - sent, 0);
+		if (bytes <= 0)
+			return -1;
+		sent += (size_t)bytes;
+	}
+	return 0;
+}
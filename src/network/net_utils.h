@@ -4,9 +4,7 @@
 
 #include "../universal_socket.h"
 #include "../universal_utils.h"
-
-#define ZIP_TEMPORARY_FILE "remote_folder_sync_temp.zip"
-#define CS_BUFFER_SIZE 1024 * 1024		// 1 MB
+#include "../buffer_pool.h"
 
 
 // Message types
@@ -17,6 +15,11 @@ typedef enum message_type_t {
 	FILE_DELETED = 12,
 	FILE_RENAMED = 13,
 
+	CONTENT_PRESENT = 20,		// Answer to the hash of a content: the server already has it
+	CONTENT_NEEDED = 21,		// Answer to the hash of a content: the content must follow
+
+	SYNC_ROOTS = 30,			// First message of a client: names of its roots (NUL terminated) and its transfer buffer size, a snapshot is sent for each one
+
 	DISCONNECT = 100,
 	VALID_RESPONSE = 61166,
 
@@ -42,11 +45,26 @@ typedef struct {
 
 } message_t;
 
+// Metadata of a file, kept by the server so size and mtime comparisons stay reliable
+typedef struct file_metadata_t {
+	unsigned int mode;			// Permissions (0 if unknown)
+	unsigned int reserved;
+	long long mtime_ns;			// Modification time in nanoseconds (0 if unknown)
+} file_metadata_t;
+
+// Extent of data of a file, followed by its content (the bytes between the extents are holes)
+typedef struct data_extent_t {
+	size_t offset;
+	size_t length;				// 0 ends the list of extents
+} data_extent_t;
+
 // Functions prototypes
 void bytes_encrypter(byte* bytes, size_t size, simple_string_t password);
 void bytes_decrypter(byte* bytes, size_t size, simple_string_t password);
 #define ENCRYPT_BYTES(bytes, size, password) bytes_encrypter((byte*)bytes, size, password)
 #define DECRYPT_BYTES(bytes, size, password) bytes_decrypter((byte*)bytes, size, password)
+int set_socket_options(SOCKET socket, size_t send_buffer, size_t recv_buffer, int no_delay);
+int socket_write_all(SOCKET socket, void *data, size_t size);
 
 #endif
 
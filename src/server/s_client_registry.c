@@ -0,0 +1,222 @@
+
+#include "s_client_registry.h"
+#include "../metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Function that initializes an empty registry.
+ * 
+ * @param registry	The registry to initialize.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+int client_registry_init(client_registry_t *registry) {
+	memset(registry, 0, sizeof(client_registry_t));
+	pthread_mutex_init(&registry->mutex, NULL);
+	return 0;
+}
+
+/**
+ * @brief Function that enters a read-side section: the clients seen until client_registry_read_unlock()
+ * stay valid (their slots are not reused and their sockets not closed), even if they are removed meanwhile.
+ * 
+ * @param registry	The registry.
+ * 
+ * @return long		The epoch to give to client_registry_read_unlock().
+ */
+long client_registry_read_lock(client_registry_t *registry) {
+	while (1) {
+		long epoch = __atomic_load_n(&registry->epoch, __ATOMIC_ACQUIRE);
+		__atomic_fetch_add(&registry->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+
+		// The epoch didn't change meanwhile: the writers won't reclaim what this reader can see
+		if (__atomic_load_n(&registry->epoch, __ATOMIC_SEQ_CST) == epoch)
+			return epoch;
+		__atomic_fetch_sub(&registry->readers[epoch & 1], 1, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * @brief Function that leaves a read-side section.
+ * 
+ * @param registry	The registry.
+ * @param epoch		The value returned by client_registry_read_lock().
+ * 
+ * @return void
+ */
+void client_registry_read_unlock(client_registry_t *registry, long epoch) {
+	__atomic_fetch_sub(&registry->readers[epoch & 1], 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Function that starts a new epoch if no reader is left in the previous one,
+ * then moves the slots that can't be seen anymore to the free list and closes their sockets.
+ * Never waits (writers only, with the mutex held).
+ * 
+ * @param registry	The registry.
+ * 
+ * @return void
+ */
+static void client_registry_reclaim(client_registry_t *registry) {
+
+	// The readers of the epoch E - 1 are gone: start the epoch E + 1 (new readers use the parity of E)
+	long epoch = registry->epoch;
+	if (__atomic_load_n(&registry->readers[(epoch + 1) & 1], __ATOMIC_ACQUIRE) != 0)
+		return;
+	__atomic_store_n(&registry->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+
+	// The slots removed during the epoch E - 1 can't be seen anymore
+	int index = (int)((epoch + 2) % 3);
+	while (registry->retired[index] != NULL) {
+		tcp_client_from_server_t *client = registry->retired[index];
+		registry->retired[index] = client->next_free;
+		socket_close(client->socket);
+		client->socket = INVALID_SOCKET;
+		__atomic_store_n(&client->state, CLIENT_SLOT_FREE, __ATOMIC_RELAXED);
+		client->next_free = registry->free_list;
+		registry->free_list = client;
+	}
+}
+
+/**
+ * @brief Function that registers a client in a free slot (reused slot, or a new segment of slots).
+ * 
+ * @param registry	The registry.
+ * @param socket	Socket of the client (owned by the registry, closed after the removal).
+ * @param address	Address of the client.
+ * @param roots		Roots requested by the client (bit of the index of each root).
+ * 
+ * @return tcp_client_from_server_t*	The registered client, NULL if the registry is full.
+ */
+tcp_client_from_server_t* client_registry_insert(client_registry_t *registry, SOCKET socket, struct sockaddr_in address, unsigned int roots) {
+	pthread_mutex_lock(&registry->mutex);
+
+	// Get a free slot: reclaim the removed ones (closing their sockets), or allocate a new segment
+	client_registry_reclaim(registry);
+	if (registry->free_list == NULL && registry->segments_count < CLIENT_REGISTRY_MAX_SEGMENTS) {
+		tcp_client_from_server_t *segment = calloc(CLIENT_REGISTRY_SEGMENT_SIZE, sizeof(tcp_client_from_server_t));
+		if (segment != NULL) {
+			int i;
+			for (i = CLIENT_REGISTRY_SEGMENT_SIZE - 1; i >= 0; i--) {
+				segment[i].socket = INVALID_SOCKET;
+				segment[i].slot = registry->segments_count * CLIENT_REGISTRY_SEGMENT_SIZE + i;
+				segment[i].next_free = registry->free_list;
+				registry->free_list = &segment[i];
+			}
+			registry->segments[registry->segments_count++] = segment;
+		}
+	}
+	tcp_client_from_server_t *client = registry->free_list;
+	if (client == NULL) {
+		pthread_mutex_unlock(&registry->mutex);
+		ERROR_PRINT("client_registry_insert(): No free slot for a new client (%d clients)\n", registry->count);
+		return NULL;
+	}
+	registry->free_list = client->next_free;
+
+	// Fill the slot, then publish it at the head of the active list
+	client->socket = socket;
+	client->address = address;
+	client->roots = roots;
+	client->id = registry->next_id++;
+	client->state = CLIENT_SLOT_ACTIVE;
+	client->next_free = NULL;
+	client->prev = NULL;
+	client->next = registry->active;
+	if (client->next != NULL)
+		client->next->prev = client;
+	__atomic_store_n(&registry->active, client, __ATOMIC_RELEASE);
+	registry->count++;
+	pthread_mutex_unlock(&registry->mutex);
+	metrics_gauge_add(METRIC_CLIENTS_REGISTERED, 1);
+	return client;
+}
+
+/**
+ * @brief Function that removes a client: it disappears from the next iterations,
+ * its slot and socket are released once the current readers are gone.
+ * Can be called from a visitor of client_registry_for_each().
+ * 
+ * @param registry	The registry.
+ * @param client	The client to remove.
+ * 
+ * @return int		0 if success, -1 if the client was not registered.
+ */
+int client_registry_remove(client_registry_t *registry, tcp_client_from_server_t *client) {
+	pthread_mutex_lock(&registry->mutex);
+	if (client->state != CLIENT_SLOT_ACTIVE) {
+		pthread_mutex_unlock(&registry->mutex);
+		return -1;
+	}
+
+	// Unlink it (its own next pointer is kept, so a reader standing on it can continue)
+	if (client->prev != NULL)
+		__atomic_store_n(&client->prev->next, client->next, __ATOMIC_RELEASE);
+	else
+		__atomic_store_n(&registry->active, client->next, __ATOMIC_RELEASE);
+	if (client->next != NULL)
+		client->next->prev = client->prev;
+	__atomic_store_n(&client->state, CLIENT_SLOT_RETIRED, __ATOMIC_RELAXED);
+
+	// Stop the transfers now, the socket is closed when the slot is reclaimed
+	#ifdef _WIN32
+		shutdown(client->socket, SD_BOTH);
+	#else
+		shutdown(client->socket, SHUT_RDWR);
+	#endif
+	client->next_free = registry->retired[registry->epoch % 3];
+	registry->retired[registry->epoch % 3] = client;
+	registry->count--;
+	client_registry_reclaim(registry);
+	pthread_mutex_unlock(&registry->mutex);
+	metrics_gauge_add(METRIC_CLIENTS_REGISTERED, -1);
+	return 0;
+}
+
+/**
+ * @brief Function that calls a function for each registered client, without taking the lock of the writers.
+ * The clients registered or removed during the iteration may or may not be visited.
+ * 
+ * @param registry	The registry.
+ * @param visitor	Function to call (returns -1 to stop the iteration).
+ * @param arg		Argument given to the visitor.
+ * 
+ * @return int		Number of visited clients.
+ */
+int client_registry_for_each(client_registry_t *registry, client_visitor_t visitor, void *arg) {
+	int visited = 0;
+	long epoch = client_registry_read_lock(registry);
+	tcp_client_from_server_t *client = __atomic_load_n(&registry->active, __ATOMIC_ACQUIRE);
+	while (client != NULL) {
+		visited++;
+		if (visitor(client, arg) == -1)
+			break;
+		client = __atomic_load_n(&client->next, __ATOMIC_ACQUIRE);
+	}
+	client_registry_read_unlock(registry, epoch);
+	return visited;
+}
+
+/**
+ * @brief Function that tells if a registered client from an address requested a root
+ * (the actions come on their own connections, only their address links them to the client).
+ * 
+ * @param registry	The registry.
+ * @param address	Address of the client sending the action.
+ * @param root		Index of the root.
+ * 
+ * @return int		1 if a client from this address synchronizes the root, 0 otherwise.
+ */
+int client_registry_has_root(client_registry_t *registry, struct in_addr address, int root) {
+	int found = 0;
+	long epoch = client_registry_read_lock(registry);
+	tcp_client_from_server_t *client = __atomic_load_n(&registry->active, __ATOMIC_ACQUIRE);
+	while (client != NULL && !found) {
+		found = client->address.sin_addr.s_addr == address.s_addr && (client->roots & (1u << root)) != 0;
+		client = __atomic_load_n(&client->next, __ATOMIC_ACQUIRE);
+	}
+	client_registry_read_unlock(registry, epoch);
+	return found;
+}
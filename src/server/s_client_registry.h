@@ -0,0 +1,60 @@
+
+#ifndef __SERVER_CLIENT_REGISTRY_H__
+#define __SERVER_CLIENT_REGISTRY_H__
+
+#include "../universal_socket.h"
+#include "../universal_pthread.h"
+#include "../universal_utils.h"
+
+#define CLIENT_REGISTRY_SEGMENT_SIZE 256		// Slots allocated at once (slots never move)
+#define CLIENT_REGISTRY_MAX_SEGMENTS 256		// Up to 65536 clients
+
+// States of a slot
+#define CLIENT_SLOT_FREE 0
+#define CLIENT_SLOT_ACTIVE 1
+#define CLIENT_SLOT_RETIRED 2					// Removed, waiting for the readers that may still see it
+
+// Clients view from the server
+typedef struct tcp_client_from_server_t {
+	SOCKET socket;
+	struct sockaddr_in address;
+	int id;											// Connection number (never reused)
+	int slot;										// Index of the slot in the registry
+	unsigned int roots;								// Roots requested with SYNC_ROOTS (bit of the index of each root)
+	volatile int state;								// CLIENT_SLOT_*
+	struct tcp_client_from_server_t *volatile next;	// Next active client (followed by the readers without lock)
+	struct tcp_client_from_server_t *prev;			// Previous active client (writers only)
+	struct tcp_client_from_server_t *next_free;		// Next slot in the free or retired list
+} tcp_client_from_server_t;
+
+// Registry of the connected clients:
+// writers (insert, remove) are serialized by a mutex and run in O(1),
+// readers iterate the active list without lock inside an epoch (read-copy-update style),
+// a slot removed during the epoch E is reused once the epoch E + 2 is reached (no reader can see it anymore).
+typedef struct client_registry_t {
+	tcp_client_from_server_t *segments[CLIENT_REGISTRY_MAX_SEGMENTS];
+	int segments_count;
+	tcp_client_from_server_t *volatile active;		// Head of the active list
+	tcp_client_from_server_t *free_list;
+	tcp_client_from_server_t *retired[3];			// Slots removed during the last epochs (their sockets are closed when reclaimed)
+	volatile long epoch;							// Changed by the writers only
+	volatile long readers[2];						// Readers inside an even and an odd epoch
+	volatile int count;
+	int next_id;
+	pthread_mutex_t mutex;
+} client_registry_t;
+
+// Function called for each client by client_registry_for_each() (returns -1 to stop)
+typedef int (*client_visitor_t)(tcp_client_from_server_t *client, void *arg);
+
+// Function prototypes
+int client_registry_init(client_registry_t *registry);
+tcp_client_from_server_t* client_registry_insert(client_registry_t *registry, SOCKET socket, struct sockaddr_in address, unsigned int roots);
+int client_registry_remove(client_registry_t *registry, tcp_client_from_server_t *client);
+long client_registry_read_lock(client_registry_t *registry);
+void client_registry_read_unlock(client_registry_t *registry, long epoch);
+int client_registry_for_each(client_registry_t *registry, client_visitor_t visitor, void *arg);
+int client_registry_has_root(client_registry_t *registry, struct in_addr address, int root);
+
+#endif
+
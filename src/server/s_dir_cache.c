@@ -0,0 +1,307 @@
+
+#ifndef _WIN32
+	#define _GNU_SOURCE
+#endif
+
+#include "s_dir_cache.h"
+#include "../hash_engine.h"
+#include "../metrics.h"
+#include "../io_engine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Function that checks a component of a received path (the paths stay inside the synchronized directory).
+ * 
+ * @param name		The component.
+ * @param length	Length of the component.
+ * 
+ * @return int		1 if the component is a valid name, 0 if it's empty, "." or "..".
+ */
+static int dir_cache_valid_name(const char *name, size_t length) {
+	#ifdef _WIN32
+		if (memchr(name, '\\', length) != NULL || memchr(name, ':', length) != NULL)
+			return 0;
+	#endif
+	return length > 0 && !(name[0] == '.' && (length == 1 || (length == 2 && name[1] == '.')));
+}
+
+/**
+ * @brief Function that checks every component of a received path, before anything is resolved or built from it.
+ * 
+ * @param path	Path relative to the root.
+ * 
+ * @return int	1 if the path stays inside the root, 0 otherwise (absolute, empty, "." or ".." component).
+ */
+int dir_cache_valid_path(const char *path) {
+	const char *component = path;
+	while (1) {
+		const char *slash = strchr(component, '/');
+		size_t length = slash == NULL ? strlen(component) : (size_t)(slash - component);
+		if (!dir_cache_valid_name(component, length))
+			return 0;
+		if (slash == NULL)
+			return 1;
+		component = slash + 1;
+	}
+}
+
+/**
+ * @brief Function that unlinks an entry from the order of use.
+ * 
+ * @param cache	The cache.
+ * @param entry	The entry.
+ * 
+ * @return void
+ */
+static void dir_cache_unlink_use(dir_cache_t *cache, dir_cache_entry_t *entry) {
+	if (entry->newer != NULL) entry->newer->older = entry->older;
+	else cache->newest = entry->older;
+	if (entry->older != NULL) entry->older->newer = entry->newer;
+	else cache->oldest = entry->newer;
+	entry->newer = entry->older = NULL;
+}
+
+/**
+ * @brief Function that marks an entry as the most recently used one.
+ * 
+ * @param cache	The cache.
+ * @param entry	The entry (not in the order of use).
+ * 
+ * @return void
+ */
+static void dir_cache_push_newest(dir_cache_t *cache, dir_cache_entry_t *entry) {
+	entry->older = cache->newest;
+	entry->newer = NULL;
+	if (cache->newest != NULL) cache->newest->newer = entry;
+	cache->newest = entry;
+	if (cache->oldest == NULL) cache->oldest = entry;
+}
+
+/**
+ * @brief Function that removes an entry from the cache and closes its directory.
+ * 
+ * @param cache	The cache.
+ * @param entry	The entry.
+ * 
+ * @return void
+ */
+static void dir_cache_remove(dir_cache_t *cache, dir_cache_entry_t *entry) {
+	dir_cache_entry_t **link = &cache->buckets[entry->path_hash & (cache->buckets_count - 1)];
+	while (*link != entry)
+		link = &(*link)->next;
+	*link = entry->next;
+	dir_cache_unlink_use(cache, entry);
+	close(entry->fd);
+	free(entry);
+	cache->count--;
+}
+
+/**
+ * @brief Function that closes every cached directory (the root excepted).
+ * 
+ * @param cache	The cache.
+ * 
+ * @return void
+ */
+static void dir_cache_flush(dir_cache_t *cache) {
+	while (cache->oldest != NULL)
+		dir_cache_remove(cache, cache->oldest);
+}
+
+/**
+ * @brief Function that initializes the cache and opens the root.
+ * 
+ * @param cache		The cache.
+ * @param root		The synchronized directory.
+ * @param capacity	Directories kept open (0 for the default).
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+int dir_cache_init(dir_cache_t *cache, const char *root, int capacity) {
+	memset(cache, 0, sizeof(dir_cache_t));
+	size_t length = strlen(root);
+	int code = (length + 2 < sizeof(cache->root)) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "dir_cache_init(): Root path too long '%s'\n", root);
+	strcpy(cache->root, root);
+	if (length > 0 && root[length - 1] != '/')
+		strcat(cache->root, "/");
+	cache->capacity = capacity > 0 ? (size_t)capacity : DIR_CACHE_DEFAULT_SIZE;
+	if (cache->capacity < DIR_CACHE_MIN_SIZE)
+		cache->capacity = DIR_CACHE_MIN_SIZE;
+	cache->buckets_count = 1;
+	while (cache->buckets_count < cache->capacity * 2)
+		cache->buckets_count *= 2;
+	cache->buckets = calloc(cache->buckets_count, sizeof(dir_cache_entry_t*));
+	ERROR_HANDLE_PTR_RETURN_INT(cache->buckets, "dir_cache_init(): Unable to allocate the buckets\n");
+	#ifdef _WIN32
+		cache->root_fd = AT_FDCWD;
+	#else
+		cache->root_fd = open(cache->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		code = cache->root_fd;
+		if (code == -1) free(cache->buckets);
+		ERROR_HANDLE_INT_RETURN_INT(code, "dir_cache_init(): Unable to open the root '%s'\n", cache->root);
+	#endif
+	return 0;
+}
+
+#ifndef _WIN32
+/**
+ * @brief Function that gets the fd of a directory, opened relative to its parent (itself resolved the same way)
+ * and created if requested: a miss costs one openat per missing level, a hit one fstatat per level.
+ * A cached directory is only used while its path still leads to it (same device and inode), so a directory
+ * moved or replaced meanwhile (the watcher doesn't report the subdirectories) is opened again from its path.
+ * A symbolic link is never followed, so the *at calls can't be redirected out of the root.
+ * 
+ * @param cache		The cache.
+ * @param path		Path of the directory relative to the root.
+ * @param length	Length of the path (ending with a '/').
+ * @param create	1 to create the directory and its missing parents.
+ * 
+ * @return int		The directory fd (owned by the cache), -1 otherwise.
+ */
+static int dir_cache_directory(dir_cache_t *cache, const char *path, size_t length, int create) {
+
+	// Resolve its parent first (checked the same way)
+	size_t parent_length = length - 1;
+	while (parent_length > 0 && path[parent_length - 1] != '/')
+		parent_length--;
+	char name[SYNC_IGNORE_MAX_PATH];
+	size_t name_length = length - 1 - parent_length;
+	int code = (dir_cache_valid_name(path + parent_length, name_length) && name_length < sizeof(name)) ? 0 : -1;
+	if (code == -1) errno = EINVAL;
+	ERROR_HANDLE_INT_RETURN_INT(code, "dir_cache_directory(): Invalid directory '%.*s'\n", (int)length, path);
+	memcpy(name, path + parent_length, name_length);
+	name[name_length] = '\0';
+	int parent_fd = parent_length == 0 ? cache->root_fd : dir_cache_directory(cache, path, parent_length, create);
+	if (parent_fd == -1)
+		return -1;
+
+	// Cached directory, if its path still leads to it
+	struct stat st;
+	unsigned long long path_hash = hash64(path, length, 0);
+	dir_cache_entry_t *entry = cache->buckets[path_hash & (cache->buckets_count - 1)];
+	while (entry != NULL && !(entry->path_hash == path_hash && entry->path_length == length && memcmp(entry->path, path, length) == 0))
+		entry = entry->next;
+	if (entry != NULL) {
+		if (fstatat(parent_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode) && (unsigned long long)st.st_dev == entry->dev && (unsigned long long)st.st_ino == entry->ino) {
+			dir_cache_unlink_use(cache, entry);
+			dir_cache_push_newest(cache, entry);
+			metrics_add(METRIC_DIR_CACHE_HITS, 1);
+			return entry->fd;
+		}
+		errno = 0;
+		dir_cache_remove(cache, entry);
+	}
+	metrics_add(METRIC_DIR_CACHE_MISSES, 1);
+
+	// Open it relative to its parent
+	int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1 && errno == ENOENT && create) {
+		if (mkdirat(parent_fd, name, 0755) == 0 || errno == EEXIST)
+			fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	}
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	// Cache it, in place of the least recently used directory when full (never its parent, just used)
+	entry = malloc(sizeof(dir_cache_entry_t) + length + 1);
+	if (entry == NULL) close(fd);
+	ERROR_HANDLE_PTR_RETURN_INT(entry, "dir_cache_directory(): Unable to allocate the entry of '%.*s'\n", (int)length, path);
+	if (cache->count >= cache->capacity)
+		dir_cache_remove(cache, cache->oldest);
+	entry->path_hash = path_hash;
+	entry->fd = fd;
+	entry->dev = (unsigned long long)st.st_dev;
+	entry->ino = (unsigned long long)st.st_ino;
+	entry->path_length = length;
+	memcpy(entry->path, path, length);
+	entry->path[length] = '\0';
+	dir_cache_entry_t **bucket = &cache->buckets[path_hash & (cache->buckets_count - 1)];
+	entry->next = *bucket;
+	*bucket = entry;
+	dir_cache_push_newest(cache, entry);
+	cache->count++;
+	return fd;
+}
+#endif
+
+/**
+ * @brief Function that resolves the parent directory of a path of the synchronized directory.
+ * Example: "a/b/file.txt" gives the fd of "a/b/" and the name "file.txt", for openat(), renameat(), unlinkat()...
+ * The fd and the name stay valid until the next resolution (keep copies to use two of them at once).
+ * 
+ * @param cache		The cache.
+ * @param path		Path relative to the root (refused with EINVAL if a component is empty, "." or "..").
+ * @param create	1 to create the missing parent directories.
+ * @param name		Filled with the name to use with the fd (AT_FDCWD and a full path without the *at calls).
+ * 
+ * @return int		The directory fd (owned by the cache), -1 otherwise.
+ */
+int dir_cache_parent(dir_cache_t *cache, const char *path, int create, const char **name) {
+
+	// Close the directories cached before a change of the tree
+	long long generation = __atomic_load_n(&cache->generation, __ATOMIC_ACQUIRE);
+	if (generation != cache->entries_generation) {
+		dir_cache_flush(cache);
+		cache->entries_generation = generation;
+	}
+
+	// Refuse the paths leaving the root, then split the path
+	int code = dir_cache_valid_path(path) ? 0 : -1;
+	if (code == -1) errno = EINVAL;
+	ERROR_HANDLE_INT_RETURN_INT(code, "dir_cache_parent(): Invalid path '%s'\n", path);
+	const char *last_slash = strrchr(path, '/');
+	*name = last_slash == NULL ? path : last_slash + 1;
+
+	// Resolve the parent
+	#ifdef _WIN32
+		(void)create;
+		snprintf(cache->full_path, sizeof(cache->full_path), "%s%s", cache->root, path);
+		*name = cache->full_path;
+		return AT_FDCWD;
+	#else
+		if (last_slash == NULL)
+			return cache->root_fd;
+		return dir_cache_directory(cache, path, (size_t)(last_slash - path) + 1, create);
+	#endif
+}
+
+/**
+ * @brief Function that drops the cached directories before their next use (a directory was deleted or moved).
+ * Can be called from any thread.
+ * 
+ * @param cache	The cache.
+ * 
+ * @return void
+ */
+void dir_cache_invalidate(dir_cache_t *cache) {
+	__atomic_add_fetch(&cache->generation, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Function that closes the cached directories and frees the cache.
+ * 
+ * @param cache	The cache.
+ * 
+ * @return void
+ */
+void dir_cache_free(dir_cache_t *cache) {
+	if (cache->buckets != NULL)
+		dir_cache_flush(cache);
+	#ifndef _WIN32
+		if (cache->root_fd != -1)
+			close(cache->root_fd);
+	#endif
+	free(cache->buckets);
+	cache->buckets = NULL;
+}
+
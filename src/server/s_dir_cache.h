@@ -0,0 +1,48 @@
+
+#ifndef __SERVER_DIR_CACHE_H__
+#define __SERVER_DIR_CACHE_H__
+
+#include "../universal_utils.h"
+#include "../sync_ignore.h"
+
+#define DIR_CACHE_DEFAULT_SIZE 256				// Directories kept open by default
+#define DIR_CACHE_MIN_SIZE 4					// A resolution inserts a directory while its parent is in use
+
+// Open directory of the synchronized tree
+typedef struct dir_cache_entry_t {
+	struct dir_cache_entry_t *next;				// Next entry of the bucket
+	struct dir_cache_entry_t *newer;			// Neighbours in the order of use
+	struct dir_cache_entry_t *older;
+	unsigned long long path_hash;
+	int fd;
+	unsigned long long dev;						// Identity of the directory when it was opened (checked before each use)
+	unsigned long long ino;
+	size_t path_length;
+	char path[];								// Path relative to the root, ending with a '/'
+} dir_cache_entry_t;
+
+// LRU cache of the directory fds of a synchronized directory, so the file operations are done with the *at calls
+// relative to their parent instead of resolving the whole path every time (used by a single thread)
+typedef struct dir_cache_t {
+	char root[SYNC_IGNORE_MAX_PATH];			// Root path ending with a '/'
+	int root_fd;								// Never evicted
+	dir_cache_entry_t **buckets;
+	size_t buckets_count;						// Power of two, at least twice the capacity
+	size_t count;
+	size_t capacity;
+	dir_cache_entry_t *newest;
+	dir_cache_entry_t *oldest;
+	volatile long long generation;				// Incremented by dir_cache_invalidate() (from any thread)
+	long long entries_generation;				// Generation of the cached entries
+	char full_path[SYNC_IGNORE_MAX_PATH * 2];	// Without the *at calls: full path of the last resolution
+} dir_cache_t;
+
+// Function prototypes
+int dir_cache_init(dir_cache_t *cache, const char *root, int capacity);
+int dir_cache_valid_path(const char *path);
+int dir_cache_parent(dir_cache_t *cache, const char *path, int create, const char **name);
+void dir_cache_invalidate(dir_cache_t *cache);
+void dir_cache_free(dir_cache_t *cache);
+
+#endif
+
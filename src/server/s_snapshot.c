@@ -0,0 +1,339 @@
+
+#include "s_snapshot.h"
+#include "../metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#ifdef _WIN32
+	#include <process.h>
+#else
+	#include <signal.h>
+#endif
+
+/**
+ * @brief Function that deletes a snapshot no session is attached to (manager mutex held).
+ * 
+ * @param snapshot	The snapshot.
+ * 
+ * @return void
+ */
+static void snapshot_destroy(snapshot_t *snapshot) {
+	if (remove(snapshot->path) != 0) {
+		WARNING_PRINT("snapshot_destroy(): Unable to delete the snapshot '%s'\n", snapshot->path);
+		errno = 0;
+	}
+	pthread_cond_destroy(&snapshot->cond);
+	pthread_mutex_destroy(&snapshot->mutex);
+	free(snapshot);
+}
+
+/**
+ * @brief Function that deletes the current snapshots no session is attached to once their window ended (manager mutex held).
+ * 
+ * @param manager	The manager.
+ * 
+ * @return long long	Time until the window of the next one ends (ms), -1 if no snapshot is waiting.
+ */
+static long long snapshot_expire(snapshot_manager_t *manager) {
+	long long now = get_time_ms();
+	long long next = -1;
+	int i;
+	for (i = 0; i < MAX_SYNC_ROOTS; i++) {
+		snapshot_t *snapshot = manager->current[i];
+		if (snapshot == NULL || snapshot->refs > 0)
+			continue;
+		long long remaining = manager->window_ms > 0 ? snapshot->created_ms + manager->window_ms - now : 0;
+		if (remaining <= 0) {
+			manager->current[i] = NULL;
+			snapshot_destroy(snapshot);
+		}
+		else if (next == -1 || remaining < next)
+			next = remaining;
+	}
+	return next;
+}
+
+/**
+ * @brief Function that handles the thread deleting the current snapshots when their window ends
+ * (woken up by snapshot_release() when the last session of one is done).
+ * 
+ * @param arg	The manager.
+ * 
+ * @return thread_return_type	Never returns.
+ */
+static thread_return_type snapshot_expire_thread(thread_param_type arg) {
+	snapshot_manager_t *manager = (snapshot_manager_t*)arg;
+	pthread_mutex_lock(&manager->mutex);
+	while (1) {
+		long long delay_ms = snapshot_expire(manager);
+		#ifdef _WIN32
+			pthread_cond_timedwait(&manager->expire_cond, &manager->mutex, delay_ms == -1 ? INFINITE : (DWORD)delay_ms);
+		#else
+			if (delay_ms == -1) {
+				pthread_cond_wait(&manager->expire_cond, &manager->mutex);
+				continue;
+			}
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += delay_ms / 1000;
+			deadline.tv_nsec += (delay_ms % 1000) * 1000000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&manager->expire_cond, &manager->mutex, &deadline);
+		#endif
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that tells if a process is still running (the owner of a snapshot file).
+ * 
+ * @param pid	Process id.
+ * 
+ * @return int	1 if the process is running, 0 otherwise.
+ */
+static int snapshot_process_running(int pid) {
+	#ifdef _WIN32
+		HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+		if (process == NULL)
+			return 0;
+		DWORD exit_code = 0;
+		int running = GetExitCodeProcess(process, &exit_code) && exit_code == STILL_ACTIVE;
+		CloseHandle(process);
+		return running;
+	#else
+		int running = kill((pid_t)pid, 0) == 0 || errno == EPERM;
+		errno = 0;
+		return running;
+	#endif
+}
+
+/**
+ * @brief Function that deletes the snapshot files left in the working directory by the stopped servers.
+ * 
+ * @return void
+ */
+static void snapshot_remove_leftovers() {
+	DIR *directory = opendir(".");
+	if (directory == NULL) {
+		errno = 0;
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(directory)) != NULL) {
+		int pid, id, length = 0;
+		if (sscanf(entry->d_name, SNAPSHOT_FILE_FORMAT "%n", &pid, &id, &length) != 2
+			|| length == 0 || entry->d_name[length] != '\0' || snapshot_process_running(pid))
+			continue;
+		if (remove(entry->d_name) == 0) {
+			INFO_PRINT("snapshot_remove_leftovers(): Snapshot '%s' deleted\n", entry->d_name);
+		}
+		else {
+			WARNING_PRINT("snapshot_remove_leftovers(): Unable to delete the snapshot '%s'\n", entry->d_name);
+			errno = 0;
+		}
+	}
+	closedir(directory);
+}
+
+/**
+ * @brief Function that initializes the snapshot manager, after deleting the snapshots left by the stopped servers.
+ * 
+ * @param manager		The manager.
+ * @param window_ms		Time during which a snapshot is joined by the new sessions (0 for the default, -1 to never share).
+ * @param max_streams	Snapshots sent at the same time (0 for the default).
+ * 
+ * @return int			0 if the manager is ready, -1 if the thread deleting the snapshots couldn't start.
+ */
+int snapshot_manager_init(snapshot_manager_t *manager, long long window_ms, int max_streams) {
+	snapshot_remove_leftovers();
+	memset(manager, 0, sizeof(snapshot_manager_t));
+	pthread_mutex_init(&manager->mutex, NULL);
+	pthread_cond_init(&manager->cond, NULL);
+	pthread_cond_init(&manager->expire_cond, NULL);
+	manager->window_ms = window_ms == 0 ? SNAPSHOT_DEFAULT_WINDOW_MS : window_ms;
+	manager->max_streams = max_streams <= 0 ? SNAPSHOT_DEFAULT_MAX_STREAMS : max_streams;
+	#ifdef _WIN32
+		pthread_create(&manager->expire_thread, NULL, snapshot_expire_thread, manager);
+		int code = manager->expire_thread == NULL ? -1 : 0;
+	#else
+		int code = pthread_create(&manager->expire_thread, NULL, snapshot_expire_thread, manager) == 0 ? 0 : -1;
+	#endif
+	ERROR_HANDLE_INT_RETURN_INT(code, "snapshot_manager_init(): Unable to start the thread deleting the snapshots\n");
+	pthread_detach(manager->expire_thread);
+	return 0;
+}
+
+/**
+ * @brief Function that attaches a session to the current snapshot of a root if it was started within the window
+ * from the same state of the directory, or to a new snapshot that the session must build.
+ * 
+ * @param manager		The manager.
+ * @param root			Index of the synchronized root.
+ * @param generation	Current generation of the index of the directory.
+ * @param is_builder	Set to 1 if the caller must build the snapshot (snapshot_set_size(), snapshot_publish(), snapshot_finish()).
+ * 
+ * @return snapshot_t*	The snapshot (given back with snapshot_release()), NULL on allocation failure.
+ */
+snapshot_t* snapshot_attach(snapshot_manager_t *manager, int root, long long generation, int *is_builder) {
+	pthread_mutex_lock(&manager->mutex);
+
+	// Join the current snapshot
+	snapshot_t *snapshot = manager->current[root];
+	if (snapshot != NULL && snapshot->state != SNAPSHOT_FAILED && snapshot->generation == generation
+		&& manager->window_ms > 0 && get_time_ms() - snapshot->created_ms <= manager->window_ms) {
+		snapshot->refs++;
+		pthread_mutex_unlock(&manager->mutex);
+		metrics_add(METRIC_SNAPSHOTS_SHARED, 1);
+		*is_builder = 0;
+		return snapshot;
+	}
+
+	// Start a new one, the previous one is deleted once its last session is done
+	snapshot = calloc(1, sizeof(snapshot_t));
+	if (snapshot == NULL) {
+		pthread_mutex_unlock(&manager->mutex);
+		ERROR_PRINT("snapshot_attach(): Unable to allocate a snapshot\n");
+		return NULL;
+	}
+	snapshot->id = manager->next_id++;
+	snapshot->root = root;
+	snprintf(snapshot->path, sizeof(snapshot->path), SNAPSHOT_FILE_FORMAT, (int)getpid(), snapshot->id);
+	snapshot->generation = generation;
+	snapshot->created_ms = get_time_ms();
+	pthread_mutex_init(&snapshot->mutex, NULL);
+	pthread_cond_init(&snapshot->cond, NULL);
+	snapshot->state = SNAPSHOT_BUILDING;
+	snapshot->refs = 1;
+	if (manager->current[root] != NULL && manager->current[root]->refs == 0)
+		snapshot_destroy(manager->current[root]);
+	manager->current[root] = snapshot;
+	pthread_mutex_unlock(&manager->mutex);
+	metrics_add(METRIC_SNAPSHOTS_BUILT, 1);
+	*is_builder = 1;
+	return snapshot;
+}
+
+/**
+ * @brief Function that detaches a session from a snapshot. The current snapshot is kept for the sessions
+ * arriving within its window (then deleted by the expire thread), the replaced or failed ones are deleted with their last session.
+ * 
+ * @param manager	The manager.
+ * @param snapshot	The snapshot.
+ * 
+ * @return void
+ */
+void snapshot_release(snapshot_manager_t *manager, snapshot_t *snapshot) {
+	pthread_mutex_lock(&manager->mutex);
+	snapshot->refs--;
+	if (snapshot->refs == 0 && (manager->current[snapshot->root] != snapshot || snapshot->state == SNAPSHOT_FAILED)) {
+		if (manager->current[snapshot->root] == snapshot)
+			manager->current[snapshot->root] = NULL;
+		snapshot_destroy(snapshot);
+	}
+	else if (snapshot->refs == 0)
+		pthread_cond_signal(&manager->expire_cond);
+	pthread_mutex_unlock(&manager->mutex);
+}
+
+/**
+ * @brief Function that publishes the size of the built archive (the sessions can send it to their clients).
+ * 
+ * @param snapshot	The snapshot.
+ * @param size		Size of the archive.
+ * 
+ * @return void
+ */
+void snapshot_set_size(snapshot_t *snapshot, size_t size) {
+	pthread_mutex_lock(&snapshot->mutex);
+	snapshot->size = size;
+	snapshot->state = SNAPSHOT_STREAMING;
+	pthread_cond_broadcast(&snapshot->cond);
+	pthread_mutex_unlock(&snapshot->mutex);
+}
+
+/**
+ * @brief Function that publishes the bytes of the archive already encrypted.
+ * 
+ * @param snapshot	The snapshot.
+ * @param ready		Bytes readable from the start of the archive.
+ * 
+ * @return void
+ */
+void snapshot_publish(snapshot_t *snapshot, size_t ready) {
+	pthread_mutex_lock(&snapshot->mutex);
+	snapshot->ready = ready;
+	pthread_cond_broadcast(&snapshot->cond);
+	pthread_mutex_unlock(&snapshot->mutex);
+}
+
+/**
+ * @brief Function that ends the build of a snapshot.
+ * 
+ * @param snapshot	The snapshot.
+ * @param failed	1 if the snapshot couldn't be built (the attached sessions fail).
+ * 
+ * @return void
+ */
+void snapshot_finish(snapshot_t *snapshot, int failed) {
+	pthread_mutex_lock(&snapshot->mutex);
+	snapshot->state = failed ? SNAPSHOT_FAILED : SNAPSHOT_COMPLETE;
+	if (!failed)
+		snapshot->ready = snapshot->size;
+	pthread_cond_broadcast(&snapshot->cond);
+	pthread_mutex_unlock(&snapshot->mutex);
+}
+
+/**
+ * @brief Function that waits until the size of the archive is known and enough of it is encrypted.
+ * 
+ * @param snapshot	The snapshot.
+ * @param needed	Bytes needed from the start of the archive (0 to only wait for the size).
+ * 
+ * @return int		0 if the bytes are readable, -1 if the snapshot failed.
+ */
+int snapshot_wait(snapshot_t *snapshot, size_t needed) {
+	pthread_mutex_lock(&snapshot->mutex);
+	while (snapshot->state == SNAPSHOT_BUILDING || (snapshot->state == SNAPSHOT_STREAMING && snapshot->ready < needed))
+		pthread_cond_wait(&snapshot->cond, &snapshot->mutex);
+	int code = snapshot->state == SNAPSHOT_FAILED ? -1 : 0;
+	pthread_mutex_unlock(&snapshot->mutex);
+	return code;
+}
+
+/**
+ * @brief Function that waits for a free stream slot (admission control of the snapshots sent at the same time).
+ * 
+ * @param manager	The manager.
+ * 
+ * @return void
+ */
+void snapshot_stream_begin(snapshot_manager_t *manager) {
+	pthread_mutex_lock(&manager->mutex);
+	while (manager->streams >= manager->max_streams)
+		pthread_cond_wait(&manager->cond, &manager->mutex);
+	manager->streams++;
+	pthread_mutex_unlock(&manager->mutex);
+	metrics_gauge_add(METRIC_SNAPSHOT_STREAMS, 1);
+}
+
+/**
+ * @brief Function that releases a stream slot.
+ * 
+ * @param manager	The manager.
+ * 
+ * @return void
+ */
+void snapshot_stream_end(snapshot_manager_t *manager) {
+	pthread_mutex_lock(&manager->mutex);
+	manager->streams--;
+	pthread_cond_signal(&manager->cond);
+	pthread_mutex_unlock(&manager->mutex);
+	metrics_gauge_add(METRIC_SNAPSHOT_STREAMS, -1);
+}
+
@@ -0,0 +1,61 @@
+
+#ifndef __SERVER_SNAPSHOT_H__
+#define __SERVER_SNAPSHOT_H__
+
+#include "../universal_utils.h"
+#include "../universal_pthread.h"
+#include "../config_manager.h"
+
+#define SNAPSHOT_DEFAULT_WINDOW_MS 2000			// Sessions arriving within this time join the same snapshot
+#define SNAPSHOT_DEFAULT_MAX_STREAMS 8			// Snapshots sent at the same time
+#define SNAPSHOT_FILE_FORMAT "remote_folder_sync_snapshot_%d_%d.snap"	// Process id and snapshot id
+
+// States of a snapshot
+#define SNAPSHOT_BUILDING 0						// Records being written, the size is unknown
+#define SNAPSHOT_STREAMING 1					// Size known, the encrypted part grows
+#define SNAPSHOT_COMPLETE 2						// Fully encrypted
+#define SNAPSHOT_FAILED 3
+
+// Archive of the directory shared by the sessions attached to it.
+// It is encrypted in place chunk by chunk (the cipher only depends on the chunk),
+// so every session sends the same bytes, each one from its own cursor.
+typedef struct snapshot_t {
+	int id;
+	int root;									// Index of the synchronized root
+	char path[64];								// Archive on the disk (SNAPSHOT_FILE_FORMAT)
+	long long generation;						// Generation of the index the snapshot was built from
+	long long created_ms;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;						// Signaled when the state or the ready bytes change
+	volatile int state;
+	size_t size;								// Size of the archive (from SNAPSHOT_STREAMING)
+	size_t ready;								// Bytes already encrypted, readable by the sessions
+	int refs;									// Attached sessions (protected by the manager mutex)
+} snapshot_t;
+
+// Sharing of the snapshots and admission control of their streams
+typedef struct snapshot_manager_t {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;						// Signaled when a stream ends
+	pthread_cond_t expire_cond;					// Signaled when the last session of a current snapshot is done
+	pthread_t expire_thread;					// Deletes the current snapshots when their window ends
+	snapshot_t *current[MAX_SYNC_ROOTS];		// Last snapshot of each root, joined by the sessions arriving within the window
+	long long window_ms;
+	int max_streams;
+	int streams;								// Snapshots being sent
+	int next_id;
+} snapshot_manager_t;
+
+// Function prototypes
+int snapshot_manager_init(snapshot_manager_t *manager, long long window_ms, int max_streams);
+snapshot_t* snapshot_attach(snapshot_manager_t *manager, int root, long long generation, int *is_builder);
+void snapshot_release(snapshot_manager_t *manager, snapshot_t *snapshot);
+void snapshot_set_size(snapshot_t *snapshot, size_t size);
+void snapshot_publish(snapshot_t *snapshot, size_t ready);
+void snapshot_finish(snapshot_t *snapshot, int failed);
+int snapshot_wait(snapshot_t *snapshot, size_t needed);
+void snapshot_stream_begin(snapshot_manager_t *manager);
+void snapshot_stream_end(snapshot_manager_t *manager);
+
+#endif
+
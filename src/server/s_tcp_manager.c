@@ -1,20 +1,62 @@
 
 #include "s_tcp_manager.h"
+#include "../staged_file.h"
+#include "../metrics.h"
+#include "../file_watcher.h"
+#include "../snapshot_stream.h"
+#include "../tree_delete.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 
+#ifndef _WIN32
+	#include <sys/epoll.h>
+#endif
+
+#define S_EPOLL_EVENTS 64
+
 #ifdef _WIN32
 	int s_winsock_init = 0;
 #endif
 
-#define S_BUFFER_SIZE CS_BUFFER_SIZE
+#define S_BUFFER_SIZE ((ssize_t)g_server->config.transfer_buffer_size)
 
 // Global variables
 tcp_server_t *g_server;
 
+/**
+ * @brief Function that prepares a synchronized root: its ignore patterns, its index, its trash and its open directories.
+ * 
+ * @param root		The root to fill.
+ * @param config	Configuration of the server (kept by the server).
+ * @param id		Index of the root in the configuration.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+static int server_root_init(server_root_t *root, const config_t *config, int id) {
+	root->config = &config->roots[id];
+	root->id = id;
+
+	// Compile the patterns of the paths that are never synchronized
+	int code = sync_ignore_load(&root->ignore, root->config->directory);
+	ERROR_HANDLE_INT_RETURN_INT(code, "server_root_init(): Unable to load the ignore patterns\n");
+
+	// Index the directory (the snapshots sent to the clients are planned from memory)
+	code = tree_index_init(&root->index, root->config->directory, &root->ignore, config->scan_threads);
+	ERROR_HANDLE_INT_RETURN_INT(code, "server_root_init(): Unable to index the directory\n");
+
+	// Finish the deletions interrupted by the last stop
+	code = tree_delete_empty_trash(root->config->directory, config->scan_threads);
+	WARNING_HANDLE_INT(code, "server_root_init(): Unable to empty the trash\n");
+
+	// Open the directory
+	code = dir_cache_init(&root->dir_cache, root->config->directory, config->dir_cache_size);
+	ERROR_HANDLE_INT_RETURN_INT(code, "server_root_init(): Error while opening the directory\n");
+	return 0;
+}
+
 /**
  * @brief Function that sets up the TCP server.
  * 
@@ -43,11 +85,23 @@ int setup_tcp_server(config_t config, tcp_server_t *tcp_server) {
 	// Fill the TCP server structure
 	memset(tcp_server, 0, sizeof(tcp_server_t));
 	tcp_server->config = config;
-
-	// Initialize the list of clients to INVALID_SOCKET
-	int i = 0;
-	for (; i < MAX_CLIENTS; i++)
-		tcp_server->clients[i].socket = INVALID_SOCKET;
+	if (config.transfer_buffer_size == 0)
+		config.transfer_buffer_size = tcp_server->config.transfer_buffer_size = CONFIG_DEFAULT_TRANSFER_BUFFER_SIZE;
+
+	// Apply the logger settings
+	log_configure(config.log_levels, config.log_rate_limit);
+
+	// Initialize the I/O buffer pool
+	code = buffer_pool_init(config.buffer_classes, config.buffer_classes_count, config.buffer_thread_cache);
+	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_server(): Unable to initialize the buffer pool\n");
+
+	// Initialize the registry of the clients
+	code = client_registry_init(&tcp_server->clients);
+	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_server(): Unable to initialize the registry of the clients\n");
+	#ifndef _WIN32
+		tcp_server->clients_epoll = epoll_create1(0);
+		ERROR_HANDLE_INT_RETURN_INT(tcp_server->clients_epoll, "setup_tcp_server(): Unable to create the epoll instance of the clients\n");
+	#endif
 
 	///// Create the TCP socket for handling connections
 	// Create the TCP socket
@@ -61,6 +115,10 @@ int setup_tcp_server(config_t config, tcp_server_t *tcp_server) {
 	addr->sin_addr.s_addr = INADDR_ANY;
 	addr->sin_port = htons(config.port);
 
+	// Apply the socket options (inherited by the accepted sockets)
+	code = set_socket_options(tcp_server->handle_new_connections.socket, config.socket_send_buffer, config.socket_recv_buffer, config.tcp_nodelay);
+	WARNING_HANDLE_INT(code, "setup_tcp_server(): Unable to apply the socket options for handling connections\n");
+
 	// Bind the socket to the server address
 	code = bind(tcp_server->handle_new_connections.socket, (struct sockaddr *)addr, sizeof(struct sockaddr_in));
 	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_server(): Error while binding the socket for handling connections\n");
@@ -84,6 +142,10 @@ int setup_tcp_server(config_t config, tcp_server_t *tcp_server) {
 	addr->sin_addr.s_addr = INADDR_ANY;
 	addr->sin_port = htons(config.port + 1);
 
+	// Apply the socket options (inherited by the accepted sockets)
+	code = set_socket_options(tcp_server->handle_client_requests.socket, config.socket_send_buffer, config.socket_recv_buffer, config.tcp_nodelay);
+	WARNING_HANDLE_INT(code, "setup_tcp_server(): Unable to apply the socket options for handling requests\n");
+
 	// Bind the socket to the server address
 	code = bind(tcp_server->handle_client_requests.socket, (struct sockaddr *)addr, sizeof(struct sockaddr_in));
 	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_server(): Error while binding the socket for handling requests\n");
@@ -95,6 +157,24 @@ int setup_tcp_server(config_t config, tcp_server_t *tcp_server) {
 	// Initialize the mutex
 	pthread_mutex_init(&tcp_server->handle_client_requests.mutex, NULL);
 
+	// Initialize the disk I/O engine used to apply the client actions
+	code = io_engine_init(&tcp_server->io_engine, config.io_uring, config.io_queue_depth, config.transfer_buffer_size, config.io_direct_threshold, config.io_fsync);
+	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_server(): Error while initializing the disk I/O engine\n");
+
+	// Prepare the synchronized roots, one after the other (the scan threads are shared)
+	code = config.roots_count > 0 ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_server(): No directory to synchronize\n");
+	code = snapshot_manager_init(&tcp_server->snapshots, config.snapshot_window_ms, config.snapshot_max_streams);
+	ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_server(): Unable to prepare the snapshots\n");
+	tcp_server->roots = calloc(config.roots_count, sizeof(server_root_t));
+	ERROR_HANDLE_PTR_RETURN_INT(tcp_server->roots, "setup_tcp_server(): Unable to allocate the roots\n");
+	int i;
+	for (i = 0; i < config.roots_count; i++) {
+		code = server_root_init(&tcp_server->roots[i], &tcp_server->config, i);
+		ERROR_HANDLE_INT_RETURN_INT(code, "setup_tcp_server(): Unable to prepare the root '%s'\n", config.roots[i].directory);
+		tcp_server->roots_count++;
+	}
+
 	// Info print
 	INFO_PRINT("setup_tcp_server(): TCP server setup successfully\n");
 
@@ -114,9 +194,19 @@ int tcp_server_run(tcp_server_t *tcp_server) {
 	// Copy the TCP server structure to the global variable
 	g_server = tcp_server;
 
-	// Create the threads
+	// Expose the metrics if configured
+	int code = metrics_start_exporter(tcp_server->config.metrics_port, tcp_server->config.metrics_socket);
+	WARNING_HANDLE_INT(code, "tcp_server_run(): Metrics are not exposed\n");
+
+	// Create the threads (a watcher per root)
+	int i;
+	for (i = 0; i < tcp_server->roots_count; i++)
+		pthread_create(&tcp_server->roots[i].index_thread, NULL, tcp_server_watch_directory, &tcp_server->roots[i]);
 	pthread_create(&tcp_server->handle_new_connections.thread, NULL, tcp_server_handle_new_connections, NULL);
 	pthread_create(&tcp_server->handle_client_requests.thread, NULL, tcp_server_handle_client_requests, NULL);
+	#ifndef _WIN32
+		pthread_create(&tcp_server->clients_thread, NULL, tcp_server_handle_disconnections, NULL);
+	#endif
 
 	// Wait for the threads to end
 	pthread_join(tcp_server->handle_new_connections.thread, NULL);
@@ -126,10 +216,52 @@ int tcp_server_run(tcp_server_t *tcp_server) {
 	return 0;
 }
 
+// Root watched by the current thread (the handlers of the watcher only get the paths)
+static __thread server_root_t *s_watched_root = NULL;
+
+/**
+ * @brief Handlers of the watcher of a server root, keeping its index current
+ * with the changes made on the server itself.
+ * 
+ * @param filepath	Path of the file relative to the directory.
+ * 
+ * @return int		0 (an index error is only reported, the watcher continues).
+ */
+static int index_file_changed(const char *filepath) {
+	int code = tree_index_refresh(&s_watched_root->index, filepath);
+	WARNING_HANDLE_INT(code, "index_file_changed(): Unable to index '%s'\n", filepath);
+	return 0;
+}
+static int index_file_deleted(const char *filepath) {
+	tree_index_remove(&s_watched_root->index, filepath);
+	dir_cache_invalidate(&s_watched_root->dir_cache);
+	return 0;
+}
+static int index_file_renamed(const char *filepath_old, const char *filepath_new) {
+	dir_cache_invalidate(&s_watched_root->dir_cache);
+	int code = tree_index_rename(&s_watched_root->index, filepath_old, filepath_new);
+	WARNING_HANDLE_INT(code, "index_file_renamed(): Unable to index '%s'\n", filepath_new);
+	return 0;
+}
+
+/**
+ * @brief Function that watches the directory of a root and applies the changes to its index.
+ * 
+ * @param arg The server_root_t to watch.
+ * 
+ * @return thread_return_type		0 when the watcher stops.
+ */
+thread_return_type tcp_server_watch_directory(thread_param_type arg) {
+	s_watched_root = (server_root_t*)arg;
+	int code = monitor_directory(s_watched_root->config->directory, index_file_changed, index_file_changed, index_file_changed, index_file_deleted, index_file_renamed, &s_watched_root->ignore);
+	WARNING_HANDLE_INT(code, "tcp_server_watch_directory(): The index of '%s' is not updated with the local changes anymore\n", s_watched_root->config->directory);
+	return 0;
+}
+
 /**
  * @brief Function that handles new connections.
- * It waits for a connection on the socket, sends the directory
- * to the client and then registers the client in the list of clients.
+ * It accepts the connections and hands each one to its own synchronization session,
+ * so a client downloading the directory never delays the next ones.
  * 
  * @param arg NULL.
  * 
@@ -147,47 +279,223 @@ thread_return_type tcp_server_handle_new_connections(thread_param_type arg) {
 
 	// Variables
 	socklen_t client_addr_size = sizeof(struct sockaddr_in);
-	char* client_ip = NULL;
-	int client_port = 0;
 
 	// Accept connections
 	while (g_server->handle_new_connections.socket != INVALID_SOCKET) {
 
-		// Get next client into a variable
-		tcp_client_from_server_t *cl = &g_server->clients[g_server->clients_count];
-
 		// Accept the connection
-		cl->socket = accept(g_server->handle_new_connections.socket, (struct sockaddr *)&cl->address, &client_addr_size);
-		code = cl->socket == INVALID_SOCKET ? -1 : 0;
+		struct sockaddr_in client_address;
+		SOCKET client_socket = accept(g_server->handle_new_connections.socket, (struct sockaddr *)&client_address, &client_addr_size);
+		code = client_socket == INVALID_SOCKET ? -1 : 0;
 		#ifdef _WIN32
 			ERROR_HANDLE_INT_RETURN_INT(code, "tcp_server_handle_new_connections(): Error while accepting a connection\n");
 		#else
 			ERROR_HANDLE_INT_RETURN_NULL(code, "tcp_server_handle_new_connections(): Error while accepting a connection\n");
 		#endif
-		cl->id = g_server->clients_count;
-
-		// Get the client IP address and port
-		client_ip = inet_ntoa(cl->address.sin_addr);
-		client_port = ntohs(cl->address.sin_port);
-		INFO_PRINT("tcp_server_handle_new_connections(): Accepted a connection from %s:%d\n", client_ip, client_port);
+		metrics_add(METRIC_CONNECTIONS_OPENED, 1);
+		INFO_PRINT("tcp_server_handle_new_connections(): Accepted a connection from %s:%d\n", inet_ntoa(client_address.sin_addr), ntohs(client_address.sin_port));
+
+		// Prepare the session
+		sync_session_t *session = malloc(sizeof(sync_session_t));
+		if (session == NULL) {
+			ERROR_PRINT("tcp_server_handle_new_connections(): Unable to allocate a session, closing the connection\n");
+			socket_close(client_socket);
+			continue;
+		}
+		session->socket = client_socket;
+		session->address = client_address;
+		session->id = __sync_fetch_and_add(&g_server->sessions_started, 1);
 
-		// Send the directory to the client
-		code = sendAllDirectoryFiles(cl->socket);
+		// Start the session (it frees itself, so only a local copy of its thread is used)
+		metrics_gauge_add(METRIC_SYNC_SESSIONS_ACTIVE, 1);
+		pthread_t thread;
+		#ifdef _WIN32
+			pthread_create(&thread, NULL, tcp_server_sync_session, session);
+			code = thread == NULL ? -1 : 0;
+		#else
+			code = pthread_create(&thread, NULL, tcp_server_sync_session, session) == 0 ? 0 : -1;
+		#endif
 		if (code == -1) {
-			ERROR_PRINT("tcp_server_handle_new_connections(): Error while sending directory, closing connection with client %s:%d\n", client_ip, client_port);
+			ERROR_PRINT("tcp_server_handle_new_connections(): Unable to start a session, closing the connection\n");
+			metrics_gauge_add(METRIC_SYNC_SESSIONS_ACTIVE, -1);
+			socket_close(client_socket);
+			free(session);
 			continue;
 		}
-
-		// Register the client
-		INFO_PRINT("tcp_server_handle_new_connections(): Client #%d registered (%s:%d)\n", cl->id, client_ip, client_port);
-		g_server->clients_count++;
+		pthread_detach(thread);
 	}
 
 	// Return
 	return 0;
 }
 
+/**
+ * @brief Function that receives the roots synchronized by a new client (SYNC_ROOTS message).
+ * 
+ * @param client_socket	Socket of the client.
+ * @param roots			Filled with the requested roots, in the order of the client.
+ * @param roots_count	Filled with the number of roots.
+ * 
+ * @return int			0 if every root is known and the transfer buffer size is the same as the server, -1 otherwise.
+ */
+static int receive_session_roots(SOCKET client_socket, server_root_t **roots, int *roots_count) {
+
+	// Receive the request
+	message_t message;
+	int code = socket_read(client_socket, &message, sizeof(message_t), MSG_WAITALL) == (ssize_t)sizeof(message_t) ? 0 : -1;
+	DECRYPT_BYTES(&message, sizeof(message_t), g_server->config.password);
+	char names[MAX_SYNC_ROOTS * sizeof(((sync_root_t*)0)->name)];
+	if (code == 0 && (message.type != SYNC_ROOTS || message.size == 0 || message.size > sizeof(names)))
+		code = -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "receive_session_roots(): Invalid request of the client\n");
+	code = socket_read(client_socket, names, message.size, MSG_WAITALL) == (ssize_t)message.size ? 0 : -1;
+	DECRYPT_BYTES(names, message.size, g_server->config.password);
+	if (code == 0 && names[message.size - 1] != '\0')
+		code = -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "receive_session_roots(): Unable to receive the names of the roots\n");
+
+	// Receive the transfer buffer size of the client (the encryption restarts on each buffer, both ends must use the same)
+	size_t transfer_buffer_size;
+	code = socket_read(client_socket, &transfer_buffer_size, sizeof(size_t), MSG_WAITALL) == (ssize_t)sizeof(size_t) ? 0 : -1;
+	DECRYPT_BYTES(&transfer_buffer_size, sizeof(size_t), g_server->config.password);
+	ERROR_HANDLE_INT_RETURN_INT(code, "receive_session_roots(): Unable to receive the transfer buffer size\n");
+	metrics_add(METRIC_BYTES_RECEIVED_WIRE, sizeof(message_t) + message.size + sizeof(size_t));
+	code = transfer_buffer_size == g_server->config.transfer_buffer_size ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "receive_session_roots(): The transfer buffer size of the client (%zu) differs from the server (%zu)\n", transfer_buffer_size, g_server->config.transfer_buffer_size);
+
+	// Find each root by its name
+	*roots_count = 0;
+	const char *name;
+	for (name = names; name < names + message.size; name += strlen(name) + 1) {
+		int i;
+		for (i = 0; i < g_server->roots_count && strcmp(g_server->roots[i].config->name, name) != 0; i++);
+		code = (i < g_server->roots_count && *roots_count < MAX_SYNC_ROOTS) ? 0 : -1;
+		ERROR_HANDLE_INT_RETURN_INT(code, "receive_session_roots(): Unknown root '%s'\n", name);
+		roots[(*roots_count)++] = &g_server->roots[i];
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that runs the initial synchronization of a new client:
+ * it sends the requested roots to the client and then registers the client in the list of clients.
+ * 
+ * @param arg The sync_session_t of the client (freed at the end).
+ * 
+ * @return thread_return_type		0
+ */
+thread_return_type tcp_server_sync_session(thread_param_type arg) {
+	sync_session_t *session = (sync_session_t*)arg;
+	char client_ip[INET_ADDRSTRLEN];
+	strcpy(client_ip, inet_ntoa(session->address.sin_addr));
+	int client_port = ntohs(session->address.sin_port);
+	long long start_time = get_time_us();
+
+	// Send the roots to the client, one snapshot after the other on the same connection
+	server_root_t *roots[MAX_SYNC_ROOTS];
+	int roots_count = 0, i;
+	int code = receive_session_roots(session->socket, roots, &roots_count);
+	if (code == -1) {
+		message_t refusal;
+		memset(&refusal, 0, sizeof(message_t));
+		refusal.type = -1;
+		ENCRYPT_BYTES(&refusal, sizeof(message_t), g_server->config.password);
+		socket_write_all(session->socket, &refusal, sizeof(message_t));
+	}
+	for (i = 0; code == 0 && i < roots_count; i++)
+		code = sendAllDirectoryFiles(session->socket, roots[i]);
+	if (code == -1) {
+		ERROR_PRINT("tcp_server_sync_session(): Error while sending the roots, closing connection with client %s:%d\n", client_ip, client_port);
+		socket_close(session->socket);
+	}
+
+	// Register the client with its roots (its actions are only accepted in them)
+	tcp_client_from_server_t *cl = NULL;
+	if (code == 0) {
+		unsigned int roots_mask = 0;
+		for (i = 0; i < roots_count; i++)
+			roots_mask |= 1u << roots[i]->id;
+		cl = client_registry_insert(&g_server->clients, session->socket, session->address, roots_mask);
+		if (cl == NULL) {
+			ERROR_PRINT("tcp_server_sync_session(): Unable to register the client %s:%d, closing the connection\n", client_ip, client_port);
+			socket_close(session->socket);
+		}
+	}
+
+	// Watch its disconnection
+	if (cl != NULL) {
+		#ifndef _WIN32
+			struct epoll_event event;
+			memset(&event, 0, sizeof(struct epoll_event));
+			event.events = EPOLLIN | EPOLLRDHUP;
+			event.data.ptr = cl;
+			code = epoll_ctl(g_server->clients_epoll, EPOLL_CTL_ADD, session->socket, &event);
+			WARNING_HANDLE_INT(code, "tcp_server_sync_session(): Unable to watch the disconnection of client #%d\n", cl->id);
+		#endif
+		INFO_PRINT("tcp_server_sync_session(): Client #%d registered (%s:%d, %d clients, synchronized in %lld ms)\n", cl->id, client_ip, client_port, g_server->clients.count, (get_time_us() - start_time) / 1000);
+	}
 
+	// End of the session, the per-thread state goes back to the next sessions (cached buffers, log ring, metrics shard)
+	metrics_gauge_add(METRIC_SYNC_SESSIONS_ACTIVE, -1);
+	free(session);
+	buffer_pool_thread_flush();
+	metrics_thread_release();
+	log_thread_release();
+	return 0;
+}
+
+#ifndef _WIN32
+/**
+ * @brief Function that handles the messages and the disconnections of the registered clients:
+ * a client closing its connection or sending DISCONNECT is removed from the registry.
+ * 
+ * @param arg NULL.
+ * 
+ * @return thread_return_type		NULL if the thread ended successfully.
+ */
+thread_return_type tcp_server_handle_disconnections(thread_param_type arg) {
+	(void)arg;
+	struct epoll_event events[S_EPOLL_EVENTS];
+	while (1) {
+
+		// Wait for the next events
+		int count = epoll_wait(g_server->clients_epoll, events, S_EPOLL_EVENTS, -1);
+		if (count == -1 && errno == EINTR) {
+			errno = 0;
+			continue;
+		}
+		ERROR_HANDLE_INT_RETURN_NULL(count, "tcp_server_handle_disconnections(): Error while waiting for the clients\n");
+
+		// Handle each client
+		int i;
+		for (i = 0; i < count; i++) {
+			tcp_client_from_server_t *cl = events[i].data.ptr;
+			int disconnected = (events[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) != 0;
+			if (!disconnected && (events[i].events & EPOLLIN)) {
+				message_t message;
+				ssize_t bytes = socket_read(cl->socket, &message, sizeof(message_t), MSG_DONTWAIT);
+				if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					errno = 0;
+					continue;
+				}
+				DECRYPT_BYTES(&message, sizeof(message_t), g_server->config.password);
+				disconnected = (bytes <= 0 || message.type == DISCONNECT);
+				if (!disconnected)
+					WARNING_PRINT("tcp_server_handle_disconnections(): Ignoring message %d from client #%d\n", message.type, cl->id);
+			}
+
+			// Remove the disconnected client (its slot is reused later)
+			if (disconnected) {
+				epoll_ctl(g_server->clients_epoll, EPOLL_CTL_DEL, cl->socket, NULL);
+				INFO_PRINT("tcp_server_handle_disconnections(): Client #%d disconnected (%s:%d)\n", cl->id, inet_ntoa(cl->address.sin_addr), ntohs(cl->address.sin_port));
+				client_registry_remove(&g_server->clients, cl);
+				errno = 0;
+			}
+		}
+	}
+	return NULL;
+}
+#endif
 
 /**
  * @brief Function that handles client requests.
@@ -231,11 +539,16 @@ thread_return_type tcp_server_handle_client_requests(thread_param_type arg) {
 		client.ip = inet_ntoa(client.address.sin_addr);
 		client.port = ntohs(client.address.sin_port);
 		INFO_PRINT("{%s:%d} Connection accepted\n", client.ip, client.port);
+		metrics_add(METRIC_CONNECTIONS_OPENED, 1);
+		metrics_gauge_add(METRIC_CONNECTIONS_ACTIVE, 1);
+		long long start_time = get_time_us();
 
 		// Receive the request
 		message_t message;
-		socket_read(client.socket, &message, sizeof(message_t), 0);
+		ssize_t bytes = socket_read(client.socket, &message, sizeof(message_t), 0);
 		DECRYPT_BYTES(&message, sizeof(message_t), g_server->config.password);
+		if (bytes > 0)
+			metrics_add(METRIC_BYTES_RECEIVED_WIRE, bytes);
 
 		// Handle the message
 		switch (message.type) {
@@ -257,11 +570,17 @@ thread_return_type tcp_server_handle_client_requests(thread_param_type arg) {
 		memset(&message, 0, sizeof(message_t));
 		message.type = (code == 0) ? VALID_RESPONSE : -1;
 		ENCRYPT_BYTES(&message, sizeof(message_t), g_server->config.password);
-		socket_write(client.socket, &message, sizeof(message_t), 0);
+		bytes = socket_write(client.socket, &message, sizeof(message_t), 0);
+		if (bytes > 0)
+			metrics_add(METRIC_BYTES_SENT_WIRE, bytes);
+		if (code == -1)
+			metrics_add(METRIC_ACTIONS_FAILED, 1);
+		metrics_record(METRIC_APPLY_LATENCY, get_time_us() - start_time);
 
 		// Close the connection
 		INFO_PRINT("{%s:%d} Connection closed\n", client.ip, client.port);
 		socket_close(client.socket);
+		metrics_gauge_add(METRIC_CONNECTIONS_ACTIVE, -1);
 	}
 
 	// Return
@@ -269,69 +588,324 @@ thread_return_type tcp_server_handle_client_requests(thread_param_type arg) {
 }
 
 
+// Entries of a snapshot, copied out of the index (its shards stay locked during the visit)
+typedef struct snapshot_entries_t {
+	tree_index_entry_t **entries;
+	size_t count;
+	size_t capacity;
+	int failed;							// 1 if an entry couldn't be copied
+} snapshot_entries_t;
+
 /**
- * @brief Function that sends the directory files to the client as a zip file.
+ * @brief Function that copies an indexed entry into the list of the snapshot (visitor of tree_index_for_each()).
  * 
- * @param client	The TCP client structure.
+ * @param entry		Indexed file or directory.
+ * @param arg		The list of entries.
  * 
- * @return int		0 if the message was sent successfully, -1 otherwise.
+ * @return int		0 if success, -1 on allocation failure (stops the iteration).
  */
-int sendAllDirectoryFiles(SOCKET client_socket) {
+static int collect_synchronized_entry(const tree_index_entry_t *entry, void *arg) {
+	snapshot_entries_t *list = (snapshot_entries_t*)arg;
+	list->failed = 1;
+	if (list->count == list->capacity) {
+		size_t capacity = list->capacity == 0 ? 1024 : list->capacity * 2;
+		tree_index_entry_t **entries = realloc(list->entries, capacity * sizeof(tree_index_entry_t*));
+		ERROR_HANDLE_PTR_RETURN_INT(entries, "collect_synchronized_entry(): Unable to grow the list of entries\n");
+		list->entries = entries;
+		list->capacity = capacity;
+	}
+	size_t entry_size = sizeof(tree_index_entry_t) + entry->path_length + 1;
+	tree_index_entry_t *copy = malloc(entry_size);
+	ERROR_HANDLE_PTR_RETURN_INT(copy, "collect_synchronized_entry(): Unable to copy the entry '%s'\n", entry->path);
+	memcpy(copy, entry, entry_size);
+	list->entries[list->count++] = copy;
+	list->failed = 0;
+	return 0;
+}
 
-	// Create the zip file
-	char command[2048];
-	#ifdef _WIN32
-		sprintf(command, "powershell -Command \"Compress-Archive -Path '%s*' -DestinationPath '%s' -Force\"", g_server->config.directory, ZIP_TEMPORARY_FILE);
-	#else
-		sprintf(command, "zip -r '%s' '%s*'", ZIP_TEMPORARY_FILE, g_server->config.directory);
-	#endif
-	int code = system(command);
-	ERROR_HANDLE_INT_RETURN_INT(code, "sendAllDirectoryFiles(): Error while creating the zip file\n");
+/**
+ * @brief Function that compares two entries by path, so a directory comes before its content (qsort).
+ * 
+ * @param a		First entry.
+ * @param b		Second entry.
+ * 
+ * @return int	Order of the paths.
+ */
+static int compare_synchronized_entries(const void *a, const void *b) {
+	return strcmp((*(tree_index_entry_t* const*)a)->path, (*(tree_index_entry_t* const*)b)->path);
+}
 
-	// Open the zip file
-	FILE *zip_file = fopen(ZIP_TEMPORARY_FILE, "rb");
-	ERROR_HANDLE_PTR_RETURN_INT(zip_file, "sendAllDirectoryFiles(): Unable to open the zip file\n");
+/**
+ * @brief Function that writes the records of the indexed paths of a root into the snapshot file.
+ * 
+ * @param root			The root.
+ * @param snapshot_file	The snapshot file.
+ * @param buffer		Buffer used to copy the files.
+ * 
+ * @return int			0 if success, -1 otherwise.
+ */
+static int write_snapshot_records(server_root_t *root, FILE *snapshot_file, pool_buffer_t *buffer) {
+
+	// Take the paths from the index, sorted so the parents are created first by the client
+	snapshot_entries_t list;
+	memset(&list, 0, sizeof(snapshot_entries_t));
+	tree_index_for_each(&root->index, collect_synchronized_entry, &list);
+	int code = list.failed ? -1 : 0;
+	if (list.count > 0)
+		qsort(list.entries, list.count, sizeof(tree_index_entry_t*), compare_synchronized_entries);
+	DEBUG_PRINT("write_snapshot_records(): %zu paths to synchronize\n", list.count);
+
+	// Write the records
+	size_t i;
+	for (i = 0; code == 0 && i < list.count; i++) {
+		tree_index_entry_t *entry = list.entries[i];
+		if (entry->is_directory)
+			code = snapshot_write_directory(snapshot_file, entry->path, entry->mode, entry->mtime_ns);
+		else
+			code = snapshot_write_file(snapshot_file, root->config->directory, entry->path, buffer->data, (size_t)S_BUFFER_SIZE);
+	}
+	for (i = 0; i < list.count; i++)
+		free(list.entries[i]);
+	free(list.entries);
+	if (code == 0)
+		code = fflush(snapshot_file) == 0 ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "write_snapshot_records(): Unable to write the records\n");
+	return 0;
+}
+
+/**
+ * @brief Function that builds a snapshot: the records of the indexed paths, then encrypted in place chunk by chunk.
+ * Each chunk is published to the attached sessions as soon as it's encrypted.
+ * 
+ * @param root		The root.
+ * @param snapshot	The snapshot to build.
+ * 
+ * @return int		0 if the snapshot was built, -1 otherwise.
+ */
+static int build_snapshot(server_root_t *root, snapshot_t *snapshot) {
+
+	// Write the records
+	FILE *snapshot_file = fopen(snapshot->path, "w+b");
+	ERROR_HANDLE_PTR_RETURN_INT(snapshot_file, "build_snapshot(): Unable to create the snapshot file\n");
+	pool_buffer_t *snapshot_buffer = buffer_pool_acquire(S_BUFFER_SIZE);
+	if (snapshot_buffer == NULL) fclose(snapshot_file);
+	ERROR_HANDLE_PTR_RETURN_INT(snapshot_buffer, "build_snapshot(): Unable to get a buffer\n");
+	int code = write_snapshot_records(root, snapshot_file, snapshot_buffer);
+	if (code == -1) { fclose(snapshot_file); buffer_pool_release(snapshot_buffer); }
+	ERROR_HANDLE_INT_RETURN_INT(code, "build_snapshot(): Error while creating the snapshot file\n");
+
+	// Publish its size
+	size_t snapshot_size = get_file_size(fileno(snapshot_file));
+	snapshot_set_size(snapshot, snapshot_size);
+	rewind(snapshot_file);
+
+	// Encrypt the chunks as they will be sent (same chunk size as the reception of the client)
+	size_t offset = 0;
+	while (offset < snapshot_size) {
+		size_t buffer_size = (size_t)S_BUFFER_SIZE < snapshot_size - offset ? (size_t)S_BUFFER_SIZE : snapshot_size - offset;
+		code = fread(snapshot_buffer->data, sizeof(byte), buffer_size, snapshot_file) == buffer_size ? 0 : -1;
+		if (code == 0) {
+			ENCRYPT_BYTES(snapshot_buffer->data, buffer_size, g_server->config.password);
+			fseek(snapshot_file, (long)offset, SEEK_SET);
+			code = (fwrite(snapshot_buffer->data, sizeof(byte), buffer_size, snapshot_file) == buffer_size && fflush(snapshot_file) == 0) ? 0 : -1;
+		}
+		if (code == -1) { fclose(snapshot_file); buffer_pool_release(snapshot_buffer); }
+		ERROR_HANDLE_INT_RETURN_INT(code, "build_snapshot(): Unable to encrypt the snapshot file\n");
+		offset += buffer_size;
+		snapshot_publish(snapshot, offset);
+	}
+	fclose(snapshot_file);
+	buffer_pool_release(snapshot_buffer);
+	INFO_PRINT("build_snapshot(): Snapshot #%d built (%zu bytes)\n", snapshot->id, snapshot_size);
+	return 0;
+}
 
-	///// Send the zip file
-	// Get the zip file size
-	size_t zip_file_size = get_file_size(fileno(zip_file));
+/**
+ * @brief Function that sends a snapshot to a client, following its build if it's not complete.
+ * 
+ * @param client_socket	Socket of the client.
+ * @param snapshot		The snapshot.
+ * 
+ * @return int			0 if the snapshot was sent, -1 otherwise.
+ */
+static int send_snapshot(SOCKET client_socket, snapshot_t *snapshot) {
 
-	// Send the zip file size
+	// Send the snapshot size
+	int code = snapshot_wait(snapshot, 0);
+	ERROR_HANDLE_INT_RETURN_INT(code, "send_snapshot(): The snapshot #%d couldn't be built\n", snapshot->id);
+	size_t snapshot_size = snapshot->size;
 	message_t message;
 	memset(&message, 0, sizeof(message_t));
-	message.size = zip_file_size;
+	message.size = snapshot_size;
 	ENCRYPT_BYTES(&message, sizeof(message_t), g_server->config.password);
-	socket_write(client_socket, &message, sizeof(message_t), 0);
+	code = socket_write_all(client_socket, &message, sizeof(message_t));
+	ERROR_HANDLE_INT_RETURN_INT(code, "send_snapshot(): Unable to send the size of the snapshot #%d\n", snapshot->id);
+
+	// Open the snapshot file (unbuffered: the part not encrypted yet must not be read ahead)
+	FILE *snapshot_file = fopen(snapshot->path, "rb");
+	ERROR_HANDLE_PTR_RETURN_INT(snapshot_file, "send_snapshot(): Unable to open the snapshot file\n");
+	setvbuf(snapshot_file, NULL, _IONBF, 0);
+	pool_buffer_t *snapshot_buffer = buffer_pool_acquire(S_BUFFER_SIZE);
+	if (snapshot_buffer == NULL) fclose(snapshot_file);
+	ERROR_HANDLE_PTR_RETURN_INT(snapshot_buffer, "send_snapshot(): Unable to get a buffer\n");
+
+	// Send the encrypted chunks from the cursor of this session
+	size_t offset = 0;
+	while (code == 0 && offset < snapshot_size) {
+		size_t buffer_size = (size_t)S_BUFFER_SIZE < snapshot_size - offset ? (size_t)S_BUFFER_SIZE : snapshot_size - offset;
+		code = snapshot_wait(snapshot, offset + buffer_size);
+		if (code == 0)
+			code = fread(snapshot_buffer->data, sizeof(byte), buffer_size, snapshot_file) == buffer_size ? 0 : -1;
+		if (code == 0)
+			code = socket_write_all(client_socket, snapshot_buffer->data, buffer_size);
+		if (code == 0)
+			metrics_add(METRIC_BYTES_SENT_WIRE, buffer_size);
+		offset += buffer_size;
+	}
 
-	// Send the zip file
-	byte zip_buffer[S_BUFFER_SIZE];
-	ssize_t bytes_remaining = zip_file_size;
-	while (bytes_remaining > 0) {
+	// Close the snapshot file and release the buffer
+	fclose(snapshot_file);
+	buffer_pool_release(snapshot_buffer);
+	ERROR_HANDLE_INT_RETURN_INT(code, "send_snapshot(): Unable to send the snapshot #%d\n", snapshot->id);
+	metrics_add(METRIC_BYTES_SENT_RAW, snapshot_size);
+	return 0;
+}
 
-		// Get the size of the buffer
-		size_t buffer_size = S_BUFFER_SIZE < bytes_remaining ? S_BUFFER_SIZE : bytes_remaining;
+/**
+ * @brief Function that sends the files of a root to the client as a snapshot (see snapshot_stream.h).
+ * The clients arriving within the sharing window, while the directory didn't change, share the same snapshot.
+ * 
+ * @param client_socket	Socket of the client.
+ * @param root			The root to send.
+ * 
+ * @return int			0 if the message was sent successfully, -1 otherwise.
+ */
+int sendAllDirectoryFiles(SOCKET client_socket, server_root_t *root) {
+
+	// Join the snapshot of the current state of the directory, or build it
+	tree_index_revalidate(&root->index);
+	int is_builder = 0;
+	snapshot_t *snapshot = snapshot_attach(&g_server->snapshots, root->id, __atomic_load_n(&root->index.generation, __ATOMIC_ACQUIRE), &is_builder);
+	ERROR_HANDLE_PTR_RETURN_INT(snapshot, "sendAllDirectoryFiles(): Unable to get a snapshot\n");
+	if (is_builder)
+		snapshot_finish(snapshot, build_snapshot(root, snapshot) == -1);
+	else
+		DEBUG_PRINT("sendAllDirectoryFiles(): Sharing the snapshot #%d\n", snapshot->id);
+
+	// Send it once a stream slot is free
+	snapshot_stream_begin(&g_server->snapshots);
+	int code = send_snapshot(client_socket, snapshot);
+	snapshot_stream_end(&g_server->snapshots);
+	snapshot_release(&g_server->snapshots, snapshot);
+	return code;
+}
 
-		// Read the file into the buffer
-		fread(zip_buffer, sizeof(byte), buffer_size, zip_file);
-		ENCRYPT_BYTES(zip_buffer, buffer_size, g_server->config.password);
-		socket_write(client_socket, zip_buffer, buffer_size, 0);
+/**
+ * @brief Function that tells if an operation on a cached directory is worth a retry:
+ * after ENOENT, the directory may have been deleted or moved on the server itself, so the cache is dropped once.
+ * 
+ * @param root		Root of the operation.
+ * @param attempt	Retries done so far for the operation.
+ * 
+ * @return int		1 to retry the operation, 0 otherwise.
+ */
+static int server_retry_stale(server_root_t *root, int *attempt) {
+	if (errno != ENOENT || (*attempt)++ > 0)
+		return 0;
+	dir_cache_invalidate(&root->dir_cache);
+	errno = 0;
+	return 1;
+}
 
-		// Update the bytes remaining
-		bytes_remaining -= buffer_size;
-	}
+/**
+ * @brief Function that tells if an unlink failed because the entry is a directory:
+ * EISDIR on Linux, EPERM on the other systems (EACCES on Windows), checked without following a symbolic link.
+ * 
+ * @param directory_fd	Directory fd of the entry (dir_cache_parent()).
+ * @param name			Name of the entry in the directory.
+ * 
+ * @return int			1 if the entry is a directory, 0 otherwise.
+ */
+static int server_unlink_is_directory(int directory_fd, const char *name) {
+	if (errno == EISDIR)
+		return 1;
+	#ifdef _WIN32
+		if (errno != EPERM && errno != EACCES)
+			return 0;
+		(void)directory_fd;
+		struct stat st;
+		int code = stat(name, &st);
+	#else
+		if (errno != EPERM)
+			return 0;
+		struct stat st;
+		int code = fstatat(directory_fd, name, &st, AT_SYMLINK_NOFOLLOW);
+	#endif
+	return code == 0 && S_ISDIR(st.st_mode);
+}
 
-	// Close the zip file
-	fclose(zip_file);
+/**
+ * @brief Function that gives the metadata of the client to a file already up to date
+ * (failures are ignored: the content is the same anyway).
+ * 
+ * @param directory_fd	Directory fd of the file (dir_cache_parent()).
+ * @param name			Name of the file in the directory.
+ * @param metadata		Metadata of the file on the client.
+ * 
+ * @return void
+ */
+static void server_apply_metadata(int directory_fd, const char *name, file_metadata_t metadata) {
+	#ifndef _WIN32
+		if (metadata.mode != 0 && fchmodat(directory_fd, name, (mode_t)(metadata.mode & 07777), 0) == -1)
+			errno = 0;
+		if (metadata.mtime_ns != 0) {
+			struct timespec times[2];
+			times[0].tv_sec = 0;
+			times[0].tv_nsec = UTIME_OMIT;
+			times[1].tv_sec = (time_t)(metadata.mtime_ns / 1000000000LL);
+			times[1].tv_nsec = (long)(metadata.mtime_ns % 1000000000LL);
+			if (utimensat(directory_fd, name, times, AT_SYMLINK_NOFOLLOW) == -1)
+				errno = 0;
+		}
+	#else
+		(void)directory_fd; (void)name; (void)metadata;
+	#endif
+}
 
-	// Delete the zip file
-	code = remove(ZIP_TEMPORARY_FILE);
-	ERROR_HANDLE_INT_RETURN_INT(code, "sendAllDirectoryFiles(): Unable to delete the zip file\n");
+/**
+ * @brief Function that checks if the server already has a content announced by a client.
+ * The same size and modification time on disk are enough (quick check), else the hashes are compared.
+ * 
+ * @param root		Root of the file.
+ * @param filename	Path of the file relative to the root.
+ * @param size		Size of the content.
+ * @param mtime_ns	Modification time of the file on the client (0 if unknown).
+ * @param hash		Hash of the content (hash_file()).
+ * 
+ * @return int		1 if the file has this content, 0 if the content must be received.
+ */
+static int server_has_content(server_root_t *root, const char *filename, size_t size, long long mtime_ns, hash128_t hash) {
 
-	// Return
-	return 0;
+	// Compare with the disk, not only the index (the watcher doesn't report the files modified in a subdirectory)
+	if (tree_index_refresh(&root->index, filename) == -1) {
+		errno = 0;
+		return 0;
+	}
+	tree_index_info_t info;
+	if (tree_index_lookup(&root->index, filename, &info) == -1 || info.is_directory || info.size != size)
+		return 0;
+
+	// Same size and modification time: the version already received (the metadata of the uploads are kept)
+	if (mtime_ns != 0 && info.mtime_ns == mtime_ns)
+		return 1;
+	hash128_t local_hash;
+	if (tree_index_content_hash(&root->index, filename, &local_hash) == -1) {
+		errno = 0;
+		return 0;
+	}
+	return hash128_equals(local_hash, hash);
 }
 
-
 /**
  * @brief Function that handles the action from the client
  * (send, modify, delete, and rename a file)
@@ -349,18 +923,29 @@ int handle_action_from_client(client_info_t client, message_t *message) {
 	// Variables
 	int code = 0;
 
-	// Receive the file name
-	char filename[256];
-	memset(filename, 0, sizeof(filename));
-	code = socket_read(client.socket, filename, message->size, 0);
-	DECRYPT_BYTES(filename, message->size, g_server->config.password);
+	// Receive the file name (prefixed with the name of its root)
+	char root_filename[256];
+	memset(root_filename, 0, sizeof(root_filename));
+	code = message->size < sizeof(root_filename) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} File name too long (%zu bytes)\n", client.ip, client.port, message->size);
+	code = socket_read(client.socket, root_filename, message->size, 0);
+	DECRYPT_BYTES(root_filename, message->size, g_server->config.password);
 	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Error while receiving the file name\n", client.ip, client.port);
-	DEBUG_PRINT("{%s:%d} Received file name '%s'\n", client.ip, client.port, filename);
-
-	// Get the file path
-	char filepath[1024];
-	sprintf(filepath, "%s%s", g_server->config.directory, filename);
-	DEBUG_PRINT("{%s:%d} File path '%s'\n", client.ip, client.port, filepath);
+	long long wire_bytes = sizeof(message_t) + code;
+	DEBUG_PRINT("{%s:%d} Received file name '%s'\n", client.ip, client.port, root_filename);
+
+	// Find its root
+	const char *filename;
+	const sync_root_t *root_config = config_find_root(&g_server->config, root_filename, &filename);
+	code = (root_config == NULL || filename[0] == '\0') ? -1 : 0;
+	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} No root for the file '%s'\n", client.ip, client.port, root_filename);
+	server_root_t *root = &g_server->roots[root_config - g_server->config.roots];
+	code = client_registry_has_root(&g_server->clients, client.address.sin_addr, root->id) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} The root of the file '%s' wasn't requested by the client\n", client.ip, client.port, root_filename);
+
+	// Refuse the paths leaving the root (only the relative path is used from here, through the cached directories)
+	code = dir_cache_valid_path(filename) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Invalid path '%s'\n", client.ip, client.port, root_filename);
 
 	// Switch case on the message type (action)
 	switch (message->type) {
@@ -380,35 +965,110 @@ int handle_action_from_client(client_info_t client, message_t *message) {
 	code = socket_read(client.socket, &file_size, sizeof(size_t), 0) > 0 ? 0 : -1;
 	DECRYPT_BYTES(&file_size, sizeof(size_t), g_server->config.password);
 	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Error while receiving the file size\n", client.ip, client.port);
+	wire_bytes += sizeof(size_t);
 	DEBUG_PRINT("{%s:%d} Received file size '%zu'\n", client.ip, client.port, file_size);
 
-	// Open the file
-	FILE *file = fopen(filepath, "wb");
-	ERROR_HANDLE_PTR_RETURN_INT(file, "{%s:%d} Unable to open the file\n", client.ip, client.port);
-
-	// Buffer to receive the file
-	byte action_buffer[S_BUFFER_SIZE];
-	memset(action_buffer, 0, S_BUFFER_SIZE);
-
-	// Receive the file
-	ssize_t bytes_remaining = file_size;
-	while (bytes_remaining > 0) {
-
-		// Get the buffer size
-		size_t buffer_size = S_BUFFER_SIZE < bytes_remaining ? S_BUFFER_SIZE : bytes_remaining;
-
-		// Read the file from the socket into the file
-		socket_read(client.socket, action_buffer, buffer_size, 0);
-		DECRYPT_BYTES(action_buffer, buffer_size, g_server->config.password);
-		fwrite(action_buffer, sizeof(byte), buffer_size, file);
-
-		// Update the bytes remaining
-		bytes_remaining -= buffer_size;
+	// Receive the metadata
+	file_metadata_t metadata;
+	code = socket_read(client.socket, &metadata, sizeof(file_metadata_t), MSG_WAITALL) == (ssize_t)sizeof(file_metadata_t) ? 0 : -1;
+	DECRYPT_BYTES(&metadata, sizeof(file_metadata_t), g_server->config.password);
+	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Error while receiving the metadata of the file\n", client.ip, client.port);
+	wire_bytes += sizeof(file_metadata_t);
+
+	// Receive the hash of the content and tell the client if it must be sent
+	hash128_t content_hash;
+	code = socket_read(client.socket, &content_hash, sizeof(hash128_t), MSG_WAITALL) == (ssize_t)sizeof(hash128_t) ? 0 : -1;
+	DECRYPT_BYTES(&content_hash, sizeof(hash128_t), g_server->config.password);
+	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Error while receiving the hash of the file\n", client.ip, client.port);
+	wire_bytes += sizeof(hash128_t);
+	int present = server_has_content(root, filename, file_size, metadata.mtime_ns, content_hash);
+	message_t answer;
+	memset(&answer, 0, sizeof(message_t));
+	answer.type = present ? CONTENT_PRESENT : CONTENT_NEEDED;
+	ENCRYPT_BYTES(&answer, sizeof(message_t), g_server->config.password);
+	code = socket_write(client.socket, &answer, sizeof(message_t), 0) > 0 ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Error while answering to the hash of the file\n", client.ip, client.port);
+	metrics_add(METRIC_BYTES_SENT_WIRE, sizeof(message_t));
+	if (present) {
+		INFO_PRINT("{%s:%d} File '%s' already up to date\n", client.ip, client.port, filename);
+		const char *name;
+		int directory_fd = dir_cache_parent(&root->dir_cache, filename, 0, &name);
+		if (directory_fd != -1)
+			server_apply_metadata(directory_fd, name, metadata);
+		errno = 0;
+		tree_index_refresh(&root->index, filename);
+		metrics_add(METRIC_PRECHECK_PRESENT, 1);
+		metrics_add(METRIC_BYTES_SKIPPED, file_size);
+		break;
 	}
+	metrics_add(METRIC_PRECHECK_NEEDED, 1);
+
+	// Receive the size of the data (the rest of the file are holes)
+	size_t data_size = 0;
+	code = socket_read(client.socket, &data_size, sizeof(size_t), MSG_WAITALL) == (ssize_t)sizeof(size_t) ? 0 : -1;
+	DECRYPT_BYTES(&data_size, sizeof(size_t), g_server->config.password);
+	if (code == 0 && data_size > file_size) code = -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Error while receiving the data size\n", client.ip, client.port);
+	wire_bytes += sizeof(size_t) + data_size;
+
+	// Open a staging file next to the destination (in its cached directory, created if missing),
+	// preallocated to the file size unless it's sparse
+	io_engine_t *engine = &g_server->io_engine;
+	staged_file_t staged;
+	int attempt = 0;
+	do {
+		const char *name;
+		int directory_fd = dir_cache_parent(&root->dir_cache, filename, 1, &name);
+		code = directory_fd == -1 ? -1 : staged_file_open_at(&staged, directory_fd, name, data_size == file_size ? file_size : 0, engine);
+	} while (code == -1 && server_retry_stale(root, &attempt));
+	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Unable to open the staging file\n", client.ip, client.port);
+
+	// Receive the extents of data, leaving holes between them
+	while (1) {
+		data_extent_t extent;
+		code = socket_read(client.socket, &extent, sizeof(data_extent_t), MSG_WAITALL) == (ssize_t)sizeof(data_extent_t) ? 0 : -1;
+		DECRYPT_BYTES(&extent, sizeof(data_extent_t), g_server->config.password);
+		if (code == 0 && extent.length > 0 && (extent.offset < staged.size || extent.offset > file_size || extent.length > file_size - extent.offset))
+			code = -1;
+		if (code == -1) staged_file_abort(&staged);
+		ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Error while receiving an extent of the file\n", client.ip, client.port);
+		wire_bytes += sizeof(data_extent_t);
+		if (extent.length == 0)
+			break;
+		staged_file_skip(&staged, extent.offset - staged.size);
+
+		// Receive the content (the disk writes of a buffer overlap the reception of the next ones)
+		ssize_t bytes_remaining = extent.length;
+		while (bytes_remaining > 0) {
+
+			// Get the buffer size and a free buffer
+			size_t buffer_size = S_BUFFER_SIZE < bytes_remaining ? S_BUFFER_SIZE : bytes_remaining;
+			byte *action_buffer = io_engine_buffer(engine);
+
+			// Read the file from the socket into the staging file
+			code = socket_read(client.socket, action_buffer, buffer_size, MSG_WAITALL) == (ssize_t)buffer_size ? 0 : -1;
+			if (code == -1) staged_file_abort(&staged);
+			ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Error while receiving the file content\n", client.ip, client.port);
+			DECRYPT_BYTES(action_buffer, buffer_size, g_server->config.password);
+			code = staged_file_write(&staged, action_buffer, buffer_size);
+			if (code == -1) staged_file_abort(&staged);
+			ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Error while writing the file content\n", client.ip, client.port);
+
+			// Update the bytes remaining
+			bytes_remaining -= buffer_size;
+		}
+	}
+	staged_file_skip(&staged, file_size - staged.size);
 
-	// Close the file
-	fclose(file);
+	// Publish the file with the metadata of the client (readers never see a partially written file)
+	staged_file_set_metadata(&staged, metadata.mode, metadata.mtime_ns);
+	code = staged_file_commit(&staged);
+	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Unable to publish the file\n", client.ip, client.port);
 	INFO_PRINT("{%s:%d} File '%s' correctly received\n", client.ip, client.port, filename);
+	tree_index_refresh(&root->index, filename);
+	metrics_add(message->type == FILE_CREATED ? METRIC_ACTIONS_CREATED : METRIC_ACTIONS_MODIFIED, 1);
+	metrics_add(METRIC_BYTES_RECEIVED_RAW, data_size);
+	metrics_add(METRIC_BYTES_SPARSE, file_size - data_size);
 }
 			break;
 
@@ -421,21 +1081,41 @@ int handle_action_from_client(client_info_t client, message_t *message) {
 {
 	// Info print
 	INFO_PRINT("{%s:%d} Deleting file '%s'\n", client.ip, client.port, filename);
+	metrics_add(METRIC_ACTIONS_DELETED, 1);
 
 	// Delete the file
-	code = remove(filepath);
+	int attempt = 0, directory_fd;
+	const char *name;
+	do {
+		directory_fd = dir_cache_parent(&root->dir_cache, filename, 0, &name);
+		code = directory_fd == -1 ? -1 : io_engine_unlinkat(&g_server->io_engine, directory_fd, name, 0);
+	} while (code == -1 && server_retry_stale(root, &attempt));
 	if (code == 0) {
 		INFO_PRINT("{%s:%d} File '%s' correctly deleted\n", client.ip, client.port, filename);
+		tree_index_remove(&root->index, filename);
 	}
-	else {
-		code = remove_directory(filepath);
+	else if (directory_fd != -1 && server_unlink_is_directory(directory_fd, name)) {
+
+		// A directory: the whole tree is deleted relative to its parent
+		// (in the background when the trash is enabled, so the client isn't delayed)
+		errno = 0;
+		dir_cache_invalidate(&root->dir_cache);
+		if (g_server->config.delete_trash)
+			code = tree_delete_to_trash(root->config->directory, directory_fd, name, g_server->config.scan_threads);
+		else
+			code = tree_delete_at(directory_fd, name, g_server->config.scan_threads, NULL);
 		if (code == 0) {
 			INFO_PRINT("{%s:%d} Folder '%s' correctly deleted\n", client.ip, client.port, filename);
+			tree_index_remove(&root->index, filename);
 		}
 		else {
 			WARNING_PRINT("{%s:%d} Unable to delete folder '%s'\n", client.ip, client.port, filename);
 		}
 	}
+	else {
+		WARNING_PRINT("{%s:%d} Unable to delete file '%s'\n", client.ip, client.port, filename);
+		errno = 0;
+	}
 }
 			break;
 
@@ -454,23 +1134,48 @@ int handle_action_from_client(client_info_t client, message_t *message) {
 	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Error while receiving the new file name size\n", client.ip, client.port);
 	DEBUG_PRINT("{%s:%d} Received new file name size '%zu'\n", client.ip, client.port, new_filename_size);
 
-	// Receive the new file name
-	char new_filename[256];
-	code = socket_read(client.socket, new_filename, sizeof(new_filename), 0) > 0 ? 0 : -1;
-	DECRYPT_BYTES(new_filename, sizeof(new_filename), g_server->config.password);
+	// Receive the new file name (in the same root)
+	char root_new_filename[256];
+	code = socket_read(client.socket, root_new_filename, sizeof(root_new_filename), 0) > 0 ? 0 : -1;
+	DECRYPT_BYTES(root_new_filename, sizeof(root_new_filename), g_server->config.password);
 	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} Error while receiving the new file name\n", client.ip, client.port);
+	root_new_filename[sizeof(root_new_filename) - 1] = '\0';
+	const char *new_filename;
+	code = (config_find_root(&g_server->config, root_new_filename, &new_filename) == root_config && dir_cache_valid_path(new_filename)) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "{%s:%d} The new name '%s' isn't in the root of '%s'\n", client.ip, client.port, root_new_filename, root_filename);
 
 	// Info print
 	INFO_PRINT("{%s:%d} Renaming file '%s' to '%s'\n", client.ip, client.port, filename, new_filename);
-
-	// Get the new file path
-	char new_filepath[1024];
-	sprintf(new_filepath, "%s%s", g_server->config.directory, new_filename);
-
-	// Rename the file
-	code = rename(filepath, new_filepath);
+	metrics_add(METRIC_ACTIONS_RENAMED, 1);
+	wire_bytes += sizeof(size_t) + new_filename_size;
+
+	// Rename the file between the cached directories (the new parents are created if missing)
+	tree_index_info_t info;
+	int is_directory = tree_index_lookup(&root->index, filename, &info) == 0 && info.is_directory;
+	int attempt = 0;
+	do {
+		const char *resolved_name, *new_name;
+		int old_directory = dir_cache_parent(&root->dir_cache, filename, 0, &resolved_name);
+		#ifndef _WIN32
+			old_directory = old_directory == -1 ? -1 : dup(old_directory);
+		#endif
+		char old_name[sizeof(root->dir_cache.full_path)];
+		snprintf(old_name, sizeof(old_name), "%s", old_directory == -1 ? "" : resolved_name);
+		int new_directory = old_directory == -1 ? -1 : dir_cache_parent(&root->dir_cache, new_filename, 1, &new_name);
+		code = new_directory == -1 ? -1 : io_engine_renameat(&g_server->io_engine, old_directory, old_name, new_directory, new_name);
+		#ifndef _WIN32
+			if (old_directory != -1) {
+				int saved_errno = errno;
+				close(old_directory);
+				errno = saved_errno;
+			}
+		#endif
+	} while (code == -1 && server_retry_stale(root, &attempt));
+	if (is_directory)
+		dir_cache_invalidate(&root->dir_cache);
 	if (code == 0) {
-		INFO_PRINT("{%s:%d} File '%s' correctly renamed to '%s'\n", client.ip, client.port, filename, new_filepath);
+		INFO_PRINT("{%s:%d} File '%s' correctly renamed to '%s'\n", client.ip, client.port, filename, new_filename);
+		tree_index_rename(&root->index, filename, new_filename);
 	}
 	else {
 		WARNING_PRINT("{%s:%d} Unable to rename file '%s'\n", client.ip, client.port, filename);
@@ -482,6 +1187,10 @@ int handle_action_from_client(client_info_t client, message_t *message) {
 			break;
 	}
 
+	// Count the bytes received from the client (the message was counted by the caller)
+	metrics_add(METRIC_BYTES_RECEIVED_WIRE, wire_bytes - sizeof(message_t));
+	metrics_client_add(client.ip, wire_bytes, 1);
+
 	// Return
 	return 0;
 }
@@ -6,15 +6,12 @@
 #include "../universal_pthread.h"
 #include "../network/net_utils.h"
 #include "../config_manager.h"
-
-#define MAX_CLIENTS 32
-
-// Clients view from the server
-typedef struct tcp_client_from_server_t {
-	SOCKET socket;
-	struct sockaddr_in address;
-	int id;
-} tcp_client_from_server_t;
+#include "../io_engine.h"
+#include "../sync_ignore.h"
+#include "s_client_registry.h"
+#include "s_tree_index.h"
+#include "s_snapshot.h"
+#include "s_dir_cache.h"
 
 // Structure for a server thread
 typedef struct tcp_server_thread_t {
@@ -25,6 +22,29 @@ typedef struct tcp_server_thread_t {
 	pthread_mutex_t mutex;
 } tcp_server_thread_t;
 
+// Initial synchronization of a new client, run by its own thread
+typedef struct sync_session_t {
+	SOCKET socket;
+	struct sockaddr_in address;
+	int id;
+} sync_session_t;
+
+// Synchronized root of the server (a directory of the config, with its own watcher)
+typedef struct server_root_t {
+	const sync_root_t *config;		// Name and directory (in the config of the server)
+	int id;							// Index of the root (in the config and the snapshot manager)
+
+	// Paths never synchronized (.syncignore of the directory)
+	sync_ignore_t ignore;
+
+	// Index of the directory, kept current by its own watcher and the applied actions
+	tree_index_t index;
+	pthread_t index_thread;
+
+	// Open directories of the thread handling client requests
+	dir_cache_t dir_cache;
+} server_root_t;
+
 // Structure of the TCP server
 typedef struct tcp_server_t {
 
@@ -35,9 +55,23 @@ typedef struct tcp_server_t {
 	tcp_server_thread_t handle_new_connections;
 	tcp_server_thread_t handle_client_requests;
 
+	// Synchronized roots (the paths exchanged with the clients start with the name of their root)
+	server_root_t *roots;
+	int roots_count;
+
+	// Archives of the roots shared by the clients connecting at the same time
+	snapshot_manager_t snapshots;
+
+	// Disk I/O engine of the thread handling client requests (shared by the roots)
+	io_engine_t io_engine;
+
 	// Clients
-	int clients_count;
-	tcp_client_from_server_t clients[MAX_CLIENTS];
+	volatile int sessions_started;		// Initial synchronizations started (gives the session ids)
+	client_registry_t clients;
+	#ifndef _WIN32
+		int clients_epoll;				// Sockets of the clients, watched for their disconnection
+		pthread_t clients_thread;
+	#endif
 
 } tcp_server_t;
 
@@ -46,9 +80,14 @@ int setup_tcp_server(config_t config, tcp_server_t *tcp_server);
 int tcp_server_run(tcp_server_t *tcp_server);
 thread_return_type tcp_server_handle_new_connections(thread_param_type arg);
 thread_return_type tcp_server_handle_client_requests(thread_param_type arg);
+thread_return_type tcp_server_sync_session(thread_param_type arg);
+thread_return_type tcp_server_watch_directory(thread_param_type arg);
+#ifndef _WIN32
+	thread_return_type tcp_server_handle_disconnections(thread_param_type arg);
+#endif
 
 // Internal functions prototypes
-int sendAllDirectoryFiles(SOCKET client_socket);
+int sendAllDirectoryFiles(SOCKET client_socket, server_root_t *root);
 int handle_action_from_client(client_info_t client, message_t *message);
 
 
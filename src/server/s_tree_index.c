@@ -0,0 +1,699 @@
+
+#include "s_tree_index.h"
+#include "../dir_scanner.h"
+#include "../metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#ifndef O_BINARY
+	#define O_BINARY 0
+#endif
+
+// Destination of the entries found by a scan (paths relative to a subdirectory are prefixed)
+typedef struct tree_index_scan_t {
+	tree_index_t *index;
+	const char *prefix;							// Path of the scanned directory ending with a '/' ("" for the root)
+	size_t prefix_length;
+	int filter;									// 1 if the entries must be checked against the ignore patterns
+} tree_index_scan_t;
+
+/**
+ * @brief Function that hashes a path.
+ * 
+ * @param path		The path.
+ * @param length	Length of the path.
+ * 
+ * @return unsigned long long	The hash.
+ */
+static unsigned long long tree_index_hash_path(const char *path, size_t length) {
+	return hash64(path, length, 0);
+}
+
+/**
+ * @brief Function that gets the shard of a path (upper bits of the hash, the lower ones select the bucket).
+ * 
+ * @param index		The index.
+ * @param hash		Hash of the path.
+ * 
+ * @return tree_index_shard_t*	The shard.
+ */
+static tree_index_shard_t* tree_index_shard(tree_index_t *index, unsigned long long hash) {
+	return &index->shards[(hash >> 58) % TREE_INDEX_SHARDS];
+}
+
+/**
+ * @brief Function that gets the length of a path without its trailing slashes.
+ * 
+ * @param path	The path.
+ * 
+ * @return size_t	The length.
+ */
+static size_t tree_index_path_length(const char *path) {
+	size_t length = strlen(path);
+	while (length > 0 && path[length - 1] == '/')
+		length--;
+	return length;
+}
+
+/**
+ * @brief Function that finds an entry in a shard (its lock must be held).
+ * 
+ * @param shard		The shard.
+ * @param path		The path.
+ * @param length	Length of the path.
+ * @param hash		Hash of the path.
+ * 
+ * @return tree_index_entry_t**		Link pointing to the entry, or to the NULL ending its bucket if the path isn't indexed.
+ */
+static tree_index_entry_t** tree_index_find(tree_index_shard_t *shard, const char *path, size_t length, unsigned long long hash) {
+	tree_index_entry_t **link = &shard->buckets[hash & (shard->buckets_count - 1)];
+	while (*link != NULL && ((*link)->path_hash != hash || (*link)->path_length != length || memcmp((*link)->path, path, length) != 0))
+		link = &(*link)->next;
+	return link;
+}
+
+/**
+ * @brief Function that updates the global counters of the index after an entry was added or removed.
+ * 
+ * @param index			The index.
+ * @param entry			The entry.
+ * @param direction		1 if the entry was added, -1 if it was removed.
+ * 
+ * @return void
+ */
+static void tree_index_count(tree_index_t *index, const tree_index_entry_t *entry, int direction) {
+	if (entry->is_directory)
+		__sync_fetch_and_add(&index->directories, direction);
+	else {
+		__sync_fetch_and_add(&index->files, direction);
+		__sync_fetch_and_add(&index->bytes, direction * (long long)entry->size);
+	}
+	__sync_fetch_and_add(&index->generation, 1);
+	metrics_gauge_add(METRIC_INDEX_ENTRIES, direction);
+}
+
+/**
+ * @brief Function that adds an entry, or updates it if the path is already indexed.
+ * The content hash is kept as long as the size and the mtime don't change.
+ * 
+ * @param index		The index.
+ * @param path		The path (relative to the root, without trailing slash).
+ * @param length	Length of the path.
+ * @param info		Type, mode, size and mtime of the entry.
+ * 
+ * @return int		1 if the entry is new or its type changed, 0 if it was updated, -1 on allocation failure.
+ */
+static int tree_index_upsert(tree_index_t *index, const char *path, size_t length, const tree_index_info_t *info) {
+	unsigned long long hash = tree_index_hash_path(path, length);
+	tree_index_shard_t *shard = tree_index_shard(index, hash);
+	pthread_mutex_lock(&shard->mutex);
+
+	// Update the entry in place
+	tree_index_entry_t **link = tree_index_find(shard, path, length, hash);
+	tree_index_entry_t *entry = *link;
+	if (entry != NULL) {
+		int changed_type = entry->is_directory != info->is_directory;
+		if (!changed_type && entry->mode == info->mode && entry->size == info->size && entry->mtime_ns == info->mtime_ns) {
+			pthread_mutex_unlock(&shard->mutex);
+			return 0;
+		}
+		tree_index_count(index, entry, -1);
+		if (entry->size != info->size || entry->mtime_ns != info->mtime_ns || changed_type)
+			entry->content_hash_valid = 0;
+		entry->is_directory = info->is_directory;
+		entry->mode = info->mode;
+		entry->size = info->size;
+		entry->mtime_ns = info->mtime_ns;
+		tree_index_count(index, entry, 1);
+		pthread_mutex_unlock(&shard->mutex);
+		return changed_type;
+	}
+
+	// Grow the shard when it's full (the entries are moved to their new bucket)
+	if (shard->count >= shard->buckets_count) {
+		size_t buckets_count = shard->buckets_count * 2;
+		tree_index_entry_t **buckets = calloc(buckets_count, sizeof(tree_index_entry_t*));
+		if (buckets != NULL) {
+			size_t i;
+			for (i = 0; i < shard->buckets_count; i++) {
+				while (shard->buckets[i] != NULL) {
+					tree_index_entry_t *moved = shard->buckets[i];
+					shard->buckets[i] = moved->next;
+					moved->next = buckets[moved->path_hash & (buckets_count - 1)];
+					buckets[moved->path_hash & (buckets_count - 1)] = moved;
+				}
+			}
+			free(shard->buckets);
+			shard->buckets = buckets;
+			shard->buckets_count = buckets_count;
+			link = tree_index_find(shard, path, length, hash);
+		}
+	}
+
+	// Add the entry at the end of its bucket
+	entry = malloc(sizeof(tree_index_entry_t) + length + 1);
+	if (entry == NULL) {
+		pthread_mutex_unlock(&shard->mutex);
+		ERROR_PRINT("tree_index_upsert(): Unable to index '%.*s'\n", (int)length, path);
+		return -1;
+	}
+	entry->next = NULL;
+	entry->path_hash = hash;
+	entry->is_directory = info->is_directory;
+	entry->mode = info->mode;
+	entry->size = info->size;
+	entry->mtime_ns = info->mtime_ns;
+	memset(&entry->content_hash, 0, sizeof(hash128_t));
+	entry->content_hash_valid = 0;
+	entry->path_length = length;
+	memcpy(entry->path, path, length);
+	entry->path[length] = '\0';
+	*link = entry;
+	shard->count++;
+	tree_index_count(index, entry, 1);
+	pthread_mutex_unlock(&shard->mutex);
+	return 1;
+}
+
+/**
+ * @brief Function that adds an entry found by dir_scan() (handler called concurrently by the scanner threads).
+ * 
+ * @param entry		Entry found by the scanner.
+ * @param arg		The tree_index_scan_t.
+ * 
+ * @return int		0 if success, -1 to stop the scan.
+ */
+static int tree_index_scan_entry(const scan_entry_t *entry, void *arg) {
+	tree_index_scan_t *scan = (tree_index_scan_t*)arg;
+
+	// Path relative to the root of the index
+	char path[SYNC_IGNORE_MAX_PATH];
+	if (scan->prefix_length + entry->path_length >= sizeof(path))
+		return 0;
+	memcpy(path, scan->prefix, scan->prefix_length);
+	memcpy(path + scan->prefix_length, entry->path, entry->path_length + 1);
+	if (scan->filter && sync_ignore_match(scan->index->ignore, path, entry->is_directory))
+		return 0;
+
+	tree_index_info_t info = { entry->is_directory, entry->mode, entry->is_directory ? 0 : entry->size, entry->mtime_ns, { 0, 0 }, 0 };
+	return tree_index_upsert(scan->index, path, scan->prefix_length + entry->path_length, &info) == -1 ? -1 : 0;
+}
+
+/**
+ * @brief Function that indexes the content of a directory.
+ * 
+ * @param index		The index.
+ * @param path		Path of the directory ending with a '/' ("" for the root).
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+static int tree_index_scan(tree_index_t *index, const char *path) {
+
+	// The ignore patterns are anchored at the root: a subdirectory is filtered here instead of by the scanner
+	tree_index_scan_t scan = { index, path, strlen(path), path[0] != '\0' };
+	dir_scan_options_t options = { index->scan_threads, 1, scan.filter ? NULL : index->ignore, tree_index_scan_entry, &scan };
+	char directory[SYNC_IGNORE_MAX_PATH * 2];
+	snprintf(directory, sizeof(directory), "%s%s", index->root, path);
+	dir_scan_stats_t stats;
+	int code = dir_scan(directory, &options, &stats);
+	ERROR_HANDLE_INT_RETURN_INT(code, "tree_index_scan(): Unable to index the directory '%s'\n", directory);
+	DEBUG_PRINT("tree_index_scan(): '%s' indexed (%lld files, %lld directories in %lld us)\n", directory, stats.files, stats.directories, stats.duration_us);
+	return 0;
+}
+
+/**
+ * @brief Function that gets the type, mode, size and mtime of a path on the disk (symbolic links are not followed).
+ * 
+ * @param index		The index.
+ * @param path		Path relative to the root.
+ * @param info		Filled with the metadata.
+ * 
+ * @return int		0 if success, -1 if the path doesn't exist.
+ */
+static int tree_index_stat(tree_index_t *index, const char *path, tree_index_info_t *info) {
+	char full_path[SYNC_IGNORE_MAX_PATH * 2];
+	snprintf(full_path, sizeof(full_path), "%s%s", index->root, path);
+	struct stat st;
+	#ifdef _WIN32
+		int code = stat(full_path, &st);
+	#else
+		int code = lstat(full_path, &st);
+	#endif
+	if (code == -1)
+		return -1;
+	memset(info, 0, sizeof(tree_index_info_t));
+	info->is_directory = S_ISDIR(st.st_mode);
+	info->mode = (unsigned int)st.st_mode;
+	info->size = info->is_directory ? 0 : (unsigned long long)st.st_size;
+	#ifdef __linux__
+		info->mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	#else
+		info->mtime_ns = (long long)st.st_mtime * 1000000000LL;
+	#endif
+	return 0;
+}
+
+/**
+ * @brief Function that builds the index of a directory (walked with the parallel scanner).
+ * 
+ * @param index			The index to build.
+ * @param root			The synchronized directory.
+ * @param ignore		Paths never indexed (NULL for none).
+ * @param scan_threads	Threads used to walk the directories (0 for the default).
+ * 
+ * @return int			0 if success, -1 otherwise.
+ */
+int tree_index_init(tree_index_t *index, const char *root, const sync_ignore_t *ignore, int scan_threads) {
+	memset(index, 0, sizeof(tree_index_t));
+	int code = strlen(root) + 2 < sizeof(index->root) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "tree_index_init(): Root path too long '%s'\n", root);
+	strcpy(index->root, root);
+	if (root[0] != '\0' && root[strlen(root) - 1] != '/')
+		strcat(index->root, "/");
+	index->ignore = ignore;
+	index->scan_threads = scan_threads;
+
+	// Prepare the shards
+	int i;
+	for (i = 0; i < TREE_INDEX_SHARDS; i++) {
+		pthread_mutex_init(&index->shards[i].mutex, NULL);
+		index->shards[i].buckets_count = TREE_INDEX_INITIAL_BUCKETS;
+		index->shards[i].buckets = calloc(TREE_INDEX_INITIAL_BUCKETS, sizeof(tree_index_entry_t*));
+		if (index->shards[i].buckets == NULL) tree_index_free(index);
+		ERROR_HANDLE_PTR_RETURN_INT(index->shards[i].buckets, "tree_index_init(): Unable to allocate the shards\n");
+	}
+
+	// Index the whole tree
+	long long start_time = get_time_us();
+	code = tree_index_scan(index, "");
+	if (code == -1) tree_index_free(index);
+	ERROR_HANDLE_INT_RETURN_INT(code, "tree_index_init(): Unable to index '%s'\n", root);
+	INFO_PRINT("tree_index_init(): '%s' indexed in %lld ms (%lld files, %lld directories, %lld bytes)\n", root, (get_time_us() - start_time) / 1000, index->files, index->directories, index->bytes);
+	return 0;
+}
+
+/**
+ * @brief Function that removes the entries inside a directory.
+ * 
+ * @param index		The index.
+ * @param path		Path of the directory (without trailing slash).
+ * @param length	Length of the path.
+ * 
+ * @return void
+ */
+static void tree_index_remove_subtree(tree_index_t *index, const char *path, size_t length) {
+	int i;
+	for (i = 0; i < TREE_INDEX_SHARDS; i++) {
+		tree_index_shard_t *shard = &index->shards[i];
+		pthread_mutex_lock(&shard->mutex);
+		size_t b;
+		for (b = 0; shard->count > 0 && b < shard->buckets_count; b++) {
+			tree_index_entry_t **link = &shard->buckets[b];
+			while (*link != NULL) {
+				tree_index_entry_t *entry = *link;
+				if (entry->path_length > length && entry->path[length] == '/' && memcmp(entry->path, path, length) == 0) {
+					*link = entry->next;
+					shard->count--;
+					tree_index_count(index, entry, -1);
+					free(entry);
+				}
+				else
+					link = &entry->next;
+			}
+		}
+		pthread_mutex_unlock(&shard->mutex);
+	}
+}
+
+/**
+ * @brief Function that removes a path from the index, with its content if it's a directory.
+ * 
+ * @param index		The index.
+ * @param path		Path relative to the root.
+ * 
+ * @return int		0 if the path was removed, -1 if it wasn't indexed.
+ */
+int tree_index_remove(tree_index_t *index, const char *path) {
+	size_t length = tree_index_path_length(path);
+	unsigned long long hash = tree_index_hash_path(path, length);
+	tree_index_shard_t *shard = tree_index_shard(index, hash);
+
+	// Remove the entry
+	pthread_mutex_lock(&shard->mutex);
+	tree_index_entry_t **link = tree_index_find(shard, path, length, hash);
+	tree_index_entry_t *entry = *link;
+	if (entry == NULL) {
+		pthread_mutex_unlock(&shard->mutex);
+		return -1;
+	}
+	*link = entry->next;
+	shard->count--;
+	tree_index_count(index, entry, -1);
+	pthread_mutex_unlock(&shard->mutex);
+
+	// Remove the content of a directory
+	if (entry->is_directory)
+		tree_index_remove_subtree(index, path, length);
+	free(entry);
+	return 0;
+}
+
+/**
+ * @brief Function that updates a path from the disk: added or updated if it exists (a new directory is indexed with its content),
+ * removed if it doesn't exist anymore or if it's ignored.
+ * 
+ * @param index		The index.
+ * @param path		Path relative to the root.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+int tree_index_refresh(tree_index_t *index, const char *path) {
+	size_t length = tree_index_path_length(path);
+	if (length == 0 || length + 2 >= SYNC_IGNORE_MAX_PATH)
+		return 0;
+	char relative[SYNC_IGNORE_MAX_PATH];
+	memcpy(relative, path, length);
+	relative[length] = '\0';
+
+	// Gone or ignored
+	tree_index_info_t info;
+	if (tree_index_stat(index, relative, &info) == -1 || sync_ignore_match(index->ignore, relative, info.is_directory)) {
+		errno = 0;
+		tree_index_remove(index, relative);
+		return 0;
+	}
+
+	// Add or update the entry, the content of a directory that wasn't indexed is walked
+	int code = tree_index_upsert(index, relative, length, &info);
+	ERROR_HANDLE_INT_RETURN_INT(code, "tree_index_refresh(): Unable to index '%s'\n", relative);
+	if (code == 1) {
+		tree_index_remove_subtree(index, relative, length);
+		if (info.is_directory) {
+			relative[length] = '/';
+			relative[length + 1] = '\0';
+			code = tree_index_scan(index, relative);
+			ERROR_HANDLE_INT_RETURN_INT(code, "tree_index_refresh(): Unable to index the content of '%s'\n", relative);
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that moves a path in the index. The content hash of a renamed file is kept.
+ * 
+ * @param index		The index.
+ * @param old_path	Previous path relative to the root.
+ * @param new_path	New path relative to the root.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+int tree_index_rename(tree_index_t *index, const char *old_path, const char *new_path) {
+	tree_index_info_t old_info;
+	int had_hash = tree_index_lookup(index, old_path, &old_info) == 0 && !old_info.is_directory && old_info.content_hash_valid;
+	tree_index_remove(index, old_path);
+	int code = tree_index_refresh(index, new_path);
+	ERROR_HANDLE_INT_RETURN_INT(code, "tree_index_rename(): Unable to index '%s'\n", new_path);
+
+	// Same content: keep its hash if the file is unchanged
+	if (had_hash) {
+		size_t length = tree_index_path_length(new_path);
+		unsigned long long hash = tree_index_hash_path(new_path, length);
+		tree_index_shard_t *shard = tree_index_shard(index, hash);
+		pthread_mutex_lock(&shard->mutex);
+		tree_index_entry_t *entry = *tree_index_find(shard, new_path, length, hash);
+		if (entry != NULL && !entry->is_directory && entry->size == old_info.size && entry->mtime_ns == old_info.mtime_ns) {
+			entry->content_hash = old_info.content_hash;
+			entry->content_hash_valid = 1;
+		}
+		pthread_mutex_unlock(&shard->mutex);
+	}
+	return 0;
+}
+
+// Paths collected from the index, processed once its locks are released
+typedef struct tree_index_paths_t {
+	char **paths;
+	size_t count;
+	size_t capacity;
+	const char *parent;							// Only the direct children of this directory are collected (NULL for the directories)
+	size_t parent_length;
+} tree_index_paths_t;
+
+/**
+ * @brief Function that collects the paths to revalidate (visitor of tree_index_for_each()).
+ * 
+ * @param entry		Indexed entry.
+ * @param arg		The tree_index_paths_t.
+ * 
+ * @return int		0 if success, -1 on allocation failure.
+ */
+static int tree_index_collect(const tree_index_entry_t *entry, void *arg) {
+	tree_index_paths_t *list = (tree_index_paths_t*)arg;
+	if (list->parent == NULL && !entry->is_directory)
+		return 0;
+	if (list->parent != NULL && (entry->path_length <= list->parent_length || memcmp(entry->path, list->parent, list->parent_length) != 0 || strchr(entry->path + list->parent_length, '/') != NULL))
+		return 0;
+	if (list->count == list->capacity) {
+		size_t capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+		char **paths = realloc(list->paths, capacity * sizeof(char*));
+		ERROR_HANDLE_PTR_RETURN_INT(paths, "tree_index_collect(): Unable to grow the list of paths\n");
+		list->paths = paths;
+		list->capacity = capacity;
+	}
+	list->paths[list->count] = strdup(entry->path);
+	ERROR_HANDLE_PTR_RETURN_INT(list->paths[list->count], "tree_index_collect(): Unable to copy the path\n");
+	list->count++;
+	return 0;
+}
+
+/**
+ * @brief Function that frees the collected paths.
+ * 
+ * @param list	The list.
+ * 
+ * @return void
+ */
+static void tree_index_paths_free(tree_index_paths_t *list) {
+	size_t i;
+	for (i = 0; i < list->count; i++)
+		free(list->paths[i]);
+	free(list->paths);
+}
+
+/**
+ * @brief Function that updates the entries of a directory whose content changed:
+ * its entries on the disk are refreshed, and the indexed ones that don't exist anymore are removed.
+ * 
+ * @param index		The index.
+ * @param path		Path of the directory ("" for the root).
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+static int tree_index_relist(tree_index_t *index, const char *path) {
+	char child[SYNC_IGNORE_MAX_PATH];
+	size_t length = strlen(path);
+	if (length > 0)
+		tree_index_refresh(index, path);
+
+	// Entries on the disk (a new subdirectory is indexed with its content)
+	char full_path[SYNC_IGNORE_MAX_PATH * 2];
+	snprintf(full_path, sizeof(full_path), "%s%s", index->root, path);
+	DIR *directory = opendir(full_path);
+	if (directory == NULL) {
+		errno = 0;
+		return 0;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(directory)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		if (snprintf(child, sizeof(child), "%s%s%s", path, length > 0 ? "/" : "", entry->d_name) >= (int)sizeof(child))
+			continue;
+		tree_index_info_t info;
+		if (tree_index_lookup(index, child, &info) == -1)
+			tree_index_refresh(index, child);
+	}
+	closedir(directory);
+
+	// Indexed entries that are gone
+	snprintf(child, sizeof(child), "%s%s", path, length > 0 ? "/" : "");
+	tree_index_paths_t list = { NULL, 0, 0, child, strlen(child) };
+	int code = tree_index_for_each(index, tree_index_collect, &list) >= 0 ? 0 : -1;
+	size_t i;
+	for (i = 0; i < list.count; i++)
+		tree_index_refresh(index, list.paths[i]);
+	tree_index_paths_free(&list);
+	return code;
+}
+
+/**
+ * @brief Function that catches up with the changes the watcher can't see (it only watches the root):
+ * every indexed directory whose mtime changed on the disk is listed again.
+ * Only the directories are stat-ed, the files of the unchanged ones are answered from memory.
+ * 
+ * @param index		The index.
+ * 
+ * @return int		Number of directories listed again, -1 on error.
+ */
+int tree_index_revalidate(tree_index_t *index) {
+
+	// Collect the indexed directories
+	tree_index_paths_t list = { NULL, 0, 0, NULL, 0 };
+	tree_index_for_each(index, tree_index_collect, &list);
+
+	// List again the root and the changed directories
+	int changed = 0;
+	size_t i;
+	for (i = 0; i < list.count; i++) {
+		tree_index_info_t indexed, current;
+		if (tree_index_lookup(index, list.paths[i], &indexed) == -1)
+			continue;
+		if (tree_index_stat(index, list.paths[i], &current) == -1 || current.mtime_ns != indexed.mtime_ns) {
+			errno = 0;
+			tree_index_relist(index, list.paths[i]);
+			changed++;
+		}
+	}
+	tree_index_paths_free(&list);
+	tree_index_relist(index, "");
+	if (changed > 0)
+		DEBUG_PRINT("tree_index_revalidate(): %d changed directories listed again\n", changed);
+	return changed;
+}
+
+/**
+ * @brief Function that gets the indexed metadata of a path.
+ * 
+ * @param index		The index.
+ * @param path		Path relative to the root.
+ * @param info		Filled with a copy of the entry.
+ * 
+ * @return int		0 if the path is indexed, -1 otherwise.
+ */
+int tree_index_lookup(tree_index_t *index, const char *path, tree_index_info_t *info) {
+	size_t length = tree_index_path_length(path);
+	unsigned long long hash = tree_index_hash_path(path, length);
+	tree_index_shard_t *shard = tree_index_shard(index, hash);
+	pthread_mutex_lock(&shard->mutex);
+	tree_index_entry_t *entry = *tree_index_find(shard, path, length, hash);
+	if (entry != NULL) {
+		info->is_directory = entry->is_directory;
+		info->mode = entry->mode;
+		info->size = entry->size;
+		info->mtime_ns = entry->mtime_ns;
+		info->content_hash = entry->content_hash;
+		info->content_hash_valid = entry->content_hash_valid;
+	}
+	pthread_mutex_unlock(&shard->mutex);
+	return entry == NULL ? -1 : 0;
+}
+
+/**
+ * @brief Function that gets the hash of the content of an indexed file,
+ * computed on the first request and kept until the size or the mtime of the file change.
+ * 
+ * @param index		The index.
+ * @param path		Path relative to the root.
+ * @param hash		Filled with the hash of the content.
+ * 
+ * @return int		0 if success, -1 if the path isn't an indexed file or can't be read.
+ */
+int tree_index_content_hash(tree_index_t *index, const char *path, hash128_t *hash) {
+
+	// A file modified in a subdirectory isn't reported by the watcher: compare with the disk first
+	int code = tree_index_refresh(index, path);
+	ERROR_HANDLE_INT_RETURN_INT(code, "tree_index_content_hash(): Unable to refresh '%s'\n", path);
+	tree_index_info_t info;
+	code = (tree_index_lookup(index, path, &info) == 0 && !info.is_directory) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "tree_index_content_hash(): '%s' is not an indexed file\n", path);
+	if (info.content_hash_valid) {
+		*hash = info.content_hash;
+		return 0;
+	}
+
+	// Hash the content without holding the lock (the chunks of a large file in parallel)
+	char full_path[SYNC_IGNORE_MAX_PATH * 2];
+	snprintf(full_path, sizeof(full_path), "%s%s", index->root, path);
+	int fd = open(full_path, O_RDONLY | O_BINARY);
+	ERROR_HANDLE_INT_RETURN_INT(fd, "tree_index_content_hash(): Unable to open '%s'\n", full_path);
+	hash128_t content_hash;
+	code = hash_file(fd, (size_t)info.size, index->scan_threads, &content_hash);
+	close(fd);
+	ERROR_HANDLE_INT_RETURN_INT(code, "tree_index_content_hash(): Error while reading '%s'\n", full_path);
+
+	// Keep it if the file didn't change meanwhile
+	size_t length = tree_index_path_length(path);
+	unsigned long long path_hash = tree_index_hash_path(path, length);
+	tree_index_shard_t *shard = tree_index_shard(index, path_hash);
+	pthread_mutex_lock(&shard->mutex);
+	tree_index_entry_t *entry = *tree_index_find(shard, path, length, path_hash);
+	if (entry != NULL && entry->size == info.size && entry->mtime_ns == info.mtime_ns) {
+		entry->content_hash = content_hash;
+		entry->content_hash_valid = 1;
+	}
+	pthread_mutex_unlock(&shard->mutex);
+	*hash = content_hash;
+	return 0;
+}
+
+/**
+ * @brief Function that calls a function for each indexed entry, one shard at a time.
+ * The changes made during the iteration may or may not be visited.
+ * 
+ * @param index		The index.
+ * @param visitor	Function to call (returns -1 to stop the iteration).
+ * @param arg		Argument given to the visitor.
+ * 
+ * @return int		Number of visited entries.
+ */
+int tree_index_for_each(tree_index_t *index, tree_index_visitor_t visitor, void *arg) {
+	int visited = 0;
+	int i, stop = 0;
+	for (i = 0; !stop && i < TREE_INDEX_SHARDS; i++) {
+		tree_index_shard_t *shard = &index->shards[i];
+		pthread_mutex_lock(&shard->mutex);
+		size_t b;
+		for (b = 0; !stop && b < shard->buckets_count; b++) {
+			tree_index_entry_t *entry;
+			for (entry = shard->buckets[b]; !stop && entry != NULL; entry = entry->next) {
+				visited++;
+				stop = visitor(entry, arg) == -1;
+			}
+		}
+		pthread_mutex_unlock(&shard->mutex);
+	}
+	return visited;
+}
+
+/**
+ * @brief Function that frees the entries of the index.
+ * 
+ * @param index		The index.
+ * 
+ * @return void
+ */
+void tree_index_free(tree_index_t *index) {
+	int i;
+	for (i = 0; i < TREE_INDEX_SHARDS; i++) {
+		tree_index_shard_t *shard = &index->shards[i];
+		size_t b;
+		for (b = 0; shard->buckets != NULL && b < shard->buckets_count; b++) {
+			while (shard->buckets[b] != NULL) {
+				tree_index_entry_t *entry = shard->buckets[b];
+				shard->buckets[b] = entry->next;
+				metrics_gauge_add(METRIC_INDEX_ENTRIES, -1);
+				free(entry);
+			}
+		}
+		free(shard->buckets);
+		shard->buckets = NULL;
+		shard->count = 0;
+		pthread_mutex_destroy(&shard->mutex);
+	}
+}
+
@@ -0,0 +1,72 @@
+
+#ifndef __SERVER_TREE_INDEX_H__
+#define __SERVER_TREE_INDEX_H__
+
+#include "../universal_utils.h"
+#include "../universal_pthread.h"
+#include "../sync_ignore.h"
+#include "../hash_engine.h"
+
+#define TREE_INDEX_SHARDS 64					// Independent locks, so the scanner threads and the lookups rarely wait
+#define TREE_INDEX_INITIAL_BUCKETS 256			// Buckets of a shard, doubled when the shard is full
+
+// Indexed file or directory
+typedef struct tree_index_entry_t {
+	struct tree_index_entry_t *next;			// Next entry of the bucket
+	unsigned long long path_hash;
+	int is_directory;
+	unsigned int mode;
+	unsigned long long size;
+	long long mtime_ns;
+	hash128_t content_hash;						// Only meaningful when content_hash_valid is set
+	int content_hash_valid;						// Computed on the first request, cleared when the size or the mtime change
+	size_t path_length;
+	char path[];								// Path relative to the root, without trailing '/'
+} tree_index_entry_t;
+
+// Part of the index protected by one lock
+typedef struct tree_index_shard_t {
+	pthread_mutex_t mutex;
+	tree_index_entry_t **buckets;
+	size_t buckets_count;
+	size_t count;
+} tree_index_shard_t;
+
+// In-memory index of a synchronized directory (path -> type, size, mtime and content hash)
+typedef struct tree_index_t {
+	char root[SYNC_IGNORE_MAX_PATH];			// Root path ending with a '/'
+	const sync_ignore_t *ignore;				// Paths never indexed
+	int scan_threads;							// Threads used to index a directory (0 for the default)
+	tree_index_shard_t shards[TREE_INDEX_SHARDS];
+	volatile long long files;
+	volatile long long directories;
+	volatile long long bytes;					// Total size of the files
+	volatile long long generation;				// Incremented on every change (an unchanged entry refreshed doesn't count)
+} tree_index_t;
+
+// Copy of an entry, safe to use without lock
+typedef struct tree_index_info_t {
+	int is_directory;
+	unsigned int mode;
+	unsigned long long size;
+	long long mtime_ns;
+	hash128_t content_hash;
+	int content_hash_valid;
+} tree_index_info_t;
+
+// Function called for each entry by tree_index_for_each(), with the lock of its shard held (returns -1 to stop)
+typedef int (*tree_index_visitor_t)(const tree_index_entry_t *entry, void *arg);
+
+// Function prototypes
+int tree_index_init(tree_index_t *index, const char *root, const sync_ignore_t *ignore, int scan_threads);
+int tree_index_refresh(tree_index_t *index, const char *path);
+int tree_index_remove(tree_index_t *index, const char *path);
+int tree_index_revalidate(tree_index_t *index);
+int tree_index_rename(tree_index_t *index, const char *old_path, const char *new_path);
+int tree_index_lookup(tree_index_t *index, const char *path, tree_index_info_t *info);
+int tree_index_content_hash(tree_index_t *index, const char *path, hash128_t *hash);
+int tree_index_for_each(tree_index_t *index, tree_index_visitor_t visitor, void *arg);
+void tree_index_free(tree_index_t *index);
+
+#endif
+
@@ -0,0 +1,249 @@
+
+#include "snapshot_stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifndef O_BINARY
+	#define O_BINARY 0
+#endif
+
+// States of the decoder
+#define SNAPSHOT_DECODE_HEADER 0
+#define SNAPSHOT_DECODE_PATH 1
+#define SNAPSHOT_DECODE_CONTENT 2
+
+/**
+ * @brief Function that checks that a received path stays inside the synchronized directory.
+ * 
+ * @param path	Path relative to the synchronized directory.
+ * 
+ * @return int	1 if the path is safe, 0 if it's absolute or has a ".." component.
+ */
+static int snapshot_path_is_safe(const char *path) {
+	if (path[0] == '/' || path[0] == '\\')
+		return 0;
+	const char *component = path;
+	while (component != NULL) {
+		if (component[0] == '.' && component[1] == '.' && (component[2] == '/' || component[2] == '\\' || component[2] == '\0'))
+			return 0;
+		component = strpbrk(component, "/\\");
+		if (component != NULL)
+			component++;
+	}
+	return 1;
+}
+
+/**
+ * @brief Function that writes the header and the path of a record.
+ * 
+ * @param stream	Stream receiving the snapshot.
+ * @param record	Header of the record (path_length is filled).
+ * @param path		Path relative to the synchronized directory.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+static int snapshot_write_header(FILE *stream, snapshot_record_t *record, const char *path) {
+	record->path_length = (unsigned int)strlen(path);
+	int code = (record->path_length > 0 && record->path_length <= SNAPSHOT_MAX_PATH) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "snapshot_write_header(): Invalid path '%s'\n", path);
+	code = (fwrite(record, sizeof(snapshot_record_t), 1, stream) == 1 && fwrite(path, 1, record->path_length, stream) == record->path_length) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "snapshot_write_header(): Unable to write the record of '%s'\n", path);
+	return 0;
+}
+
+/**
+ * @brief Function that writes the record of a directory.
+ * 
+ * @param stream	Stream receiving the snapshot.
+ * @param path		Path relative to the synchronized directory.
+ * @param mode		Permissions of the directory.
+ * @param mtime_ns	Modification time of the directory.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+int snapshot_write_directory(FILE *stream, const char *path, unsigned int mode, long long mtime_ns) {
+	snapshot_record_t record;
+	memset(&record, 0, sizeof(snapshot_record_t));
+	record.type = SNAPSHOT_RECORD_DIRECTORY;
+	record.mode = mode;
+	record.mtime_ns = mtime_ns;
+	return snapshot_write_header(stream, &record, path);
+}
+
+/**
+ * @brief Function that writes the record of a file with its content.
+ * The size is taken when the file is opened: if the file shrinks meanwhile, the content is padded with zeros
+ * (the watcher sends the new version anyway). A file that can't be opened is skipped.
+ * 
+ * @param stream		Stream receiving the snapshot.
+ * @param root			The synchronized directory (ending with a '/').
+ * @param path			Path relative to the synchronized directory.
+ * @param buffer		Buffer used to copy the content.
+ * @param buffer_size	Size of the buffer.
+ * 
+ * @return int			0 if success (or skipped), -1 if the stream can't be written.
+ */
+int snapshot_write_file(FILE *stream, const char *root, const char *path, byte *buffer, size_t buffer_size) {
+
+	// Open the file and get its metadata
+	char full_path[SNAPSHOT_MAX_PATH * 2];
+	snprintf(full_path, sizeof(full_path), "%s%s", root, path);
+	int fd = open(full_path, O_RDONLY | O_BINARY);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		WARNING_PRINT("snapshot_write_file(): Skipping '%s' (unable to read it)\n", full_path);
+		if (fd != -1) close(fd);
+		errno = 0;
+		return 0;
+	}
+	snapshot_record_t record;
+	memset(&record, 0, sizeof(snapshot_record_t));
+	record.type = SNAPSHOT_RECORD_FILE;
+	record.mode = (unsigned int)st.st_mode & 07777;
+	record.size = (unsigned long long)st.st_size;
+	#ifdef __linux__
+		record.mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	#else
+		record.mtime_ns = (long long)st.st_mtime * 1000000000LL;
+	#endif
+	int code = snapshot_write_header(stream, &record, path);
+	if (code == -1) close(fd);
+	ERROR_HANDLE_INT_RETURN_INT(code, "snapshot_write_file(): Unable to write the header of '%s'\n", path);
+
+	// Copy the announced size of content
+	unsigned long long remaining = record.size;
+	while (remaining > 0) {
+		size_t chunk = remaining < buffer_size ? (size_t)remaining : buffer_size;
+		ssize_t bytes = read(fd, buffer, chunk);
+		if (bytes <= 0) {
+			memset(buffer, 0, chunk);
+			bytes = (ssize_t)chunk;
+			errno = 0;
+		}
+		code = fwrite(buffer, 1, (size_t)bytes, stream) == (size_t)bytes ? 0 : -1;
+		if (code == -1) close(fd);
+		ERROR_HANDLE_INT_RETURN_INT(code, "snapshot_write_file(): Unable to write the content of '%s'\n", path);
+		remaining -= (unsigned long long)bytes;
+	}
+	close(fd);
+	return 0;
+}
+
+/**
+ * @brief Function that initializes a decoder.
+ * 
+ * @param decoder		The decoder.
+ * @param on_directory	Called for each directory.
+ * @param on_file_begin	Called at the start of each file.
+ * @param on_file_data	Called with each part of the content of the current file.
+ * @param on_file_end	Called at the end of each file.
+ * @param arg			Argument given to the handlers.
+ * 
+ * @return void
+ */
+void snapshot_decoder_init(snapshot_decoder_t *decoder, snapshot_directory_handler on_directory, snapshot_file_begin_handler on_file_begin, snapshot_file_data_handler on_file_data, snapshot_file_end_handler on_file_end, void *arg) {
+	memset(decoder, 0, sizeof(snapshot_decoder_t));
+	decoder->state = SNAPSHOT_DECODE_HEADER;
+	decoder->on_directory = on_directory;
+	decoder->on_file_begin = on_file_begin;
+	decoder->on_file_data = on_file_data;
+	decoder->on_file_end = on_file_end;
+	decoder->arg = arg;
+}
+
+/**
+ * @brief Function that decodes the next bytes of the stream (the records can span several calls).
+ * 
+ * @param decoder	The decoder.
+ * @param data		Next bytes of the stream.
+ * @param size		Number of bytes.
+ * 
+ * @return int		0 if success, -1 if the stream is invalid or a handler failed.
+ */
+int snapshot_decoder_feed(snapshot_decoder_t *decoder, const byte *data, size_t size) {
+	int code = 0;
+	while (size > 0 && code == 0) {
+		switch (decoder->state) {
+
+			// Header of the next record
+			case SNAPSHOT_DECODE_HEADER: {
+				size_t chunk = sizeof(snapshot_record_t) - decoder->filled;
+				if (chunk > size) chunk = size;
+				memcpy((byte*)&decoder->record + decoder->filled, data, chunk);
+				decoder->filled += chunk;
+				data += chunk;
+				size -= chunk;
+				if (decoder->filled == sizeof(snapshot_record_t)) {
+					code = (decoder->record.path_length > 0 && decoder->record.path_length <= SNAPSHOT_MAX_PATH
+						&& (decoder->record.type == SNAPSHOT_RECORD_DIRECTORY || decoder->record.type == SNAPSHOT_RECORD_FILE)) ? 0 : -1;
+					ERROR_HANDLE_INT_RETURN_INT(code, "snapshot_decoder_feed(): Invalid record (type %u, path of %u bytes)\n", decoder->record.type, decoder->record.path_length);
+					decoder->state = SNAPSHOT_DECODE_PATH;
+					decoder->filled = 0;
+				}
+				break;
+			}
+
+			// Path of the record
+			case SNAPSHOT_DECODE_PATH: {
+				size_t chunk = decoder->record.path_length - decoder->filled;
+				if (chunk > size) chunk = size;
+				memcpy(decoder->path + decoder->filled, data, chunk);
+				decoder->filled += chunk;
+				data += chunk;
+				size -= chunk;
+				if (decoder->filled < decoder->record.path_length)
+					break;
+				decoder->path[decoder->filled] = '\0';
+				decoder->filled = 0;
+
+				// Paths escaping the synchronized directory are refused
+				code = snapshot_path_is_safe(decoder->path) ? 0 : -1;
+				ERROR_HANDLE_INT_RETURN_INT(code, "snapshot_decoder_feed(): Refusing the path '%s'\n", decoder->path);
+				if (decoder->record.type == SNAPSHOT_RECORD_DIRECTORY) {
+					code = decoder->on_directory(&decoder->record, decoder->path, decoder->arg);
+					decoder->state = SNAPSHOT_DECODE_HEADER;
+				}
+				else {
+					code = decoder->on_file_begin(&decoder->record, decoder->path, decoder->arg);
+					decoder->remaining = decoder->record.size;
+					decoder->state = SNAPSHOT_DECODE_CONTENT;
+					if (code == 0 && decoder->remaining == 0) {
+						code = decoder->on_file_end(decoder->arg);
+						decoder->state = SNAPSHOT_DECODE_HEADER;
+					}
+				}
+				break;
+			}
+
+			// Content of the current file
+			case SNAPSHOT_DECODE_CONTENT: {
+				size_t chunk = decoder->remaining < size ? (size_t)decoder->remaining : size;
+				code = decoder->on_file_data(data, chunk, decoder->arg);
+				decoder->remaining -= chunk;
+				data += chunk;
+				size -= chunk;
+				if (code == 0 && decoder->remaining == 0) {
+					code = decoder->on_file_end(decoder->arg);
+					decoder->state = SNAPSHOT_DECODE_HEADER;
+				}
+				break;
+			}
+		}
+	}
+	return code;
+}
+
+/**
+ * @brief Function that checks that the stream ended between two records.
+ * 
+ * @param decoder	The decoder.
+ * 
+ * @return int		1 if the last record is complete, 0 otherwise.
+ */
+int snapshot_decoder_finished(const snapshot_decoder_t *decoder) {
+	return decoder->state == SNAPSHOT_DECODE_HEADER && decoder->filled == 0;
+}
+
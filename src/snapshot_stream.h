@@ -0,0 +1,53 @@
+
+#ifndef __SNAPSHOT_STREAM_H__
+#define __SNAPSHOT_STREAM_H__
+
+#include <stdio.h>
+#include "universal_utils.h"
+
+// Snapshot of a directory sent for the initial synchronization: a sequence of records,
+// each one a snapshot_record_t followed by the path and, for a file, its content.
+// A directory always comes before its content (the records are sorted by path).
+#define SNAPSHOT_RECORD_DIRECTORY 1
+#define SNAPSHOT_RECORD_FILE 2
+#define SNAPSHOT_MAX_PATH 4096
+
+// Header of a record (fixed size, the same layout on both ends like message_t)
+typedef struct snapshot_record_t {
+	unsigned int type;					// SNAPSHOT_RECORD_*
+	unsigned int mode;					// Permissions (0 if unknown)
+	unsigned long long size;			// Size of the content (0 for a directory)
+	long long mtime_ns;					// Modification time in nanoseconds (0 if unknown)
+	unsigned int path_length;			// Length of the path following the header (no trailing '\0')
+	unsigned int reserved;
+} snapshot_record_t;
+
+// Functions called by the decoder (return -1 to stop the decoding)
+typedef int (*snapshot_directory_handler)(const snapshot_record_t *record, const char *path, void *arg);
+typedef int (*snapshot_file_begin_handler)(const snapshot_record_t *record, const char *path, void *arg);
+typedef int (*snapshot_file_data_handler)(const byte *data, size_t size, void *arg);
+typedef int (*snapshot_file_end_handler)(void *arg);
+
+// Incremental decoder: the stream is given in chunks of any size, as it's received
+typedef struct snapshot_decoder_t {
+	int state;							// Part of the record being decoded
+	snapshot_record_t record;
+	size_t filled;						// Bytes of the header or of the path already decoded
+	unsigned long long remaining;		// Bytes of content left for the current file
+	char path[SNAPSHOT_MAX_PATH + 1];
+	snapshot_directory_handler on_directory;
+	snapshot_file_begin_handler on_file_begin;
+	snapshot_file_data_handler on_file_data;
+	snapshot_file_end_handler on_file_end;
+	void *arg;
+} snapshot_decoder_t;
+
+// Function prototypes
+int snapshot_write_directory(FILE *stream, const char *path, unsigned int mode, long long mtime_ns);
+int snapshot_write_file(FILE *stream, const char *root, const char *path, byte *buffer, size_t buffer_size);
+void snapshot_decoder_init(snapshot_decoder_t *decoder, snapshot_directory_handler on_directory, snapshot_file_begin_handler on_file_begin, snapshot_file_data_handler on_file_data, snapshot_file_end_handler on_file_end, void *arg);
+int snapshot_decoder_feed(snapshot_decoder_t *decoder, const byte *data, size_t size);
+int snapshot_decoder_finished(const snapshot_decoder_t *decoder);
+
+#endif
+
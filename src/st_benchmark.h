@@ -7,87 +7,420 @@
 #include <string.h>
 #include <fcntl.h>
 #include <time.h>
+#include <math.h>
+#include <errno.h>
 
 #ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <unistd.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <linux/perf_event.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+	#include <x86intrin.h>
+	#define ST_HAS_TSC 1
+#else
+	#define ST_HAS_TSC 0
+#endif
+
+#define ST_COLOR_RESET "\033[0m"
+#define ST_COLOR_RED "\033[0;31m"
+#define ST_COLOR_YELLOW "\033[0;33m"
+
+#define ST_BENCHMARK_MIN_SAMPLES 10			// Samples taken even if the time budget is exceeded
+#define ST_BENCHMARK_MAX_SAMPLES 10000
+#define ST_BENCHMARK_PERF_COUNTERS 3		// Cycles, instructions, cache misses
+
+///// Protection against the compiler removing the measured work
+// #define ST_DO_NOT_OPTIMIZE(value) : Forces the value to be computed (as if it was read by unknown code)
+// #define ST_CLOBBER_MEMORY() : Forces the pending writes to memory to be done
+#define ST_DO_NOT_OPTIMIZE(value) __asm__ __volatile__("" : : "g"(value) : "memory")
+#define ST_CLOBBER_MEMORY() __asm__ __volatile__("" : : : "memory")
+
+// Settings of a benchmark
+typedef struct st_benchmark_config_t {
+	long long warmup_ns;			// Minimum warmup time (also used to calibrate the iterations)
+	long long sample_ns;			// Target duration of a sample: iterations per sample are calibrated to reach it
+	int samples;					// Samples to take
+	long long max_time_ns;			// Time budget of the sampling (at least ST_BENCHMARK_MIN_SAMPLES are taken)
+	int use_perf;					// 1 to read the hardware counters with perf_event_open() when available
+} st_benchmark_config_t;
+
+// Results of a benchmark (times are per operation)
+typedef struct st_benchmark_result_t {
+	char name[128];
+	long iterations;				// Iterations per sample
+	int samples;
+	size_t bytes_per_op;			// Bytes processed by an operation (0 if not relevant)
+	double min_ns;
+	double median_ns;
+	double mean_ns;
+	double p99_ns;
+	double max_ns;
+	double stddev_ns;
+	double median_ci_low_ns;		// 95% confidence interval of the median (order statistics)
+	double median_ci_high_ns;
+	double tsc_per_op;				// Time stamp counter ticks (x86 only, 0 otherwise)
+	double cycles_per_op;			// Hardware counters (-1 if perf_event_open() is unavailable)
+	double instructions_per_op;
+	double cache_misses_per_op;
+} st_benchmark_result_t;
+
+// State of a running benchmark (used by the ST_BENCHMARK_RUN macros)
+typedef struct st_benchmark_t {
+	st_benchmark_config_t config;
+	st_benchmark_result_t *result;
+	int phase;						// 0: warmup and calibration, 1: sampling, 2: done
+	long iterations;
+	long long phase_start_ns;
+	long long start_ns;
+	unsigned long long start_tsc;
+	unsigned long long start_counters[ST_BENCHMARK_PERF_COUNTERS];
+	double tsc_total;
+	double counters_total[ST_BENCHMARK_PERF_COUNTERS];
+	int perf_failed;				// 1 if a read of the counters failed
+	long long sampled_iterations;
+	double *samples;
+	int count;
+} st_benchmark_t;
+
+// Default settings: 0.2 s of warmup, 100 samples of 2 ms, 5 s at most
+static __attribute__((unused)) st_benchmark_config_t st_benchmark_default_config = { 200000000LL, 2000000LL, 100, 5000000000LL, 1 };
+
+/**
+ * @brief Function that returns a monotonic time in nanoseconds.
+ * 
+ * @return long long	Nanoseconds since an unspecified starting point.
+ */
+static inline long long st_now_ns() {
+	#ifdef _WIN32
+		LARGE_INTEGER counter, frequency;
+		QueryPerformanceCounter(&counter);
+		QueryPerformanceFrequency(&frequency);
+		return (long long)((double)counter.QuadPart * 1000000000.0 / (double)frequency.QuadPart);
+	#else
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+	#endif
+}
+
+/**
+ * @brief Function that returns the time stamp counter (0 if the CPU doesn't have one).
+ * 
+ * @return unsigned long long	Ticks since an unspecified starting point.
+ */
+static inline unsigned long long st_tsc() {
+	#if ST_HAS_TSC
+		return __rdtsc();
+	#else
+		return 0;
+	#endif
+}
+
+/**
+ * @brief Function that reads the hardware counters (cycles, instructions, cache misses) of the calling thread.
+ * The counters are opened on the first call, and disabled if perf_event_open() fails
+ * (not Linux, no PMU in virtual machines, perf_event_paranoid, ...).
+ * 
+ * @param values	Filled with the counter values.
+ * 
+ * @return int		0 if the counters were read, -1 if they are unavailable.
+ */
+static inline int st_perf_read(unsigned long long values[ST_BENCHMARK_PERF_COUNTERS]) {
+	#ifdef _WIN32
+		(void)values;
+		return -1;
+	#else
+		static int leader = -2;
+		if (leader == -2) {
+			int saved_errno = errno;
+			const unsigned long long configs[ST_BENCHMARK_PERF_COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+			int i;
+			leader = -1;
+			for (i = 0; i < ST_BENCHMARK_PERF_COUNTERS; i++) {
+				struct perf_event_attr attr;
+				memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = configs[i];
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				attr.read_format = PERF_FORMAT_GROUP;
+				int fd = syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : leader, 0);
+				if (fd == -1) {
+					if (leader != -1) close(leader);
+					leader = -1;
+					break;
+				}
+				if (i == 0) leader = fd;
+			}
+			if (leader != -1) {
+				ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+				ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+			}
+			errno = saved_errno;
+		}
+		if (leader == -1)
+			return -1;
+		unsigned long long buffer[1 + ST_BENCHMARK_PERF_COUNTERS];
+		if (read(leader, buffer, sizeof(buffer)) != (ssize_t)sizeof(buffer))
+			return -1;
+		memcpy(values, buffer + 1, sizeof(unsigned long long) * ST_BENCHMARK_PERF_COUNTERS);
+		return 0;
+	#endif
+}
+
+/**
+ * @brief Function that compares two samples for qsort().
+ * 
+ * @return int	Comparison result.
+ */
+static inline int st_compare_samples(const void *a, const void *b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief Function that starts a benchmark (use the ST_BENCHMARK_RUN macros).
+ * 
+ * @param state		State of the benchmark.
+ * @param result	Results to fill.
+ * @param name		Name of the benchmark.
+ * @param bytes		Bytes processed by an operation (0 if not relevant).
+ * @param config	Settings.
+ * 
+ * @return void
+ */
+static inline void st_benchmark_begin(st_benchmark_t *state, st_benchmark_result_t *result, const char *name, size_t bytes, st_benchmark_config_t config) {
+	memset(state, 0, sizeof(st_benchmark_t));
+	memset(result, 0, sizeof(st_benchmark_result_t));
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->bytes_per_op = bytes;
+	if (config.samples > ST_BENCHMARK_MAX_SAMPLES) config.samples = ST_BENCHMARK_MAX_SAMPLES;
+	if (config.samples < ST_BENCHMARK_MIN_SAMPLES) config.samples = ST_BENCHMARK_MIN_SAMPLES;
+	state->config = config;
+	state->result = result;
+	state->iterations = 1;
+	state->samples = malloc(sizeof(double) * config.samples);
+	state->phase = state->samples == NULL ? 2 : 0;
+	state->phase_start_ns = st_now_ns();
+}
 
-#include <windows.h>
+/**
+ * @brief Function that ends the current batch of iterations and starts the next one.
+ * During the warmup, the iterations are scaled until a batch lasts config.sample_ns.
+ * The counters are read outside of the timed section.
+ * 
+ * @param state		State of the benchmark.
+ * 
+ * @return int		1 if a batch of state->iterations must be run, 0 if the benchmark is done.
+ */
+static inline int st_benchmark_next(st_benchmark_t *state) {
 
-int gettimeofday(struct timeval * tp, struct timezone * tzp) {
-    static const uint64_t EPOCH = ((uint64_t) 116444736000000000ULL);
-	if (tzp != NULL) {
-		tzp = NULL; // No timezone for Windows
+	// End the current batch
+	if (state->start_ns != 0) {
+		long long elapsed = st_now_ns() - state->start_ns;
+		unsigned long long tsc = st_tsc() - state->start_tsc;
+		unsigned long long counters[ST_BENCHMARK_PERF_COUNTERS];
+		int has_counters = state->config.use_perf && st_perf_read(counters) == 0;
+		if (elapsed < 1) elapsed = 1;
+
+		// Warmup: calibrate the iterations (x10 at most per batch)
+		if (state->phase == 0) {
+			if (elapsed < state->config.sample_ns) {
+				double factor = (double)state->config.sample_ns / (double)elapsed * 1.2;
+				state->iterations = (long)(state->iterations * (factor > 10 ? 10 : factor)) + 1;
+			}
+			else if (st_now_ns() - state->phase_start_ns >= state->config.warmup_ns) {
+				state->phase = 1;
+				state->phase_start_ns = st_now_ns();
+			}
+		}
+
+		// Sampling: record the time per operation
+		else {
+			state->samples[state->count++] = (double)elapsed / (double)state->iterations;
+			state->sampled_iterations += state->iterations;
+			state->tsc_total += (double)tsc;
+			if (has_counters) {
+				int i;
+				for (i = 0; i < ST_BENCHMARK_PERF_COUNTERS; i++)
+					state->counters_total[i] += (double)(counters[i] - state->start_counters[i]);
+			}
+			else
+				state->perf_failed = 1;
+			if (state->count >= state->config.samples || (state->count >= ST_BENCHMARK_MIN_SAMPLES && st_now_ns() - state->phase_start_ns >= state->config.max_time_ns))
+				state->phase = 2;
+		}
 	}
+	if (state->phase == 2)
+		return 0;
+
+	// Start the next batch
+	if (!(state->config.use_perf && st_perf_read(state->start_counters) == 0))
+		state->perf_failed = 1;
+	state->start_tsc = st_tsc();
+	state->start_ns = st_now_ns();
+	return 1;
+}
 
-    SYSTEMTIME  system_time;
-    FILETIME    file_time;
-    uint64_t    time;
+/**
+ * @brief Function that computes the statistics of a benchmark.
+ * 
+ * @param state		State of the benchmark.
+ * 
+ * @return void
+ */
+static inline void st_benchmark_end(st_benchmark_t *state) {
+	st_benchmark_result_t *result = state->result;
+	int n = state->count;
+	if (n == 0) {
+		free(state->samples);
+		return;
+	}
+	qsort(state->samples, n, sizeof(double), st_compare_samples);
+	double sum = 0, squares = 0;
+	int i;
+	for (i = 0; i < n; i++)
+		sum += state->samples[i];
+	result->mean_ns = sum / n;
+	for (i = 0; i < n; i++)
+		squares += (state->samples[i] - result->mean_ns) * (state->samples[i] - result->mean_ns);
+	result->stddev_ns = n > 1 ? sqrt(squares / (n - 1)) : 0;
+	result->iterations = state->iterations;
+	result->samples = n;
+	result->min_ns = state->samples[0];
+	result->max_ns = state->samples[n - 1];
+	result->median_ns = (n % 2) ? state->samples[n / 2] : (state->samples[n / 2 - 1] + state->samples[n / 2]) / 2;
+	int p99 = (int)ceil(0.99 * n) - 1;
+	result->p99_ns = state->samples[p99 < 0 ? 0 : p99];
 
-    GetSystemTime( &system_time );
-    SystemTimeToFileTime( &system_time, &file_time );
-    time =  ((uint64_t)file_time.dwLowDateTime )      ;
-    time += ((uint64_t)file_time.dwHighDateTime) << 32;
+	// Ranks of the 95% confidence interval of the median: n/2 -+ 1.96 * sqrt(n) / 2
+	int low = (int)floor(n / 2.0 - 0.98 * sqrt(n));
+	int high = (int)ceil(n / 2.0 + 0.98 * sqrt(n));
+	result->median_ci_low_ns = state->samples[low < 0 ? 0 : low];
+	result->median_ci_high_ns = state->samples[high >= n ? n - 1 : high];
 
-    tp->tv_sec  = (long) ((time - EPOCH) / 10000000L);
-    tp->tv_usec = (long) (system_time.wMilliseconds * 1000);
-    return 0;
+	// Counters per operation
+	result->tsc_per_op = ST_HAS_TSC ? state->tsc_total / state->sampled_iterations : 0;
+	if (state->perf_failed)
+		result->cycles_per_op = result->instructions_per_op = result->cache_misses_per_op = -1;
+	else {
+		result->cycles_per_op = state->counters_total[0] / state->sampled_iterations;
+		result->instructions_per_op = state->counters_total[1] / state->sampled_iterations;
+		result->cache_misses_per_op = state->counters_total[2] / state->sampled_iterations;
+	}
+	free(state->samples);
 }
 
-#else
-	#include <unistd.h>
-	#include <sys/time.h>
-#endif
+/**
+ * @brief Function that prints the results of a benchmark in a human readable form.
+ * 
+ * @param result	Results of the benchmark.
+ * 
+ * @return void
+ */
+static inline void st_benchmark_print(const st_benchmark_result_t *result) {
+	printf(ST_COLOR_YELLOW "[BENCHMARK] " ST_COLOR_RED "%s: median " ST_COLOR_YELLOW "%.1f" ST_COLOR_RED " ns [%.1f, %.1f], min %.1f, p99 %.1f, stddev %.1f (%d samples of %ld)",
+		result->name, result->median_ns, result->median_ci_low_ns, result->median_ci_high_ns, result->min_ns, result->p99_ns, result->stddev_ns, result->samples, result->iterations);
+	if (result->bytes_per_op > 0 && result->median_ns > 0)
+		printf(", " ST_COLOR_YELLOW "%.1f" ST_COLOR_RED " MB/s", result->bytes_per_op / result->median_ns * 1000000000.0 / 1048576.0);
+	if (result->cycles_per_op >= 0)
+		printf(", %.1f cycles, %.1f instructions, %.2f cache misses", result->cycles_per_op, result->instructions_per_op, result->cache_misses_per_op);
+	printf("\n" ST_COLOR_RESET);
+}
 
-#define ST_COLOR_RESET "\033[0m"
-#define ST_COLOR_RED "\033[0;31m"
-#define ST_COLOR_YELLOW "\033[0;33m"
+/**
+ * @brief Function that writes the results of a benchmark as a JSON object on one line (JSON Lines).
+ * 
+ * @param file		File to write.
+ * @param result	Results of the benchmark.
+ * 
+ * @return void
+ */
+static inline void st_benchmark_write_json(FILE *file, const st_benchmark_result_t *result) {
+	fprintf(file, "{\"name\": \"%s\", \"samples\": %d, \"iterations\": %ld, \"bytes_per_op\": %zu, \"min_ns\": %.3f, \"median_ns\": %.3f, \"median_ci_low_ns\": %.3f, \"median_ci_high_ns\": %.3f, \"mean_ns\": %.3f, \"p99_ns\": %.3f, \"max_ns\": %.3f, \"stddev_ns\": %.3f, \"tsc_per_op\": %.3f, \"cycles_per_op\": %.3f, \"instructions_per_op\": %.3f, \"cache_misses_per_op\": %.3f}\n",
+		result->name, result->samples, result->iterations, result->bytes_per_op, result->min_ns, result->median_ns, result->median_ci_low_ns, result->median_ci_high_ns, result->mean_ns, result->p99_ns, result->max_ns, result->stddev_ns,
+		result->tsc_per_op, result->cycles_per_op, result->instructions_per_op, result->cache_misses_per_op);
+}
 
-#define ST_BENCHMARK_BETWEEN(ST_BENCH_buffer, ST_BENCH_f1, ST_BENCH_f2, ST_BENCH_f1_name, ST_BENCH_f2_name, ST_BENCH_testing_time) { \
-	long ST_BENCH_countF1 = 0; \
-	long ST_BENCH_countF2 = 0; \
-	time_t ST_BENCH_end = time(NULL) + 1; \
-	while (time(NULL) < ST_BENCH_end) {} \
-	ST_BENCH_end = time(NULL) + ST_BENCH_testing_time; \
-	while (time(NULL) < ST_BENCH_end) { \
-		ST_BENCH_f1; \
-		ST_BENCH_countF1 += 1; \
-	} \
-	ST_BENCH_end = time(NULL) + ST_BENCH_testing_time; \
-	while (time(NULL) < ST_BENCH_end) { \
-		ST_BENCH_f2; \
-		ST_BENCH_countF2 += 1; \
-	} \
-	if (ST_BENCH_countF1 > ST_BENCH_countF2) { \
-		sprintf(ST_BENCH_buffer, ST_COLOR_YELLOW "[BENCHMARK] " ST_COLOR_RED ST_BENCH_f1_name " faster than " ST_BENCH_f2_name " by " ST_COLOR_YELLOW "%f" ST_COLOR_RED " times with" ST_COLOR_YELLOW "\n[BENCHMARK] " ST_COLOR_RED ST_BENCH_f1_name " executed " ST_COLOR_YELLOW "%ld" ST_COLOR_RED " times and " ST_BENCH_f2_name " executed " ST_COLOR_YELLOW "%ld" ST_COLOR_RED " times\n" ST_COLOR_RESET, (double)ST_BENCH_countF1 / (double)ST_BENCH_countF2, ST_BENCH_countF1, ST_BENCH_countF2); \
-	} else { \
-		sprintf(ST_BENCH_buffer, ST_COLOR_YELLOW "[BENCHMARK] " ST_COLOR_RED ST_BENCH_f1_name " slower than " ST_BENCH_f2_name " by " ST_COLOR_YELLOW "%f" ST_COLOR_RED " times with" ST_COLOR_YELLOW "\n[BENCHMARK] " ST_COLOR_RED ST_BENCH_f1_name " executed " ST_COLOR_YELLOW "%ld" ST_COLOR_RED " times and " ST_BENCH_f2_name " executed " ST_COLOR_YELLOW "%ld" ST_COLOR_RED " times\n" ST_COLOR_RESET, (double)ST_BENCH_countF2 / (double)ST_BENCH_countF1, ST_BENCH_countF1, ST_BENCH_countF2); \
+/**
+ * @brief Function that writes the results of a benchmark as a CSV row.
+ * 
+ * @param file		File to write.
+ * @param result	Results of the benchmark.
+ * @param header	1 to write the header line first.
+ * 
+ * @return void
+ */
+static inline void st_benchmark_write_csv(FILE *file, const st_benchmark_result_t *result, int header) {
+	if (header)
+		fprintf(file, "name,samples,iterations,bytes_per_op,min_ns,median_ns,median_ci_low_ns,median_ci_high_ns,mean_ns,p99_ns,max_ns,stddev_ns,tsc_per_op,cycles_per_op,instructions_per_op,cache_misses_per_op\n");
+	fprintf(file, "%s,%d,%ld,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+		result->name, result->samples, result->iterations, result->bytes_per_op, result->min_ns, result->median_ns, result->median_ci_low_ns, result->median_ci_high_ns, result->mean_ns, result->p99_ns, result->max_ns, result->stddev_ns,
+		result->tsc_per_op, result->cycles_per_op, result->instructions_per_op, result->cache_misses_per_op);
+}
+
+///// Benchmark macros: the code is run in calibrated batches, after a warmup
+// #define ST_BENCHMARK_RUN(result, f, f_name) : Measures the code f with the default settings
+// #define ST_BENCHMARK_RUN_BYTES(result, f, f_name, bytes) : Same, with the bytes processed per run (MB/s)
+// #define ST_BENCHMARK_RUN_CONFIG(result, f, f_name, bytes, config) : Same, with custom settings
+#define ST_BENCHMARK_RUN_CONFIG(ST_BENCH_result, ST_BENCH_f, ST_BENCH_f_name, ST_BENCH_bytes, ST_BENCH_config) { \
+	st_benchmark_t ST_BENCH_state; \
+	st_benchmark_begin(&ST_BENCH_state, &(ST_BENCH_result), ST_BENCH_f_name, ST_BENCH_bytes, ST_BENCH_config); \
+	while (st_benchmark_next(&ST_BENCH_state)) { \
+		long ST_BENCH_i; \
+		for (ST_BENCH_i = 0; ST_BENCH_i < ST_BENCH_state.iterations; ST_BENCH_i++) { \
+			ST_BENCH_f; \
+			ST_CLOBBER_MEMORY(); \
+		} \
 	} \
+	st_benchmark_end(&ST_BENCH_state); \
+}
+#define ST_BENCHMARK_RUN_BYTES(ST_BENCH_result, ST_BENCH_f, ST_BENCH_f_name, ST_BENCH_bytes) ST_BENCHMARK_RUN_CONFIG(ST_BENCH_result, ST_BENCH_f, ST_BENCH_f_name, ST_BENCH_bytes, st_benchmark_default_config)
+#define ST_BENCHMARK_RUN(ST_BENCH_result, ST_BENCH_f, ST_BENCH_f_name) ST_BENCHMARK_RUN_CONFIG(ST_BENCH_result, ST_BENCH_f, ST_BENCH_f_name, 0, st_benchmark_default_config)
+
+///// Older macros (results written as text in a buffer), now measured with the calibrated runs
+// testing_time: time budget of the sampling of each code (seconds)
+#define ST_BENCHMARK_BETWEEN(ST_BENCH_buffer, ST_BENCH_f1, ST_BENCH_f2, ST_BENCH_f1_name, ST_BENCH_f2_name, ST_BENCH_testing_time) { \
+	st_benchmark_config_t ST_BENCH_config = st_benchmark_default_config; \
+	ST_BENCH_config.samples = ST_BENCHMARK_MAX_SAMPLES; \
+	ST_BENCH_config.max_time_ns = (long long)(ST_BENCH_testing_time) * 1000000000LL; \
+	st_benchmark_result_t ST_BENCH_r1, ST_BENCH_r2; \
+	ST_BENCHMARK_RUN_CONFIG(ST_BENCH_r1, ST_BENCH_f1, ST_BENCH_f1_name, 0, ST_BENCH_config); \
+	ST_BENCHMARK_RUN_CONFIG(ST_BENCH_r2, ST_BENCH_f2, ST_BENCH_f2_name, 0, ST_BENCH_config); \
+	int ST_BENCH_faster = ST_BENCH_r1.median_ns < ST_BENCH_r2.median_ns; \
+	int ST_BENCH_significant = ST_BENCH_r1.median_ci_high_ns < ST_BENCH_r2.median_ci_low_ns || ST_BENCH_r2.median_ci_high_ns < ST_BENCH_r1.median_ci_low_ns; \
+	sprintf(ST_BENCH_buffer, ST_COLOR_YELLOW "[BENCHMARK] " ST_COLOR_RED ST_BENCH_f1_name " %s than " ST_BENCH_f2_name " by " ST_COLOR_YELLOW "%f" ST_COLOR_RED " times%s" ST_COLOR_YELLOW "\n[BENCHMARK] " ST_COLOR_RED ST_BENCH_f1_name " median " ST_COLOR_YELLOW "%.1f" ST_COLOR_RED " ns [%.1f, %.1f] and " ST_BENCH_f2_name " median " ST_COLOR_YELLOW "%.1f" ST_COLOR_RED " ns [%.1f, %.1f]\n" ST_COLOR_RESET, \
+		ST_BENCH_faster ? "faster" : "slower", ST_BENCH_faster ? ST_BENCH_r2.median_ns / ST_BENCH_r1.median_ns : ST_BENCH_r1.median_ns / ST_BENCH_r2.median_ns, ST_BENCH_significant ? "" : " (not significant)", \
+		ST_BENCH_r1.median_ns, ST_BENCH_r1.median_ci_low_ns, ST_BENCH_r1.median_ci_high_ns, ST_BENCH_r2.median_ns, ST_BENCH_r2.median_ci_low_ns, ST_BENCH_r2.median_ci_high_ns); \
 }
 
 
 #define ST_BENCHMARK_SOLO_COUNT(ST_BENCH_buffer, ST_BENCH_f, ST_BENCH_f_name, ST_BENCH_count) { \
-	struct timeval ST_BENCH_timeval, ST_BENCH_timeval2; \
-	gettimeofday(&ST_BENCH_timeval, NULL); \
-	unsigned long ST_BENCH_time = 1000000 * ST_BENCH_timeval.tv_sec + ST_BENCH_timeval.tv_usec; \
+	long long ST_BENCH_time = st_now_ns(); \
 	long ST_BENCH_i = 0; \
 	for (ST_BENCH_i = 0; ST_BENCH_i < ST_BENCH_count; ST_BENCH_i++) { \
 		ST_BENCH_f; \
+		ST_CLOBBER_MEMORY(); \
 	} \
-	gettimeofday(&ST_BENCH_timeval2, NULL); \
-	ST_BENCH_time = 1000000 * ST_BENCH_timeval2.tv_sec + ST_BENCH_timeval2.tv_usec - ST_BENCH_time; \
-	sprintf(ST_BENCH_buffer, ST_COLOR_YELLOW "[BENCHMARK] " ST_COLOR_RED ST_BENCH_f_name " executed " ST_COLOR_YELLOW "%d" ST_COLOR_RED " times in " ST_COLOR_YELLOW "%lf" ST_COLOR_RED "s\n" ST_COLOR_RESET, ST_BENCH_count, (double)ST_BENCH_time / 1000000.0); \
+	ST_BENCH_time = st_now_ns() - ST_BENCH_time; \
+	sprintf(ST_BENCH_buffer, ST_COLOR_YELLOW "[BENCHMARK] " ST_COLOR_RED ST_BENCH_f_name " executed " ST_COLOR_YELLOW "%d" ST_COLOR_RED " times in " ST_COLOR_YELLOW "%lf" ST_COLOR_RED "s\n" ST_COLOR_RESET, ST_BENCH_count, (double)ST_BENCH_time / 1000000000.0); \
 }
 
 
 #define ST_BENCHMARK_SOLO_TIME(ST_BENCH_buffer, ST_BENCH_f, ST_BENCH_f_name, ST_BENCH_testing_time) { \
-	long ST_BENCH_count = 0; \
-	time_t ST_BENCH_end = time(NULL) + 1; \
-	while (time(NULL) < ST_BENCH_end) {} \
-	ST_BENCH_end = time(NULL) + (long)ST_BENCH_testing_time; \
-	while (time(NULL) < ST_BENCH_end) { \
-		ST_BENCH_f; \
-		ST_BENCH_count += 1; \
-	} \
-	sprintf(ST_BENCH_buffer, ST_COLOR_YELLOW "[BENCHMARK] " ST_COLOR_RED ST_BENCH_f_name " executed " ST_COLOR_YELLOW "%ld" ST_COLOR_RED " times in " ST_COLOR_YELLOW "%ld" ST_COLOR_RED "s\n" ST_COLOR_RESET, ST_BENCH_count, (long)ST_BENCH_testing_time); \
+	st_benchmark_config_t ST_BENCH_config = st_benchmark_default_config; \
+	ST_BENCH_config.samples = ST_BENCHMARK_MAX_SAMPLES; \
+	ST_BENCH_config.max_time_ns = (long long)(ST_BENCH_testing_time) * 1000000000LL; \
+	st_benchmark_result_t ST_BENCH_result; \
+	ST_BENCHMARK_RUN_CONFIG(ST_BENCH_result, ST_BENCH_f, ST_BENCH_f_name, 0, ST_BENCH_config); \
+	sprintf(ST_BENCH_buffer, ST_COLOR_YELLOW "[BENCHMARK] " ST_COLOR_RED ST_BENCH_f_name " executed " ST_COLOR_YELLOW "%ld" ST_COLOR_RED " times in " ST_COLOR_YELLOW "%ld" ST_COLOR_RED "s (median " ST_COLOR_YELLOW "%.1f" ST_COLOR_RED " ns)\n" ST_COLOR_RESET, \
+		(long)ST_BENCH_result.samples * ST_BENCH_result.iterations, (long)(ST_BENCH_testing_time), ST_BENCH_result.median_ns); \
 }
 
 #endif
@@ -0,0 +1,341 @@
+
+#ifndef _WIN32
+	#define _GNU_SOURCE
+#endif
+
+#include "staged_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef _WIN32
+	#include <io.h>
+	#include <process.h>
+#endif
+
+#ifndef O_BINARY
+	#define O_BINARY 0
+#endif
+
+// Counter used to generate unique staging names
+static unsigned int staged_counter = 0;
+
+/**
+ * @brief Function that gets the directory part of a path (with the trailing slash).
+ * 
+ * @param path		Path of the file.
+ * @param directory	Buffer to fill with the directory (STAGED_PATH_SIZE bytes).
+ * 
+ * @return size_t	Length of the directory part (0 if the path has no directory).
+ */
+static size_t staged_directory_of(const char *path, char *directory) {
+	const char *last_slash = strrchr(path, '/');
+	size_t length = (last_slash == NULL) ? 0 : (size_t)(last_slash - path) + 1;
+	memcpy(directory, path, length);
+	directory[length] = '\0';
+	return length;
+}
+
+/**
+ * @brief Function that generates a hidden staging name next to the final path.
+ * Example: "dir/file.txt" -> "dir/.rfs-staging-file.txt.1234-5"
+ * 
+ * @param final_path	Path where the file will be published.
+ * @param temp_path		Buffer to fill with the staging name (STAGED_PATH_SIZE bytes).
+ * 
+ * @return int			0 if the name fits in the buffer, -1 otherwise.
+ */
+static int staged_temp_name(const char *final_path, char *temp_path) {
+	char directory[STAGED_PATH_SIZE];
+	size_t directory_length = staged_directory_of(final_path, directory);
+	int length = snprintf(temp_path, STAGED_PATH_SIZE, "%s" STAGED_TEMP_PREFIX "%s.%d-%u",
+		directory, final_path + directory_length, (int)getpid(), staged_counter++);
+	return (length < 0 || length >= STAGED_PATH_SIZE) ? -1 : 0;
+}
+
+/**
+ * @brief Function that preallocates the staging file so large writes land contiguously.
+ * Filesystems without support for it are silently ignored.
+ * 
+ * @param staged	The staged file.
+ * @param size		Number of bytes to reserve.
+ * 
+ * @return void
+ */
+static void staged_preallocate(staged_file_t *staged, size_t size) {
+	if (size == 0)
+		return;
+	if (io_engine_fallocate(staged->engine, staged->fd, size) == 0)
+		staged->allocated = size;
+	else if (errno != EOPNOTSUPP && errno != ENOSYS)
+		WARNING_PRINT("staged_preallocate(): Unable to preallocate %zu bytes for '%s'\n", size, staged->final_path);
+	errno = 0;
+}
+
+/**
+ * @brief Function that switches the staging file to O_DIRECT (or back to buffered I/O)
+ * so large files don't pollute the page cache.
+ * 
+ * @param staged	The staged file.
+ * @param enable	1 to enable O_DIRECT, 0 to disable it.
+ * 
+ * @return void
+ */
+static void staged_set_direct(staged_file_t *staged, int enable) {
+	#if defined(__linux__) && defined(O_DIRECT)
+		int flags = fcntl(staged->fd, F_GETFL);
+		if (flags != -1 && fcntl(staged->fd, F_SETFL, enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT)) == 0)
+			staged->direct = enable;
+		errno = 0;
+	#else
+		(void)staged; (void)enable;
+	#endif
+}
+
+/**
+ * @brief Function that opens a staging file for the given destination.
+ * The staging file lives in the destination directory so it can be published with a rename,
+ * and is preallocated to the announced size.
+ * 
+ * @param staged			The staged file structure to fill.
+ * @param final_path		Path where the file will be published.
+ * @param announced_size	Size announced for the file (0 if unknown).
+ * @param engine			Disk I/O engine to use (NULL for blocking I/O).
+ * 
+ * @return int				0 if the staging file is ready, -1 otherwise.
+ */
+int staged_file_open(staged_file_t *staged, const char *final_path, size_t announced_size, io_engine_t *engine) {
+	return staged_file_open_at(staged, AT_FDCWD, final_path, announced_size, engine);
+}
+
+/**
+ * @brief Function that opens a staging file for a destination relative to a directory fd:
+ * the staging file, its publication and its removal never resolve the parent directories again.
+ * 
+ * @param staged			The staged file structure to fill.
+ * @param directory_fd		Directory fd the final path is relative to (must stay open until the commit or the abort).
+ * @param final_path		Path where the file will be published, relative to the directory fd.
+ * @param announced_size	Size announced for the file (0 if unknown).
+ * @param engine			Disk I/O engine to use (NULL for blocking I/O).
+ * 
+ * @return int				0 if the staging file is ready, -1 otherwise.
+ */
+int staged_file_open_at(staged_file_t *staged, int directory_fd, const char *final_path, size_t announced_size, io_engine_t *engine) {
+
+	// Fill the structure
+	memset(staged, 0, sizeof(staged_file_t));
+	staged->fd = -1;
+	staged->directory_fd = directory_fd;
+	staged->engine = engine;
+	int code = (strlen(final_path) < STAGED_PATH_SIZE) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "staged_file_open(): Path too long '%s'\n", final_path);
+	strcpy(staged->final_path, final_path);
+
+	// Try an anonymous file first (nothing visible until published)
+	#if defined(__linux__) && defined(O_TMPFILE)
+	{
+		char directory[STAGED_PATH_SIZE];
+		if (staged_directory_of(final_path, directory) == 0)
+			strcpy(directory, ".");
+		staged->fd = io_engine_openat(engine, directory_fd, directory, O_TMPFILE | O_WRONLY, 0644);
+		if (staged->fd != -1)
+			staged->anonymous = 1;
+		errno = 0;
+	}
+	#endif
+
+	// Else, create a hidden staging file (retry if the name is already taken)
+	while (staged->fd == -1) {
+		code = staged_temp_name(final_path, staged->temp_path);
+		ERROR_HANDLE_INT_RETURN_INT(code, "staged_file_open(): Staging path too long for '%s'\n", final_path);
+		staged->fd = io_engine_openat(engine, directory_fd, staged->temp_path, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0644);
+		if (staged->fd == -1 && errno != EEXIST) {
+			ERROR_PRINT("staged_file_open(): Unable to create the staging file '%s'\n", staged->temp_path);
+			return -1;
+		}
+	}
+
+	// Preallocate the file, and bypass the page cache for large files
+	staged_preallocate(staged, announced_size);
+	if (engine != NULL && engine->direct_threshold > 0 && announced_size >= engine->direct_threshold)
+		staged_set_direct(staged, 1);
+
+	// Return
+	return 0;
+}
+
+/**
+ * @brief Function that appends data to the staging file.
+ * When the data is an engine buffer, the write may complete asynchronously:
+ * the buffer must not be reused (ask the engine for a new one instead).
+ * 
+ * @param staged	The staged file.
+ * @param data		Data to write.
+ * @param size		Size of the data.
+ * 
+ * @return int		0 if the data was written or queued, -1 otherwise.
+ */
+int staged_file_write(staged_file_t *staged, void *data, size_t size) {
+
+	// O_DIRECT needs aligned buffers, offsets and sizes: pad the last chunk with zeros
+	size_t length = size;
+	if (staged->direct) {
+		size_t padded = (size + IO_ENGINE_ALIGNMENT - 1) & ~(size_t)(IO_ENGINE_ALIGNMENT - 1);
+		if ((uintptr_t)data % IO_ENGINE_ALIGNMENT != 0 || staged->size % IO_ENGINE_ALIGNMENT != 0 || io_engine_capacity(staged->engine, data) < padded)
+			staged_set_direct(staged, 0);
+		else {
+			memset((byte*)data + size, 0, padded - size);
+			length = padded;
+		}
+	}
+
+	// Write the data at the end of the file
+	int code = io_engine_write(staged->engine, staged->fd, data, length, staged->size);
+	ERROR_HANDLE_INT_RETURN_INT(code, "staged_file_write(): Unable to write to the staging file of '%s'\n", staged->final_path);
+	staged->size += size;
+	if (staged->size + (length - size) > staged->written)
+		staged->written = staged->size + (length - size);
+	return 0;
+}
+
+/**
+ * @brief Function that leaves a hole at the end of the staging file (sparse files):
+ * the next data is written after it, and a hole at the end is kept by the commit.
+ * 
+ * @param staged	The staged file.
+ * @param size		Size of the hole.
+ * 
+ * @return void
+ */
+void staged_file_skip(staged_file_t *staged, size_t size) {
+	staged->size += size;
+}
+
+/**
+ * @brief Function that sets the permissions and the modification time the file is published with
+ * (applied after the last write, so the content can't change the modification time back).
+ * 
+ * @param staged	The staged file.
+ * @param mode		Permissions (0 to keep the default).
+ * @param mtime_ns	Modification time in nanoseconds (0 to keep the current time).
+ * 
+ * @return void
+ */
+void staged_file_set_metadata(staged_file_t *staged, unsigned int mode, long long mtime_ns) {
+	staged->mode = mode & 07777;
+	staged->mtime_ns = mtime_ns;
+}
+
+/**
+ * @brief Function that applies the metadata of the staged file (failures are ignored: the content matters more).
+ * 
+ * @param staged	The staged file.
+ * 
+ * @return void
+ */
+static void staged_apply_metadata(staged_file_t *staged) {
+	#ifndef _WIN32
+		if (staged->mode != 0 && fchmod(staged->fd, (mode_t)staged->mode) == -1)
+			errno = 0;
+		if (staged->mtime_ns != 0) {
+			struct timespec times[2];
+			times[0].tv_sec = 0;
+			times[0].tv_nsec = UTIME_OMIT;
+			times[1].tv_sec = (time_t)(staged->mtime_ns / 1000000000LL);
+			times[1].tv_nsec = (long)(staged->mtime_ns % 1000000000LL);
+			if (futimens(staged->fd, times) == -1)
+				errno = 0;
+		}
+	#else
+		(void)staged;
+	#endif
+}
+
+/**
+ * @brief Function that atomically publishes the staging file at its final path.
+ * Readers either see the previous content or the new one, never a partial file.
+ * 
+ * @param staged	The staged file (closed after this call).
+ * 
+ * @return int		0 if the file is published, -1 otherwise (the staging file is removed).
+ */
+int staged_file_commit(staged_file_t *staged) {
+
+	// Wait for the asynchronous writes
+	int code = io_engine_drain(staged->engine);
+	if (code == -1) staged_file_abort(staged);
+	ERROR_HANDLE_INT_RETURN_INT(code, "staged_file_commit(): Unable to write the staging file of '%s'\n", staged->final_path);
+
+	// Drop the preallocated space and the O_DIRECT padding that were not used, or extend the file over a final hole
+	if (staged->allocated > staged->size || staged->written != staged->size)
+		code = ftruncate(staged->fd, (off_t)staged->size);
+	if (code == 0)
+		staged_apply_metadata(staged);
+	if (code == 0 && staged->engine != NULL && staged->engine->fsync_before_publish)
+		code = io_engine_fsync(staged->engine, staged->fd);
+	if (code == -1) staged_file_abort(staged);
+	ERROR_HANDLE_INT_RETURN_INT(code, "staged_file_commit(): Unable to finalize the staging file of '%s'\n", staged->final_path);
+
+	// Anonymous file: link it directly, or under a hidden name when the destination already exists
+	#if defined(__linux__) && defined(O_TMPFILE)
+	if (staged->anonymous) {
+		char proc_path[64];
+		sprintf(proc_path, "/proc/self/fd/%d", staged->fd);
+		code = io_engine_linkat(staged->engine, AT_FDCWD, proc_path, staged->directory_fd, staged->final_path);
+		while (code == -1 && errno == EEXIST) {
+			if (staged_temp_name(staged->final_path, staged->temp_path) == -1)
+				break;
+			code = io_engine_linkat(staged->engine, AT_FDCWD, proc_path, staged->directory_fd, staged->temp_path);
+			if (code == 0)
+				staged->anonymous = 0;
+		}
+		if (code == -1) staged_file_abort(staged);
+		ERROR_HANDLE_INT_RETURN_INT(code, "staged_file_commit(): Unable to link the staging file of '%s'\n", staged->final_path);
+
+		// Published directly
+		if (staged->anonymous) {
+			close(staged->fd);
+			staged->fd = -1;
+			return 0;
+		}
+	}
+	#endif
+
+	// Close the staging file
+	close(staged->fd);
+	staged->fd = -1;
+
+	// Rename it over the destination
+	code = io_engine_renameat(staged->engine, staged->directory_fd, staged->temp_path, staged->directory_fd, staged->final_path);
+	if (code == -1) staged_file_abort(staged);
+	ERROR_HANDLE_INT_RETURN_INT(code, "staged_file_commit(): Unable to publish '%s'\n", staged->final_path);
+
+	// Return
+	staged->temp_path[0] = '\0';
+	return 0;
+}
+
+/**
+ * @brief Function that discards the staging file, leaving the destination untouched.
+ * 
+ * @param staged	The staged file.
+ * 
+ * @return void
+ */
+void staged_file_abort(staged_file_t *staged) {
+	int saved_errno = errno;
+	io_engine_drain(staged->engine);
+	if (staged->fd != -1)
+		close(staged->fd);
+	if (staged->temp_path[0] != '\0')
+		io_engine_unlinkat(staged->engine, staged->directory_fd, staged->temp_path, 0);
+	staged->fd = -1;
+	staged->temp_path[0] = '\0';
+	errno = saved_errno;
+}
+
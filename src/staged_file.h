@@ -0,0 +1,37 @@
+
+#ifndef __STAGED_FILE_H__
+#define __STAGED_FILE_H__
+
+#include "universal_utils.h"
+#include "io_engine.h"
+
+#define STAGED_PATH_SIZE 1024
+#define STAGED_TEMP_PREFIX ".rfs-staging-"		// Files being received (never synchronized, see sync_ignore)
+
+// Structure of a file being written before being published
+typedef struct staged_file_t {
+	int fd;									// File descriptor of the staging file
+	int directory_fd;						// Directory fd the paths are relative to (AT_FDCWD for the working directory)
+	int anonymous;							// 1 if the staging file has no name yet (O_TMPFILE)
+	int direct;								// 1 if the staging file is written with O_DIRECT
+	io_engine_t *engine;					// Disk I/O engine used for the file (NULL for blocking I/O)
+	size_t size;							// Number of bytes written so far
+	size_t allocated;						// Number of bytes preallocated on disk
+	size_t written;							// End of the data written on disk (aligned when O_DIRECT)
+	unsigned int mode;						// Permissions given when published (0 to keep the default)
+	long long mtime_ns;						// Modification time given when published (0 to keep the current time)
+	char final_path[STAGED_PATH_SIZE];		// Path where the file will be published (relative to the directory fd)
+	char temp_path[STAGED_PATH_SIZE];		// Path of the staging file (empty if anonymous)
+} staged_file_t;
+
+// Function prototypes
+int staged_file_open(staged_file_t *staged, const char *final_path, size_t announced_size, io_engine_t *engine);
+int staged_file_open_at(staged_file_t *staged, int directory_fd, const char *final_path, size_t announced_size, io_engine_t *engine);
+int staged_file_write(staged_file_t *staged, void *data, size_t size);
+void staged_file_skip(staged_file_t *staged, size_t size);
+void staged_file_set_metadata(staged_file_t *staged, unsigned int mode, long long mtime_ns);
+int staged_file_commit(staged_file_t *staged);
+void staged_file_abort(staged_file_t *staged);
+
+#endif
+
@@ -0,0 +1,453 @@
+
+#include "sync_ignore.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+// Types of the glob tokens
+#define IGNORE_TOKEN_CHAR 0				// One given character
+#define IGNORE_TOKEN_ANY 1				// '?': one character except '/'
+#define IGNORE_TOKEN_CLASS 2			// [...]: one character of the class (never '/')
+#define IGNORE_TOKEN_STAR 3				// '*': any characters except '/'
+#define IGNORE_TOKEN_GLOBSTAR 4			// '**': any characters
+#define IGNORE_TOKEN_GLOBSTAR_SLASH 5	// '**/': nothing, or any characters ending with a '/'
+
+// Rules always applied before the ones of the file (so they can be re-included with '!'),
+// with the trash of the server (tree_delete.h) and the files being received (staged_file.h)
+static const char *sync_ignore_defaults[] = { ".git/", "__pycache__/", ".code-workspace", ".rfs-trash/", ".rfs-staging-*" };
+
+/**
+ * @brief Function that initializes an empty set of patterns with the default rules.
+ * 
+ * @param ignore	The set of patterns to initialize.
+ * 
+ * @return int		0 if success, -1 otherwise.
+ */
+int sync_ignore_init(sync_ignore_t *ignore) {
+	memset(ignore, 0, sizeof(sync_ignore_t));
+	size_t i;
+	for (i = 0; i < sizeof(sync_ignore_defaults) / sizeof(char*); i++) {
+		int code = sync_ignore_add(ignore, sync_ignore_defaults[i]);
+		ERROR_HANDLE_INT_RETURN_INT(code, "sync_ignore_init(): Unable to add the default pattern '%s'\n", sync_ignore_defaults[i]);
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that gets (or creates) the child of a trie node.
+ * 
+ * @param node		Parent node.
+ * @param c			Character of the child.
+ * 
+ * @return ignore_trie_node_t*	The child, NULL on allocation failure.
+ */
+static ignore_trie_node_t* sync_ignore_trie_child(ignore_trie_node_t *node, char c) {
+	ignore_trie_node_t *child = node->child;
+	while (child != NULL && child->c != c)
+		child = child->sibling;
+	if (child != NULL)
+		return child;
+	child = calloc(1, sizeof(ignore_trie_node_t));
+	ERROR_HANDLE_PTR_RETURN_NULL(child, "sync_ignore_trie_child(): Unable to allocate a trie node\n");
+	child->c = c;
+	child->rule_any = -1;
+	child->rule_dir = -1;
+	child->sibling = node->child;
+	node->child = child;
+	return child;
+}
+
+/**
+ * @brief Function that compiles the glob part of a pattern into tokens.
+ * 
+ * @param pattern	Glob to compile (after the literal prefix).
+ * @param segment_start	1 if the glob starts a path component (after a '/' or at the beginning of the pattern).
+ * @param tokens	Tokens to fill (SYNC_IGNORE_MAX_PATTERN at most).
+ * 
+ * @return int		Number of tokens, -1 if the glob is invalid.
+ */
+static int sync_ignore_compile_glob(const char *pattern, int segment_start, ignore_token_t *tokens) {
+	int count = 0;
+	const char *p = pattern;
+	while (*p != '\0') {
+		if (count >= SYNC_IGNORE_MAX_PATTERN)
+			return -1;
+		ignore_token_t *token = &tokens[count++];
+		memset(token, 0, sizeof(ignore_token_t));
+
+		// Stars: '**/' and '**' cross the directories, '*' does not
+		if (*p == '*') {
+			const char *stars = p;
+			while (*p == '*') p++;
+			if (p - stars >= 2 && (stars == pattern ? segment_start : stars[-1] == '/') && (*p == '/' || *p == '\0')) {
+				if (*p == '/') { token->type = IGNORE_TOKEN_GLOBSTAR_SLASH; p++; }
+				else token->type = IGNORE_TOKEN_GLOBSTAR;
+			}
+			else
+				token->type = IGNORE_TOKEN_STAR;
+		}
+
+		// Any character
+		else if (*p == '?') {
+			token->type = IGNORE_TOKEN_ANY;
+			p++;
+		}
+
+		// Class of characters: [abc], [a-z], [!a-z] or [^a-z]
+		else if (*p == '[' && strchr(p + 1, ']') != NULL) {
+			token->type = IGNORE_TOKEN_CLASS;
+			p++;
+			int negated = (*p == '!' || *p == '^');
+			if (negated) p++;
+			int first = 1;
+			while (*p != '\0' && (*p != ']' || first)) {
+				byte low = (byte)*p;
+				if (*p == '\\' && p[1] != '\0') low = (byte)*++p;
+				byte high = low;
+				if (p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+					p += 2;
+					high = (byte)*p;
+					if (*p == '\\' && p[1] != '\0') high = (byte)*++p;
+				}
+				int c;
+				for (c = low; c <= high; c++)
+					token->class_bits[c >> 6] |= 1ULL << (c & 63);
+				p++;
+				first = 0;
+			}
+			if (*p != ']')
+				return -1;
+			p++;
+			int i;
+			if (negated)
+				for (i = 0; i < 4; i++)
+					token->class_bits[i] = ~token->class_bits[i];
+			token->class_bits['/' >> 6] &= ~(1ULL << ('/' & 63));
+		}
+
+		// Literal character (possibly escaped)
+		else {
+			if (*p == '\\' && p[1] != '\0') p++;
+			token->type = IGNORE_TOKEN_CHAR;
+			token->c = (byte)*p++;
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief Function that adds a pattern (one line of a .syncignore file).
+ * The literal beginning of the pattern is stored in a trie, the rest (if any) is compiled into a glob.
+ * 
+ * @param ignore	The set of patterns.
+ * @param pattern	The pattern in gitignore syntax (comments and empty lines are skipped).
+ * 
+ * @return int		0 if success (or skipped line), -1 if the pattern is invalid.
+ */
+int sync_ignore_add(sync_ignore_t *ignore, const char *pattern) {
+
+	// Copy the pattern without the trailing spaces (unless escaped) and the line ending
+	char buffer[SYNC_IGNORE_MAX_PATTERN + 1];
+	size_t length = strlen(pattern);
+	while (length > 0 && (pattern[length - 1] == '\n' || pattern[length - 1] == '\r' || (pattern[length - 1] == ' ' && (length < 2 || pattern[length - 2] != '\\'))))
+		length--;
+	if (length == 0 || pattern[0] == '#')
+		return 0;
+	int code = length < sizeof(buffer) ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "sync_ignore_add(): Pattern too long (%zu bytes, %d at most)\n", length, SYNC_IGNORE_MAX_PATTERN);
+	memcpy(buffer, pattern, length);
+	buffer[length] = '\0';
+	char *p = buffer;
+
+	// Negation, directory only and anchoring
+	int negated = 0;
+	if (*p == '!') { negated = 1; p++; }
+	else if (*p == '\\' && (p[1] == '!' || p[1] == '#')) p++;
+	int dir_only = 0;
+	length = strlen(p);
+	if (length > 0 && p[length - 1] == '/') { dir_only = 1; p[--length] = '\0'; }
+	if (strncmp(p, "**/", 3) == 0 && strchr(p + 3, '/') == NULL) p += 3;	// '**/name' is the same as 'name'
+	int anchored = strchr(p, '/') != NULL;
+	if (*p == '/') p++;
+	code = *p != '\0' ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "sync_ignore_add(): Empty pattern '%s'\n", pattern);
+
+	// Register the rule
+	if (ignore->rules_count == ignore->rules_capacity) {
+		int capacity = ignore->rules_capacity == 0 ? 16 : ignore->rules_capacity * 2;
+		byte *negated_rules = realloc(ignore->negated, capacity);
+		ERROR_HANDLE_PTR_RETURN_INT(negated_rules, "sync_ignore_add(): Unable to grow the rules\n");
+		ignore->negated = negated_rules;
+		ignore->rules_capacity = capacity;
+	}
+	int rule = ignore->rules_count;
+
+	// Walk the trie along the literal prefix
+	ignore_trie_node_t **root = anchored ? &ignore->anchored : &ignore->basename;
+	if (*root == NULL) {
+		*root = calloc(1, sizeof(ignore_trie_node_t));
+		ERROR_HANDLE_PTR_RETURN_INT(*root, "sync_ignore_add(): Unable to allocate a trie root\n");
+		(*root)->rule_any = -1;
+		(*root)->rule_dir = -1;
+	}
+	ignore_trie_node_t *node = *root;
+	const char *start = p;
+	while (*p != '\0' && strchr("*?[", *p) == NULL) {
+		if (*p == '\\' && p[1] != '\0') p++;
+		node = sync_ignore_trie_child(node, *p++);
+		ERROR_HANDLE_PTR_RETURN_INT(node, "sync_ignore_add(): Unable to store the pattern '%s'\n", pattern);
+	}
+
+	// Fully literal pattern: ends on the node
+	if (*p == '\0') {
+		if (dir_only) node->rule_dir = rule;
+		else node->rule_any = rule;
+	}
+
+	// Else, compile the rest into a glob
+	else {
+		ignore_token_t tokens[SYNC_IGNORE_MAX_PATTERN];
+		int count = sync_ignore_compile_glob(p, p == start || p[-1] == '/', tokens);
+		code = count > 0 ? 0 : -1;
+		ERROR_HANDLE_INT_RETURN_INT(code, "sync_ignore_add(): Invalid pattern '%s'\n", pattern);
+		ignore_glob_t *glob = malloc(sizeof(ignore_glob_t));
+		ERROR_HANDLE_PTR_RETURN_INT(glob, "sync_ignore_add(): Unable to allocate a glob\n");
+		ignore_token_t *glob_tokens = malloc(count * sizeof(ignore_token_t));
+		if (glob_tokens == NULL) free(glob);
+		ERROR_HANDLE_PTR_RETURN_INT(glob_tokens, "sync_ignore_add(): Unable to allocate the tokens\n");
+		memcpy(glob_tokens, tokens, count * sizeof(ignore_token_t));
+		glob->tokens = glob_tokens;
+		glob->tokens_count = count;
+		glob->rule = rule;
+		glob->dir_only = dir_only;
+
+		// Keep the globs of a node sorted by decreasing rule (the first match is the highest)
+		glob->next = node->globs;
+		node->globs = glob;
+	}
+	ignore->negated[rule] = (byte)negated;
+	ignore->rules_count++;
+	return 0;
+}
+
+/**
+ * @brief Function that reads the patterns of the .syncignore file of a directory (missing file: only the defaults).
+ * 
+ * @param ignore		The set of patterns to initialize.
+ * @param directory		The synchronized directory (ending with a '/').
+ * 
+ * @return int			0 if success, -1 otherwise (invalid patterns are reported and skipped).
+ */
+int sync_ignore_load(sync_ignore_t *ignore, const char *directory) {
+	int code = sync_ignore_init(ignore);
+	ERROR_HANDLE_INT_RETURN_INT(code, "sync_ignore_load(): Unable to initialize the patterns\n");
+
+	// Read the file if there is one
+	char path[SYNC_IGNORE_MAX_PATH];
+	snprintf(path, sizeof(path), "%s%s", directory, SYNC_IGNORE_FILE);
+	if (file_accessible(path) == -1) {
+		errno = 0;
+		return 0;
+	}
+	char *content = readEntireFile(path);
+	ERROR_HANDLE_PTR_RETURN_INT(content, "sync_ignore_load(): Unable to read '%s'\n", path);
+
+	// Add each line
+	int line_number = 0;
+	char *line = content;
+	while (line != NULL && *line != '\0') {
+		char *next = strchr(line, '\n');
+		if (next != NULL)
+			*next++ = '\0';
+		line_number++;
+		if (sync_ignore_add(ignore, line) == -1)
+			WARNING_PRINT("sync_ignore_load(): %s:%d: Ignoring invalid pattern '%s'\n", path, line_number, line);
+		line = next;
+	}
+	free(content);
+	INFO_PRINT("sync_ignore_load(): %d patterns loaded from '%s'\n", ignore->rules_count, path);
+	return 0;
+}
+
+/**
+ * @brief Function that runs a compiled glob on a string (simulation of its automaton, linear time).
+ * 
+ * @param glob	The compiled glob.
+ * @param str	The string to match entirely.
+ * 
+ * @return int	1 if the string matches, 0 otherwise.
+ */
+static int sync_ignore_glob_match(const ignore_glob_t *glob, const char *str) {
+	unsigned long long states[5] = { 0, 0, 0, 0, 0 };		// State i: i tokens matched (up to 256)
+	unsigned long long next[5];
+	int n = glob->tokens_count;
+	int i;
+	#define STATE_SET(set, s) ((set)[(s) >> 6] |= 1ULL << ((s) & 63))
+	#define STATE_HAS(set, s) (((set)[(s) >> 6] >> ((s) & 63)) & 1)
+
+	// Initial state and the states reachable without reading (stars can match nothing)
+	STATE_SET(states, 0);
+	for (i = 0; i < n && glob->tokens[i].type >= IGNORE_TOKEN_STAR; i++)
+		STATE_SET(states, i + 1);
+
+	// Read the string
+	const byte *s = (const byte*)str;
+	for (; *s != '\0'; s++) {
+		memset(next, 0, sizeof(next));
+		int alive = 0;
+		for (i = 0; i < n; i++) {
+			if (!STATE_HAS(states, i))
+				continue;
+			const ignore_token_t *token = &glob->tokens[i];
+			int advance = 0;
+			switch (token->type) {
+				case IGNORE_TOKEN_CHAR: advance = (*s == token->c); break;
+				case IGNORE_TOKEN_ANY: advance = (*s != '/'); break;
+				case IGNORE_TOKEN_CLASS: advance = (token->class_bits[*s >> 6] >> (*s & 63)) & 1; break;
+				case IGNORE_TOKEN_STAR: if (*s != '/') { STATE_SET(next, i); alive = 1; } break;
+				case IGNORE_TOKEN_GLOBSTAR: STATE_SET(next, i); alive = 1; break;
+				case IGNORE_TOKEN_GLOBSTAR_SLASH: STATE_SET(next, i); alive = 1; advance = (*s == '/'); break;
+			}
+			if (advance) {
+				STATE_SET(next, i + 1);
+				alive = 1;
+			}
+		}
+		if (!alive)
+			return 0;
+
+		// Add the states reachable without reading (stars following a reached state)
+		for (i = 0; i < n; i++)
+			if (STATE_HAS(next, i) && glob->tokens[i].type >= IGNORE_TOKEN_STAR)
+				STATE_SET(next, i + 1);
+		memcpy(states, next, sizeof(states));
+	}
+	return STATE_HAS(states, n);
+	#undef STATE_SET
+	#undef STATE_HAS
+}
+
+/**
+ * @brief Function that finds the highest rule of a trie matching a string.
+ * 
+ * @param root			Root of the trie (can be NULL).
+ * @param str			The string (whole path or name).
+ * @param is_directory	1 if the string is a directory.
+ * 
+ * @return int			The highest matching rule, -1 if none.
+ */
+static int sync_ignore_trie_match(const ignore_trie_node_t *root, const char *str, int is_directory) {
+	int best = -1;
+	const ignore_trie_node_t *node = root;
+	const char *s = str;
+	while (node != NULL) {
+
+		// Globs continuing the literal prefix
+		const ignore_glob_t *glob;
+		for (glob = node->globs; glob != NULL && glob->rule > best; glob = glob->next)
+			if ((!glob->dir_only || is_directory) && sync_ignore_glob_match(glob, s)) {
+				best = glob->rule;
+				break;
+			}
+
+		// End of the string: literal patterns
+		if (*s == '\0') {
+			if (node->rule_any > best) best = node->rule_any;
+			if (is_directory && node->rule_dir > best) best = node->rule_dir;
+			break;
+		}
+
+		// Next character
+		const ignore_trie_node_t *child = node->child;
+		while (child != NULL && child->c != *s)
+			child = child->sibling;
+		node = child;
+		s++;
+	}
+	return best;
+}
+
+/**
+ * @brief Function that tells if a path must not be synchronized.
+ * A path is ignored if it matches a pattern, or if one of its parent directories does.
+ * 
+ * @param ignore		The compiled patterns (NULL to ignore nothing).
+ * @param path			Path relative to the synchronized directory (with '/' separators).
+ * @param is_directory	1 if the path is a directory.
+ * 
+ * @return int			1 if the path is ignored, 0 otherwise.
+ */
+int sync_ignore_match(const sync_ignore_t *ignore, const char *path, int is_directory) {
+	if (ignore == NULL || ignore->rules_count == 0)
+		return 0;
+
+	// Copy the path (each component is cut in place)
+	while (*path == '/' || (path[0] == '.' && path[1] == '/'))
+		path += (*path == '/') ? 1 : 2;
+	char buffer[SYNC_IGNORE_MAX_PATH];
+	size_t length = strlen(path);
+	if (length == 0 || length >= sizeof(buffer))
+		return 0;
+	memcpy(buffer, path, length + 1);
+	while (length > 1 && buffer[length - 1] == '/')
+		buffer[--length] = '\0';
+
+	// Check each component: the parent directories first, then the path itself
+	char *name = buffer;
+	while (1) {
+		char *end = strchr(name, '/');
+		int last = (end == NULL);
+		if (!last)
+			*end = '\0';
+		int directory = last ? is_directory : 1;
+		int rule = sync_ignore_trie_match(ignore->anchored, buffer, directory);
+		int rule_name = sync_ignore_trie_match(ignore->basename, name, directory);
+		if (rule_name > rule)
+			rule = rule_name;
+		if (rule >= 0 && !ignore->negated[rule])
+			return 1;
+		if (last)
+			return 0;
+		*end = '/';
+		name = end + 1;
+	}
+}
+
+/**
+ * @brief Function that frees a trie.
+ * 
+ * @param node	Root of the trie (can be NULL).
+ * 
+ * @return void
+ */
+static void sync_ignore_trie_free(ignore_trie_node_t *node) {
+	while (node != NULL) {
+		ignore_trie_node_t *sibling = node->sibling;
+		sync_ignore_trie_free(node->child);
+		while (node->globs != NULL) {
+			ignore_glob_t *glob = node->globs;
+			node->globs = glob->next;
+			free(glob->tokens);
+			free(glob);
+		}
+		free(node);
+		node = sibling;
+	}
+}
+
+/**
+ * @brief Function that frees the compiled patterns.
+ * 
+ * @param ignore	The set of patterns.
+ * 
+ * @return void
+ */
+void sync_ignore_free(sync_ignore_t *ignore) {
+	sync_ignore_trie_free(ignore->anchored);
+	sync_ignore_trie_free(ignore->basename);
+	free(ignore->negated);
+	memset(ignore, 0, sizeof(sync_ignore_t));
+}
+
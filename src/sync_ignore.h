@@ -0,0 +1,54 @@
+
+#ifndef __SYNC_IGNORE_H__
+#define __SYNC_IGNORE_H__
+
+#include "universal_utils.h"
+
+#define SYNC_IGNORE_FILE ".syncignore"				// Read from the root of the synchronized directory
+#define SYNC_IGNORE_MAX_PATTERN 256					// Longest pattern (bytes, so the automaton has at most 256 states)
+#define SYNC_IGNORE_MAX_PATH 4096
+
+// Token of a compiled glob (one state of the automaton)
+typedef struct ignore_token_t {
+	byte type;						// IGNORE_TOKEN_* (see sync_ignore.c)
+	byte c;							// Character of a literal token
+	unsigned long long class_bits[4];	// Characters accepted by a [...] token
+} ignore_token_t;
+
+// Glob attached to a trie node: it matches the end of the path after the literal prefix of the node
+typedef struct ignore_glob_t {
+	int rule;						// Index of the rule
+	int dir_only;					// 1 if the rule only matches directories (trailing '/')
+	int tokens_count;
+	ignore_token_t *tokens;
+	struct ignore_glob_t *next;
+} ignore_glob_t;
+
+// Node of a literal-prefix trie
+typedef struct ignore_trie_node_t {
+	char c;
+	int rule_any;					// Highest rule whose literal pattern ends here (-1 if none)
+	int rule_dir;					// Same, for the rules only matching directories
+	ignore_glob_t *globs;
+	struct ignore_trie_node_t *child;
+	struct ignore_trie_node_t *sibling;
+} ignore_trie_node_t;
+
+// Compiled ignore patterns (gitignore syntax: the last matching rule wins, '!' re-includes)
+typedef struct sync_ignore_t {
+	ignore_trie_node_t *anchored;	// Patterns containing a '/', matched against the path from the root
+	ignore_trie_node_t *basename;	// Patterns without '/', matched against the name at any depth
+	byte *negated;					// For each rule, 1 if it re-includes the paths
+	int rules_count;
+	int rules_capacity;
+} sync_ignore_t;
+
+// Function prototypes
+int sync_ignore_init(sync_ignore_t *ignore);
+int sync_ignore_add(sync_ignore_t *ignore, const char *pattern);
+int sync_ignore_load(sync_ignore_t *ignore, const char *directory);
+int sync_ignore_match(const sync_ignore_t *ignore, const char *path, int is_directory);
+void sync_ignore_free(sync_ignore_t *ignore);
+
+#endif
+
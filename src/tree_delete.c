@@ -0,0 +1,365 @@
+
+#ifndef _WIN32
+	#define _GNU_SOURCE
+#endif
+
+#include "tree_delete.h"
+#include "dir_scanner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#define TREE_DELETE_INITIAL_DIRECTORIES 64
+
+// State shared by the threads walking the subtree
+typedef struct tree_delete_walk_t {
+	int directory_fd;						// Directory fd the path of the subtree is relative to
+	char root[SYNC_IGNORE_MAX_PATH];		// Path of the subtree ending with a '/'
+	pthread_mutex_t mutex;					// Protects the list of directories
+	char **directories;						// Directories found, removed once their content is deleted
+	size_t count;
+	size_t capacity;
+	volatile long long files;
+	volatile long long errors;
+} tree_delete_walk_t;
+
+// Deletion running in the background
+typedef struct tree_delete_job_t {
+	int threads;
+	char path[];
+} tree_delete_job_t;
+
+// Gives unique names in the trash
+static volatile unsigned int tree_delete_trash_counter = 0;
+
+/**
+ * @brief Function that deletes an entry of the subtree by its path from the directory fd of the deletion
+ * (no directory fd of its own parent).
+ * 
+ * @param walk			The deletion.
+ * @param path			Path relative to the subtree.
+ * @param is_directory	1 to remove an (empty) directory.
+ * 
+ * @return int			0 if the entry is deleted, -1 otherwise.
+ */
+static int tree_delete_path(tree_delete_walk_t *walk, const char *path, int is_directory) {
+	char full_path[SYNC_IGNORE_MAX_PATH * 2];
+	snprintf(full_path, sizeof(full_path), "%s%s", walk->root, path);
+	#ifdef _WIN32
+		return is_directory ? rmdir(full_path) : remove(full_path);
+	#else
+		return unlinkat(walk->directory_fd, full_path, is_directory ? AT_REMOVEDIR : 0);
+	#endif
+}
+
+/**
+ * @brief Function called by the scanner threads for each entry of the subtree:
+ * the files are unlinked relative to the directory being read, the directories are kept for later.
+ * 
+ * @param entry	The entry.
+ * @param arg	The deletion.
+ * 
+ * @return int	0 (the failures are counted, the walk continues).
+ */
+static int tree_delete_entry(const scan_entry_t *entry, void *arg) {
+	tree_delete_walk_t *walk = (tree_delete_walk_t*)arg;
+
+	// Directories are removed once emptied
+	if (entry->is_directory) {
+		char *path = strdup(entry->path);
+		pthread_mutex_lock(&walk->mutex);
+		if (path != NULL && walk->count == walk->capacity) {
+			size_t capacity = walk->capacity == 0 ? TREE_DELETE_INITIAL_DIRECTORIES : walk->capacity * 2;
+			char **directories = realloc(walk->directories, capacity * sizeof(char*));
+			if (directories != NULL) {
+				walk->directories = directories;
+				walk->capacity = capacity;
+			}
+		}
+		int added = path != NULL && walk->count < walk->capacity;
+		if (added)
+			walk->directories[walk->count++] = path;
+		pthread_mutex_unlock(&walk->mutex);
+		if (!added) {
+			free(path);
+			__sync_fetch_and_add(&walk->errors, 1);
+		}
+		return 0;
+	}
+
+	// Files and symbolic links
+	#ifndef _WIN32
+		int code = entry->directory_fd != -1 ? unlinkat(entry->directory_fd, entry->name, 0) : tree_delete_path(walk, entry->path, 0);
+	#else
+		int code = tree_delete_path(walk, entry->path, 0);
+	#endif
+	if (code == 0)
+		__sync_fetch_and_add(&walk->files, 1);
+	else {
+		WARNING_PRINT("tree_delete_entry(): Unable to delete '%s%s'\n", walk->root, entry->path);
+		__sync_fetch_and_add(&walk->errors, 1);
+		errno = 0;
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that sorts the directories from the longest path to the shortest one,
+ * so every directory comes before its parent.
+ * 
+ * @param a		First directory (char**).
+ * @param b		Second directory (char**).
+ * 
+ * @return int	Negative if a is longer than b, positive if it's shorter, 0 otherwise.
+ */
+static int tree_delete_compare_depth(const void *a, const void *b) {
+	size_t length_a = strlen(*(char* const*)a);
+	size_t length_b = strlen(*(char* const*)b);
+	return (length_a < length_b) - (length_a > length_b);
+}
+
+/**
+ * @brief Function that deletes a file or a whole directory tree.
+ * 
+ * @param path		Path of the file or of the root of the tree (deleted too).
+ * @param threads	Threads walking the tree (0 for the default).
+ * @param stats		Statistics of the deletion (can be NULL).
+ * 
+ * @return int		0 if everything is deleted, -1 otherwise.
+ */
+int tree_delete(const char *path, int threads, tree_delete_stats_t *stats) {
+	return tree_delete_at(AT_FDCWD, path, threads, stats);
+}
+
+/**
+ * @brief Function that deletes a file or a whole directory tree relative to a directory fd, without following
+ * a symbolic link: a link is deleted, never what it points to.
+ * The files are unlinked by the scanner threads while they read the directories (relative to their fd, in parallel),
+ * then the emptied directories are removed, deepest first.
+ * 
+ * @param directory_fd	Directory fd the path is relative to (AT_FDCWD for the working directory).
+ * @param path			Path of the file or of the root of the tree (deleted too).
+ * @param threads		Threads walking the tree (0 for the default).
+ * @param stats			Statistics of the deletion (can be NULL).
+ * 
+ * @return int			0 if everything is deleted, -1 otherwise.
+ */
+int tree_delete_at(int directory_fd, const char *path, int threads, tree_delete_stats_t *stats) {
+	long long start_time = get_time_us();
+	tree_delete_stats_t total;
+	memset(&total, 0, sizeof(tree_delete_stats_t));
+
+	// Not a directory: a single unlink
+	struct stat st;
+	#ifdef _WIN32
+		(void)directory_fd;
+		int code = stat(path, &st);
+	#else
+		int code = fstatat(directory_fd, path, &st, AT_SYMLINK_NOFOLLOW);
+	#endif
+	ERROR_HANDLE_INT_RETURN_INT(code, "tree_delete(): Unable to find '%s'\n", path);
+	if (!S_ISDIR(st.st_mode)) {
+		#ifdef _WIN32
+			code = remove(path);
+		#else
+			code = unlinkat(directory_fd, path, 0);
+		#endif
+		ERROR_HANDLE_INT_RETURN_INT(code, "tree_delete(): Unable to delete '%s'\n", path);
+		total.files = 1;
+		total.duration_us = get_time_us() - start_time;
+		if (stats != NULL)
+			*stats = total;
+		return 0;
+	}
+
+	// Prepare the walk
+	tree_delete_walk_t *walk = calloc(1, sizeof(tree_delete_walk_t));
+	ERROR_HANDLE_PTR_RETURN_INT(walk, "tree_delete(): Unable to allocate the deletion of '%s'\n", path);
+	size_t length = strlen(path);
+	code = (length + 2 < sizeof(walk->root)) ? 0 : -1;
+	if (code == -1) free(walk);
+	ERROR_HANDLE_INT_RETURN_INT(code, "tree_delete(): Path too long '%s'\n", path);
+	walk->directory_fd = directory_fd;
+	strcpy(walk->root, path);
+	if (length > 0 && path[length - 1] != '/')
+		strcat(walk->root, "/");
+	pthread_mutex_init(&walk->mutex, NULL);
+
+	// Delete the files while walking the tree
+	dir_scan_options_t options = { threads, 0, NULL, tree_delete_entry, walk };
+	dir_scan_stats_t scan_stats;
+	code = dir_scan_at(directory_fd, path, &options, &scan_stats);
+	total.errors = walk->errors + (code == 0 ? scan_stats.errors : 1);
+	total.files = walk->files;
+
+	// Remove the directories (children first), relative to the root of the tree
+	qsort(walk->directories, walk->count, sizeof(char*), tree_delete_compare_depth);
+	#ifdef __linux__
+		int root_fd = openat(directory_fd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	#endif
+	size_t i;
+	for (i = 0; i < walk->count; i++) {
+		#ifdef __linux__
+			code = root_fd != -1 ? unlinkat(root_fd, walk->directories[i], AT_REMOVEDIR) : tree_delete_path(walk, walk->directories[i], 1);
+		#else
+			code = tree_delete_path(walk, walk->directories[i], 1);
+		#endif
+		if (code == 0)
+			total.directories++;
+		else {
+			total.errors++;
+			errno = 0;
+		}
+		free(walk->directories[i]);
+	}
+	#ifdef __linux__
+		if (root_fd != -1)
+			close(root_fd);
+	#endif
+	errno = 0;
+
+	// Remove the root of the tree
+	#ifdef _WIN32
+		code = rmdir(path);
+	#else
+		code = unlinkat(directory_fd, path, AT_REMOVEDIR);
+	#endif
+	if (code == 0)
+		total.directories++;
+	else {
+		total.errors++;
+		errno = 0;
+	}
+	pthread_mutex_destroy(&walk->mutex);
+	free(walk->directories);
+	free(walk);
+	total.duration_us = get_time_us() - start_time;
+	if (stats != NULL)
+		*stats = total;
+	code = total.errors == 0 ? 0 : -1;
+	ERROR_HANDLE_INT_RETURN_INT(code, "tree_delete(): %lld entries of '%s' couldn't be deleted\n", total.errors, path);
+	DEBUG_PRINT("tree_delete(): '%s' deleted in %lld us (%lld files, %lld directories)\n", path, total.duration_us, total.files, total.directories);
+	return 0;
+}
+
+/**
+ * @brief Function run by the background deletions.
+ * 
+ * @param arg	The tree_delete_job_t (freed at the end).
+ * 
+ * @return thread_return_type	0
+ */
+static thread_return_type tree_delete_thread(thread_param_type arg) {
+	tree_delete_job_t *job = (tree_delete_job_t*)arg;
+	tree_delete_stats_t stats;
+	int code = tree_delete(job->path, job->threads, &stats);
+	WARNING_HANDLE_INT(code, "tree_delete_thread(): The trash entry '%s' was not completely deleted\n", job->path);
+	if (code == 0)
+		INFO_PRINT("tree_delete_thread(): %lld files and %lld directories deleted from the trash in %lld ms\n", stats.files, stats.directories, stats.duration_us / 1000);
+	free(job);
+	return 0;
+}
+
+/**
+ * @brief Function that deletes a tree in a detached thread.
+ * 
+ * @param path		Path of the tree.
+ * @param threads	Threads walking the tree (0 for the default).
+ * 
+ * @return int		0 if the deletion is started, -1 otherwise.
+ */
+static int tree_delete_in_background(const char *path, int threads) {
+	size_t length = strlen(path);
+	tree_delete_job_t *job = malloc(sizeof(tree_delete_job_t) + length + 1);
+	ERROR_HANDLE_PTR_RETURN_INT(job, "tree_delete_in_background(): Unable to allocate the deletion of '%s'\n", path);
+	job->threads = threads;
+	memcpy(job->path, path, length + 1);
+	pthread_t thread;
+	pthread_create(&thread, NULL, tree_delete_thread, job);
+	pthread_detach(thread);
+	return 0;
+}
+
+/**
+ * @brief Function that moves a tree to the trash of the synchronized directory and deletes it in the background:
+ * the tree disappears with a single rename, whatever its size.
+ * When it can't be moved (other filesystem, no trash), it's deleted before returning.
+ * 
+ * @param root			The synchronized directory (ending with a '/').
+ * @param directory_fd	Directory fd of the parent of the tree (inside the synchronized directory, AT_FDCWD for a path).
+ * @param name			Name of the tree in its parent.
+ * @param threads		Threads walking the tree (0 for the default).
+ * 
+ * @return int			0 if the tree is gone from its path, -1 otherwise.
+ */
+int tree_delete_to_trash(const char *root, int directory_fd, const char *name, int threads) {
+
+	// Create the trash if needed
+	char trash_path[SYNC_IGNORE_MAX_PATH * 2];
+	snprintf(trash_path, sizeof(trash_path), "%s%s", root, TREE_DELETE_TRASH);
+	#ifdef _WIN32
+		int code = mkdir(trash_path);
+	#else
+		int code = mkdir(trash_path, 0700);
+	#endif
+	if (code == -1 && errno == EEXIST)
+		code = 0;
+	errno = 0;
+
+	// Move the tree under a unique name
+	if (code == 0) {
+		size_t length = strlen(trash_path);
+		snprintf(trash_path + length, sizeof(trash_path) - length, "%lld-%u", get_time_us(), __sync_fetch_and_add(&tree_delete_trash_counter, 1));
+		#ifdef _WIN32
+			code = rename(name, trash_path);
+		#else
+			code = renameat(directory_fd, name, AT_FDCWD, trash_path);
+		#endif
+		errno = 0;
+	}
+	if (code == -1) {
+		WARNING_PRINT("tree_delete_to_trash(): Unable to move '%s' to the trash, deleting it now\n", name);
+		return tree_delete_at(directory_fd, name, threads, NULL);
+	}
+
+	// Delete it in the background
+	if (tree_delete_in_background(trash_path, threads) == -1)
+		return tree_delete(trash_path, threads, NULL);
+	return 0;
+}
+
+/**
+ * @brief Function that deletes in the background what was left in the trash (deletions interrupted by a stop).
+ * Each entry gets its own deletion, so the trees moved to the trash meanwhile are never deleted twice.
+ * 
+ * @param root		The synchronized directory (ending with a '/').
+ * @param threads	Threads walking the trees (0 for the default).
+ * 
+ * @return int		0 if the trash is empty or its deletion is started, -1 otherwise.
+ */
+int tree_delete_empty_trash(const char *root, int threads) {
+	char trash_path[SYNC_IGNORE_MAX_PATH * 2];
+	snprintf(trash_path, sizeof(trash_path), "%s%s", root, TREE_DELETE_TRASH);
+	DIR *trash = opendir(trash_path);
+	if (trash == NULL) {
+		errno = 0;
+		return 0;
+	}
+	size_t length = strlen(trash_path);
+	int code = 0;
+	struct dirent *entry;
+	while (code == 0 && (entry = readdir(trash)) != NULL) {
+		const char *name = entry->d_name;
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+			continue;
+		snprintf(trash_path + length, sizeof(trash_path) - length, "%s", name);
+		code = tree_delete_in_background(trash_path, threads);
+	}
+	closedir(trash);
+	return code;
+}
+
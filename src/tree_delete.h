@@ -0,0 +1,25 @@
+
+#ifndef __TREE_DELETE_H__
+#define __TREE_DELETE_H__
+
+#include "universal_utils.h"
+#include "universal_pthread.h"
+
+#define TREE_DELETE_TRASH ".rfs-trash/"			// Trash of a synchronized directory (never synchronized, see sync_ignore)
+
+// Statistics of a deletion
+typedef struct tree_delete_stats_t {
+	long long files;				// Every entry that is not a directory
+	long long directories;
+	long long errors;				// Entries that couldn't be deleted
+	long long duration_us;
+} tree_delete_stats_t;
+
+// Function prototypes
+int tree_delete(const char *path, int threads, tree_delete_stats_t *stats);
+int tree_delete_at(int directory_fd, const char *path, int threads, tree_delete_stats_t *stats);
+int tree_delete_to_trash(const char *root, int directory_fd, const char *name, int threads);
+int tree_delete_empty_trash(const char *root, int threads);
+
+#endif
+
@@ -3,6 +3,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #include "universal_utils.h"
 
@@ -207,6 +208,8 @@ size_t get_file_size(int fd) {
 
 /**
  * @brief Function that returns the hash value of a string.
+ * Only used to scramble the password (its values must not change, they derive the keys of the peers),
+ * the paths and the contents are hashed by hash_engine.h.
  * 
  * @param str	String to hash.
  * 
@@ -214,16 +217,16 @@ size_t get_file_size(int fd) {
 */
 int hash_string(char* str) {
 	
-	// Variables
-	int hash = 0;
-	int pow = 1;
+	// Variables (unsigned, the overflow wraps the same way without being undefined)
+	unsigned int hash = 0;
+	unsigned int pow = 1;
 	int i = 0;
 
 	// Loop through the string
 	while (str[i] != '\0') {
 
 		// Add the character to the hash
-		hash += str[i] * pow;
+		hash += (unsigned int)str[i] * pow;
 
 		// Increment the power
 		pow *= 31;
@@ -233,18 +236,78 @@ int hash_string(char* str) {
 	}
 
 	// Return the hash
-	return hash;
+	return (int)hash;
 }
 
 /**
- * @brief Function that removes a directory.
+ * @brief Function that returns a monotonic time in milliseconds.
  * 
- * @param path	Path of the directory to remove.
+ * @return long long	Milliseconds since an unspecified starting point.
+*/
+long long get_time_ms() {
+	#ifdef _WIN32
+		return (long long)GetTickCount64();
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	#endif
+}
+
+/**
+ * @brief Function that returns a monotonic time in microseconds.
  * 
- * @return int	0 if the directory is removed, -1 otherwise.
+ * @return long long	Microseconds since an unspecified starting point.
 */
-int remove_directory(char* path) {
-	return rmdir(path);
-	// TODO: Remove all the files in the directory
+long long get_time_us() {
+	#ifdef _WIN32
+		LARGE_INTEGER counter, frequency;
+		QueryPerformanceCounter(&counter);
+		QueryPerformanceFrequency(&frequency);
+		return (long long)(counter.QuadPart * 1000000 / frequency.QuadPart);
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	#endif
+}
+
+/**
+ * @brief Function that checks if a string matches a wildcard pattern
+ * ('*' matches any sequence of characters, '?' matches one character).
+ * 
+ * @param pattern	Pattern to match.
+ * @param str		String to check.
+ * 
+ * @return int		1 if the string matches the pattern, 0 otherwise.
+*/
+int wildcard_match(const char *pattern, const char *str) {
+
+	// Variables to backtrack to the last '*'
+	const char *star = NULL;
+	const char *star_str = NULL;
+
+	// Loop through the string
+	while (*str != '\0') {
+		if (*pattern == '?' || *pattern == *str) {
+			pattern++;
+			str++;
+		}
+		else if (*pattern == '*') {
+			star = pattern++;
+			star_str = str;
+		}
+		else if (star != NULL) {
+			pattern = star + 1;
+			str = ++star_str;
+		}
+		else
+			return 0;
+	}
+
+	// Skip the remaining '*'
+	while (*pattern == '*')
+		pattern++;
+	return *pattern == '\0';
 }
 
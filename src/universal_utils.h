@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 
 #ifdef _WIN32
 	#include <windows.h>
@@ -21,10 +22,17 @@
 	#include <sys/stat.h>
 #endif
 
+// Systems without the *at calls: only paths relative to the working directory
+#ifndef AT_FDCWD
+	#define AT_FDCWD -100
+	#define AT_REMOVEDIR 0x200
+#endif
 
 // Utils defines
 typedef unsigned char byte;
 
+#include "logger.h"
+
 // Defines for colors
 #define RED "\033[0;31m"
 #define GREEN "\033[0;32m"
@@ -55,29 +63,31 @@ typedef unsigned char byte;
 // #define WARNING_PRINT(...) : For warnings, always print in stderr
 // #define ERROR_PRINT(...) : For errors, always print in stderr
 // #define PRINTER(...) : For printing in the console, without any default color or level
+// The *_PRINT macros only record the message: the logger thread formats and writes it (see logger.h)
 #define PRINT_ERRNO_STDERR(...) { if (errno != 0) { char buffer[16384]; sprintf(buffer, __VA_ARGS__); int err_pos = strlen(buffer); while (err_pos > 0 && buffer[err_pos] != '\n') err_pos--; buffer[err_pos] = '\0'; fprintf(stderr, "%s: %s\n", buffer, strerror(errno)); errno = 0; } else { fprintf(stderr, __VA_ARGS__); } }
 #if DEVELOPMENT_MODE
 	#define PRINTER(...) PRINT_ERRNO_STDERR(__VA_ARGS__)
 #else
 	#define PRINTER(...) { printf(__VA_ARGS__); }
 #endif
+#define LOG_PRINT(level, ...) { if (log_levels & (level)) log_record(level, __VA_ARGS__); }
 #if IS_INFO_LEVEL
-	#define INFO_PRINT(...) PRINTER(GREEN "[INFO] " RESET __VA_ARGS__)
+	#define INFO_PRINT(...) LOG_PRINT(INFO_LEVEL, GREEN "[INFO] " RESET __VA_ARGS__)
 #else
 	#define INFO_PRINT(...) {}
 #endif
 #if IS_DEBUG_LEVEL
-	#define DEBUG_PRINT(...) PRINTER(CYAN "[DEBUG] " RESET __VA_ARGS__)
+	#define DEBUG_PRINT(...) LOG_PRINT(DEBUG_LEVEL, CYAN "[DEBUG] " RESET __VA_ARGS__)
 #else
 	#define DEBUG_PRINT(...) {}
 #endif
 #if IS_WARNING_LEVEL
-	#define WARNING_PRINT(...) PRINT_ERRNO_STDERR(YELLOW "[WARNING] " RESET __VA_ARGS__)
+	#define WARNING_PRINT(...) LOG_PRINT(WARNING_LEVEL, YELLOW "[WARNING] " RESET __VA_ARGS__)
 #else
 	#define WARNING_PRINT(...) {}
 #endif
 #if IS_ERROR_LEVEL
-	#define ERROR_PRINT(...) PRINT_ERRNO_STDERR(RED "[ERROR] " RESET __VA_ARGS__)
+	#define ERROR_PRINT(...) LOG_PRINT(ERROR_LEVEL, RED "[ERROR] " RESET __VA_ARGS__)
 #else
 	#define ERROR_PRINT(...) {}
 #endif
@@ -109,7 +119,9 @@ int get_line_from_file(char **lineptr, int fd);
 int file_accessible(char* path);
 size_t get_file_size(int fd);
 int hash_string(char* str);
-int remove_directory(char* path);
+long long get_time_ms();
+long long get_time_us();
+int wildcard_match(const char *pattern, const char *str);
 
 #endif
 
@@ -0,0 +1,340 @@
+
+#include "wan_proxy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Chunk of data waiting for its arrival time
+typedef struct wan_chunk_t {
+	long long arrival_us;
+	size_t size;					// 0 for the end of the stream
+	struct wan_chunk_t *next;
+	byte data[];
+} wan_chunk_t;
+
+// One direction of a proxied connection: a reader thread queues the chunks, a writer thread delivers them
+typedef struct wan_pipe_t {
+	wan_proxy_t *proxy;
+	wan_link_t *link;
+	SOCKET from;
+	SOCKET to;
+	wan_chunk_t *head;
+	wan_chunk_t *tail;
+	size_t queued;
+	long long last_arrival_us;
+	unsigned long long rng_state;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct wan_connection_t *connection;
+} wan_pipe_t;
+
+// Proxied connection (freed when both directions are done)
+typedef struct wan_connection_t {
+	wan_pipe_t pipes[2];
+	int pipes_done;
+	pthread_mutex_t mutex;
+} wan_connection_t;
+
+// Accept thread parameter
+typedef struct wan_listener_t {
+	wan_proxy_t *proxy;
+	int index;
+} wan_listener_t;
+
+/**
+ * @brief Function that sleeps for a number of microseconds.
+ * 
+ * @param us	Duration of the sleep.
+ * 
+ * @return void
+ */
+static void wan_sleep_us(long long us) {
+	if (us <= 0)
+		return;
+	#ifdef _WIN32
+		Sleep((DWORD)((us + 999) / 1000));
+	#else
+		struct timespec duration = { us / 1000000, (us % 1000000) * 1000 };
+		nanosleep(&duration, NULL);
+	#endif
+}
+
+/**
+ * @brief Function that returns a pseudo-random number in [0, 1) (xorshift64*).
+ * 
+ * @param state	State of the generator.
+ * 
+ * @return double	The number.
+ */
+static double wan_random(unsigned long long *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return (double)((*state * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+}
+
+/**
+ * @brief Function that computes the arrival time of a chunk read now:
+ * serialization on the shared link (bandwidth), then the one way delay with jitter, plus a possible stall.
+ * 
+ * @param pipe	Direction of the connection.
+ * @param size	Size of the chunk.
+ * 
+ * @return long long	Arrival time (us).
+ */
+static long long wan_arrival_time(wan_pipe_t *pipe, size_t size) {
+	wan_proxy_config_t *config = &pipe->proxy->config;
+	long long now = get_time_us();
+
+	// Serialization on the link (shared by the connections)
+	long long departure = now;
+	if (config->bandwidth > 0) {
+		pthread_mutex_lock(&pipe->link->mutex);
+		long long start = pipe->link->next_free_us > now ? pipe->link->next_free_us : now;
+		departure = start + (long long)size * 1000000 / config->bandwidth;
+		pipe->link->next_free_us = departure;
+		pthread_mutex_unlock(&pipe->link->mutex);
+	}
+
+	// Propagation delay with jitter, and stalls (the following bytes wait too, like TCP head-of-line blocking)
+	long long delay = config->rtt_us / 2;
+	if (config->jitter_us > 0)
+		delay += (long long)((wan_random(&pipe->rng_state) * 2 - 1) * config->jitter_us);
+	if (delay < 0)
+		delay = 0;
+	if (config->stall_rate > 0 && wan_random(&pipe->rng_state) < config->stall_rate)
+		delay += config->stall_us;
+	long long arrival = departure + delay;
+	if (arrival < pipe->last_arrival_us)
+		arrival = pipe->last_arrival_us;
+	pipe->last_arrival_us = arrival;
+	return arrival;
+}
+
+/**
+ * @brief Function called when a thread of a connection ends: the last of the four threads closes the sockets and frees it.
+ * 
+ * @param pipe	Direction of the connection.
+ * 
+ * @return void
+ */
+static void wan_pipe_done(wan_pipe_t *pipe) {
+	wan_connection_t *connection = pipe->connection;
+	pthread_mutex_lock(&connection->mutex);
+	int done = ++connection->pipes_done;
+	pthread_mutex_unlock(&connection->mutex);
+	if (done < 4)
+		return;
+	socket_close(connection->pipes[0].from);
+	socket_close(connection->pipes[0].to);
+	free(connection);
+}
+
+/**
+ * @brief Function that handles the reader thread of a direction:
+ * reads the chunks and queues them with their arrival time (blocks when too many bytes are in flight).
+ * 
+ * @param arg	Direction of the connection (wan_pipe_t*)
+ * 
+ * @return thread_return_type	0
+ */
+static thread_return_type wan_pipe_reader(thread_param_type arg) {
+	wan_pipe_t *pipe = (wan_pipe_t*)arg;
+	while (1) {
+		wan_chunk_t *chunk = malloc(sizeof(wan_chunk_t) + WAN_PROXY_CHUNK_SIZE);
+		if (chunk == NULL)
+			break;
+		ssize_t bytes = socket_read(pipe->from, chunk->data, WAN_PROXY_CHUNK_SIZE, 0);
+		chunk->size = bytes > 0 ? (size_t)bytes : 0;
+		chunk->arrival_us = wan_arrival_time(pipe, chunk->size);
+		chunk->next = NULL;
+
+		// Queue the chunk (wait while the direction is full)
+		pthread_mutex_lock(&pipe->mutex);
+		while (pipe->queued >= WAN_PROXY_MAX_QUEUED)
+			pthread_cond_wait(&pipe->cond, &pipe->mutex);
+		if (pipe->tail == NULL) pipe->head = chunk;
+		else pipe->tail->next = chunk;
+		pipe->tail = chunk;
+		pipe->queued += chunk->size;
+		pthread_cond_broadcast(&pipe->cond);
+		pthread_mutex_unlock(&pipe->mutex);
+		if (chunk->size == 0)
+			break;
+	}
+	errno = 0;
+	wan_pipe_done(pipe);
+	return 0;
+}
+
+/**
+ * @brief Function that handles the writer thread of a direction:
+ * delivers each chunk at its arrival time, then shuts down the sending side at the end of the stream.
+ * 
+ * @param arg	Direction of the connection (wan_pipe_t*)
+ * 
+ * @return thread_return_type	0
+ */
+static thread_return_type wan_pipe_writer(thread_param_type arg) {
+	wan_pipe_t *pipe = (wan_pipe_t*)arg;
+	int failed = 0;
+	while (1) {
+
+		// Wait for a chunk
+		pthread_mutex_lock(&pipe->mutex);
+		while (pipe->head == NULL)
+			pthread_cond_wait(&pipe->cond, &pipe->mutex);
+		wan_chunk_t *chunk = pipe->head;
+		pthread_mutex_unlock(&pipe->mutex);
+
+		// Deliver it at its arrival time (after a write error, the data is dropped until the end)
+		wan_sleep_us(chunk->arrival_us - get_time_us());
+		size_t sent = 0;
+		while (!failed && sent < chunk->size) {
+			ssize_t bytes = socket_write(pipe->to, chunk->data + sent, chunk->size - sent, 0);
+			if (bytes <= 0) failed = 1;
+			else sent += bytes;
+		}
+
+		// Remove it from the queue
+		pthread_mutex_lock(&pipe->mutex);
+		pipe->head = chunk->next;
+		if (pipe->head == NULL) pipe->tail = NULL;
+		pipe->queued -= chunk->size;
+		pthread_cond_broadcast(&pipe->cond);
+		pthread_mutex_unlock(&pipe->mutex);
+		size_t size = chunk->size;
+		free(chunk);
+		if (size == 0)
+			break;
+	}
+	#ifdef _WIN32
+		shutdown(pipe->to, SD_SEND);
+	#else
+		shutdown(pipe->to, SHUT_WR);
+	#endif
+	errno = 0;
+	wan_pipe_done(pipe);
+	return 0;
+}
+
+/**
+ * @brief Function that handles the accept thread of a port: each connection is forwarded
+ * to the target port through two directions (client -> server and server -> client).
+ * 
+ * @param arg	Listener (wan_listener_t*)
+ * 
+ * @return thread_return_type	Never returns if the sockets work.
+ */
+static thread_return_type wan_proxy_accept(thread_param_type arg) {
+	wan_listener_t *listener = (wan_listener_t*)arg;
+	wan_proxy_t *proxy = listener->proxy;
+	int index = listener->index;
+	free(listener);
+	while (1) {
+
+		// Accept a client and connect to the target
+		SOCKET client = accept(proxy->listen_sockets[index], NULL, NULL);
+		if (client == INVALID_SOCKET) {
+			WARNING_PRINT("wan_proxy_accept(): Unable to accept a connection\n");
+			continue;
+		}
+		SOCKET server = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons(proxy->config.target_port + index);
+		address.sin_addr.s_addr = inet_addr(proxy->config.target_ip);
+		if (server == INVALID_SOCKET || connect(server, (struct sockaddr*)&address, sizeof(address)) != 0) {
+			WARNING_PRINT("wan_proxy_accept(): Unable to connect to %s:%d\n", proxy->config.target_ip, proxy->config.target_port + index);
+			if (server != INVALID_SOCKET) socket_close(server);
+			socket_close(client);
+			continue;
+		}
+
+		// Start the two directions (each one has a reader and a writer thread)
+		wan_connection_t *connection = calloc(1, sizeof(wan_connection_t));
+		if (connection == NULL) {
+			socket_close(server);
+			socket_close(client);
+			continue;
+		}
+		pthread_mutex_init(&connection->mutex, NULL);
+		unsigned long number = __atomic_fetch_add(&proxy->connections, 1, __ATOMIC_RELAXED);
+		int i;
+		for (i = 0; i < 2; i++) {
+			wan_pipe_t *pipe = &connection->pipes[i];
+			pipe->proxy = proxy;
+			pipe->link = i == 0 ? &proxy->upstream : &proxy->downstream;
+			pipe->from = i == 0 ? client : server;
+			pipe->to = i == 0 ? server : client;
+			pipe->rng_state = (proxy->config.seed + 1) * 2654435761ULL + number * 2 + i + 1;
+			pipe->connection = connection;
+			pipe->last_arrival_us = i == 0 ? get_time_us() + proxy->config.rtt_us : 0;		// The TCP handshake takes a round trip before the first bytes
+			pthread_mutex_init(&pipe->mutex, NULL);
+			pthread_cond_init(&pipe->cond, NULL);
+		}
+		for (i = 0; i < 4; i++) {
+			pthread_t thread;
+			pthread_create(&thread, NULL, (i % 2) ? wan_pipe_writer : wan_pipe_reader, &connection->pipes[i / 2]);
+			#ifndef _WIN32
+				pthread_detach(thread);
+			#endif
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Function that starts a proxy emulating a WAN link (delay, jitter, bandwidth, stalls)
+ * between 127.0.0.1:listen_port.. and target_ip:target_port.. (one accept thread per port).
+ * 
+ * @param proxy		Proxy structure to fill.
+ * @param config	Settings of the link.
+ * 
+ * @return int		0 if the proxy listens on all the ports, -1 otherwise.
+ */
+int wan_proxy_start(wan_proxy_t *proxy, wan_proxy_config_t config) {
+	memset(proxy, 0, sizeof(wan_proxy_t));
+	if (config.stall_us == 0)
+		config.stall_us = WAN_PROXY_DEFAULT_STALL_MS * 1000;
+	proxy->config = config;
+	pthread_mutex_init(&proxy->upstream.mutex, NULL);
+	pthread_mutex_init(&proxy->downstream.mutex, NULL);
+	int code = (config.ports < 1 || config.ports > WAN_PROXY_MAX_PORTS) ? -1 : 0;
+	ERROR_HANDLE_INT_RETURN_INT(code, "wan_proxy_start(): Invalid number of ports (%d)\n", config.ports);
+
+	int i;
+	for (i = 0; i < config.ports; i++) {
+
+		// Listen on the port
+		proxy->listen_sockets[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		code = proxy->listen_sockets[i] == INVALID_SOCKET ? -1 : 0;
+		ERROR_HANDLE_INT_RETURN_INT(code, "wan_proxy_start(): Unable to create the socket\n");
+		int reuse = 1;
+		setsockopt(proxy->listen_sockets[i], SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons(config.listen_port + i);
+		address.sin_addr.s_addr = inet_addr("127.0.0.1");
+		code = bind(proxy->listen_sockets[i], (struct sockaddr*)&address, sizeof(address));
+		if (code == 0) code = listen(proxy->listen_sockets[i], SOMAXCONN);
+		if (code != 0) socket_close(proxy->listen_sockets[i]);
+		ERROR_HANDLE_INT_RETURN_INT(code, "wan_proxy_start(): Unable to listen on port %d\n", config.listen_port + i);
+
+		// Start the accept thread
+		wan_listener_t *listener = malloc(sizeof(wan_listener_t));
+		ERROR_HANDLE_PTR_RETURN_INT(listener, "wan_proxy_start(): Unable to allocate the listener\n");
+		listener->proxy = proxy;
+		listener->index = i;
+		pthread_create(&proxy->accept_threads[i], NULL, wan_proxy_accept, listener);
+	}
+	INFO_PRINT("wan_proxy_start(): Forwarding 127.0.0.1:%d-%d to %s:%d-%d (rtt %lld ms, jitter %lld ms, %lld KB/s, stalls %.4f x %lld ms)\n",
+		config.listen_port, config.listen_port + config.ports - 1, config.target_ip, config.target_port, config.target_port + config.ports - 1,
+		config.rtt_us / 1000, config.jitter_us / 1000, config.bandwidth / 1024, config.stall_rate, config.stall_us / 1000);
+	return 0;
+}
+
@@ -0,0 +1,48 @@
+
+#ifndef __WAN_PROXY_H__
+#define __WAN_PROXY_H__
+
+#include "universal_utils.h"
+#include "universal_socket.h"
+#include "universal_pthread.h"
+
+#define WAN_PROXY_MAX_PORTS 8
+#define WAN_PROXY_CHUNK_SIZE (16 * 1024)				// Bytes read at once (granularity of the delays)
+#define WAN_PROXY_MAX_QUEUED (4 * 1024 * 1024)			// Bytes in flight per direction of a connection (then the sender is blocked)
+#define WAN_PROXY_DEFAULT_STALL_MS 200
+
+// Settings of the emulated link
+typedef struct wan_proxy_config_t {
+	int listen_port;				// First port to listen on (127.0.0.1)
+	char target_ip[16];
+	int target_port;				// First port to forward to
+	int ports;						// Consecutive ports forwarded (the sync server uses 2)
+	long long rtt_us;				// Round trip time (half of it in each direction)
+	long long jitter_us;			// Uniform variation of the one way delay (order of the bytes is kept)
+	long long bandwidth;			// Bytes per second in each direction, shared by the connections (0 = unlimited)
+	double stall_rate;				// Probability that a chunk is stalled (like a lost packet waiting for its retransmission)
+	long long stall_us;				// Duration of a stall
+	unsigned long long seed;
+} wan_proxy_config_t;
+
+// Direction of the emulated link (shared by all the connections)
+typedef struct wan_link_t {
+	pthread_mutex_t mutex;
+	long long next_free_us;			// Time when the link finishes sending the previous chunks
+} wan_link_t;
+
+// Structure of the proxy
+typedef struct wan_proxy_t {
+	wan_proxy_config_t config;
+	SOCKET listen_sockets[WAN_PROXY_MAX_PORTS];
+	pthread_t accept_threads[WAN_PROXY_MAX_PORTS];
+	wan_link_t upstream;			// Client -> server
+	wan_link_t downstream;			// Server -> client
+	unsigned long connections;
+} wan_proxy_t;
+
+// Function prototypes
+int wan_proxy_start(wan_proxy_t *proxy, wan_proxy_config_t config);
+
+#endif
+